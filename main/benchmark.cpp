@@ -0,0 +1,491 @@
+#include "sdkconfig.h"
+
+#ifdef CONFIG_BENCHMARK_CONSOLE_COMMANDS
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "cJSON.h"
+#include "jsonStreamParser.h"
+#include "irrigationEvent.h"
+#include "globalComponents.h"
+
+extern const uint8_t irrigationConfig_default_json_start[] asm("_binary_irrigationConfig_default_json_start");
+
+/** State of the streaming parse, used to track the heap while parsing */
+typedef struct parse_state_t {
+    uint32_t values;
+    uint32_t minFreeHeap;
+} parse_state_t;
+
+static bool benchmarkParseHook(JsonStreamParser* parser, const JsonStreamParser::value_t* value, void* param)
+{
+    parse_state_t* state = (parse_state_t*) param;
+
+    state->values++;
+    state->minFreeHeap = std::min(state->minFreeHeap, esp_get_free_heap_size());
+
+    return true;
+}
+
+/** State of the MQTT ingress benchmark, shared with its message handler */
+typedef struct ingress_state_t {
+    JsonStreamParser parser;
+    parse_state_t parse;
+    int dataLen;
+    bool parsed;
+    SemaphoreHandle_t doneSem;
+    StaticSemaphore_t doneSemBuf;
+} ingress_state_t;
+
+static void benchmarkIngressHandler(const char* data, int dataLen, void* param)
+{
+    ingress_state_t* state = (ingress_state_t*) param;
+
+    state->dataLen = dataLen;
+    state->parse.values = 0;
+    state->parse.minFreeHeap = esp_get_free_heap_size();
+    state->parser.begin(benchmarkParseHook, &state->parse);
+    state->parsed = (JsonStreamParser::ERR_OK == state->parser.feed(data, dataLen)) && (JsonStreamParser::ERR_OK == state->parser.end());
+
+    xSemaphoreGive(state->doneSem);
+}
+
+/**
+ * @brief Get the SettingsManager used by the benchmarks, which is separate from the global one.
+ */
+static SettingsManager& benchmarkSettings(void)
+{
+    static SettingsManager settings;
+    return settings;
+}
+
+/**
+ * @brief Default constructor, which performs basic initialization.
+ */
+Benchmark::Benchmark(void)
+{
+}
+
+/**
+ * @brief Default destructor, which cleans up allocated data.
+ */
+Benchmark::~Benchmark(void)
+{
+}
+
+/**
+ * @brief Simulate the event processing of the IrrigationController for the given number of years.
+ *
+ * A daily, a weekly (Sundays 02:30, i.e. within the DST switches of central Europe), a monthly
+ * (1st + 31st 23:59:59) and a single event (02:30 on the first DST switch day) are applied to
+ * a separate SettingsManager and published to a separate IrrigationPlanner.
+ * Like the controller does, the next event time is taken relative to the last event, and all
+ * its events are fetched and confirmed (including the resulting stop events).
+ * Each getNextEventTime(), getEventHandles() and confirmEvent() call counts as iteration.
+ * Event times not after the last one and failed calls are errors.
+ *
+ * @param years Number of years to be simulated (starting at simStartYear, local time).
+ * @param dst Result destination.
+ * @param occurances Number of start occurances per event (may be nullptr).
+ * @param numEvents Size of occurances (see numYearEvents).
+ */
+void Benchmark::runEventYear(int years, result_t* dst, uint32_t occurances[], int numEvents)
+{
+    static IrrigationPlanner planner;
+    static char doc[1024];
+    SettingsManager& settings = benchmarkSettings();
+    IrrigationPlanner::event_handle_t handles[maxEventHandles];
+    struct tm tmp;
+    time_t ref, end, next, last;
+
+    memset(dst, 0, sizeof(result_t));
+    if(nullptr != occurances) memset(occurances, 0, numEvents * sizeof(uint32_t));
+
+    size_t docLen = buildYearConfig(doc, sizeof(doc));
+    if(SettingsManager::ERR_OK != applyConfig(settings, doc, docLen, nullptr)) {
+        dst->errors++;
+        return;
+    }
+    planner.irrigConfigUpdated(settings);
+
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.tm_mday = 1;
+    tmp.tm_year = simStartYear - 1900;
+    tmp.tm_isdst = -1;
+    ref = mktime(&tmp);
+    tmp.tm_year += years;
+    tmp.tm_isdst = -1;
+    end = mktime(&tmp);
+    last = ref - 1;
+
+    // adopt the config and build the timeline outside of the measurement
+    planner.getNextEventTime(last, false);
+
+    int64_t startMicros = esp_timer_get_time();
+    while(1) {
+        next = planner.getNextEventTime(last, true);
+        dst->iterations++;
+        if((0 == next) || (next >= end)) break;
+        if(next <= last) {
+            dst->errors++;
+            break;
+        }
+
+        // events at the same time are processed together
+        if(IrrigationPlanner::ERR_OK != planner.getEventHandles(next, handles, maxEventHandles)) dst->errors++;
+        dst->iterations++;
+        for(int i = 0; (i < maxEventHandles) && (handles[i].idx >= 0); i++) {
+            if(IrrigationPlanner::ERR_OK != planner.confirmEvent(handles[i])) dst->errors++;
+            dst->iterations++;
+
+            if(handles[i].isStart && (nullptr != occurances) && (handles[i].idx < std::min(numEvents, (int) numYearEvents))) {
+                occurances[handles[i].idx]++;
+            }
+        }
+
+        last = next;
+    }
+    finish(dst, startMicros);
+
+    // confirm the stop events of the last irrigations, so the next simulation starts without them
+    while((0 != (next = planner.getNextEventTime(last, true))) && (next <= (end + simDurationSecs))) {
+        if(IrrigationPlanner::ERR_OK == planner.getEventHandles(next, handles, maxEventHandles)) {
+            for(int i = 0; (i < maxEventHandles) && (handles[i].idx >= 0); i++) {
+                if(!handles[i].isStart) planner.confirmEvent(handles[i]);
+            }
+        }
+        last = next;
+    }
+}
+
+/**
+ * @brief Parse an irrigation config repeatedly.
+ *
+ * PARSER_SETTINGS streams the config into a separate SettingsManager in chunks of configChunkSize bytes
+ * and applies it there (without notification). The cJSON parsers only build the DOM of the config
+ * for comparison.
+ *
+ * @param runs Number of parses.
+ * @param parser Parser to be used.
+ * @param large If true, a config using all zones and events is parsed (see buildLargeConfig()),
+ * the default irrigation config otherwise.
+ * @param dst Result destination. heapBytes contains the peak heap usage of a single parse
+ * (the arena usage for PARSER_CJSON_ARENA).
+ */
+void Benchmark::runConfigParse(int runs, parser_t parser, bool large, result_t* dst)
+{
+    static char largeDoc[MqttIngress::largeSlotDataSize + 1];
+    SettingsManager& settings = benchmarkSettings();
+    const char* doc = (const char*) irrigationConfig_default_json_start;
+    size_t docLen;
+
+    memset(dst, 0, sizeof(result_t));
+
+    if(large) {
+        docLen = buildLargeConfig(largeDoc, sizeof(largeDoc));
+        doc = largeDoc;
+    } else {
+        docLen = strlen(doc);
+    }
+
+    int64_t startMicros = esp_timer_get_time();
+    for(int i = 0; i < runs; i++) {
+        uint32_t freeHeap = esp_get_free_heap_size();
+        uint32_t minFreeHeap = freeHeap;
+
+        if(PARSER_SETTINGS == parser) {
+            if(SettingsManager::ERR_OK != applyConfig(settings, doc, docLen, &minFreeHeap)) {
+                dst->errors++;
+            }
+        } else {
+            bool arena = (PARSER_CJSON_ARENA == parser);
+            if(arena && (JsonArena::ERR_OK != jsonArena.begin())) {
+                dst->errors++;
+                break;
+            }
+
+            cJSON* root = cJSON_Parse(doc);
+            minFreeHeap = std::min(minFreeHeap, esp_get_free_heap_size());
+            if(nullptr == root) {
+                dst->errors++;
+            } else {
+                cJSON_Delete(root);
+            }
+
+            if(arena) {
+                freeHeap = minFreeHeap + jsonArena.getUsed(); // report the arena usage instead
+                jsonArena.end();
+            }
+        }
+
+        dst->heapBytes = std::max(dst->heapBytes, (int32_t) (freeHeap - minFreeHeap));
+        dst->iterations++;
+    }
+    finish(dst, startMicros);
+}
+
+/**
+ * @brief Pass an irrigation config exceeding MqttIngress::slotDataSize through an MQTT ingress repeatedly,
+ * like the irrigation config subscription does. A run lasts from posting the config until its handler
+ * has parsed it.
+ *
+ * The benchmark uses its own ingress (and thus task), so the received config isn't applied.
+ *
+ * @param runs Number of configs posted.
+ * @param dst Result destination. heapBytes contains the peak heap usage of a single run.
+ * @param docLen Size of the posted config in bytes (may be nullptr).
+ */
+void Benchmark::runIngress(int runs, result_t* dst, size_t* docLen)
+{
+    static MqttIngress ingress;
+    static ingress_state_t state;
+    static char doc[MqttIngress::largeSlotDataSize + 1];
+    size_t len = buildLargeConfig(doc, sizeof(doc));
+
+    memset(dst, 0, sizeof(result_t));
+    if(nullptr != docLen) *docLen = len;
+
+    if(nullptr == state.doneSem) state.doneSem = xSemaphoreCreateBinaryStatic(&state.doneSemBuf);
+    if((MqttIngress::ERR_OK != ingress.registerHandler(MqttIngress::MSG_IRRIG_CONFIG, benchmarkIngressHandler, &state)) ||
+        (MqttIngress::ERR_OK != ingress.start()))
+    {
+        dst->errors++;
+        return;
+    }
+
+    int64_t startMicros = esp_timer_get_time();
+    for(int i = 0; i < runs; i++) {
+        uint32_t freeHeap = esp_get_free_heap_size();
+        state.parsed = false;
+
+        if((MqttIngress::ERR_OK != ingress.post(MqttIngress::MSG_IRRIG_CONFIG, doc, len)) ||
+            (pdTRUE != xSemaphoreTake(state.doneSem, pdMS_TO_TICKS(ingressTimeoutMs))) ||
+            !state.parsed || (state.dataLen != (int) len))
+        {
+            dst->errors++;
+        }
+
+        dst->heapBytes = std::max(dst->heapBytes, (int32_t) (freeHeap - std::min(freeHeap, state.parse.minFreeHeap)));
+        dst->iterations++;
+    }
+    finish(dst, startMicros);
+}
+
+/**
+ * @brief Feed a byte stream with randomized frames into a separate SerialFramer (i.e. the framing
+ * FSM of the SerialPacketizer) repeatedly.
+ *
+ * The payloads (packetMinPayload..packetMaxPayload bytes) consist of the frame number, random data
+ * and a checksum, so received packets can be verified. Each frame gets a random byte altered with
+ * the given probability. Each fed byte counts as iteration; intact frames not received are errors.
+ *
+ * @param runs Number of times the stream is fed.
+ * @param corruptPermille Probability of a frame being corrupted in permille.
+ * @param dst Result destination.
+ * @param stats Frame statistics of all runs.
+ */
+void Benchmark::runPacketizer(int runs, int corruptPermille, result_t* dst, packet_stats_t* stats)
+{
+    static framer_t framer;
+    static packet_state_t state;
+    static uint8_t stream[packetStreamLen];
+    const char* logTag = "bench_framer";
+    size_t streamLen = 0;
+
+    memset(dst, 0, sizeof(result_t));
+    memset(stats, 0, sizeof(packet_stats_t));
+
+    // the corrupted frames would flood the console otherwise
+    framer.setLogTag(logTag);
+    esp_log_level_set(logTag, ESP_LOG_ERROR);
+    framer.reset();
+
+    state.stats = stats;
+    state.numFrames = 0;
+    while(state.numFrames < packetMaxFrames) {
+        uint8_t payload[packetMaxPayload];
+        unsigned int len = packetMinPayload + (esp_random() % (packetMaxPayload - packetMinPayload + 1));
+        uint8_t sum = 0;
+
+        if((streamLen + len + (framer_t::maxFrameLen - packetMaxPayload)) > packetStreamLen) break;
+
+        payload[0] = state.numFrames & 0xff;
+        payload[1] = (state.numFrames >> 8) & 0xff;
+        for(unsigned int i = 2; i < (len - 1); i++) {
+            payload[i] = esp_random() & 0xff;
+        }
+        for(unsigned int i = 0; i < (len - 1); i++) {
+            sum += payload[i];
+        }
+        payload[len - 1] = sum;
+
+        int frameLen = framer.encode(len, payload, &stream[streamLen]);
+        state.frameLen[state.numFrames] = len;
+        state.corrupted[state.numFrames] = ((int) (esp_random() % 1000) < corruptPermille);
+        if(state.corrupted[state.numFrames]) {
+            // a single altered byte always changes the checksum
+            stream[streamLen + (esp_random() % frameLen)] ^= 1 + (esp_random() % 255);
+        }
+
+        streamLen += frameLen;
+        state.numFrames++;
+    }
+
+    int64_t startMicros = esp_timer_get_time();
+    for(int i = 0; i < runs; i++) {
+        stats->framingErrors += framer.feed(stream, streamLen, packetHook, &state);
+        dst->iterations += streamLen;
+    }
+    finish(dst, startMicros);
+
+    for(unsigned int i = 0; i < state.numFrames; i++) {
+        if(state.corrupted[i]) stats->corrupted += runs;
+    }
+    stats->frames = state.numFrames * runs;
+    dst->errors = (stats->frames - stats->corrupted) - std::min(stats->received, stats->frames - stats->corrupted);
+}
+
+/**
+ * @brief Packet hook of runPacketizer, which verifies the received packets.
+ */
+void Benchmark::packetHook(const framer_t::BUFFER_T* packet, void* param)
+{
+    packet_state_t* state = (packet_state_t*) param;
+    unsigned int frame;
+    uint8_t sum = 0;
+
+    if(packet->len < (int) packetMinPayload) {
+        state->stats->corruptReceived++;
+        return;
+    }
+
+    frame = packet->data[0] | (packet->data[1] << 8);
+    for(int i = 0; i < (packet->len - 1); i++) {
+        sum += packet->data[i];
+    }
+
+    if((frame < state->numFrames) && (state->frameLen[frame] == packet->len) && (sum == packet->data[packet->len - 1]) &&
+        !state->corrupted[frame])
+    {
+        state->stats->received++;
+    } else {
+        state->stats->corruptReceived++;
+    }
+}
+
+/**
+ * @brief Generate the irrigation config simulated by runEventYear (see numYearEvents).
+ *
+ * @param buf Destination buffer.
+ * @param bufSize Size of buf.
+ * @return size_t Length of the config (excluding NULL-termination), 0 if buf is too small.
+ */
+size_t Benchmark::buildYearConfig(char* buf, size_t bufSize)
+{
+    int n = snprintf(buf, bufSize, "{\n  \"storePersistent\": false,\n  \"zones\": [\n"
+        "    { \"name\": \"BENCH\", \"chEnabled\": [true], \"chNum\": [0], \"chStateStart\": [true], \"chStateStop\": [false] }\n"
+        "  ],\n  \"events\": [\n"
+        "    { \"zoneNum\": 0, \"durationSecs\": %d, \"isDaily\": true, \"hour\": 6, \"minute\": 0, \"second\": 0 },\n"
+        "    { \"zoneNum\": 0, \"durationSecs\": %d, \"isWeekly\": true, \"weekdays\": [0], \"hour\": 2, \"minute\": 30, \"second\": 0 },\n"
+        "    { \"zoneNum\": 0, \"durationSecs\": %d, \"isMonthly\": true, \"monthdays\": [1, 31], \"hour\": 23, \"minute\": 59, \"second\": 59 },\n"
+        "    { \"zoneNum\": 0, \"durationSecs\": %d, \"isSingle\": true, \"day\": 31, \"month\": 3, \"year\": %d, "
+        "\"hour\": 2, \"minute\": 30, \"second\": 0 }\n"
+        "  ]\n}\n", simDurationSecs, simDurationSecs, simDurationSecs, simDurationSecs, simStartYear);
+
+    return ((n > 0) && ((size_t) n < bufSize)) ? n : 0;
+}
+
+/**
+ * @brief Generate an irrigation config using all zones and events, which exceeds the small MQTT ingress
+ * slots (see MqttIngress::slotDataSize). Events are omitted if the buffer is too small.
+ *
+ * @param buf Destination buffer.
+ * @param bufSize Size of buf.
+ * @return size_t Length of the config (excluding NULL-termination).
+ */
+size_t Benchmark::buildLargeConfig(char* buf, size_t bufSize)
+{
+    const char* tail = "\n  ]\n}\n";
+    size_t reserve = strlen(tail) + 1;
+    size_t len = 0;
+    int n;
+
+    if(bufSize <= reserve) return 0;
+    bufSize -= reserve;
+
+    n = snprintf(buf, bufSize, "{\n  \"storePersistent\": false,\n  \"zones\": [");
+    len = std::min((size_t) std::max(n, 0), bufSize);
+    for(int i = 0; (i < (int) irrigationPlannerNumZones) && (len < bufSize); i++) {
+        n = snprintf(&buf[len], bufSize - len, "%s\n    {\n      \"name\": \"ZONE%d\",\n"
+            "      \"chEnabled\": [true, false, false, false],\n      \"chNum\": [%d, -1, -1, -1],\n"
+            "      \"chStateStart\": [true, false, false, false],\n      \"chStateStop\": [false, false, false, false],\n"
+            "      \"reservoir\": 0\n    }", (i > 0) ? "," : "", i, i % 3);
+        len = std::min(len + std::max(n, 0), bufSize);
+    }
+
+    n = snprintf(&buf[len], bufSize - len, "\n  ],\n  \"events\": [");
+    len = std::min(len + std::max(n, 0), bufSize);
+    for(int i = 0; i < (int) irrigationPlannerNumNormalEvents; i++) {
+        char evt[160];
+        n = snprintf(evt, sizeof(evt), "%s\n    { \"zoneNum\": %d, \"durationSecs\": 300, \"isWeekly\": true, "
+            "\"weekdays\": [0, 3], \"hour\": %d, \"minute\": %d, \"second\": 0 }",
+            (i > 0) ? "," : "", i % irrigationPlannerNumZones, 4 + i / 8, (i % 8) * 5);
+        if((n <= 0) || ((len + n) >= bufSize)) break;
+        memcpy(&buf[len], evt, n);
+        len += n;
+    }
+
+    // the tail fits, as it has been reserved
+    memcpy(&buf[len], tail, strlen(tail) + 1);
+
+    return len + strlen(tail);
+}
+
+/**
+ * @brief Stream an irrigation config into a SettingsManager in chunks of configChunkSize bytes and apply it
+ * without notifying the hooks.
+ *
+ * @param settings SettingsManager to be updated.
+ * @param doc Irrigation config.
+ * @param docLen Length of the config.
+ * @param minFreeHeap Updated with the minimum free heap seen in between the chunks (may be nullptr).
+ * @return SettingsManager::err_t ERR_OK on success.
+ */
+SettingsManager::err_t Benchmark::applyConfig(SettingsManager& settings, const char* doc, size_t docLen, uint32_t* minFreeHeap)
+{
+    SettingsManager::err_t ret = settings.beginIrrigationConfigStream();
+    SettingsManager::err_t endRet;
+
+    if(SettingsManager::ERR_OK != ret) return ret;
+
+    for(size_t pos = 0; (pos < docLen) && (SettingsManager::ERR_OK == ret); pos += configChunkSize) {
+        ret = settings.feedIrrigationConfigStream(&doc[pos], std::min(configChunkSize, docLen - pos));
+        if(nullptr != minFreeHeap) *minFreeHeap = std::min(*minFreeHeap, esp_get_free_heap_size());
+    }
+
+    // the stream must be ended even if feeding failed
+    endRet = settings.endIrrigationConfigStream(true);
+    if(nullptr != minFreeHeap) *minFreeHeap = std::min(*minFreeHeap, esp_get_free_heap_size());
+
+    return (SettingsManager::ERR_OK != ret) ? ret : endRet;
+}
+
+void Benchmark::finish(result_t* dst, int64_t startMicros)
+{
+    int64_t total = esp_timer_get_time() - startMicros;
+
+    dst->totalMicros = (uint32_t) std::min(total, (int64_t) UINT32_MAX);
+    dst->nsPerIteration = (dst->iterations > 0) ? (uint32_t) ((total * 1000) / dst->iterations) : 0;
+}
+
+#endif /* CONFIG_BENCHMARK_CONSOLE_COMMANDS */
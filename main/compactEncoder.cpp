@@ -0,0 +1,208 @@
+#include "compactEncoder.h"
+
+#include <cstdio>
+#include <cstring>
+
+/**
+ * @brief Constructor, which prepares the encoder for writing into the specified buffer.
+ * 
+ * @param encoding Encoding to be used.
+ * @param buf Destination buffer. Note: JSON output is NOT NULL-terminated.
+ * @param bufLen Size of the destination buffer.
+ */
+CompactEncoder::CompactEncoder(encoding_t encoding, char* buf, size_t bufLen)
+{
+    this->encoding = encoding;
+    this->buf = buf;
+    this->bufLen = bufLen;
+    len = 0;
+    overflow = false;
+
+    depth = 0;
+    firstElement[0] = true;
+    afterKey = false;
+}
+
+/**
+ * @brief Default destructor, which cleans up allocated data.
+ */
+CompactEncoder::~CompactEncoder()
+{
+}
+
+void CompactEncoder::beginMap(void)
+{
+    if(ENCODING_JSON == encoding) {
+        jsonSeparator();
+        putChar('{');
+    } else {
+        putChar((char) 0xbf); // map, indefinite length
+    }
+    push();
+}
+
+void CompactEncoder::endMap(void)
+{
+    pop();
+    putChar((ENCODING_JSON == encoding) ? '}' : (char) 0xff);
+}
+
+void CompactEncoder::beginArray(size_t numElements)
+{
+    if(ENCODING_JSON == encoding) {
+        jsonSeparator();
+        putChar('[');
+    } else {
+        cborHead(4, numElements);
+    }
+    push();
+}
+
+void CompactEncoder::endArray(void)
+{
+    pop();
+    if(ENCODING_JSON == encoding) putChar(']');
+}
+
+void CompactEncoder::addKey(const char* key)
+{
+    addString(key);
+    if(ENCODING_JSON == encoding) {
+        putChar(':');
+        afterKey = true;
+    }
+}
+
+void CompactEncoder::addUint(uint32_t val)
+{
+    char numStr[11];
+
+    if(ENCODING_JSON == encoding) {
+        jsonSeparator();
+        put(numStr, snprintf(numStr, sizeof(numStr), "%u", val));
+    } else {
+        cborHead(0, val);
+    }
+}
+
+void CompactEncoder::addInt(int32_t val)
+{
+    char numStr[12];
+
+    if(ENCODING_JSON == encoding) {
+        jsonSeparator();
+        put(numStr, snprintf(numStr, sizeof(numStr), "%d", val));
+    } else if(val >= 0) {
+        cborHead(0, (uint32_t) val);
+    } else {
+        cborHead(1, (uint32_t) (-1 - val));
+    }
+}
+
+void CompactEncoder::addString(const char* str)
+{
+    size_t strLen = strlen(str);
+
+    if(ENCODING_JSON == encoding) {
+        jsonSeparator();
+        putChar('"');
+        for(size_t i = 0; i < strLen; i++) {
+            if((str[i] == '"') || (str[i] == '\\')) putChar('\\');
+            putChar(str[i]);
+        }
+        putChar('"');
+    } else {
+        cborHead(3, strLen);
+        put(str, strLen);
+    }
+}
+
+/**
+ * @brief Get the length of the encoded data.
+ */
+size_t CompactEncoder::getLength(void)
+{
+    return len;
+}
+
+/**
+ * @brief Check wether or not the buffer was too small for the encoded data.
+ * The data must not be used in this case.
+ */
+bool CompactEncoder::hasOverflowed(void)
+{
+    return overflow;
+}
+
+void CompactEncoder::put(const char* data, size_t dataLen)
+{
+    if((len + dataLen) > bufLen) {
+        overflow = true;
+    } else {
+        memcpy(&buf[len], data, dataLen);
+        len += dataLen;
+    }
+}
+
+void CompactEncoder::putChar(char c)
+{
+    put(&c, 1);
+}
+
+/**
+ * @brief Write a CBOR data item head, i.e. major type and argument.
+ */
+void CompactEncoder::cborHead(uint8_t majorType, uint32_t val)
+{
+    char head[5];
+    majorType <<= 5;
+
+    if(val < 24) {
+        head[0] = majorType | val;
+        put(head, 1);
+    } else if(val <= 0xff) {
+        head[0] = majorType | 24;
+        head[1] = val;
+        put(head, 2);
+    } else if(val <= 0xffff) {
+        head[0] = majorType | 25;
+        head[1] = val >> 8;
+        head[2] = val;
+        put(head, 3);
+    } else {
+        head[0] = majorType | 26;
+        head[1] = val >> 24;
+        head[2] = val >> 16;
+        head[3] = val >> 8;
+        head[4] = val;
+        put(head, 5);
+    }
+}
+
+/**
+ * @brief Write the JSON separator needed before the next element, if any.
+ */
+void CompactEncoder::jsonSeparator(void)
+{
+    if(afterKey) {
+        afterKey = false;
+    } else {
+        if(!firstElement[depth]) putChar(',');
+    }
+    firstElement[depth] = false;
+}
+
+void CompactEncoder::push(void)
+{
+    if(depth < (maxDepth - 1)) {
+        depth++;
+        firstElement[depth] = true;
+    } else {
+        overflow = true;
+    }
+}
+
+void CompactEncoder::pop(void)
+{
+    if(depth > 0) depth--;
+}
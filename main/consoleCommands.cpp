@@ -9,6 +9,7 @@
 #include <string.h>
 #include <stdio.h>
 
+#include "sdkconfig.h"
 #include "esp_log.h"
 
 #include "driver/gpio.h"
@@ -19,6 +20,8 @@
 
 #include "version.h"
 #include "timeSystem.h"
+#include "globalComponents.h"
+#include "benchmark.h"
 
 
 #define IGNORE_UNUSED_VARIABLE(x)     if ( &x == &x ) {}
@@ -34,6 +37,14 @@ static eCommandResult_T ConsoleCommandTimeSet(const char buffer[]);
 static eCommandResult_T ConsoleCommandTimeSntp(const char buffer[]);
 static eCommandResult_T ConsoleCommandLog(const char buffer[]);
 static eCommandResult_T ConsoleCommandLogLevel(const char buffer[]);
+static eCommandResult_T ConsoleCommandProf(const char buffer[]);
+static eCommandResult_T ConsoleCommandProfReset(const char buffer[]);
+#ifdef CONFIG_BENCHMARK_CONSOLE_COMMANDS
+static eCommandResult_T ConsoleCommandBenchEvt(const char buffer[]);
+static eCommandResult_T ConsoleCommandBenchCfg(const char buffer[]);
+static eCommandResult_T ConsoleCommandBenchIngress(const char buffer[]);
+static eCommandResult_T ConsoleCommandBenchPkt(const char buffer[]);
+#endif
 
 static const sConsoleCommandTable_T mConsoleCommandTable[] =
 {
@@ -52,6 +63,16 @@ static const sConsoleCommandTable_T mConsoleCommandTable[] =
     {"log", &ConsoleCommandLog, HELP("Set logging on/off. Param: 0:off,1:on")},
     {"log_level", &ConsoleCommandLogLevel, HELP("Set log level. Param: 0:NONE,1:ERR,2:WARN,3:INFO,4:DEBUG,5:DFLT")},
 
+    {"prof", &ConsoleCommandProf, HELP("Show the wake cycle profiling statistics (durations in us).")},
+    {"prof_reset", &ConsoleCommandProfReset, HELP("Clear the wake cycle profiling statistics.")},
+
+#ifdef CONFIG_BENCHMARK_CONSOLE_COMMANDS
+    {"bench_evt", &ConsoleCommandBenchEvt, HELP("Benchmark the event processing. Param: 0=years (default 1)")},
+    {"bench_cfg", &ConsoleCommandBenchCfg, HELP("Benchmark the default and a large irrigation config parsing. Param: 0=runs (default 20)")},
+    {"bench_ingress", &ConsoleCommandBenchIngress, HELP("Benchmark the MQTT ingress with a large irrigation config. Param: 0=runs (default 20)")},
+    {"bench_pkt", &ConsoleCommandBenchPkt, HELP("Benchmark the packetizer framing. Params: 0=runs (default 20), 1=corrupted frames in permille (default 10)")},
+#endif
+
     {"exit", &ConsoleExit, HELP("Exits the command console.")},
     CONSOLE_COMMAND_TABLE_END // must be LAST
 };
@@ -300,3 +321,161 @@ const sConsoleCommandTable_T* ConsoleCommandsGetTable(void)
 {
     return (mConsoleCommandTable);
 }
+
+static eCommandResult_T ConsoleCommandProf(const char buffer[])
+{
+    eCommandResult_T result = COMMAND_SUCCESS;
+    WakeProfiler::scope_stats_t stats;
+    static char outStr[112];
+
+    IGNORE_UNUSED_VARIABLE(buffer);
+
+    snprintf(outStr, sizeof(outStr) / sizeof(outStr[0]), "%-14s %8s %10s %10s %10s %10s %10s %10s",
+        "scope", "n", "min", "p50", "p90", "p99", "max", "mean");
+    ConsoleIoSendString(outStr);
+    ConsoleIoSendString(STR_ENDLINE);
+
+    for(int i = 0; i < WakeProfiler::SCOPE_MAX; i++) {
+        WakeProfiler::scope_t scope = (WakeProfiler::scope_t) i;
+        if(wakeProfiler.getStats(scope, &stats)) {
+            snprintf(outStr, sizeof(outStr) / sizeof(outStr[0]), "%-14s %8u %10u %10u %10u %10u %10u %10u",
+                WAKE_PROFILER_SCOPE_TO_STR(scope), stats.count, stats.minMicros, stats.p50Micros,
+                stats.p90Micros, stats.p99Micros, stats.maxMicros, stats.meanMicros);
+        } else {
+            snprintf(outStr, sizeof(outStr) / sizeof(outStr[0]), "%-14s %8u", WAKE_PROFILER_SCOPE_TO_STR(scope), 0);
+        }
+        ConsoleIoSendString(outStr);
+        ConsoleIoSendString(STR_ENDLINE);
+    }
+
+    return result;
+}
+
+static eCommandResult_T ConsoleCommandProfReset(const char buffer[])
+{
+    eCommandResult_T result = COMMAND_SUCCESS;
+
+    IGNORE_UNUSED_VARIABLE(buffer);
+
+    wakeProfiler.reset();
+    ConsoleIoSendString("Profiling statistics cleared.");
+    ConsoleIoSendString(STR_ENDLINE);
+    return result;
+}
+
+#ifdef CONFIG_BENCHMARK_CONSOLE_COMMANDS
+static eCommandResult_T ConsoleCommandBenchEvt(const char buffer[])
+{
+    eCommandResult_T result = COMMAND_SUCCESS;
+    static Benchmark bench;
+    Benchmark::result_t res;
+    uint32_t occurances[Benchmark::numYearEvents];
+    int16_t years;
+    static char outStr[96];
+
+    if((COMMAND_SUCCESS != ConsoleReceiveParamInt16(buffer, 1, &years)) || (years < 1)) years = 1;
+
+    bench.runEventYear(years, &res, occurances, Benchmark::numYearEvents);
+
+    snprintf(outStr, sizeof(outStr) / sizeof(outStr[0]), "%d year(s): %u calls, %u us, %u ns/call, %u errors",
+        years, res.iterations, res.totalMicros, res.nsPerIteration, res.errors);
+    ConsoleIoSendString(outStr);
+    ConsoleIoSendString(STR_ENDLINE);
+    snprintf(outStr, sizeof(outStr) / sizeof(outStr[0]), "Occurances: daily %u, weekly %u, monthly %u, single %u",
+        occurances[0], occurances[1], occurances[2], occurances[3]);
+    ConsoleIoSendString(outStr);
+    ConsoleIoSendString(STR_ENDLINE);
+
+    if(0 != res.errors) result = COMMAND_ERROR;
+    return result;
+}
+
+static eCommandResult_T ConsoleCommandBenchCfg(const char buffer[])
+{
+    eCommandResult_T result = COMMAND_SUCCESS;
+    static Benchmark bench;
+    Benchmark::result_t res;
+    int16_t runs;
+    static char outStr[96];
+
+    if((COMMAND_SUCCESS != ConsoleReceiveParamInt16(buffer, 1, &runs)) || (runs < 1)) runs = 20;
+
+    for(int large = 0; large < 2; large++) {
+        for(int i = 0; i < Benchmark::PARSER_MAX; i++) {
+            Benchmark::parser_t parser = (Benchmark::parser_t) i;
+            bench.runConfigParse(runs, parser, (0 != large), &res);
+
+            snprintf(outStr, sizeof(outStr) / sizeof(outStr[0]), "%-7s %-9s %u runs, %u ns/run, peak %s %d bytes, %u errors",
+                large ? "large" : "default",
+                (Benchmark::PARSER_SETTINGS == parser) ? "settings:" : (Benchmark::PARSER_CJSON_HEAP == parser) ? "cJSON:" : "arena:",
+                res.iterations, res.nsPerIteration, (Benchmark::PARSER_CJSON_ARENA == parser) ? "arena" : "heap",
+                res.heapBytes, res.errors);
+            ConsoleIoSendString(outStr);
+            ConsoleIoSendString(STR_ENDLINE);
+
+            if(0 != res.errors) result = COMMAND_ERROR;
+        }
+    }
+
+    return result;
+}
+
+static eCommandResult_T ConsoleCommandBenchIngress(const char buffer[])
+{
+    eCommandResult_T result = COMMAND_SUCCESS;
+    static Benchmark bench;
+    Benchmark::result_t res;
+    size_t docLen;
+    int16_t runs;
+    static char outStr[96];
+
+    if((COMMAND_SUCCESS != ConsoleReceiveParamInt16(buffer, 1, &runs)) || (runs < 1)) runs = 20;
+
+    bench.runIngress(runs, &res, &docLen);
+
+    snprintf(outStr, sizeof(outStr) / sizeof(outStr[0]), "%u bytes: %u runs, %u ns/run, peak heap %d bytes, %u errors",
+        docLen, res.iterations, res.nsPerIteration, res.heapBytes, res.errors);
+    ConsoleIoSendString(outStr);
+    ConsoleIoSendString(STR_ENDLINE);
+
+    if(0 != res.errors) result = COMMAND_ERROR;
+    return result;
+}
+
+static eCommandResult_T ConsoleCommandBenchPkt(const char buffer[])
+{
+    eCommandResult_T result = COMMAND_SUCCESS;
+    static Benchmark bench;
+    Benchmark::result_t res;
+    Benchmark::packet_stats_t stats;
+    int16_t runs, corruptPermille;
+    static char outStr[96];
+
+    if((COMMAND_SUCCESS != ConsoleReceiveParamInt16(buffer, 1, &runs)) || (runs < 1)) runs = 20;
+    if((COMMAND_SUCCESS != ConsoleReceiveParamInt16(buffer, 2, &corruptPermille)) || (corruptPermille < 0) ||
+        (corruptPermille > 1000))
+    {
+        corruptPermille = 10;
+    }
+
+    bench.runPacketizer(runs, corruptPermille, &res, &stats);
+
+    snprintf(outStr, sizeof(outStr) / sizeof(outStr[0]), "%u bytes, %u us, %u ns/byte, %u kB/s",
+        res.iterations, res.totalMicros, res.nsPerIteration,
+        (res.totalMicros > 0) ? (uint32_t) (((uint64_t) res.iterations * 1000000ULL) / ((uint64_t) res.totalMicros * 1024ULL)) : 0);
+    ConsoleIoSendString(outStr);
+    ConsoleIoSendString(STR_ENDLINE);
+    snprintf(outStr, sizeof(outStr) / sizeof(outStr[0]), "Frames: %u fed, %u corrupted, %u received, %u corrupt received",
+        stats.frames, stats.corrupted, stats.received, stats.corruptReceived);
+    ConsoleIoSendString(outStr);
+    ConsoleIoSendString(STR_ENDLINE);
+    snprintf(outStr, sizeof(outStr) / sizeof(outStr[0]), "%u framing errors, %u intact frames lost",
+        stats.framingErrors, res.errors);
+    ConsoleIoSendString(outStr);
+    ConsoleIoSendString(STR_ENDLINE);
+
+    // frames next to corrupted ones may be lost due to resyncing, so only clean streams must be lossless
+    if((0 != res.errors) && (0 == corruptPermille)) result = COMMAND_ERROR;
+    return result;
+}
+#endif
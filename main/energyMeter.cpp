@@ -0,0 +1,221 @@
+#include "energyMeter.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sys/time.h>
+
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+
+#include "globalComponents.h"
+
+RTC_DATA_ATTR static EnergyMeter::persistent_data_t energyMeterPersistentData = {
+    .magic = 0
+};
+
+/** Protects the persistent data and the state levels, which are reported by several tasks */
+static portMUX_TYPE energyMeterMux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Default constructor, which performs basic initialization.
+ *
+ * The time since boot is accounted as awake time. On deep sleep wakeups the time slept is credited.
+ *
+ * Note: Persistent data will be cleared on cold boots only. Must be constructed before the
+ * components reporting their states (see main.cpp).
+ */
+EnergyMeter::EnergyMeter(void)
+{
+    memset(levels, 0, sizeof(levels));
+    memset(microAmps, 0, sizeof(microAmps));
+    levels[STATE_AWAKE] = 1;
+    lastTransitionMicros = 0;
+
+    if(energyMeterPersistentData.magic != persistentDataMagic) {
+        memset(&energyMeterPersistentData, 0, sizeof(persistent_data_t));
+        energyMeterPersistentData.magic = persistentDataMagic;
+    } else if(energyMeterPersistentData.sleepPending && (ESP_SLEEP_WAKEUP_UNDEFINED != esp_sleep_get_wakeup_cause())) {
+        creditDeepSleep();
+    }
+    energyMeterPersistentData.sleepPending = false;
+}
+
+/**
+ * @brief Default destructor, which cleans up allocated data.
+ */
+EnergyMeter::~EnergyMeter(void)
+{
+}
+
+/**
+ * @brief Report a state transition.
+ *
+ * @param state State which changed.
+ * @param level New level of the state, i.e. the number of active consumers (0 = off).
+ */
+void EnergyMeter::setLevel(state_t state, unsigned int level)
+{
+    if((state < 0) || (state >= STATE_MAX) || (STATE_DEEP_SLEEP == state)) return;
+
+    portENTER_CRITICAL(&energyMeterMux);
+    if(levels[state] != level) {
+        integrate();
+        levels[state] = (uint8_t) std::min(level, (unsigned int) UINT8_MAX);
+    }
+    portEXIT_CRITICAL(&energyMeterMux);
+}
+
+/**
+ * @brief Close the awake period right before going to deep sleep.
+ *
+ * The peripheral and output levels are kept during deep sleep, all other states are turned off.
+ * If the sleep doesn't happen after all, the next transition continues the awake accounting.
+ *
+ * @param ms Requested deep sleep time, which limits the time credited on the wakeup.
+ */
+void EnergyMeter::enterDeepSleep(uint32_t ms)
+{
+    int64_t now = getSystemMicros();
+
+    portENTER_CRITICAL(&energyMeterMux);
+    integrate();
+    memset(energyMeterPersistentData.sleepLevels, 0, sizeof(energyMeterPersistentData.sleepLevels));
+    energyMeterPersistentData.sleepLevels[STATE_PERIPHERAL] = levels[STATE_PERIPHERAL];
+    energyMeterPersistentData.sleepLevels[STATE_OUTPUTS] = levels[STATE_OUTPUTS];
+    energyMeterPersistentData.sleepLevels[STATE_DEEP_SLEEP] = 1;
+    energyMeterPersistentData.sleepStartMicros = now;
+    energyMeterPersistentData.sleepPlannedMillis = ms;
+    energyMeterPersistentData.sleepPending = true;
+    portEXIT_CRITICAL(&energyMeterMux);
+}
+
+/**
+ * @brief Get the times per state and the estimated charge of an accounting window.
+ *
+ * @param lastWindow If true, the last complete window is returned, otherwise the current one.
+ * @param dst Statistics destination.
+ * @return bool False if no data is available (or the parameters are invalid).
+ */
+bool EnergyMeter::getStats(bool lastWindow, energy_stats_t* dst)
+{
+    uint64_t micros[STATE_MAX];
+    uint32_t currents[STATE_MAX];
+    bool valid;
+
+    if(nullptr == dst) return false;
+
+    portENTER_CRITICAL(&energyMeterMux);
+    integrate();
+    valid = !lastWindow || energyMeterPersistentData.lastValid;
+    memcpy(micros, lastWindow ? energyMeterPersistentData.lastMicros : energyMeterPersistentData.currentMicros, sizeof(micros));
+    memcpy(currents, microAmps, sizeof(currents));
+    portEXIT_CRITICAL(&energyMeterMux);
+
+    memset(dst, 0, sizeof(energy_stats_t));
+    uint64_t window = micros[STATE_AWAKE] + micros[STATE_DEEP_SLEEP];
+    if(!valid || (0 == window)) return false;
+
+    // uA * us fits easily into 64 bit for several days, even at ampere level currents
+    uint64_t charge = 0;
+    for(int i = 0; i < STATE_MAX; i++) {
+        dst->seconds[i] = (uint32_t) (micros[i] / 1000000);
+        charge += micros[i] * currents[i];
+    }
+    charge /= 3600ULL * 1000 * 1000;
+
+    dst->windowSeconds = (uint32_t) (window / 1000000);
+    dst->chargeMicroAmpHours = (uint32_t) charge;
+    dst->dailyMicroAmpHours = (uint32_t) ((charge * windowMicros) / window);
+
+    return true;
+}
+
+/**
+ * @brief Add the time since the last transition to all active states. Completes the
+ * current window once it covers windowMicros.
+ *
+ * Note: Must be called with energyMeterMux held.
+ */
+void EnergyMeter::integrate(void)
+{
+    persistent_data_t* data = &energyMeterPersistentData;
+    int64_t now = esp_timer_get_time();
+    uint64_t delta = (uint64_t) std::max(now - lastTransitionMicros, (int64_t) 0);
+
+    lastTransitionMicros = now;
+    for(int i = 0; i < STATE_MAX; i++) {
+        data->currentMicros[i] += delta * levels[i];
+    }
+
+    if((data->currentMicros[STATE_AWAKE] + data->currentMicros[STATE_DEEP_SLEEP]) >= windowMicros) {
+        memcpy(data->lastMicros, data->currentMicros, sizeof(data->lastMicros));
+        memset(data->currentMicros, 0, sizeof(data->currentMicros));
+        data->lastValid = true;
+    }
+}
+
+/**
+ * @brief Credit the time slept to the states kept during deep sleep.
+ *
+ * The time slept is measured by the RTC based system time. It is limited to the requested
+ * time, as wakeups can only happen early (keep awake, ULP).
+ */
+void EnergyMeter::creditDeepSleep(void)
+{
+    persistent_data_t* data = &energyMeterPersistentData;
+    int64_t planned = (int64_t) data->sleepPlannedMillis * 1000;
+    int64_t slept = getSystemMicros() - data->sleepStartMicros;
+
+    if((slept < 0) || (slept > planned)) slept = planned;
+    // the boot is accounted as awake time
+    slept = std::max(slept - esp_timer_get_time(), (int64_t) 0);
+
+    for(int i = 0; i < STATE_MAX; i++) {
+        data->currentMicros[i] += ((uint64_t) slept) * data->sleepLevels[i];
+    }
+
+    ESP_LOGD(logTag, "Credited %u ms of deep sleep.", (uint32_t) (slept / 1000));
+}
+
+int64_t EnergyMeter::getSystemMicros(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return ((int64_t) tv.tv_sec * 1000000) + tv.tv_usec;
+}
+
+void EnergyMeter::hardwareConfigUpdatedHookDispatch(void* param)
+{
+    EnergyMeter* meter = (EnergyMeter*) param;
+
+    if(nullptr == meter) {
+        ESP_LOGE("unkown", "No valid EnergyMeter available to dispatch hardware config events to!");
+    } else {
+        meter->hardwareConfigUpdated();
+    }
+}
+
+/**
+ * @brief Take over the currents per state from the hardware config.
+ */
+void EnergyMeter::hardwareConfigUpdated()
+{
+    SettingsManager::energy_config_t energyConf;
+
+    ESP_LOGI(logTag, "Hardware config update notification received.");
+
+    if(SettingsManager::ERR_OK != settingsMgr.copyEnergyConfig(&energyConf)) return;
+
+    portENTER_CRITICAL(&energyMeterMux);
+    microAmps[STATE_AWAKE] = energyConf.awakeMicroAmps;
+    microAmps[STATE_WIFI] = energyConf.wifiMicroAmps;
+    microAmps[STATE_KEEP_AWAKE] = 0;
+    microAmps[STATE_PERIPHERAL] = energyConf.peripheralMicroAmps;
+    microAmps[STATE_EXT_SUPPLY] = energyConf.extSupplyMicroAmps;
+    microAmps[STATE_OUTPUTS] = energyConf.outputMicroAmps;
+    microAmps[STATE_DEEP_SLEEP] = energyConf.deepSleepMicroAmps;
+    portEXIT_CRITICAL(&energyMeterMux);
+}
@@ -8,18 +8,50 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "user_config.h"
+#include "hardwareConfig.h"
 
 //#include "serialPacketizer.h"
 
+/** Cached reading of a fill sensor (see FillSensorProtoHandler::getReading()) */
+typedef struct fill_sensor_reading_t {
+    int fillLevelMm;                                            /**< Median of the latest readings in mm (-1 = none) */
+    int lastFillLevelMm;                                        /**< Latest reading in mm (-1 = none) */
+    uint32_t raw;                                               /**< Latest raw sensor value */
+    int64_t timestampMicros;                                    /**< Time of the latest reading (esp_timer_get_time()) */
+    int numSamples;                                             /**< Number of readings the median is based on */
+    bool stable;                                                /**< Filter is full and its spread within stableSpreadMm */
+} fill_sensor_reading_t;
 
+/**
+ * @brief The FillSensorProtoHandler class implements the protocol of the fill level sensor.
+ *
+ * Two modes are supported:
+ * - Request/response: requestFillLevel() + waitFillLevel() (or the blocking getFillLevel()).
+ * - Streaming: startStreaming() subscribes to readings at a fixed interval, which are received by
+ *   a background task until stopStreaming(). waitStableFillLevel() returns as soon as the median
+ *   filtered value is stable.
+ *
+ * In both modes the latest reading is kept in a cache (incl. the raw sensor value for calibration),
+ * which can be read by getReading() at any time without blocking. The cache is a seqlock with the
+ * receiving task as single writer, so readers must not have a higher priority than the receiving task.
+ */
 template <class PacketizerClass>
 class FillSensorProtoHandler
 {
+public:
+    static const int medianFilterLen = 5;                       /**< Number of readings the median is taken of */
+    static const int stableSpreadMm = 10;                       /**< Maximum spread of the filtered readings being stable */
+
+    /** Same for all packetizers, so readings of different sensors can be handled alike (see FillSensorRegistry) */
+    typedef fill_sensor_reading_t fill_reading_t;
+
 private:
     const char* logTag = "fill_proto";
 
@@ -35,11 +67,171 @@ private:
 
     SemaphoreHandle_t requestMutex;
     StaticSemaphore_t requestMutexBuf;
+    bool requestPending;
+
+    /** Maximum time to wait for a fill level answer. The sensor may send multiple answer packets. */
+    const TickType_t fillLevelTimeout = pdMS_TO_TICKS(600);
+
+    static const int streamTaskStackSize = 2048;
+    static const UBaseType_t streamTaskPrio = tskIDLE_PRIORITY + 6;     /**< Above the readers of the cache */
+    StackType_t streamTaskStack[streamTaskStackSize];
+    StaticTask_t streamTaskBuf;
+    TaskHandle_t streamTaskHandle;
+    class PacketizerClass::BUFFER_T streamPacketBuf;
+
+    /** Interval the streaming task checks for being stopped */
+    const TickType_t streamPollTicks = pdMS_TO_TICKS(100);
+
+    volatile bool streaming;
+    SemaphoreHandle_t streamStoppedSem;
+    StaticSemaphore_t streamStoppedSemBuf;
+    SemaphoreHandle_t stableSem;
+    StaticSemaphore_t stableSemBuf;
+
+    /** Cache of the latest reading: odd sequence numbers mark an update in progress */
+    volatile uint32_t cacheSeq;
+    fill_reading_t cache;
+    int filterBuf[medianFilterLen];
+    int filterNext;
+
+    void releaseRequest()
+    {
+        if(pdFALSE == xSemaphoreGive(requestMutex)) {
+            ESP_LOGE(logTag, "Error occurred releasing the requestMutex.");
+            // TBD: distinctive error code
+        }
+    }
+
+    void writeCache(const fill_reading_t& reading)
+    {
+        cacheSeq = cacheSeq + 1;
+        __sync_synchronize();
+        cache = reading;
+        __sync_synchronize();
+        cacheSeq = cacheSeq + 1;
+    }
+
+    /**
+     * @brief Reset the cache and the median filter. Only to be called while no readings are received.
+     */
+    void resetReadings()
+    {
+        fill_reading_t reading;
+
+        reading.fillLevelMm = -1;
+        reading.lastFillLevelMm = -1;
+        reading.raw = 0;
+        reading.timestampMicros = 0;
+        reading.numSamples = 0;
+        reading.stable = false;
+
+        filterNext = 0;
+        writeCache(reading);
+    }
+
+    /**
+     * @brief Add a raw sensor value to the cache.
+     */
+    void addRawReading(uint32_t raw)
+    {
+        fill_reading_t reading = cache; // single writer, no need for getReading()
+
+        reading.raw = raw;
+        writeCache(reading);
+    }
+
+    /**
+     * @brief Add a reading to the median filter and update the cache.
+     *
+     * @return bool True if the filtered value is stable.
+     */
+    bool addReading(int fillLevelMm)
+    {
+        fill_reading_t reading = cache; // single writer, no need for getReading()
+        int sorted[medianFilterLen];
+
+        filterBuf[filterNext] = fillLevelMm;
+        filterNext = (filterNext + 1) % medianFilterLen;
+        if(reading.numSamples < medianFilterLen) reading.numSamples++;
+
+        // insertion sort of the (few) valid entries
+        for(int i = 0; i < reading.numSamples; i++) {
+            int val = filterBuf[i];
+            int j = i;
+            for(; (j > 0) && (sorted[j-1] > val); j--) sorted[j] = sorted[j-1];
+            sorted[j] = val;
+        }
+
+        reading.fillLevelMm = sorted[reading.numSamples / 2];
+        reading.lastFillLevelMm = fillLevelMm;
+        reading.timestampMicros = esp_timer_get_time();
+        reading.stable = (reading.numSamples == medianFilterLen) &&
+            ((sorted[reading.numSamples - 1] - sorted[0]) <= stableSpreadMm);
+        writeCache(reading);
+
+        return reading.stable;
+    }
+
+    /**
+     * @brief Send a subscription request: the sensor streams its readings at the given interval (0 = stop).
+     */
+    bool sendSubscription(uint16_t intervalMillis)
+    {
+        txBuffer[0] = PROTO_TYPE_FILL_LEVEL_SUBSCRIBE_REQ;
+        memcpy(&txBuffer[1], &intervalMillis, 2);
+        if(0 != packetizer->transmitData(3, txBuffer, pdMS_TO_TICKS(100))) {
+            ESP_LOGE(logTag, "Couldn't send fill level subscription (interval %u ms).", intervalMillis);
+            return false;
+        }
+
+        return true;
+    }
+
+    static void streamTaskFuncDispatch(void* params)
+    {
+        FillSensorProtoHandler* handler = (FillSensorProtoHandler*) params;
+
+        handler->streamTaskFunc();
+    }
+
+    void streamTaskFunc()
+    {
+        bool active = false;
+
+        while(1) {
+            if(!streaming) {
+                if(active) {
+                    active = false;
+                    xSemaphoreGive(streamStoppedSem);
+                }
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                continue;
+            }
+            active = true;
+
+            if(pdPASS != xQueueReceive(rxPacketQueue, &streamPacketBuf, streamPollTicks)) continue;
+
+            if((streamPacketBuf.len == 5) && (PROTO_TYPE_FILL_LEVEL_IND == streamPacketBuf.data[0])) {
+                int fillLevel;
+                memcpy(&fillLevel, &streamPacketBuf.data[1], 4);
+                if(fillLevel < 0) continue;
+                if(addReading(fillLevel)) xSemaphoreGive(stableSem);
+            } else if((streamPacketBuf.len == 5) && (PROTO_TYPE_FILL_LEVEL_RAW_IND == streamPacketBuf.data[0])) {
+                uint32_t rawData;
+                memcpy(&rawData, &streamPacketBuf.data[1], 4);
+                addRawReading(rawData);
+            } else {
+                ESP_LOGW(logTag, "Dropping unexpected packet while streaming. len: %d, type: 0x%02x", streamPacketBuf.len,
+                    streamPacketBuf.data[0]);
+            }
+        }
+    }
 
     enum {
-        PROTO_TYPE_FILL_LEVEL_REQ       = 0x01,
-        PROTO_TYPE_FILL_LEVEL_IND       = 0x81,
-        PROTO_TYPE_FILL_LEVEL_RAW_IND   = 0x82
+        PROTO_TYPE_FILL_LEVEL_REQ           = 0x01,
+        PROTO_TYPE_FILL_LEVEL_SUBSCRIBE_REQ = 0x02,     /**< Data: interval in ms (uint16_t, 0 = stop) */
+        PROTO_TYPE_FILL_LEVEL_IND           = 0x81,
+        PROTO_TYPE_FILL_LEVEL_RAW_IND       = 0x82
     } PROTO_TYPE_E;
 
 public:
@@ -47,6 +239,9 @@ public:
     FillSensorProtoHandler(void)
     {
         packetizerInitialized = false;
+        requestPending = false;
+        streaming = false;
+        streamTaskHandle = nullptr;
         this->packetizer = nullptr;
 
         ESP_LOGE(logTag, "Unsupported default constructor called!");
@@ -55,11 +250,18 @@ public:
     FillSensorProtoHandler(PacketizerClass* packetizer)
     {
         packetizerInitialized = false;
+        requestPending = false;
+        streaming = false;
+        streamTaskHandle = nullptr;
         this->packetizer = packetizer;
 
         memset(txBuffer, 0x00, maxPacketDataLen+1);
 
         requestMutex = xSemaphoreCreateMutexStatic(&requestMutexBuf);
+        streamStoppedSem = xSemaphoreCreateBinaryStatic(&streamStoppedSemBuf);
+        stableSem = xSemaphoreCreateBinaryStatic(&stableSemBuf);
+        cacheSeq = 0;
+        resetReadings();
 
         rxPacketQueue = packetizer->getRxPacketQueue();
 
@@ -71,60 +273,212 @@ public:
         }
     }
 
+    /**
+     * @brief Request the fill level from the sensor (blocking).
+     * 
+     * @return int Fill level in mm or -1 in case of an error.
+     */
     int getFillLevel()
     {
-        int ret = -1;
-        int fillLevel = -1;
+        if(!requestFillLevel()) return -1;
 
-        if(!packetizerInitialized) return -1;
+        return waitFillLevel(fillLevelTimeout);
+    }
+
+    /**
+     * @brief Send a fill level request to the sensor without waiting for the answer.
+     * 
+     * The answer must be fetched by waitFillLevel() afterwards. Until then, requests
+     * of other tasks are blocked.
+     * 
+     * @return bool True if the request has been sent.
+     */
+    bool requestFillLevel()
+    {
+        if(!packetizerInitialized) return false;
 
         // TBD: make mutex wait time configurable/as param?
-        if(pdTRUE == xSemaphoreTake(requestMutex, portMAX_DELAY)) {
-            txBuffer[0] = PROTO_TYPE_FILL_LEVEL_REQ;
-
-            // Note: The timeout is devided into multiple polls, because the fill sensor
-            // may send multiple answer packet (i.e. raw value and the actual percentage)
-            TickType_t wait = pdMS_TO_TICKS(100);
-            int polls = 5;
-
-            if(0 == packetizer->transmitData(1, txBuffer, wait)) {
-                while(polls >= 0) {
-                    if(pdPASS == xQueueReceive(rxPacketQueue, &rxPacketBuf, wait)) {
-                        if((rxPacketBuf.len == 5) && (PROTO_TYPE_FILL_LEVEL_IND == rxPacketBuf.data[0])) {
-                            memcpy(&fillLevel, &rxPacketBuf.data[1], 4);
-                            ESP_LOGD(logTag, "Received answer is fill level: %d mm", fillLevel);
-                            break;
-                        } else if((rxPacketBuf.len == 5) && (PROTO_TYPE_FILL_LEVEL_RAW_IND == rxPacketBuf.data[0])) {
-                            uint32_t rawData;
-                            memcpy(&rawData, &rxPacketBuf.data[1], 4);
-                            ESP_LOGD(logTag, "Received answer is raw fill level. raw: 0x%08x (%d)", rawData, rawData);
-                        } else {
-                            ESP_LOGE(logTag, "Received answer isn't a proper fill level indication! len: %d, type: 0x%02x", rxPacketBuf.len, rxPacketBuf.data[0]);
-                            // TBD: distinctive error code
-                            break;
-                        }
-                    }
-                    polls--;
-                }
+        if(pdTRUE != xSemaphoreTake(requestMutex, portMAX_DELAY)) {
+            ESP_LOGE(logTag, "Error occurred acquiring the requestMutex.");
+            // TBD: distinctive error code
+            return false;
+        }
+
+        // drop stale packets (e.g. streamed readings still in flight), which would be taken as the answer
+        xQueueReset(rxPacketQueue);
+
+        txBuffer[0] = PROTO_TYPE_FILL_LEVEL_REQ;
+        if(0 != packetizer->transmitData(1, txBuffer, pdMS_TO_TICKS(100))) {
+            ESP_LOGE(logTag, "Couldn't send fill level request.");
+            // TBD: distinctive error code
+            releaseRequest();
+            return false;
+        }
+
+        resetReadings();
+        requestPending = true;
+        return true;
+    }
+
+    /**
+     * @brief Subscribe to a reading stream of the sensor (non-blocking).
+     *
+     * The readings are received in the background until stopStreaming(). Until then, other
+     * requests are blocked.
+     *
+     * @param intervalMillis Interval of the readings in milliseconds.
+     * @return bool True if the subscription has been sent.
+     */
+    bool startStreaming(uint16_t intervalMillis)
+    {
+        if(!packetizerInitialized || (0 == intervalMillis)) return false;
+
+        if(nullptr == streamTaskHandle) {
+            streamTaskHandle = xTaskCreateStaticPinnedToCore(streamTaskFuncDispatch, "fill_stream_task", streamTaskStackSize,
+                (void*) this, streamTaskPrio, streamTaskStack, &streamTaskBuf, controlTaskCore);
+            if(nullptr == streamTaskHandle) {
+                ESP_LOGE(logTag, "Couldn't create streaming task.");
+                return false;
+            }
+        }
+
+        if(pdTRUE != xSemaphoreTake(requestMutex, portMAX_DELAY)) {
+            ESP_LOGE(logTag, "Error occurred acquiring the requestMutex.");
+            return false;
+        }
+
+        resetReadings();
+        xSemaphoreTake(stableSem, 0); // drop a stale notification
+        xSemaphoreTake(streamStoppedSem, 0);
+
+        if(!sendSubscription(intervalMillis)) {
+            releaseRequest();
+            return false;
+        }
+
+        streaming = true;
+        xTaskNotifyGive(streamTaskHandle);
+        return true;
+    }
+
+    /**
+     * @brief Unsubscribe from the reading stream. The cache keeps the latest reading.
+     */
+    void stopStreaming()
+    {
+        if(!streaming) return;
+
+        sendSubscription(0); // the sensor stops anyway when its supply is switched off
+        streaming = false;
+        if(pdTRUE != xSemaphoreTake(streamStoppedSem, streamPollTicks * 2)) {
+            ESP_LOGW(logTag, "Streaming task didn't acknowledge the stop.");
+        }
+        // readings sent before the sensor handled the unsubscription must not be taken for later answers
+        xQueueReset(rxPacketQueue);
 
-                if(polls < 0) {
-                    ESP_LOGE(logTag, "Receiving fill level timed out!");
+        releaseRequest();
+    }
+
+    /**
+     * @brief Wait for a stable median filtered fill level while streaming (see startStreaming()).
+     *
+     * @param wait Maximum time to wait in OS ticks.
+     * @param reading Optional destination of the complete reading.
+     * @return int Filtered fill level in mm (even if not stable yet) or -1 if there isn't any reading.
+     */
+    int waitStableFillLevel(TickType_t wait, fill_reading_t* reading = nullptr)
+    {
+        fill_reading_t latest;
+
+        if(!streaming) {
+            ESP_LOGE(logTag, "Not streaming.");
+            return -1;
+        }
+
+        if(pdTRUE != xSemaphoreTake(stableSem, wait)) {
+            ESP_LOGW(logTag, "Fill level not stable within timeout.");
+        }
+
+        getReading(&latest);
+        if(nullptr != reading) *reading = latest;
+        ESP_LOGD(logTag, "Filtered fill level: %d mm (%d readings, last %d mm, raw 0x%08x)%s", latest.fillLevelMm,
+            latest.numSamples, latest.lastFillLevelMm, latest.raw, latest.stable ? "" : " - not stable");
+
+        return latest.fillLevelMm;
+    }
+
+    /**
+     * @brief Get the latest reading from the cache (non-blocking).
+     *
+     * @param dst Destination of the reading.
+     * @return bool True if the reading is valid, i.e. at least one fill level has been received.
+     */
+    bool getReading(fill_reading_t* dst)
+    {
+        uint32_t seq;
+
+        do {
+            seq = cacheSeq;
+            __sync_synchronize();
+            *dst = cache;
+            __sync_synchronize();
+        } while((0 != (seq & 1)) || (seq != cacheSeq));
+
+        return dst->numSamples > 0;
+    }
+
+    /**
+     * @brief Wait for the answer of a fill level request sent by requestFillLevel().
+     * 
+     * Note: The function returns as soon as the answer has been received, i.e. the
+     * rx packet queue of the packetizer serves as completion notification.
+     * 
+     * @param wait Maximum time to wait for the answer in OS ticks.
+     * @return int Fill level in mm or -1 in case of an error.
+     */
+    int waitFillLevel(TickType_t wait)
+    {
+        int ret = -1;
+        int fillLevel = -1;
+        TickType_t start = xTaskGetTickCount();
+        TickType_t elapsed = 0;
+
+        if(!requestPending) {
+            ESP_LOGE(logTag, "No fill level request pending.");
+            return -1;
+        }
+
+        // Note: The sensor may send multiple answer packets (i.e. raw value and the actual percentage)
+        while(1) {
+            if(pdPASS == xQueueReceive(rxPacketQueue, &rxPacketBuf, wait - elapsed)) {
+                if((rxPacketBuf.len == 5) && (PROTO_TYPE_FILL_LEVEL_IND == rxPacketBuf.data[0])) {
+                    memcpy(&fillLevel, &rxPacketBuf.data[1], 4);
+                    ESP_LOGD(logTag, "Received answer is fill level: %d mm", fillLevel);
+                    if(fillLevel >= 0) addReading(fillLevel);
+                    break;
+                } else if((rxPacketBuf.len == 5) && (PROTO_TYPE_FILL_LEVEL_RAW_IND == rxPacketBuf.data[0])) {
+                    uint32_t rawData;
+                    memcpy(&rawData, &rxPacketBuf.data[1], 4);
+                    ESP_LOGD(logTag, "Received answer is raw fill level. raw: 0x%08x (%d)", rawData, rawData);
+                    addRawReading(rawData);
+                } else {
+                    ESP_LOGE(logTag, "Received answer isn't a proper fill level indication! len: %d, type: 0x%02x", rxPacketBuf.len, rxPacketBuf.data[0]);
                     // TBD: distinctive error code
+                    break;
                 }
-            } else {
-                ESP_LOGE(logTag, "Couldn't send fill level request.");
-                // TBD: distinctive error code
             }
 
-            if(pdFALSE == xSemaphoreGive(requestMutex)) {
-                ESP_LOGE(logTag, "Error occurred releasing the requestMutex.");
+            elapsed = xTaskGetTickCount() - start;
+            if(elapsed >= wait) {
+                ESP_LOGE(logTag, "Receiving fill level timed out!");
                 // TBD: distinctive error code
+                break;
             }
-        } else {
-            ESP_LOGE(logTag, "Error occurred acquiring the requestMutex.");
-            // TBD: distinctive error code
         }
 
+        requestPending = false;
+        releaseRequest();
+
         if(fillLevel >= 0) {
             ret = fillLevel;
         }
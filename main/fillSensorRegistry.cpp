@@ -0,0 +1,89 @@
+#include "fillSensorRegistry.h"
+
+/**
+ * @brief Default constructor, which performs basic initialization.
+ *
+ * Note: The sensors are registered by registerSensor().
+ */
+FillSensorRegistry::FillSensorRegistry(void)
+{
+    numSensors = 0;
+}
+
+/**
+ * @brief Return the number of registered sensors.
+ */
+int FillSensorRegistry::getNumSensors(void)
+{
+    return numSensors;
+}
+
+/**
+ * @brief Send the fill level requests (or subscriptions in streaming mode) to all sensors without
+ * waiting for the answers.
+ *
+ * @return uint32_t Bitmap of the sensors which have been requested (bit = sensor index).
+ */
+uint32_t FillSensorRegistry::requestAll(void)
+{
+    uint32_t requested = 0;
+
+    for(int i = 0; i < numSensors; i++) {
+        if(sensors[i].request(sensors[i].handler)) {
+            requested |= (1U << i);
+        } else {
+            ESP_LOGW(logTag, "Couldn't request fill sensor %d.", i);
+        }
+    }
+
+    return requested;
+}
+
+/**
+ * @brief Collect the answers of the requests sent by requestAll().
+ *
+ * All requests are in flight at the same time, so the timeout applies to all sensors together.
+ *
+ * @param requested Bitmap of the requested sensors (see requestAll()).
+ * @param wait Maximum time to wait for all answers in OS ticks.
+ * @param fillLevelsMm Destination of the fill levels in mm, one per registered sensor (-1 = none).
+ */
+void FillSensorRegistry::waitAll(uint32_t requested, TickType_t wait, int* fillLevelsMm)
+{
+    TickType_t start = xTaskGetTickCount();
+
+    for(int i = 0; i < numSensors; i++) {
+        fillLevelsMm[i] = -1;
+        if(0 == (requested & (1U << i))) continue;
+
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        // the answer may have been received meanwhile, so even an expired wait is worth a try
+        fillLevelsMm[i] = sensors[i].wait(sensors[i].handler, (elapsed < wait) ? (wait - elapsed) : 1);
+    }
+}
+
+/**
+ * @brief Complete the requests of all sensors, i.e. stop streaming in streaming mode.
+ *
+ * @param requested Bitmap of the requested sensors (see requestAll()).
+ */
+void FillSensorRegistry::finishAll(uint32_t requested)
+{
+    for(int i = 0; i < numSensors; i++) {
+        if(0 != (requested & (1U << i))) sensors[i].finish(sensors[i].handler);
+    }
+}
+
+/**
+ * @brief Get the latest cached reading of a sensor (non-blocking).
+ *
+ * @param idx Sensor index.
+ * @param dst Destination of the reading.
+ * @return bool True if the reading is valid.
+ */
+bool FillSensorRegistry::getReading(int idx, fill_sensor_reading_t* dst)
+{
+    if((idx < 0) || (idx >= numSensors)) return false;
+
+    return sensors[idx].getReading(sensors[idx].handler, dst);
+}
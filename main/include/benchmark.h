@@ -0,0 +1,98 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "settingsManager.h"
+#include "serialFramer.h"
+
+/**
+ * @brief The Benchmark class contains on-target benchmarks of the performance critical
+ * parts of the software, which are meant to be run from the console (see consoleCommands.cpp)
+ * before rolling out a new firmware.
+ *
+ * The benchmarks only use their own instances of the classes under test, i.e. they don't
+ * alter the current configuration or irrigation plan.
+ *
+ * Note: Only built with CONFIG_BENCHMARK_CONSOLE_COMMANDS enabled.
+ */
+class Benchmark
+{
+public:
+    typedef struct result_t {
+        uint32_t iterations;                    /**< Number of measured operations */
+        uint32_t errors;                        /**< Number of operations with unexpected results */
+        uint32_t totalMicros;                   /**< Overall duration in microseconds */
+        uint32_t nsPerIteration;                /**< Average duration of an operation in nanoseconds */
+        int32_t heapBytes;                      /**< Heap held by an operation in bytes (if applicable) */
+    } result_t;
+
+    typedef enum {
+        PARSER_SETTINGS = 0,                    /**< SettingsManager stream parsing and apply (as used for the irrigation config) */
+        PARSER_CJSON_HEAP = 1,                  /**< cJSON allocating from the heap */
+        PARSER_CJSON_ARENA = 2,                 /**< cJSON allocating from the JsonArena (as used for the hardware config) */
+        PARSER_MAX = 3
+    } parser_t;
+
+    /** Frame statistics of runPacketizer */
+    typedef struct packet_stats_t {
+        uint32_t frames;                        /**< Number of frames fed */
+        uint32_t corrupted;                     /**< Number of frames with an injected byte error */
+        uint32_t received;                      /**< Number of intact frames received */
+        uint32_t corruptReceived;               /**< Number of corrupted frames received, i.e. not detected by the framing */
+        uint32_t framingErrors;                 /**< Number of errors reported by the framing FSM */
+    } packet_stats_t;
+
+    Benchmark(void);
+    ~Benchmark(void);
+
+    void runEventYear(int years, result_t* dst, uint32_t occurances[], int numEvents);
+    void runConfigParse(int runs, parser_t parser, bool large, result_t* dst);
+    void runIngress(int runs, result_t* dst, size_t* docLen);
+    void runPacketizer(int runs, int corruptPermille, result_t* dst, packet_stats_t* stats);
+
+    static const int numYearEvents = 4;         /**< Number of events used by runEventYear */
+
+private:
+    /** Start of the event simulation (local time) */
+    static const int simStartYear = 2019;
+
+    /** Irrigation duration of the simulated events */
+    static const int simDurationSecs = 600;
+
+    /** Maximum number of simultaneous events, like the IrrigationController handles */
+    static const int maxEventHandles = 8;
+
+    /** Chunk size of the streamed config parsing (like the config file is read) */
+    static const size_t configChunkSize = 256;
+
+    /** Maximum time for the MQTT ingress to process a message in ms */
+    static const int ingressTimeoutMs = 1000;
+
+    /** Maximum payload length of the packetizer under test (as used by the fill sensors) */
+    static const unsigned int packetMaxPayload = 16;
+    /** Minimum payload length: sequence number (2 bytes), data and checksum */
+    static const unsigned int packetMinPayload = 4;
+    /** Size of the byte stream fed by runPacketizer */
+    static const size_t packetStreamLen = 4096;
+    static const unsigned int packetMaxFrames = packetStreamLen / (packetMinPayload + 6);
+
+    typedef SerialFramer<packetMaxPayload> framer_t;
+
+    /** State of runPacketizer, shared with its packet hook */
+    typedef struct packet_state_t {
+        packet_stats_t* stats;
+        uint8_t frameLen[packetMaxFrames];      /**< Payload length per frame */
+        bool corrupted[packetMaxFrames];        /**< Whether or not a byte of the frame has been altered */
+        unsigned int numFrames;                 /**< Number of frames in the stream */
+    } packet_state_t;
+
+    static size_t buildYearConfig(char* buf, size_t bufSize);
+    static size_t buildLargeConfig(char* buf, size_t bufSize);
+    static SettingsManager::err_t applyConfig(SettingsManager& settings, const char* doc, size_t docLen, uint32_t* minFreeHeap);
+    static void packetHook(const framer_t::BUFFER_T* packet, void* param);
+    static void finish(result_t* dst, int64_t startMicros);
+};
+
+#endif /* BENCHMARK_H */
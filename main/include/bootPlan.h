@@ -0,0 +1,27 @@
+#ifndef BOOT_PLAN_H
+#define BOOT_PLAN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * Subsystems which are only brought up if a wakeup needs them (see app_main). Whatever the boot
+ * plan skipped can be brought up on demand later on by bootBringUp().
+ */
+typedef enum {
+    BOOT_SUBSYS_NETWORK = (1<<0),           /**< WiFi/TCP/IP stack, MQTT client, config + OTA subscriptions, OTA updater */
+    BOOT_SUBSYS_CONSOLE = (1<<1),           /**< Serial console */
+    BOOT_SUBSYS_ALL = BOOT_SUBSYS_NETWORK | BOOT_SUBSYS_CONSOLE
+} boot_subsys_t;
+
+void bootBringUp(uint32_t subsystems);
+uint32_t bootGetStarted(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BOOT_PLAN_H */
@@ -0,0 +1,59 @@
+#ifndef COMPACT_ENCODER_H
+#define COMPACT_ENCODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief The CompactEncoder class is a minimal streaming encoder for small documents
+ * consisting of maps, arrays, integers and strings. It writes either minified JSON
+ * or CBOR (RFC 7049) into a caller provided buffer.
+ * 
+ * Note: Maps are encoded with indefinite length in CBOR, so the number of entries
+ * doesn't need to be known in advance. Arrays need their number of elements.
+ */
+class CompactEncoder
+{
+public:
+    typedef enum {
+        ENCODING_JSON = 0,
+        ENCODING_CBOR = 1
+    } encoding_t;
+
+    CompactEncoder(encoding_t encoding, char* buf, size_t bufLen);
+    ~CompactEncoder();
+
+    void beginMap(void);
+    void endMap(void);
+    void beginArray(size_t numElements);
+    void endArray(void);
+    void addKey(const char* key);
+    void addUint(uint32_t val);
+    void addInt(int32_t val);
+    void addString(const char* str);
+
+    size_t getLength(void);
+    bool hasOverflowed(void);
+
+private:
+    static const int maxDepth = 4;
+
+    encoding_t encoding;
+    char* buf;
+    size_t bufLen;
+    size_t len;
+    bool overflow;
+
+    int depth;
+    bool firstElement[maxDepth];
+    bool afterKey;
+
+    void put(const char* data, size_t dataLen);
+    void putChar(char c);
+    void cborHead(uint8_t majorType, uint32_t val);
+    void jsonSeparator(void);
+    void push(void);
+    void pop(void);
+};
+
+#endif /* COMPACT_ENCODER_H */
@@ -0,0 +1,94 @@
+#ifndef ENERGY_METER_H
+#define ENERGY_METER_H
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "esp_log.h"
+
+#define ENERGY_METER_STATE_TO_STR(state) (\
+    (state == EnergyMeter::STATE_AWAKE) ? "awake" : \
+    (state == EnergyMeter::STATE_WIFI) ? "wifi" : \
+    (state == EnergyMeter::STATE_KEEP_AWAKE) ? "keepAwake" : \
+    (state == EnergyMeter::STATE_PERIPHERAL) ? "peripheral" : \
+    (state == EnergyMeter::STATE_EXT_SUPPLY) ? "extSupply" : \
+    (state == EnergyMeter::STATE_OUTPUTS) ? "outputs" : \
+    (state == EnergyMeter::STATE_DEEP_SLEEP) ? "deepSleep" : \
+    "unknown" \
+)
+
+/**
+ * @brief The EnergyMeter class estimates the charge drawn from the battery by integrating the
+ * time spent in each power state.
+ *
+ * The owners of the power states (PowerManager, OutputController, WiFi event handler) report their
+ * transitions, which are timestamped with esp_timer_get_time(). States have a level, i.e. the number
+ * of active consumers (e.g. active outputs), so the integrated times are weighted by it.
+ * On deep sleep the peripheral and output levels are carried over (they are held during deep sleep)
+ * and the time slept is credited on the wakeup.
+ *
+ * The times are kept in RTC memory, i.e. they accumulate across deep sleeps until the next cold boot.
+ * They are collected in windows of (at least) 24 hours of system time. The currents per state are
+ * taken from the hardware config (see SettingsManager::energy_config_t) and applied when reading
+ * the statistics, so changing them re-evaluates the collected data as well.
+ */
+class EnergyMeter
+{
+public:
+    typedef enum {
+        STATE_AWAKE = 0,            /**< Main CPU running */
+        STATE_WIFI = 1,             /**< WiFi radio started */
+        STATE_KEEP_AWAKE = 2,       /**< Keep awake forced (informational, CPU current is part of STATE_AWAKE) */
+        STATE_PERIPHERAL = 3,       /**< DCDC + RS232 driver enabled */
+        STATE_EXT_SUPPLY = 4,       /**< External sensor supply enabled */
+        STATE_OUTPUTS = 5,          /**< Active outputs (level = number of active outputs) */
+        STATE_DEEP_SLEEP = 6,       /**< Deep sleep */
+        STATE_MAX = 7
+    } state_t;
+
+    static const uint64_t windowMicros = 24ULL * 60 * 60 * 1000 * 1000;     /**< Minimum duration of an accounting window */
+
+    typedef struct energy_stats_t {
+        uint32_t seconds[STATE_MAX];                    /**< Time per state in seconds (weighted by the level) */
+        uint32_t windowSeconds;                         /**< Duration of the window in seconds (awake + deep sleep) */
+        uint32_t chargeMicroAmpHours;                   /**< Charge drawn within the window in uAh */
+        uint32_t dailyMicroAmpHours;                    /**< Charge normalized to 24 hours in uAh */
+    } energy_stats_t;
+
+    typedef struct persistent_data_t {
+        uint32_t magic;                                 /**< Data is valid if this is persistentDataMagic */
+        uint64_t currentMicros[STATE_MAX];              /**< Times per state of the current window */
+        uint64_t lastMicros[STATE_MAX];                 /**< Times per state of the last complete window */
+        bool lastValid;                                 /**< Wether or not lastMicros contains a complete window */
+        bool sleepPending;                              /**< Wether or not the fields below describe a deep sleep to be credited */
+        int64_t sleepStartMicros;                       /**< System time (gettimeofday) when going to deep sleep */
+        uint32_t sleepPlannedMillis;                    /**< Requested deep sleep time */
+        uint8_t sleepLevels[STATE_MAX];                 /**< State levels kept during deep sleep */
+    } persistent_data_t;
+
+    EnergyMeter(void);
+    ~EnergyMeter(void);
+
+    void setLevel(state_t state, unsigned int level);
+    void enterDeepSleep(uint32_t ms);
+    bool getStats(bool lastWindow, energy_stats_t* dst);
+
+    static void hardwareConfigUpdatedHookDispatch(void* param);
+    void hardwareConfigUpdated();
+
+private:
+    const char* logTag = "energy";
+
+    static const uint32_t persistentDataMagic = 0x454e5247; // 'ENRG'
+
+    uint8_t levels[STATE_MAX];                          /**< Current state levels */
+    uint32_t microAmps[STATE_MAX];                      /**< Current per level of each state */
+    int64_t lastTransitionMicros;                       /**< esp_timer time of the last integration */
+
+    void integrate(void);
+    void creditDeepSleep(void);
+    static int64_t getSystemMicros(void);
+};
+
+#endif /* ENERGY_METER_H */
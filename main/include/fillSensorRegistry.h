@@ -0,0 +1,119 @@
+#ifndef FILL_SENSOR_REGISTRY_H
+#define FILL_SENSOR_REGISTRY_H
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+
+#include "hardwareConfig.h"
+#include "fillSensorProtoHandler.h"
+
+/**
+ * @brief The FillSensorRegistry class polls all fill sensors (one per reservoir) at once.
+ *
+ * Each sensor has its own packetizer (i.e. UART and receiving task), so the requests of all sensors
+ * are sent first and the answers are collected afterwards. The time to read all sensors is thus the
+ * time of the slowest sensor instead of the sum of all.
+ *
+ * The handlers are templates of their packetizer, so they are registered by registerSensor(), which
+ * sets up the dispatchers of the handler type. The sensor index is the reservoir index.
+ */
+class FillSensorRegistry
+{
+public:
+    typedef enum err_t {
+        ERR_OK = 0,
+        ERR_INVALID_PARAM = -1,
+        ERR_NO_RESOURCES = -2
+    } err_t;
+
+    static const int maxSensors = fillSensorNum;
+
+    FillSensorRegistry(void);
+
+    /**
+     * @brief Register the handler of the next sensor (i.e. reservoir).
+     *
+     * @param handler Sensor handler, which must exist for the lifetime of the registry.
+     * @return err_t ERR_OK on success, ERR_NO_RESOURCES if maxSensors are registered already.
+     */
+    template <class HandlerClass>
+    err_t registerSensor(HandlerClass* handler)
+    {
+        if(nullptr == handler) return ERR_INVALID_PARAM;
+        if(numSensors >= maxSensors) {
+            ESP_LOGE(logTag, "Can't register more than %d fill sensors!", maxSensors);
+            return ERR_NO_RESOURCES;
+        }
+
+        sensors[numSensors].handler = (void*) handler;
+        sensors[numSensors].request = requestDispatch<HandlerClass>;
+        sensors[numSensors].wait = waitDispatch<HandlerClass>;
+        sensors[numSensors].finish = finishDispatch<HandlerClass>;
+        sensors[numSensors].getReading = getReadingDispatch<HandlerClass>;
+        numSensors++;
+
+        return ERR_OK;
+    }
+
+    int getNumSensors(void);
+    uint32_t requestAll(void);
+    void waitAll(uint32_t requested, TickType_t wait, int* fillLevelsMm);
+    void finishAll(uint32_t requested);
+    bool getReading(int idx, fill_sensor_reading_t* dst);
+
+private:
+    const char* logTag = "fill_reg";
+
+    typedef struct sensor_t {
+        void* handler;
+        bool (*request)(void* handler);
+        int (*wait)(void* handler, TickType_t wait);
+        void (*finish)(void* handler);
+        bool (*getReading)(void* handler, fill_sensor_reading_t* dst);
+    } sensor_t;
+
+    sensor_t sensors[maxSensors];
+    int numSensors;
+
+    template <class HandlerClass>
+    static bool requestDispatch(void* handler)
+    {
+#ifdef CONFIG_FILL_SENSOR_STREAMING
+        return ((HandlerClass*) handler)->startStreaming(CONFIG_FILL_SENSOR_STREAM_INTERVAL_MS);
+#else
+        return ((HandlerClass*) handler)->requestFillLevel();
+#endif
+    }
+
+    template <class HandlerClass>
+    static int waitDispatch(void* handler, TickType_t wait)
+    {
+#ifdef CONFIG_FILL_SENSOR_STREAMING
+        return ((HandlerClass*) handler)->waitStableFillLevel(wait);
+#else
+        return ((HandlerClass*) handler)->waitFillLevel(wait);
+#endif
+    }
+
+    template <class HandlerClass>
+    static void finishDispatch(void* handler)
+    {
+#ifdef CONFIG_FILL_SENSOR_STREAMING
+        ((HandlerClass*) handler)->stopStreaming();
+#else
+        (void) handler; // the request is completed by waitFillLevel() already
+#endif
+    }
+
+    template <class HandlerClass>
+    static bool getReadingDispatch(void* handler, fill_sensor_reading_t* dst)
+    {
+        return ((HandlerClass*) handler)->getReading(dst);
+    }
+};
+
+#endif /* FILL_SENSOR_REGISTRY_H */
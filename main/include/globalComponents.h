@@ -7,24 +7,41 @@
 
 #include "serialPacketizer.h"
 #include "fillSensorProtoHandler.h"
+#include "fillSensorRegistry.h"
 #include "timeSystem.h"
 #include "powerManager.h"
 #include "outputController.h"
+#include "outputActuator.h"
 #include "mqttManager.h"
 #include "settingsManager.h"
 #include "irrigationPlanner.h"
+#include "wakeProfiler.h"
+#include "energyMeter.h"
+#include "mqttIngress.h"
+#include "jsonArena.h"
 
 extern FillSensorPacketizer fillSensorPacketizer;
 extern FillSensorProtoHandler<FillSensorPacketizer> fillSensor;
+#if CONFIG_FILL_SENSOR_NUM_SENSORS > 1
+extern FillSensor1Packetizer fillSensor1Packetizer;
+extern FillSensorProtoHandler<FillSensor1Packetizer> fillSensor1;
+#endif
+extern FillSensorRegistry fillSensors;
 
 extern PowerManager pwrMgr;
 extern OutputController outputCtrl;
+extern OutputActuator outputActuator;
 
 extern MqttManager mqttMgr;
+extern MqttIngress mqttIngress;
 extern SettingsManager settingsMgr;
+extern JsonArena jsonArena;
 
 extern IrrigationPlanner irrigPlanner;
 
+extern WakeProfiler wakeProfiler;
+extern EnergyMeter energyMeter;
+
 #endif
 
 #endif /* GLOBAL_COMPONENTS_H */
@@ -3,9 +3,17 @@
 
 
 #include <stdint.h>
+#include "sdkconfig.h"
 #include "driver/uart.h"
 #include "driver/adc.h"
 
+// Task/core layout: the radio stack (WiFi, TCP/IP, MQTT; see sdkconfig) runs on the PRO_CPU,
+// control (IrrigationController, OutputActuator, MqttIngress) and sensors (SerialPacketizer) on the APP_CPU.
+#ifdef CONFIG_FREERTOS_UNICORE
+static const int controlTaskCore = 0;
+#else
+static const int controlTaskCore = 1;                   /**< APP_CPU */
+#endif
 
 static const int heartbeatLedPin = 2;
 
@@ -15,7 +23,7 @@ static const int fillSensorPortRxPin = 21;
 static const int fillSensorPortTxPin = 22;
 
 #ifdef __cplusplus
-#define FillSensorPacketizer SerialPacketizer<fillSensorPortNum, fillSensorPortBaud, fillSensorPortRxPin, fillSensorPortTxPin, 16, 2>
+#define FillSensorPacketizer SerialPacketizer<fillSensorPortNum, fillSensorPortBaud, fillSensorPortRxPin, fillSensorPortTxPin, 16, 2, SERIAL_PACKETIZER_RX_PATTERN_DET>
 #endif
 
 static const uart_port_t spareSensorPortNum = UART_NUM_2;
@@ -23,6 +31,16 @@ static const uint32_t spareSensorPortBaud = 115200;
 static const int spareSensorPortRxPin = 16;
 static const int spareSensorPortTxPin = 17;
 
+// Fill sensors, i.e. reservoirs: the first one is attached to the fill sensor port, the second one to the spare port
+#ifndef CONFIG_FILL_SENSOR_NUM_SENSORS
+#define CONFIG_FILL_SENSOR_NUM_SENSORS 1
+#endif
+static const int fillSensorNum = CONFIG_FILL_SENSOR_NUM_SENSORS;
+
+#ifdef __cplusplus
+#define FillSensor1Packetizer SerialPacketizer<spareSensorPortNum, spareSensorPortBaud, spareSensorPortRxPin, spareSensorPortTxPin, 16, 2, SERIAL_PACKETIZER_RX_PATTERN_DET>
+#endif
+
 static const uart_port_t consolePortNum = UART_NUM_0;
 #define NO_CONSOLE_IO_LL_INIT
 // static const uint32_t consolePortBaud = 115200;
@@ -46,6 +64,17 @@ static const gpio_num_t irrigationMainGpioNum = GPIO_NUM_4;
 static const gpio_num_t irrigationAux0GpioNum = GPIO_NUM_27;
 static const gpio_num_t irrigationAux1GpioNum = GPIO_NUM_26;
 
+// External outputs: 74HC595 shift register (8 channels), powered by the peripheral supply.
+// Clock, latch and output enable are RTC GPIOs, so they can be held during deep sleep (GPIO 32/33 are taken
+// by the 32 kHz crystal of the RTC clock). The data line is a plain GPIO: without clock and latch edges its
+// level doesn't affect the register, so it isn't held. The output enable (active low) is pulled up during
+// boot and only driven low while external outputs are active, which hides the undefined register content
+// after powering it up.
+static const gpio_num_t outputExtDataGpioNum = GPIO_NUM_18;
+static const gpio_num_t outputExtClockGpioNum = GPIO_NUM_14;
+static const gpio_num_t outputExtLatchGpioNum = GPIO_NUM_13;
+static const gpio_num_t outputExtEnableGpioNum = GPIO_NUM_15;
+
 static const gpio_num_t keepAwakeGpioNum = GPIO_NUM_34;
 
 #endif /* HARDWARE_CONFIG_H */
@@ -11,6 +11,7 @@
 #include "freertos/event_groups.h"
 
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_log.h"
 #include "driver/gpio.h"
 
@@ -18,6 +19,9 @@
 
 #include "globalComponents.h"
 #include "wifiEvents.h"
+#include "wakeTimeBudget.h"
+#include "compactEncoder.h"
+#include "telemetryBuffer.h"
 
 #define RESERVOIR_STATE_TO_STR(state) (\
     (state == IrrigationController::RESERVOIR_OK) ? "OK" : \
@@ -50,9 +54,47 @@ public:
 
     typedef struct peristent_data_t {
         time_t lastIrrigEvent;
-        reservoir_state_t reservoirState;
+        reservoir_state_t reservoirStates[fillSensorNum];        /**< Per reservoir, needed for the hysteresis */
     } peristent_data_t;
 
+    /** Maximum number of running irrigations whose stop events are kept across a deep sleep */
+    static const unsigned int persistentStopEventsMax = 8;
+
+    /** Stop event of a running irrigation incl. the zone config chosen for it */
+    typedef struct persistent_stop_event_t {
+        IrrigationPlanner::stop_event_t evt;                    /**< Stop event as taken from the planner */
+        irrigation_zone_cfg_t zoneCfg;                          /**< Zone config (i.e. stop states) to apply on the stop */
+    } persistent_stop_event_t;
+
+    /** Stop events of the running irrigations. Kept in RTC memory while deep sleeping with held outputs. */
+    typedef struct persistent_stop_events_t {
+        uint32_t magic;                                         /**< Data is valid if this is persistentStopEventsMagic */
+        unsigned int num;                                       /**< Number of valid entries */
+        persistent_stop_event_t entries[persistentStopEventsMax];
+    } persistent_stop_events_t;
+
+    static const uint32_t persistentStopEventsMagic = 0x53544f50; // 'STOP', change on layout changes!
+
+    /** Maximum number of active outputs reported via MQTT */
+    static const unsigned int publishedStateMaxOutputs = OutputController::intChannels + OutputController::extChannels;
+
+    /** State as published via MQTT. Kept in RTC memory to be able to send only changes after wakeups. */
+    typedef struct published_state_t {
+        bool valid;                                             /**< Wether or not the data is valid */
+        uint16_t deltasSinceFull;                               /**< Number of delta updates since the last full update */
+        int32_t fillLevel;                                      /**< See state_t */
+        reservoir_state_t reservoirState;                       /**< See state_t */
+        int32_t reservoirFillLevels[fillSensorNum];             /**< See state_t */
+        reservoir_state_t reservoirStates[fillSensorNum];       /**< See state_t */
+        uint32_t battVoltage;                                   /**< See state_t */
+        PowerManager::batt_state_t battState;                   /**< See state_t */
+        uint32_t numActiveOutputs;                              /**< Number of valid entries in activeOutputs */
+        uint32_t activeOutputs[publishedStateMaxOutputs];       /**< See state_t */
+        time_t nextIrrigEvent;                                  /**< See state_t */
+        time_t sntpLastSync;                                    /**< See state_t */
+        time_t sntpNextSync;                                    /**< See state_t */
+    } published_state_t;
+
     IrrigationController(void);
     ~IrrigationController(void);
 
@@ -63,10 +105,12 @@ private:
 
     /** Internal state structure used for MQTT updates and persistant storage. */
     typedef struct state_t_ {
-        int32_t fillLevel;                                      /**< Fill level of reservoir in percent multiplied by 10.
-                                                                 * Note: Will be -1 if getting the fill level failed.
+        int32_t fillLevel;                                      /**< Fill level of the emptiest reservoir in percent multiplied by 10.
+                                                                 * Note: Will be -2 if the reservoir check is disabled.
                                                                  */
-        reservoir_state_t reservoirState;                       /**< State of the reservoir (e.g. RESERVOIR_OK, ...) */
+        reservoir_state_t reservoirState;                       /**< Worst state of all reservoirs (e.g. RESERVOIR_OK, ...) */
+        int32_t reservoirFillLevels[fillSensorNum];             /**< Fill level of each reservoir, see fillLevel */
+        reservoir_state_t reservoirStates[fillSensorNum];       /**< State of each reservoir, gating the zones supplied by it */
         uint32_t battVoltage;                                   /**< External battery supply voltage in mV. */
         PowerManager::batt_state_t battState;                   /**< State of the battery (e.g. BATT_FULL, BATT_OK, ...) */
         std::vector<uint32_t> activeOutputs;                    /**< Currently active outputs. */
@@ -92,13 +136,29 @@ private:
     const int mqttConnectedWaitMillis = 3000;
     /** Timeout in milliseconds to wait for the MQTT client publishing all messages */
     const int mqttAllPublishedWaitMillis = 4000;
+    /** Timeout in milliseconds to wait for the OutputActuator performing the queued output changes */
+    const int outputsFlushWaitMillis = 500;
 
+    /** Wether or not the deep sleep time is determined by the upcoming deadlines (next event, SNTP resync,
+     * telemetry flush), bounded by maxSleepMillis, instead of the fixed wakeupIntervalMillis */
+    bool eventDrivenSleep = false;
     /** Nominal wakeup time in milliseconds when going into deep sleep (i.e. non-keepawake) */
-    const int wakeupIntervalMillis = 600000 - bootCompensationMillis;
+    int wakeupIntervalMillis = 600000 - bootCompensationMillis;
+    /** Maximum deep sleep time in milliseconds in case of event-driven sleep */
+    int maxSleepMillis = 7200000 - bootCompensationMillis;
+    /** Maximum age in milliseconds of recorded telemetry samples in case of event-driven sleep */
+    int telemetryFlushIntervalMillis = 14400000;
     /** Processing task wakeup time in milliseconds when keepawake is active */
     const int wakeupIntervalKeepAwakeMillis = 30000;
     /** If an event is this close, don't go to deep sleep */
     const int noDeepSleepRangeMillis = 60000;
+    /** Wether or not to deep sleep while outputs are active, holding their states. Otherwise the task
+     * stays awake (incl. network) till all outputs are off again (see CONFIG_OUTPUT_HOLD_DEEP_SLEEP). */
+#ifdef CONFIG_OUTPUT_HOLD_DEEP_SLEEP
+    const bool outputHoldDeepSleepEnabled = true;
+#else
+    const bool outputHoldDeepSleepEnabled = false;
+#endif
 
     /** Nominal max task sleep time the emergency timer is based on */
     const int taskMaxSleepTimeMillis = wakeupIntervalKeepAwakeMillis;
@@ -109,6 +169,12 @@ private:
     TimerHandle_t emergencyTimerHandle;
     static void emergencyTimerCb(TimerHandle_t timerHandle);
 
+    /** One-shot timer armed at the exact time of an approaching event */
+    esp_timer_handle_t eventTimer;
+    static void eventTimerCb(void* arg);
+    /** Margin added to the event timer timeout, e.g. covering the esp_timer task latency */
+    const int eventTimerMarginMillis = 100;
+
     // In case of deep sleep bare minimum is: peripheralEnStartupMillis + peripheralExtSupplyMillis + wifiConnectedWaitMillis + x
     // This is due to the fact that the lastIrrigEvent time is lost during deep sleep and we need to make sure to reach
     // the initial setup of this variable BEFORE the upcoming event. Otherwise it will be lost.
@@ -118,18 +184,44 @@ private:
     /* battery sensor: ~ 8 * 10 ms + x */
     /** Time in milliseconds to wakeup before an event */
     const int sensorBatReadoutTimeMillis = 8*5*100 + 8*10 + 200; // TBD: config option for avg
+    /** Timeout in milliseconds to wait for the background battery voltage sampling */
+    const int battSampleTimeoutMillis = 200;
+    /** Timeout in milliseconds to wait for the fill level answer */
+    const int fillLevelTimeoutMillis = 600;
     /* Boot time is just an approximation, which includes a reset of the systime during boot */
     /** Time in milliseconds a boot takes (in case of deep sleep) */
     const int bootToTaskTimeMillis = 600 + bootCompensationMillis;
-    /** Time in milliseconds to wakeup before an event */
-    const int preEventMillis = peripheralEnStartupMillis + peripheralExtSupplyMillis + sensorBatReadoutTimeMillis + 5000;
-    /** Time in milliseconds to wakeup before an event in case of deep sleep */
+    /** Guard time in milliseconds added to the wakeup times before an event */
+    const int preEventGuardMillis = 5000;
+    /** Time in milliseconds to wakeup before an event.
+     * Note: This is the upper bound only. See getPreEventMillis() for the actually used time. */
+    const int preEventMillis = peripheralEnStartupMillis + peripheralExtSupplyMillis + sensorBatReadoutTimeMillis + preEventGuardMillis;
+    /** Time in milliseconds to wakeup before an event in case of deep sleep.
+     * Note: This is the upper bound only. See getPreEventMillisDeepSleep() for the actually used time. */
     const int preEventMillisDeepSleep = wifiConnectedWaitMillis + peripheralEnStartupMillis + peripheralExtSupplyMillis +
-        sensorBatReadoutTimeMillis + bootToTaskTimeMillis + 5000;
+        sensorBatReadoutTimeMillis + bootToTaskTimeMillis + preEventGuardMillis;
+
+    /** Measured durations of the wakeup phases */
+    WakeTimeBudget wakeBudget;
+
+    /** Wether or not telemetry mode is enabled, i.e. sensor samples are recorded to the telemetry buffer
+     * and the network is only brought up if needed (upload due, state change, events, SNTP, ...).
+     * Otherwise the network is started on every wakeup (see CONFIG_TELEMETRY_MODE). */
+#ifdef CONFIG_TELEMETRY_MODE
+    const bool telemetryEnabled = true;
+#else
+    const bool telemetryEnabled = false;
+#endif
+    /** Number of samples (i.e. wakeups) after which the telemetry buffer is uploaded */
+    const int telemetryUploadIntervalWakeups = 6;
+    /** Sensor samples recorded since the last telemetry upload */
+    TelemetryBuffer telemetry;
+    /** Wether or not the network has been started */
+    bool networkStarted = false;
 
     /** If an event is this close, don't resync time via SNTP */
     const int noSntpResyncRangeMillis = 60000;
-    /** Time in hours after which a time resync via SNTP should be requested */
+    /** Time in hours after which a time resync via SNTP should be requested (minimum, see TimeSystem_GetSntpResyncIntervalSecs()) */
     const double sntpResyncIntervalHours = 4;
     /** Time in minutes after which a time resync via SNTP should be requested in case it failed previously */
     const double sntpResyncIntervalFailMinutes = 10;
@@ -149,8 +241,6 @@ private:
 
     /** Internal state representation */
     state_t state;
-    /** Internal state representation (as sent via MQTT the last time) */
-    state_t lastState;
 
     // MQTT related state/data
     bool mqttPrepared = false;
@@ -159,48 +249,117 @@ private:
     /** MQTT topic postfix for state information (i.e. the part after the MAC address) */
     const char* mqttStateTopicPost = "/state";
 
-    /** MQTT state update data format.
-     * Needed format specifiers (in this order!):
-     * - \%u Battery voltage in mV,
-     * - \%u Battery state (0..4),
-     * - \%s Battery state string representation,
-     * - \%d Reservoir fill level (multiplied by 10),
-     * - \%u Reservoir state (0..3),
-     * - \%s Reservoir state string representation,
-     * - \%s Next irrigation event occurance ('YYYY-MM-DD HH:MM:SS')
-     * - \%s Active outputs array (list of unsigned integers)
-     * - \%s Active outputs array (list of names)
-     */
-    const char* mqttStateDataFmt = "{\n  \"batteryVoltage\": %u,\n  \"batteryState\": %u,\n"
-        "  \"batteryStateStr\": \"%s\",\n"
-        "  \"reservoirFillLevel\": %d,\n  \"reservoirState\": %u,\n  \"reservoirStateStr\": \"%s\",\n"
-        "  \"activeOutputs\": [%s],\n"
-        "  \"activeOutputsStr\": [%s],\n"
-        "  \"nextIrrigationEvent\": \"%s\",\n"
-        "  \"sntpLastSync\": \"%s\",\n"
-        "  \"sntpNextSync\": \"%s\"\n"
-        "}";
+    /** Encoding of the MQTT state updates */
+    const CompactEncoder::encoding_t mqttStateEncoding = CompactEncoder::ENCODING_JSON;
+    /** Wether or not only changed fields are published. Full state updates are published retained,
+     * delta updates are published non-retained. */
+    const bool mqttStateDeltaEnabled = true;
+    /** Number of delta updates after which a full (retained) state update is published again */
+    const int mqttStateFullInterval = 24;
+    /** Battery voltage changes in mV below this value aren't considered as state change */
+    const uint32_t mqttStateBattVoltageHysteresisMilli = 20;
+
+    /** State fields which can be published individually */
+    typedef enum {
+        STATE_FIELD_BATT_VOLTAGE = (1<<0),
+        STATE_FIELD_BATT_STATE = (1<<1),
+        STATE_FIELD_FILL_LEVEL = (1<<2),
+        STATE_FIELD_RESERVOIR_STATE = (1<<3),
+        STATE_FIELD_ACTIVE_OUTPUTS = (1<<4),
+        STATE_FIELD_NEXT_EVENT = (1<<5),
+        STATE_FIELD_SNTP_LAST_SYNC = (1<<6),
+        STATE_FIELD_SNTP_NEXT_SYNC = (1<<7),
+        STATE_FIELD_ALL = 0xff
+    } state_field_t;
+
+    /** MQTT topic postfix for the wake cycle profiling diagnostics (i.e. the part after the MAC address) */
+    const char* mqttDiagTopicPost = "/diag";
+
+    /** MQTT topic postfix for telemetry batches (i.e. the part after the MAC address) */
+    const char* mqttTelemetryTopicPost = "/telemetry";
+    /** Telemetry end sequence number of the last publish which isn't confirmed as published yet */
+    uint32_t telemetryPendingEndSeq;
+    /** Wether or not telemetryPendingEndSeq is valid */
+    bool telemetryPublishPending = false;
+
+    /** State of the last publish which isn't confirmed as published yet */
+    published_state_t pendingPublishedState;
+    /** Wether or not pendingPublishedState is valid */
+    bool statePublishPending = false;
+
     /** Buffer for the state topic. Will be allocated in constructor and freed in the destructor. */
     char* mqttStateTopic;
     /** Buffer for the state data. Will be allocated in constructor and freed in the destructor. */
     char* mqttStateData;
     /** Maximum allowed length of the state data.
-     * Will be determined by the constructor. Assumption: 5 digits for battery voltage (mV),
-     * 1 digit for battery state, 8 digits for battery state string,
-     * 4 digits for (fillLevel * 10), 1 digit for reservoir state,
-     * 8 digits for reservoir state string,
-     * 2 digits per active output + ', ' as seperator,
-     * 6 digits per active output string + ', ' as seperator,
-     * 19 digits for the next event datetime,
-     * 19 digits for the next SNTP sync datetime,
-     * 19 digits for the last SNTP sync datetime. */
+     * Will be determined by the constructor. Assumption: mqttStateDataBaseLen for keys and syntax,
+     * 10 digits each for battery voltage, battery state, fillLevel and reservoir state,
+     * 8 digits each for battery and reservoir state strings,
+     * 10 digits per active output + ',' as seperator,
+     * 8 digits per active output string + '"",' as seperator,
+     * 19 digits + '""' each for the next event, next SNTP sync and last SNTP sync datetimes,
+     * 10 digits + ',' each for the fill level and state of every reservoir (in case of several). */
     size_t mqttStateDataMaxLen;
+    /** Length of all keys and syntax elements of the state data */
+    const size_t mqttStateDataBaseLen = 256 + 48;
+
+    /** Buffer for the telemetry topic. Will be allocated in constructor and freed in the destructor. */
+    char* mqttTelemetryTopic;
+    /** Buffer for the telemetry data. Will be allocated in constructor and freed in the destructor. */
+    char* mqttTelemetryData;
+    /** Maximum allowed length of the telemetry data.
+     * Will be determined by the constructor. Assumption: mqttTelemetryDataBaseLen for keys, field names and syntax,
+     * mqttTelemetrySampleMaxLen per sample. */
+    size_t mqttTelemetryDataMaxLen;
+    /** Length of all keys, field names and syntax elements of the telemetry data */
+    const size_t mqttTelemetryDataBaseLen = 128;
+    /** Maximum length of a single telemetry sample: 10+5+1+5+1+10 digits, 5 ',' and '[],' as syntax */
+    const size_t mqttTelemetrySampleMaxLen = 44;
+
+    /** Buffer for the diagnostics topic. Will be allocated in constructor and freed in the destructor. */
+    char* mqttDiagTopic;
+    /** Buffer for the diagnostics data. Will be allocated in constructor and freed in the destructor. */
+    char* mqttDiagData;
+    /** Maximum allowed length of the diagnostics data.
+     * Will be determined by the constructor. Assumption: mqttDiagDataBaseLen for keys and syntax,
+     * mqttDiagScopeMaxLen per profiled scope, mqttDiagEnergyMaxLen for the energy accounting. */
+    size_t mqttDiagDataMaxLen;
+    /** Length of the keys and syntax elements of the diagnostics data */
+    const size_t mqttDiagDataBaseLen = 32;
+    /** Maximum length of a single scope: name + 7 keys, 10 digits each and syntax */
+    const size_t mqttDiagScopeMaxLen = 160;
+    /** Maximum length of the energy accounting: 2 windows with 3 values + 1 per state, 10 digits each and syntax */
+    const size_t mqttDiagEnergyMaxLen = 512;
 
     static void taskFuncDispatch(void* params);
     void taskFunc();
-    void setZoneOutputs(bool irrigOk, irrigation_zone_cfg_t* zoneCfg, bool start);
+    void setZoneOutputs(bool irrigOk, irrigation_zone_cfg_t* zoneCfg, bool start, time_t eventTime);
+    bool isZoneSupplyOk(const irrigation_zone_cfg_t* zoneCfg);
+    void disableCriticalZoneOutputs();
+    bool persistStopEvents();
+    void restoreStopEvents();
+    int findPersistedStopEvent(time_t eventTime, int zoneIdx);
+    bool takeRestoredStopZoneCfg(time_t eventTime, int zoneIdx, irrigation_zone_cfg_t* cfg);
+    int32_t getFillLevelPercent10(int fillLevelMm);
+    reservoir_state_t getReservoirState(int32_t fillLevel, reservoir_state_t lastState);
+    bool waitForEvent(time_t eventTime);
+    void recordEventJitter(time_t eventTime);
     void updateStateActiveOutputs(uint32_t chNum, bool active);
+    bool startNetwork();
+    bool isNetworkNeeded(const TelemetryBuffer::sample_t& sample, time_t now, time_t nextIrrigEvent);
+    bool prepareMqttTopics();
+    void publishTelemetry();
+    void confirmTelemetryPublished();
+    void publishDiagnostics();
     void publishStateUpdate();
+    void confirmStatePublished();
+    void getPublishedState(published_state_t* dst);
+    uint32_t getChangedStateFields(const published_state_t* current, const published_state_t* last);
+    size_t encodeState(const published_state_t* src, uint32_t fields);
+    int getPreEventMillis();
+    int getPreEventMillisDeepSleep();
+    int getDeepSleepMillis(int loopRunTimeMillis);
+    int getMillisTillTelemetryFlush(time_t now);
 
     static void timeSytemEventsHookDispatch(void* param, time_system_event_t events);
     void timeSytemEventHandler(time_system_event_t events);
@@ -216,6 +375,7 @@ private:
     const int extEventTimeSetSntp = (1<<1);
     const int extEventIrrigConfigUpdated = (1<<2);
     const int extEventHardwareConfigUpdated = (1<<3);
+    const int extEventIrrigEventDue = (1<<4);
 };
 
 #endif /* IRRIGATION_CONTROLLER_H */
@@ -7,6 +7,10 @@
 #include <vector>
 
 #include "irrigationZoneCfg.h"
+#include "irrigationPlannerCfg.h"
+#include "timeSystem.h"
+
+// #define IRRIGATION_EVENT_FAST_PATH_VERIFY      /**< Compare fast path results against mktime and log mismatches */
 
 /**
  * @brief The IrrigationEvent class is a utility class to represent irrigation events.
@@ -22,6 +26,14 @@ public:
         ERR_INVALID_PARAM = -2,
     } err_t;
 
+    typedef enum {
+        NOT_SET = 0,
+        SINGLE = 1,
+        DAILY = 2,
+        WEEKLY = 3,
+        MONTHLY = 4,
+    } repetition_type_t;
+
     typedef struct irrigation_event_data_t {
         int                 zoneIdx;        /**< Associated zone configuration index*/
         unsigned int        durationSecs;   /**< Stores the duration the channel configuration shall be kept active */
@@ -29,6 +41,21 @@ public:
         IrrigationEvent*    parentPtr;      /**< Pointer to the parent object containing the event data */
     } irrigation_event_data_t;
 
+    /** Plain representation of an event's configuration, e.g. used for binary config snapshots. */
+    typedef struct irrigation_event_cfg_t {
+        uint8_t             repetitionType; /**< Repetition type (see repetition_type_t) */
+        uint8_t             hour;           /**< Hour of the event */
+        uint8_t             minute;         /**< Minute of the event */
+        uint8_t             second;         /**< Second of the event */
+        uint8_t             day;            /**< Day of the event (single events only) */
+        uint8_t             month;          /**< Month of the event (single events only) */
+        uint16_t            year;           /**< Year of the event (single events only) */
+        uint32_t            dayMask;        /**< Weekday (bit 0 = Sunday) or monthday (bit 0 = 1st) mask (weekly/monthly events only) */
+        int32_t             zoneIdx;        /**< Associated zone configuration index*/
+        uint32_t            durationSecs;   /**< Stores the duration the channel configuration shall be kept active */
+        bool                isStart;        /**< Wether or not this is an irrigation start event */
+    } irrigation_event_cfg_t;
+
     IrrigationEvent(void);
     ~IrrigationEvent(void);
 
@@ -39,12 +66,15 @@ public:
 
     err_t setSingleEvent(int hour, int minute, int second, int day, int month, int year);
     err_t setDailyRepetition(int hour, int minute, int second);
-    //void setWeeklyRepetition();
-    //void setMonthlyRepetition();
+    err_t setWeeklyRepetition(int hour, int minute, int second, uint32_t weekdayMask);
+    err_t setMonthlyRepetition(int hour, int minute, int second, uint32_t monthdayMask);
+    void getConfig(irrigation_event_cfg_t* dest) const;
+    err_t setConfig(const irrigation_event_cfg_t* src);
 
     void updateReferenceTime(time_t ref);
     time_t getReferenceTime(void);
     time_t getNextOccurance(void) const;
+    bool isRepetitive(void) const;
 
     bool operator==(const IrrigationEvent& rhs) const;
     bool operator!=(const IrrigationEvent& rhs) const;
@@ -54,19 +84,22 @@ public:
     bool operator>=(const IrrigationEvent& rhs) const;
 
 private:
-    typedef enum {
-        NOT_SET = 0,
-        SINGLE = 1,
-        DAILY = 2,
-        WEEKLY = 3,
-        MONTHLY = 4,
-    } repetition_type_t;
+    static const time_t secsPerDay = 24*60*60;
+    static const uint32_t weekdayMaskAll = 0x7f;    /**< All valid weekday mask bits */
+    static const uint32_t monthdayMaskAll = 0x7fffffff; /**< All valid monthday mask bits */
 
     repetition_type_t repetitionType;               /**< Stores the repetition type of this event */
     irrigation_event_data_t eventData;              /**< Stores associated event data */
     struct tm eventTime;                            /**< Stores the time info of this event. Note: Its fields are only sparsely used. */
+    int32_t eventDaySecs;                           /**< Stores the time of day of this event in seconds */
+    time_t eventLocalSecs;                          /**< Stores the local time (see TimeSystem_CivilToLocalSecs) of single events */
+    uint32_t dayMask;                               /**< Stores the weekdays (bit 0 = Sunday) or monthdays (bit 0 = 1st) of weekly/monthly events */
 
     time_t refTime;                                 /**< Stores the reference time for time comparisions and the next occurance */
+
+    time_t getNextOccuranceMktime(void) const;
+    int getDayOffset(int year, int month, int mday, int wday) const;
+    static int getDaysInMonth(int year, int month);
 };
 
 #endif /* IRRIGATION_EVENT_H */
@@ -4,27 +4,25 @@
 #include <stdint.h>
 #include <ctime>
 #include <vector>
+#include <algorithm>
+#include <atomic>
 
 #include "esp_log.h"
 
+#include "irrigationPlannerCfg.h"
 #include "irrigationEvent.h"
 #include "hardwareConfig.h"
 
-/** Number of configurable irrigation zones. */
-constexpr unsigned int irrigationPlannerNumZones = 8;
-/** Number of regular irrigation events. */
-constexpr unsigned int irrigationPlannerNumNormalEvents = 4*irrigationPlannerNumZones;
-/** Number of temporary single shot irrigation events. */
-constexpr unsigned int irrigationPlannerNumSingleShotEvents = 1;
-
-/** Number of irrigation events. */
-static constexpr unsigned int irrigationPlannerNumEvents = irrigationPlannerNumNormalEvents + irrigationPlannerNumSingleShotEvents;
-/** Number of irrigation stop events. */ // TBD: raise to numEvents + 1 ?
-static constexpr unsigned int irrigationPlannerNumStopEvents = irrigationPlannerNumZones + irrigationPlannerNumSingleShotEvents;
+class SettingsManager;
 
 /**
  * @brief The IrrigationPlanner class is a manager of IrrigationEvents. It is used
  * by the IrrigationController to determine what to do and when to do it.
+ * 
+ * Config updates are published as versioned snapshots (see irrigConfigUpdated), which
+ * are adopted by the schedule accessors without blocking. Therefore the schedule accessors
+ * (getNextEventTime, getEventHandles, getEventData, confirmEvent, getZoneConfig and the config
+ * lock) must only be called from a single task.
  */
 class IrrigationPlanner
 {
@@ -45,6 +43,12 @@ public:
         bool isStart;
     } event_handle_t;
 
+    /** Pending stop event of a running irrigation, e.g. to keep it across deep sleeps */
+    typedef struct stop_event_t {
+        time_t  time;                                               /**< Time of the stop event. */
+        int     zoneIdx;                                            /**< Zone to be stopped. */
+    } stop_event_t;
+
     typedef void(*IrrigConfigUpdateHookFncPtr)(void*);
 
     IrrigationPlanner();
@@ -55,12 +59,15 @@ public:
     err_t getEventData(event_handle_t handle, IrrigationEvent::irrigation_event_data_t* dest);
     err_t confirmEvent(event_handle_t handle);
     err_t getZoneConfig(int idx, irrigation_zone_cfg_t* cfg);
+    err_t getStopEvents(stop_event_t* dest, unsigned int maxElements, unsigned int* num);
+    err_t restoreStopEvent(const stop_event_t* evt);
 
     err_t setConfigLock(bool lockState);
     bool getConfigLock();
 
     static void irrigConfigUpdatedHookDispatch(void* param);
     void irrigConfigUpdated();
+    void irrigConfigUpdated(SettingsManager& settings);
     err_t registerIrrigPlanUpdatedHook(IrrigConfigUpdateHookFncPtr hook, void* param);
 
 private:
@@ -73,25 +80,79 @@ private:
 
     IrrigationEvent stopEvents[irrigationPlannerNumStopEvents];     /**< Storage holding irrigation stop events. */
     bool stopEventsUsed[irrigationPlannerNumStopEvents];            /**< Flag weather or not the corresponding stop event storage is used. */
-
-    bool configLock;                                                /**< Flag weather or not the config should be locked from updates. */
-    bool configUpdatedDuringLock;                                   /**< Flag weather or not a config update happend during a locked phase. */
+    unsigned int stopEventsFree[irrigationPlannerNumStopEvents];    /**< Stack of unused stop event storage indices. */
+    unsigned int stopEventsFreeCnt;                                 /**< Number of valid entries in stopEventsFree. */
+
+    std::atomic<bool> configLock;                                   /**< Flag weather or not the config should be locked from updates. */
+
+    /** Zone and event config published to the schedule accessors. Immutable once published. */
+    typedef struct plan_config_t {
+        irrigation_zone_cfg_t zones[irrigationPlannerNumZones];
+        IrrigationEvent events[irrigationPlannerNumNormalEvents];
+        bool eventsUsed[irrigationPlannerNumNormalEvents];
+    } plan_config_t;
+
+    static const uint32_t configEpochNone = UINT32_MAX;
+
+    plan_config_t configBufs[2];                                    /**< Double buffered config, the published one is configBufs[configEpoch & 1]. */
+    std::atomic<uint32_t> configEpoch;                              /**< Epoch of the published config. */
+    std::atomic<uint32_t> configReadingEpoch;                       /**< Epoch of the config currently being adopted (configEpochNone if idle). */
+    uint32_t configAdoptedEpoch;                                    /**< Epoch of the config the schedule is based on. */
+
+    /** Timeline entry caching the next occurance of a single (stop) event. */
+    typedef struct timeline_entry_t {
+        time_t          time;                                       /**< Next occurance of the event. */
+        event_handle_t  handle;                                     /**< Handle of the event. */
+    } timeline_entry_t;
+
+    /** Step and maximum number of steps to look for the next existing occurance of repetitive events,
+     * see timelineNextOccurance(). The step must be shorter than the gap between two occurances (23 h on
+     * DST days), the steps must cover the longest repetition (a month). */
+    static const time_t timelineRetryStepSecs = 60*60;
+    static const int timelineRetryMaxSteps = 32*24;
+    static constexpr unsigned int timelineMaxEntries = irrigationPlannerNumEvents + irrigationPlannerNumStopEvents;
+
+    timeline_entry_t timeline[timelineMaxEntries];                  /**< Indexed min-heap of upcoming event occurances, ordered by time. */
+    unsigned int timelineEntries;                                   /**< Number of valid entries in the timeline heap. */
+    time_t timelineRefTime;                                         /**< Start time the timeline has been calculated for. */
+    bool timelineValid;                                             /**< Flag weather or not the timeline reflects the current schedule. */
+
+    time_t eventsNext[irrigationPlannerNumEvents];                  /**< Cached next occurance per event (0 if not in the timeline). */
+    time_t stopEventsNext[irrigationPlannerNumStopEvents];          /**< Cached next occurance per stop event (0 if not in the timeline). */
+    int eventsPos[irrigationPlannerNumEvents];                      /**< Position per event in the timeline heap (-1 if not in the timeline). */
+    int stopEventsPos[irrigationPlannerNumStopEvents];              /**< Position per stop event in the timeline heap (-1 if not in the timeline). */
 
     IrrigConfigUpdateHookFncPtr configUpdatedHook;                  /**< Configuration updated hook function storage. */
     void* configUpdatedHookParamPtr;                                /**< Parameter storage for configuration updated hook function. */
 
     const TickType_t lockAcquireTimeout = pdMS_TO_TICKS(1000);          /**< Maximum lock acquisition time in OS ticks. */
 
-    SemaphoreHandle_t accessMutex;
-    StaticSemaphore_t accessMutexBuf;
+    SemaphoreHandle_t publishMutex;
+    StaticSemaphore_t publishMutexBuf;
 
     SemaphoreHandle_t hookMutex;
     StaticSemaphore_t hookMutexBuf;
 
-    int getNextEventIdx(time_t startTime, IrrigationEvent* eventList, bool* eventUsedList, unsigned int listElements);
+    IrrigationEvent* getEventByHandle(event_handle_t handle);
+    time_t* getCachedNextByHandle(event_handle_t handle);
+    int* getTimelinePosByHandle(event_handle_t handle);
+
+    void configAdopt();
+    void callPlanUpdatedHook();
+
+    time_t timelineNextOccurance(IrrigationEvent* evt, time_t startTime);
+    void timelineRebuild(time_t startTime);
+    void timelineAdvance(time_t startTime);
+    void timelinePush(time_t time, event_handle_t handle);
+    void timelineRemove(event_handle_t handle);
+    void timelineRemoveAt(unsigned int pos);
+    void timelineSet(unsigned int pos, const timeline_entry_t& entry);
+    void timelineSiftUp(unsigned int pos);
+    void timelineSiftDown(unsigned int pos);
     void printEventDetails(IrrigationEvent* evt);
     void printAllEvents();
 
+    err_t addStopEvent(time_t stopTime, int zoneIdx, time_t refTime);
     bool confirmNormalEvent(unsigned int idx);
     void confirmStopEvent(unsigned int idx);
 };
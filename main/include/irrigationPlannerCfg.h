@@ -0,0 +1,43 @@
+#ifndef IRRIGATION_PLANNER_CFG_H
+#define IRRIGATION_PLANNER_CFG_H
+
+#include "sdkconfig.h"
+
+/*
+ * Capacities of the irrigation planner, chosen at build time (see Kconfig.projbuild / make menuconfig).
+ * All planner and settings storages are sized by these, i.e. no dynamic allocations are involved.
+ */
+
+#ifndef CONFIG_IRRIGATION_PLANNER_NUM_ZONES
+#define CONFIG_IRRIGATION_PLANNER_NUM_ZONES 8
+#endif
+
+#ifndef CONFIG_IRRIGATION_PLANNER_EVENTS_PER_ZONE
+#define CONFIG_IRRIGATION_PLANNER_EVENTS_PER_ZONE 4
+#endif
+
+#ifndef CONFIG_IRRIGATION_PLANNER_NUM_STOP_EVENTS
+#define CONFIG_IRRIGATION_PLANNER_NUM_STOP_EVENTS 0
+#endif
+
+#ifndef CONFIG_IRRIGATION_PLANNER_RAM_BUDGET
+#define CONFIG_IRRIGATION_PLANNER_RAM_BUDGET 32768
+#endif
+
+/** Number of configurable irrigation zones. */
+constexpr unsigned int irrigationPlannerNumZones = CONFIG_IRRIGATION_PLANNER_NUM_ZONES;
+/** Number of regular irrigation events. */
+constexpr unsigned int irrigationPlannerNumNormalEvents = CONFIG_IRRIGATION_PLANNER_EVENTS_PER_ZONE*irrigationPlannerNumZones;
+/** Number of temporary single shot irrigation events. */
+constexpr unsigned int irrigationPlannerNumSingleShotEvents = 1;
+
+/** Number of irrigation events. */
+static constexpr unsigned int irrigationPlannerNumEvents = irrigationPlannerNumNormalEvents + irrigationPlannerNumSingleShotEvents;
+/** Number of irrigation stop events, i.e. irrigations running at the same time. By default every event can have one. */
+static constexpr unsigned int irrigationPlannerNumStopEvents = (CONFIG_IRRIGATION_PLANNER_NUM_STOP_EVENTS > 0) ?
+    CONFIG_IRRIGATION_PLANNER_NUM_STOP_EVENTS : irrigationPlannerNumEvents;
+
+/** Maximum RAM in bytes the planner and the irrigation config storages of the settings may use (checked at build time). */
+static constexpr unsigned int irrigationPlannerRamBudget = CONFIG_IRRIGATION_PLANNER_RAM_BUDGET;
+
+#endif /* IRRIGATION_PLANNER_CFG_H */
@@ -6,6 +6,7 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "outputController.h"
 
 constexpr unsigned int irrigationZoneCfgElements = 4; // TBD: use (OutputController::intChannels + OutputController::extChannels)?
@@ -17,6 +18,7 @@ typedef struct irrigation_zone_cfg_t_ {
     OutputController::ch_map_t  chNum[irrigationZoneCfgElements];
     bool                        chStateStart[irrigationZoneCfgElements];
     bool                        chStateStop[irrigationZoneCfgElements];
+    int8_t                      reservoirIdx;       /**< Reservoir (i.e. fill sensor) the zone is supplied by, -1 = none */
 } irrigation_zone_cfg_t;
 
 #ifdef __cplusplus
@@ -0,0 +1,56 @@
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+
+/**
+ * @brief The JsonArena class is a bump allocator for cJSON, registered via cJSON_InitHooks().
+ *
+ * A parse is scoped by begin() and end(): in between, all cJSON allocations of the calling task are
+ * taken linearly from a static pool and released at once by end(), i.e. parsing neither fragments
+ * the heap nor pays for individual mallocs and frees. cJSON allocations of other tasks (or outside
+ * of a scope) still use the heap.
+ *
+ * If the pool is exhausted, the allocation fails (cJSON reports a parse error then) and
+ * hasOverflowed() returns true.
+ */
+class JsonArena
+{
+public:
+    typedef enum err_t {
+        ERR_OK = 0,
+        ERR_TIMEOUT = -2
+    } err_t;
+
+    /** Pool size. The largest accepted config (~2 KB JSON, see SettingsManager) needs less than half of it. */
+    static const size_t poolSize = 8192;
+
+    JsonArena(void);
+    ~JsonArena(void);
+
+    err_t begin(void);
+    void end(void);
+    bool hasOverflowed(void);
+    size_t getUsed(void);
+    size_t getHighWaterMark(void);
+
+private:
+    const char* logTag = "json_arena";
+
+    const TickType_t lockAcquireTimeout = pdMS_TO_TICKS(1000);  /**< Maximum lock acquisition time in OS ticks. */
+
+    SemaphoreHandle_t arenaMutex;
+    StaticSemaphore_t arenaMutexBuf;
+
+    static void* arenaMalloc(size_t size);
+    static void arenaFree(void* ptr);
+};
+
+#endif /* JSON_ARENA_H */
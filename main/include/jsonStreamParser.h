@@ -0,0 +1,116 @@
+#ifndef JSON_STREAM_PARSER_H
+#define JSON_STREAM_PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief The JsonStreamParser class is a minimal incremental (SAX-style) JSON parser.
+ * The document can be fed in arbitrary chunks and every parsed value is reported to
+ * a hook together with its position (keys/indices of the enclosing containers).
+ *
+ * Memory usage is fixed and independent of the document size: Only the current token
+ * and the key/index of each enclosing container are stored. Strings exceeding the
+ * token buffer are reported truncated (see value_t::truncated).
+ */
+class JsonStreamParser
+{
+public:
+    typedef enum err_t {
+        ERR_OK = 0,
+        ERR_INVALID_ARG = -1,
+        ERR_SYNTAX = -2,
+        ERR_DEPTH = -3,
+        ERR_INCOMPLETE = -4,
+        ERR_ABORTED = -5
+    } err_t;
+
+    typedef enum value_type_t {
+        VALUE_OBJECT_START = 0,
+        VALUE_OBJECT_END = 1,
+        VALUE_ARRAY_START = 2,
+        VALUE_ARRAY_END = 3,
+        VALUE_STRING = 4,
+        VALUE_NUMBER = 5,
+        VALUE_BOOL = 6,
+        VALUE_NULL = 7
+    } value_type_t;
+
+    typedef struct value_t {
+        value_type_t type;                  /**< Type of the value */
+        const char* str;                    /**< NULL-terminated string (strings only) */
+        bool truncated;                     /**< Wether or not the string exceeded the token buffer */
+        double number;                      /**< Number value (numbers only) */
+        int valueint;                       /**< Number value casted to int (numbers only) */
+        bool boolean;                       /**< Bool value (bools only) */
+    } value_t;
+
+    /** Value hook. Returning false aborts parsing (see ERR_ABORTED). */
+    typedef bool(*ValueHookFncPtr)(JsonStreamParser* parser, const value_t* value, void* param);
+
+    static const int maxDepth = 8;          /**< Maximum container nesting */
+    static const int maxKeyLen = 15;        /**< Maximum length of object keys */
+    static const int maxTokenLen = 63;      /**< Maximum length of strings and literals */
+
+    JsonStreamParser();
+    ~JsonStreamParser();
+
+    void begin(ValueHookFncPtr hook, void* param);
+    err_t feed(const char* data, size_t dataLen);
+    err_t end(void);
+
+    int getDepth(void) const;
+    bool isKey(int level, const char* key) const;
+    int getIndex(int level) const;
+
+private:
+    typedef enum state_t {
+        STATE_VALUE = 0,                    /**< Value expected */
+        STATE_VALUE_OR_END,                 /**< Value or end of array expected (after '[') */
+        STATE_KEY,                          /**< Key expected (after ',' in objects) */
+        STATE_KEY_OR_END,                   /**< Key or end of object expected (after '{') */
+        STATE_COLON,                        /**< ':' expected */
+        STATE_COMMA_OR_END,                 /**< ',' or end of container expected */
+        STATE_STRING,                       /**< Within a string */
+        STATE_STRING_ESCAPE,                /**< Within an escape sequence of a string */
+        STATE_STRING_UNICODE,               /**< Within an unicode escape sequence of a string */
+        STATE_LITERAL,                      /**< Within a number, true, false or null */
+        STATE_DONE,                         /**< Root value finished */
+        STATE_ERROR                         /**< Parsing failed or has been aborted */
+    } state_t;
+
+    typedef struct level_t {
+        bool isArray;                       /**< Wether the container is an array or an object */
+        int index;                          /**< Index of the current element (arrays only) */
+        char key[maxKeyLen + 1];            /**< Key of the current member (objects only) */
+        bool keyTruncated;                  /**< Wether or not the key exceeded the key buffer */
+    } level_t;
+
+    ValueHookFncPtr hook;
+    void* hookParam;
+
+    state_t state;
+    err_t err;
+    bool stringIsKey;
+    uint32_t unicodeVal;
+    int unicodeDigits;
+
+    level_t levels[maxDepth];
+    int depth;
+
+    char token[maxTokenLen + 1];
+    int tokenLen;
+    bool tokenTruncated;
+
+    err_t processChar(char c);
+    err_t valueStart(char c);
+    err_t valueDone(void);
+    err_t literalDone(void);
+    err_t containerEnd(bool isArray);
+    err_t report(value_type_t type);
+    void tokenPut(char c);
+    void tokenPutUtf8(uint32_t codepoint);
+    void fail(err_t err);
+};
+
+#endif /* JSON_STREAM_PARSER_H */
@@ -0,0 +1,113 @@
+#ifndef MQTT_INGRESS_H
+#define MQTT_INGRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#define MQTT_INGRESS_MSG_TO_STR(type) (\
+    (type == MqttIngress::MSG_IRRIG_CONFIG) ? "irrigConfig" : \
+    (type == MqttIngress::MSG_HARDWARE_CONFIG) ? "hardwareConfig" : \
+    (type == MqttIngress::MSG_OTA_REQUEST) ? "otaRequest" : \
+    "unknown" \
+)
+
+/**
+ * @brief The MqttIngress class decouples the handling of received MQTT messages from the MQTT client task.
+ *
+ * Subscription callbacks only copy the message into one of the statically allocated slots (see post()),
+ * which are processed by a dedicated task calling the handler registered for the message type.
+ * No memory is allocated at runtime, so long keep awake periods don't fragment the heap.
+ * The device is kept awake while messages are pending.
+ *
+ * Irrigation configs exceeding slotDataSize are copied into a dedicated large slot, which holds
+ * anything the MQTT client can receive in one piece (CONFIG_MQTT_BUFFER_SIZE).
+ *
+ * Note: Messages are dropped if all slots are in use or they exceed the slot size of their type.
+ */
+class MqttIngress
+{
+public:
+    typedef enum {
+        MSG_IRRIG_CONFIG = 0,           /**< Irrigation config update */
+        MSG_HARDWARE_CONFIG = 1,        /**< Hardware config update */
+        MSG_OTA_REQUEST = 2,            /**< OTA upgrade request */
+        MSG_MAX = 3
+    } msg_type_t;
+
+    typedef enum err_t {
+        ERR_OK = 0,
+        ERR_INVALID_ARG = -1,
+        ERR_NO_SLOT = -2,
+        ERR_TOO_LARGE = -3,
+        ERR_NO_RESOURCES = -4
+    } err_t;
+
+    /** Message handler, called by the ingress task. data is NULL-terminated. */
+    typedef void(*MessageHandlerFncPtr)(const char* data, int dataLen, void* param);
+
+    static const int numSlots = 3;                      /**< Number of messages which can be pending at once */
+    static const size_t slotDataSize = 2048;            /**< Maximum message size (see SettingsManager::updateHardwareConfig) */
+    static const int numLargeSlots = 1;                 /**< Number of large irrigation configs which can be pending at once */
+    static const size_t largeSlotDataSize = CONFIG_MQTT_BUFFER_SIZE; /**< Maximum irrigation config size */
+
+    MqttIngress(void);
+    ~MqttIngress(void);
+
+    err_t start(void);
+    err_t registerHandler(msg_type_t type, MessageHandlerFncPtr handler, void* param);
+    err_t post(msg_type_t type, const char* data, int dataLen);
+
+private:
+    const char* logTag = "mqtt_ingress";
+
+    static const int taskStackSize = 4096;
+    static const UBaseType_t taskPrio = tskIDLE_PRIORITY + 4;
+    StackType_t taskStack[taskStackSize];
+    StaticTask_t taskBuf;
+    TaskHandle_t taskHandle;
+
+    typedef struct slot_t {
+        msg_type_t type;
+        int dataLen;
+        char* data;                                     /**< Points into slotData or largeSlotData */
+        QueueHandle_t freeQueue;                        /**< Queue the slot index is returned to once processed */
+    } slot_t;
+
+    /** The small slots come first, followed by the large ones */
+    slot_t slots[numSlots + numLargeSlots];
+    char slotData[numSlots][slotDataSize + 1];
+    char largeSlotData[numLargeSlots][largeSlotDataSize + 1];
+
+    /** Indices of the free slots */
+    QueueHandle_t freeSlots;
+    StaticQueue_t freeSlotsBuf;
+    uint8_t freeSlotsStorage[numSlots * sizeof(int)];
+
+    /** Indices of the free large slots */
+    QueueHandle_t freeLargeSlots;
+    StaticQueue_t freeLargeSlotsBuf;
+    uint8_t freeLargeSlotsStorage[numLargeSlots * sizeof(int)];
+
+    /** Indices of the slots to be processed (in order of reception) */
+    QueueHandle_t pendingSlots;
+    StaticQueue_t pendingSlotsBuf;
+    uint8_t pendingSlotsStorage[(numSlots + numLargeSlots) * sizeof(int)];
+
+    SemaphoreHandle_t handlerMutex;
+    StaticSemaphore_t handlerMutexBuf;
+    MessageHandlerFncPtr handlers[MSG_MAX];
+    void* handlerParams[MSG_MAX];
+
+    static void taskFuncDispatch(void* params);
+    void taskFunc(void);
+};
+
+#endif /* MQTT_INGRESS_H */
@@ -0,0 +1,88 @@
+#ifndef OUTPUT_ACTUATOR_H
+#define OUTPUT_ACTUATOR_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "esp_log.h"
+
+#include "outputController.h"
+
+/**
+ * @brief The OutputActuator class switches the outputs on behalf of the IrrigationController.
+ *
+ * Output changes are queued and performed by a dedicated high priority task on the control core,
+ * so they are neither delayed by network operations of the controller (publishing, SNTP waits, ...)
+ * nor by lower priority tasks. It is the only task switching outputs while running.
+ *
+ * Changes can be batched by beginUpdate() / setOutput() / commit(), which then get applied by a single
+ * OutputController transaction. Outside of a batch, setOutput() is queued right away.
+ *
+ * The latency of each switching relative to the time of the triggering event is recorded in the
+ * WakeProfiler (SCOPE_RELAY_ON_LATENCY / SCOPE_RELAY_OFF_LATENCY).
+ */
+class OutputActuator
+{
+public:
+    typedef enum err_t {
+        ERR_OK = 0,
+        ERR_INVALID_PARAM = -1,
+        ERR_QUEUE_FULL = -2,
+        ERR_TIMEOUT = -3,
+        ERR_NO_RESOURCES = -4
+    } err_t;
+
+    OutputActuator(void);
+    ~OutputActuator(void);
+
+    err_t start(void);
+    void beginUpdate(void);
+    err_t setOutput(OutputController::ch_map_t outputNum, bool switchOn, time_t eventTime);
+    err_t commit(void);
+    err_t disableAllOutputs(void);
+    err_t flush(TickType_t wait);
+
+private:
+    const char* logTag = "out_act";
+
+    static const int taskStackSize = 2048;
+    static const UBaseType_t taskPrio = tskIDLE_PRIORITY + 10;         /**< Above all other control and sensor tasks */
+    StackType_t taskStack[taskStackSize];
+    StaticTask_t taskBuf;
+    TaskHandle_t taskHandle;
+
+    typedef enum {
+        REQ_UPDATE = 0,                                                 /**< Switch a set of outputs */
+        REQ_DISABLE_ALL = 1,                                            /**< Disable all outputs */
+        REQ_FLUSH = 2                                                   /**< Notify the requesting task (see flush()) */
+    } request_type_t;
+
+    typedef struct request_t {
+        request_type_t type;
+        uint64_t onMask;                                                /**< Channels to switch on (bit = channel number) */
+        uint64_t offMask;                                               /**< Channels to switch off (bit = channel number) */
+        time_t eventTime;                                               /**< Time of the triggering event (0 = none) */
+        TaskHandle_t requester;                                         /**< Task to be notified (REQ_FLUSH only) */
+    } request_t;
+
+    static const int queueLen = 16;                                     /**< Enough for all channels of several events */
+    QueueHandle_t requestQueue;
+    StaticQueue_t requestQueueBuf;
+    uint8_t requestQueueStorage[queueLen * sizeof(request_t)];
+
+    /** Batch collected by the caller (see beginUpdate()) */
+    bool batchActive;
+    request_t batch;
+
+    err_t post(const request_t& req);
+    void recordLatency(bool switchOn, time_t eventTime);
+
+    static void taskFuncDispatch(void* params);
+    void taskFunc(void);
+};
+
+#endif /* OUTPUT_ACTUATOR_H */
@@ -4,6 +4,9 @@
 #include <stdint.h>
 
 #include "esp_log.h"
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+#include "driver/rtc_io.h"
 
 #include "hardwareConfig.h"
 
@@ -12,12 +15,27 @@
     (num == OutputController::CH_AUX0) ? "AUX0" : \
     (num == OutputController::CH_AUX1) ? "AUX1" : \
     (num == OutputController::CH_EXT0) ? "EXT0" : \
+    (num == OutputController::CH_EXT1) ? "EXT1" : \
+    (num == OutputController::CH_EXT2) ? "EXT2" : \
+    (num == OutputController::CH_EXT3) ? "EXT3" : \
+    (num == OutputController::CH_EXT4) ? "EXT4" : \
+    (num == OutputController::CH_EXT5) ? "EXT5" : \
+    (num == OutputController::CH_EXT6) ? "EXT6" : \
+    (num == OutputController::CH_EXT7) ? "EXT7" : \
     "UNKOWN" \
 )
 
 /**
  * @brief The OutputController class is the abstraction layer for mapping
  * channels to actual hardware outputs.
+ *
+ * Internal channels are GPIOs, external channels (CH_EXT*) the outputs of a shift register
+ * (see hardwareConfig.h). Several channels can be switched at once by a transaction:
+ * beginUpdate(), setOutput() for each channel and commit(). The commit applies the resulting
+ * channel maps in one operation, i.e. a single GPIO register write and a single shift register
+ * transfer (only if the respective map changed). Outside of a transaction, setOutput() commits right away.
+ *
+ * Note: Not thread-safe, outputs are meant to be switched by a single task (see OutputActuator).
  */
 class OutputController
 {
@@ -27,27 +45,44 @@ public:
         CH_AUX0 = 1,
         CH_AUX1 = 2,
         CH_EXT0 = 32,
+        CH_EXT1 = 33,
+        CH_EXT2 = 34,
+        CH_EXT3 = 35,
+        CH_EXT4 = 36,
+        CH_EXT5 = 37,
+        CH_EXT6 = 38,
+        CH_EXT7 = 39,
         NUM_CHANNELS
     } ch_map_t;
 
     static const unsigned int intChannels = CH_AUX1 - CH_MAIN + 1;
     static const unsigned int intChannelMin = CH_MAIN;
     static const unsigned int intChannelMax = CH_AUX1;
-    static const unsigned int extChannels = 0;
+    static const unsigned int extChannels = CH_EXT7 - CH_EXT0 + 1;
     static const unsigned int extChannelMin = CH_EXT0;
-    static const unsigned int extChannelMax = CH_EXT0;
+    static const unsigned int extChannelMax = CH_EXT7;
 
     typedef enum {
         ERR_OK = 0,
         ERR_INVALID_PARAM = -1,
     } err_t;
 
+    /** Output states kept in RTC memory while the outputs are held during deep sleep */
+    typedef struct persistent_data_t {
+        bool held;                                      /**< Wether or not the outputs were held when going to deep sleep */
+        uint32_t activeIntChannelMap;                   /**< Active internal channels at that time */
+        uint32_t activeExtChannelMap;                   /**< Active external channels at that time */
+    } persistent_data_t;
+
     OutputController(void);
     ~OutputController(void);
 
     bool anyOutputsActive(void);
+    void beginUpdate(void);
     err_t setOutput(ch_map_t outputNum, bool switchOn);
+    void commit(void);
     void disableAllOutputs(void);
+    void setHold(bool en);
 
 private:
     const char* logTag = "out_ctrl";
@@ -59,7 +94,30 @@ private:
         irrigationAux1GpioNum
     };
 
+    /** Lines of the external shift register */
+    const gpio_num_t extGpios[4] = {
+        outputExtDataGpioNum,
+        outputExtClockGpioNum,
+        outputExtLatchGpioNum,
+        outputExtEnableGpioNum
+    };
+
+    /** Lines of the external shift register held during deep sleep like the internal channels (RTC GPIOs only) */
+    const gpio_num_t extHoldGpios[3] = {
+        outputExtClockGpioNum,
+        outputExtLatchGpioNum,
+        outputExtEnableGpioNum
+    };
+
     uint32_t activeIntChannelMap;
+    uint32_t activeExtChannelMap;
+
+    bool updateActive;                                  /**< Wether or not a transaction is running (see beginUpdate()) */
+    uint32_t pendingIntChannelMap;                      /**< Internal channel map to be applied by commit() */
+    uint32_t pendingExtChannelMap;                      /**< External channel map to be applied by commit() */
+
+    void writeIntOutputs(uint32_t channelMap);
+    void writeExtOutputs(uint32_t channelMap);
 };
 
 #endif /* OUTPUT_CONTROLLER_H */
@@ -12,6 +12,7 @@
 #include "esp_wifi.h"
 #include "esp_sleep.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "driver/adc.h"
 #include "esp_adc_cal.h"
@@ -19,6 +20,7 @@
 #include "driver/rtc_io.h"
 
 #include "user_config.h"
+#include "ulpBattMonitor.h"
 
 #define BATT_STATE_TO_STR(state) (\
     (state == PowerManager::BATT_FULL) ? "FULL" : \
@@ -38,6 +40,36 @@ private:
     float battVoltageMult;
     esp_adc_cal_characteristics_t battVoltageAdcCharacteristics;
 
+    // non-blocking battery voltage sampling
+    static const int battNumSamples = 8;                                /**< Number of samples averaged. Must be a power of 2! */
+    static const int battSampleIntervalMillis = 10;                     /**< Time in milliseconds between the samples */
+    esp_timer_handle_t battSampleTimer;
+    SemaphoreHandle_t battSampleDoneSem;
+    StaticSemaphore_t battSampleDoneSemBuf;
+    volatile bool battSampleActive;
+    int battSampleCnt;
+    uint32_t battSampleSumMilli;
+    bool battSampleErr;
+
+    static void battSampleTimerCb(void* arg);
+    void battSample(void);
+
+    /** Last measured supply voltage in mV (by the main CPU or the ULP) */
+    uint32_t lastSupplyVoltageMilli;
+
+    // battery monitoring by the ULP during deep sleep (needs CONFIG_ULP_COPROC_ENABLED)
+    const bool ulpBattMonitorEnabled = true;                            /**< Wether or not the ULP monitors the battery during deep sleep */
+    const uint32_t ulpBattSamplePeriodMillis = 60000;                   /**< ULP sampling period in milliseconds */
+    const int ulpBattWakeHysteresisMilli = 100;                         /**< Margin of the ULP wake thresholds beyond the battery
+                                                                         * state thresholds, so ADC noise and load steps at a
+                                                                         * threshold don't wake the main CPU over and over */
+    bool ulpBattDataValid;                                              /**< Wether or not ulpBattData has been collected during the last deep sleep */
+    ulp_batt_monitor_data_t ulpBattData;                                /**< Data collected by the ULP during the last deep sleep */
+
+    uint32_t battRawToMilli(uint32_t raw);
+    uint16_t battMilliToRaw(uint32_t millis);
+    void startUlpBattMonitor(void);
+
     SemaphoreHandle_t peripheralEnMutex;
     StaticSemaphore_t peripheralEnMutexBuf;
     bool peripheralEnState;
@@ -56,6 +88,7 @@ private:
     SemaphoreHandle_t configMutex;
     StaticSemaphore_t configMutexBuf;
 
+    bool battMonitorDisabled = true;
     int battCriticalThresholdMilli = 1;
     int battLowThresholdMilli = 2;
     int battOkThresholdMilli = 3;
@@ -69,14 +102,26 @@ public:
         BATT_DISABLED = 4
     } batt_state_t;
 
+    /** Summary of the battery voltage samples taken by the ULP during the last deep sleep */
+    typedef struct ulp_batt_summary_t {
+        uint32_t lastMilli;                                             /**< Last sample in mV */
+        uint32_t minMilli;                                              /**< Minimum in mV */
+        uint32_t avgMilli;                                              /**< Average in mV */
+        uint32_t numSamples;                                            /**< Number of samples */
+    } ulp_batt_summary_t;
+
     PowerManager();
     ~PowerManager();
 
     uint32_t getSupplyVoltageMilli(void);
+    bool startSupplyVoltageSampling(void);
+    uint32_t waitSupplyVoltageMilli(TickType_t wait);
     batt_state_t getBatteryState(uint32_t millis);
+    bool getUlpBatterySummary(ulp_batt_summary_t* dst);
 
     void setPeripheralEnable(bool en);
     bool getPeripheralEnable(void);
+    void setPeripheralEnableHold(bool en);
     void setPeripheralExtSupply(bool en);
     bool getPeripheralExtSupply(void);
 
@@ -2,6 +2,7 @@
 #define SETTINGS_MANAGER_H
 
 #include <stdint.h>
+#include <stdio.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
@@ -16,6 +17,7 @@
 #include "hardwareConfig.h"
 
 #include "cJSON.h"
+#include "jsonStreamParser.h"
 
 /**
  * @brief The SettingsManager class is a manager of all changable settings of the system.
@@ -51,14 +53,51 @@ public:
         int fillLevelHysteresisPercent10;
     } reservoir_config_t;
 
+    typedef struct sleep_config_t {
+        bool eventDrivenSleep;                                                          /**< Sleep until the next deadline instead of fixed intervals */
+        int wakeupIntervalSeconds;                                                      /**< Wakeup interval (fixed interval mode) */
+        int maxSleepSeconds;                                                            /**< Maximum deep sleep time (event-driven mode) */
+        int telemetryFlushIntervalSeconds;                                              /**< Maximum age of recorded telemetry samples (event-driven mode) */
+    } sleep_config_t;
+
+    /** Current figures of the power states used for the energy accounting (see EnergyMeter) */
+    typedef struct energy_config_t {
+        int deepSleepMicroAmps;                                                         /**< Overall current during deep sleep */
+        int awakeMicroAmps;                                                             /**< Overall current with the main CPU running */
+        int wifiMicroAmps;                                                              /**< Additional current of the WiFi radio */
+        int peripheralMicroAmps;                                                        /**< Additional current of the DCDC + RS232 driver */
+        int extSupplyMicroAmps;                                                         /**< Additional current of the external sensors */
+        int outputMicroAmps;                                                            /**< Additional current per active output */
+    } energy_config_t;
+
+    /** Binary snapshot of all parsed settings. Kept in RTC memory (and NVS) to skip JSON parsing on wakeups. */
+    typedef struct config_snapshot_t {
+        uint32_t magic;                                                                 /**< Must be snapshotMagic */
+        uint32_t version;                                                               /**< Must be snapshotVersion */
+        uint32_t size;                                                                  /**< Must be sizeof(config_snapshot_t) */
+        irrigation_zone_cfg_t zones[irrigationPlannerNumZones];                         /**< Irrigation zone configurations */
+        IrrigationEvent::irrigation_event_cfg_t events[irrigationPlannerNumNormalEvents]; /**< Irrigation event configurations */
+        bool eventsUsed[irrigationPlannerNumNormalEvents];                              /**< Flag weather or not the corresponding event is used */
+        battery_config_t battery;                                                       /**< Battery configuration */
+        reservoir_config_t reservoir;                                                   /**< Reservoir configuration */
+        sleep_config_t sleep;                                                           /**< Sleep configuration */
+        energy_config_t energy;                                                         /**< Energy accounting configuration */
+        uint32_t crc;                                                                   /**< CRC32 of all preceding fields */
+    } config_snapshot_t;
+
     typedef void(*ConfigUpdatedHookFncPtr)(void*);
 
     SettingsManager();
     ~SettingsManager();
 
     void init();
+    bool isRestoredFromSnapshot();
+    err_t storeSnapshot();
 
     err_t updateIrrigationConfig(const char* const jsonData, int jsonDataLen, bool noNotify);
+    err_t beginIrrigationConfigStream();
+    err_t feedIrrigationConfigStream(const char* const jsonData, int jsonDataLen);
+    err_t endIrrigationConfigStream(bool noNotify);
     err_t readIrrigationConfigFile();
 
     err_t updateHardwareConfig(const char* const jsonData, int jsonDataLen, bool noNotify);
@@ -67,6 +106,8 @@ public:
     err_t copyZonesAndEvents(irrigation_zone_cfg_t* zones, IrrigationEvent* events, bool* eventsUsed);
     err_t copyBatteryConfig(battery_config_t* dst);
     err_t copyReservoirConfig(reservoir_config_t* dst);
+    err_t copySleepConfig(sleep_config_t* dst);
+    err_t copyEnergyConfig(energy_config_t* dst);
 
     err_t registerIrrigConfigUpdatedHook(ConfigUpdatedHookFncPtr hook, void* param);
     err_t registerHardwareConfigUpdatedHook(ConfigUpdatedHookFncPtr hook, void* param);
@@ -76,6 +117,20 @@ private:
 
     const TickType_t lockAcquireTimeout = pdMS_TO_TICKS(1000);          /**< Maximum lock acquisition time in OS ticks. */
 
+    static const uint32_t snapshotMagic = 0x47464353;                   /**< Snapshot magic ('SCFG') */
+    static const uint32_t snapshotVersion = 5;                          /**< Snapshot layout version. Increase on layout changes! */
+    const char* snapshotNvsNamespace = "settings";                      /**< NVS namespace of the snapshot fallback copy */
+    const char* snapshotNvsKey = "snapshot";                            /**< NVS key of the snapshot fallback copy */
+
+    static const uint32_t recordMagic = 0x43455243;                     /**< Persistent config record magic ('CREC') */
+    static const uint32_t recordVersion = 1;                            /**< Persistent config record layout version. Increase on layout changes! */
+    const char* irrigRecordNvsKey = "irrig_rec";                        /**< NVS key of the persistent irrigation config record */
+    const char* irrigRecordHashNvsKey = "irrig_hash";                   /**< NVS key of the CRC of the irrigation config record */
+    const char* hardwareRecordNvsKey = "hw_rec";                        /**< NVS key of the persistent hardware config record */
+    const char* hardwareRecordHashNvsKey = "hw_hash";                   /**< NVS key of the CRC of the hardware config record */
+    const char* energyRecordNvsKey = "energy_rec";                      /**< NVS key of the persistent energy config record */
+    const char* energyRecordHashNvsKey = "energy_hash";                 /**< NVS key of the CRC of the energy config record */
+
     SemaphoreHandle_t configMutex;
     StaticSemaphore_t configMutexBuf;
 
@@ -85,6 +140,9 @@ private:
     SemaphoreHandle_t hookMutex;
     StaticSemaphore_t hookMutexBuf;
 
+    SemaphoreHandle_t streamMutex;
+    StaticSemaphore_t streamMutexBuf;
+
     typedef struct irrigation_config_t {
         irrigation_zone_cfg_t zones[irrigationPlannerNumZones];         /**< Storage holding irrigation zone configurations. */
 
@@ -93,8 +151,115 @@ private:
     } irrigation_config_t;
 
     irrigation_config_t shadowDataIrrigationConfig;
+
+    /** Header of persistent config records. The records end with a CRC32 of all preceding fields. */
+    typedef struct record_header_t {
+        uint32_t magic;                                                 /**< Must be recordMagic */
+        uint32_t version;                                               /**< Must be recordVersion */
+        uint32_t size;                                                  /**< Must be the size of the whole record */
+    } record_header_t;
+
+    /** Persistent irrigation config, stored as NVS blob */
+    typedef struct irrigation_record_t {
+        record_header_t header;
+        irrigation_zone_cfg_t zones[irrigationPlannerNumZones];
+        IrrigationEvent::irrigation_event_cfg_t events[irrigationPlannerNumNormalEvents];
+        bool eventsUsed[irrigationPlannerNumNormalEvents];
+        uint32_t crc;
+    } irrigation_record_t;
+
+    /** Persistent hardware config, stored as NVS blob */
+    typedef struct hardware_record_t {
+        record_header_t header;
+        battery_config_t battery;
+        reservoir_config_t reservoir;
+        sleep_config_t sleep;
+        uint32_t crc;
+    } hardware_record_t;
+
+    /** Persistent energy accounting config, stored as separate NVS blob, so older hardware records stay valid */
+    typedef struct energy_record_t {
+        record_header_t header;
+        energy_config_t energy;
+        uint32_t crc;
+    } energy_record_t;
+
+    /** Numeric fields of irrigation events (see eventFieldNames) */
+    typedef enum event_field_t {
+        EVT_FIELD_ZONE_NUM = 0,
+        EVT_FIELD_DURATION_SECS,
+        EVT_FIELD_HOUR,
+        EVT_FIELD_MINUTE,
+        EVT_FIELD_SECOND,
+        EVT_FIELD_DAY,
+        EVT_FIELD_MONTH,
+        EVT_FIELD_YEAR,
+        EVT_FIELD_NUM
+    } event_field_t;
+
+    /** Channel arrays of irrigation zones (see zoneChArrayNames) */
+    typedef enum zone_ch_array_t {
+        ZONE_CH_ENABLED = 0,
+        ZONE_CH_NUM,
+        ZONE_CH_STATE_START,
+        ZONE_CH_STATE_STOP,
+        ZONE_CH_ARRAY_NUM
+    } zone_ch_array_t;
+
+    /** Fields of the irrigation event currently being parsed from a stream */
+    typedef struct stream_event_t {
+        uint32_t present;                                               /**< Bitmask of the numeric fields found (see event_field_t) */
+        int values[EVT_FIELD_NUM];                                      /**< Numeric field values */
+        bool isSingle;
+        bool isDaily;
+        bool isWeekly;
+        bool isMonthly;
+        uint32_t weekdayMask;                                           /**< Weekdays (bit 0 = Sunday), 0 if missing or invalid */
+        uint32_t monthdayMask;                                          /**< Monthdays (bit 0 = 1st), 0 if missing or invalid */
+        bool dayListErr;                                                /**< Wether or not the day list being parsed is invalid */
+    } stream_event_t;
+
+    /** State of a streamed irrigation config update. Its size doesn't depend on the document size. */
+    typedef struct irrigation_stream_t {
+        JsonStreamParser parser;                                        /**< Incremental JSON parser */
+        irrigation_config_t settings;                                   /**< Storage the config is parsed into */
+        bool active;                                                    /**< Wether or not a stream has been started (see beginIrrigationConfigStream) */
+        bool fromFile;                                                  /**< Wether or not the stream is read from the config file */
+        err_t ret;                                                      /**< First settings error, which aborted parsing */
+        bool zonesFound;
+        bool eventsFound;
+        bool storePersistent;
+        uint32_t zonePresent;                                           /**< Bitmask of the fields found in the current zone (see zone_ch_array_t, bit 31 = name) */
+        int zoneArrayLen[ZONE_CH_ARRAY_NUM];                            /**< Lengths of the channel arrays of the current zone */
+        stream_event_t event;                                           /**< Current event */
+    } irrigation_stream_t;
+
+    irrigation_stream_t irrigStream;
     battery_config_t shadowDataBatteryConfig;
     reservoir_config_t shadowDataReservoirConfig;
+    sleep_config_t shadowDataSleepConfig;
+    energy_config_t shadowDataEnergyConfig;
+
+    /** Defaults of the optional sleep settings of the hardware config */
+    const sleep_config_t sleepConfigDefaults = {
+        .eventDrivenSleep = false,
+        .wakeupIntervalSeconds = 600,
+        .maxSleepSeconds = 7200,
+        .telemetryFlushIntervalSeconds = 14400
+    };
+
+    /** Defaults of the optional energy accounting settings of the hardware config (rough estimates) */
+    const energy_config_t energyConfigDefaults = {
+        .deepSleepMicroAmps = 150,
+        .awakeMicroAmps = 40000,
+        .wifiMicroAmps = 80000,
+        .peripheralMicroAmps = 5000,
+        .extSupplyMicroAmps = 20000,
+        .outputMicroAmps = 150000
+    };
+
+    bool restoredFromSnapshot;                                          /**< Wether or not the config was restored from a snapshot during init */
+    bool volatileChanges;                                               /**< Wether or not non-persistent config changes happened since boot */
 
     typedef enum config_file_type_t {
         CONFIG_FILE_IRRIGATION = 0,
@@ -110,14 +275,39 @@ private:
 
     void clearZoneData(irrigation_config_t& settings);
     void clearEventData(irrigation_config_t& settings);
-    err_t jsonParseZone(cJSON* zoneJson, irrigation_zone_cfg_t& zoneCfg);
-    err_t jsonParseEvent(cJSON* evtJson, IrrigationEvent& evt, bool& used);
+    static bool irrigStreamValueHook(JsonStreamParser* parser, const JsonStreamParser::value_t* value, void* param);
+    bool irrigStreamValue(JsonStreamParser* parser, const JsonStreamParser::value_t* value);
+    bool irrigStreamZoneValue(JsonStreamParser* parser, const JsonStreamParser::value_t* value, int zoneIdx);
+    bool irrigStreamEventValue(JsonStreamParser* parser, const JsonStreamParser::value_t* value);
+    bool irrigStreamDayValue(const JsonStreamParser::value_t* value, int minVal, int maxVal, uint32_t& mask);
+    bool irrigStreamFail(const char* msg, int idx);
+    err_t irrigStreamApplyEvent(const stream_event_t& fields, IrrigationEvent& evt, bool& used);
+    err_t streamIrrigationConfigFile(FILE* f);
 
     err_t readConfigFile(config_file_type_t type);
-    err_t writeConfigFile(const char* const filename, const char* const jsonData, int jsonDataLen);
 
-    void copyBatteryConfigInt(battery_config_t* dst, battery_config_t& src);
-    void copyReservoirConfigInt(reservoir_config_t* dst, reservoir_config_t& src);
+    uint32_t recordCrc(const record_header_t* record, size_t size);
+    void recordSeal(record_header_t* record, size_t size);
+    bool recordValid(const record_header_t* record, size_t size);
+    err_t recordRead(const char* key, record_header_t* record, size_t size);
+    err_t recordWrite(const char* key, const char* hashKey, const record_header_t* record, size_t size);
+    err_t persistIrrigationConfig(const irrigation_config_t& settings);
+    err_t persistHardwareConfig(const battery_config_t& battery, const reservoir_config_t& reservoir, const sleep_config_t& sleep,
+        const energy_config_t& energy);
+    err_t applyIrrigationRecord(const irrigation_record_t* record);
+
+    uint32_t snapshotCrc(const config_snapshot_t* snapshot);
+    bool snapshotValid(const config_snapshot_t* snapshot);
+    void snapshotCreate(config_snapshot_t* snapshot);
+    err_t snapshotApply(const config_snapshot_t* snapshot);
+    err_t snapshotReadNvs(config_snapshot_t* snapshot);
+    err_t snapshotWriteNvs(const config_snapshot_t* snapshot);
+    void snapshotConfigChanged(bool persistent, bool applied);
+
+    void copyBatteryConfigInt(battery_config_t* dst, const battery_config_t& src);
+    void copyReservoirConfigInt(reservoir_config_t* dst, const reservoir_config_t& src);
+    void copySleepConfigInt(sleep_config_t* dst, const sleep_config_t& src);
+    void copyEnergyConfigInt(energy_config_t* dst, const energy_config_t& src);
 
     void callIrrigConfigUpdatedHooks();
     void callHardwareConfigUpdatedHooks();
@@ -0,0 +1,60 @@
+#ifndef TELEMETRY_BUFFER_H
+#define TELEMETRY_BUFFER_H
+
+#include <stdint.h>
+#include <ctime>
+
+#include "esp_log.h"
+
+/**
+ * @brief The TelemetryBuffer class records sensor samples (battery, reservoir, ...)
+ * in a ring buffer in RTC memory, so they survive deep sleep and can be uploaded
+ * in batches instead of connecting the network on every wakeup.
+ *
+ * Every sample gets a sequence number. Uploaded samples are removed by passing the
+ * end sequence number of the upload to removeUpTo(), so samples recorded in-between
+ * publishing and the confirmation of a batch aren't lost.
+ * If the buffer is full, the oldest sample gets overwritten.
+ *
+ * Note: The class isn't thread-safe. It is meant to be used by a single task.
+ */
+class TelemetryBuffer
+{
+public:
+    static const int numSamples = 48;                   /**< Maximum number of samples kept */
+
+    typedef struct sample_t {
+        time_t timestamp;                               /**< Time the sample was taken */
+        uint32_t battVoltage;                           /**< Battery voltage in mV */
+        int16_t fillLevel;                              /**< Reservoir fill level in percent multiplied by 10 */
+        uint8_t reservoirState;                         /**< Reservoir state (see IrrigationController::reservoir_state_t) */
+        uint8_t battState;                              /**< Battery state (see PowerManager::batt_state_t) */
+        uint32_t fillLevelRaw;                          /**< Raw fill sensor value, for calibration (0 = none) */
+    } sample_t;
+
+    typedef struct persistent_data_t {
+        uint32_t magic;                                 /**< Data is valid if this is persistentDataMagic */
+        sample_t samples[numSamples];                   /**< Ring buffer of samples */
+        uint16_t next;                                  /**< Index of the next sample to be written */
+        uint16_t count;                                 /**< Number of valid samples */
+        uint32_t nextSeq;                               /**< Sequence number of the next sample to be written */
+    } persistent_data_t;
+
+    TelemetryBuffer(void);
+    ~TelemetryBuffer(void);
+
+    void addSample(const sample_t& sample);
+    bool getLatest(sample_t* dst);
+    bool getSample(int idx, sample_t* dst);
+    int getCount(void);
+    bool isFull(void);
+    uint32_t getEndSeq(void);
+    void removeUpTo(uint32_t endSeq);
+
+private:
+    const char* logTag = "telemetry";
+
+    static const uint32_t persistentDataMagic = 0x54454c32; // 'TEL2', change on layout changes!
+};
+
+#endif /* TELEMETRY_BUFFER_H */
@@ -29,6 +29,13 @@ void TimeSystem_LogTime(void);
 time_t TimeSystem_GetLastSntpSync(void);
 time_t TimeSystem_GetNextSntpSync(void);
 void TimeSystem_SetNextSntpSync(time_t next);
+int32_t TimeSystem_GetSntpResyncIntervalSecs(int32_t baseSecs);
+bool TimeSystem_GetDrift(float* driftPpm, float* residualPpm);
+
+void TimeSystem_UpdateDstTable(void);
+time_t TimeSystem_CivilToLocalSecs(int year, int month, int day, int hour, int minute, int second);
+bool TimeSystem_UtcToLocalSecs(time_t utc, time_t* local);
+bool TimeSystem_LocalSecsToUtc(time_t local, time_t* utc);
 
 void TimeSystem_SntpStart(void);
 void TimeSystem_SntpStop(void);
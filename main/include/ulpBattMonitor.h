@@ -0,0 +1,30 @@
+#ifndef ULP_BATT_MONITOR_H
+#define ULP_BATT_MONITOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_system.h"
+#include "driver/adc.h"
+
+/** Raw ADC data collected by the ULP during deep sleep */
+typedef struct ulp_batt_monitor_data_t {
+    uint16_t lastRaw;           /**< Last sample */
+    uint16_t minRaw;            /**< Minimum of all samples */
+    uint32_t sumRaw;            /**< Sum of all samples */
+    uint16_t numSamples;        /**< Number of samples */
+} ulp_batt_monitor_data_t;
+
+esp_err_t UlpBattMonitor_Start(adc1_channel_t channel, uint32_t periodMillis, uint16_t wakeBelowRaw, uint16_t wakeAboveRaw);
+void UlpBattMonitor_Stop(void);
+bool UlpBattMonitor_GetData(ulp_batt_monitor_data_t* dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ULP_BATT_MONITOR_H */
@@ -0,0 +1,104 @@
+#ifndef WAKE_PROFILER_H
+#define WAKE_PROFILER_H
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "esp_log.h"
+
+#define WAKE_PROFILER_SCOPE_TO_STR(scope) (\
+    (scope == WakeProfiler::SCOPE_BOOT) ? "boot" : \
+    (scope == WakeProfiler::SCOPE_WIFI) ? "wifi" : \
+    (scope == WakeProfiler::SCOPE_SENSOR_POWER_UP) ? "sensorPowerUp" : \
+    (scope == WakeProfiler::SCOPE_ADC) ? "adc" : \
+    (scope == WakeProfiler::SCOPE_FILL_SENSOR) ? "fillSensor" : \
+    (scope == WakeProfiler::SCOPE_PLANNER) ? "planner" : \
+    (scope == WakeProfiler::SCOPE_MQTT_PUBLISH) ? "mqttPublish" : \
+    (scope == WakeProfiler::SCOPE_SLEEP_PREP) ? "sleepPrep" : \
+    (scope == WakeProfiler::SCOPE_RELAY_ON_LATENCY) ? "relayOnLatency" : \
+    (scope == WakeProfiler::SCOPE_RELAY_OFF_LATENCY) ? "relayOffLatency" : \
+    (scope == WakeProfiler::SCOPE_EVENT_JITTER) ? "eventJitter" : \
+    "unknown" \
+)
+
+/**
+ * @brief The WakeProfiler class measures the durations of named scopes of a wake cycle
+ * (boot, WiFi, sensor readout, ...) with esp_timer_get_time() and keeps a histogram per scope.
+ *
+ * Histograms use logarithmic (power of two) buckets in microseconds, so a few bytes per scope
+ * cover everything from some microseconds up to minutes. They are kept in RTC memory, i.e.
+ * they accumulate across deep sleeps until the next cold boot or reset().
+ * Percentiles are derived from the buckets (upper bucket bound, limited by the exact min/max),
+ * so they are accurate to a factor of two.
+ *
+ * Note: Scopes are meant to be measured by a single task. Reading the statistics is
+ * thread-safe, though.
+ */
+class WakeProfiler
+{
+public:
+    typedef enum {
+        SCOPE_BOOT = 0,             /**< Boot until the processing task runs (deep sleep wakeups only) */
+        SCOPE_WIFI = 1,             /**< Waiting for the WiFi connection */
+        SCOPE_SENSOR_POWER_UP = 2,  /**< Waiting for the onboard peripherals and external sensors to power up */
+        SCOPE_ADC = 3,              /**< Battery voltage sampling */
+        SCOPE_FILL_SENSOR = 4,      /**< Waiting for the fill level answer */
+        SCOPE_PLANNER = 5,          /**< Event processing incl. the irrigation planner */
+        SCOPE_MQTT_PUBLISH = 6,     /**< Publishing all MQTT messages of a wake cycle */
+        SCOPE_SLEEP_PREP = 7,       /**< Shutting down the network till entering deep sleep */
+        SCOPE_RELAY_ON_LATENCY = 8, /**< Event time till an output got switched on (see OutputActuator) */
+        SCOPE_RELAY_OFF_LATENCY = 9,/**< Event time till an output got switched off (see OutputActuator) */
+        SCOPE_EVENT_JITTER = 10,    /**< Scheduled event time till the event got processed */
+        SCOPE_MAX = 11
+    } scope_t;
+
+    static const int numBuckets = 24;                   /**< Number of histogram buckets per scope */
+    static const int firstBucketShift = 6;              /**< Bucket 0 covers [0, 2^firstBucketShift) us, bucket n [2^(n+5), 2^(n+6)) us */
+
+    typedef struct scope_stats_t {
+        uint32_t count;                                 /**< Number of samples */
+        uint32_t minMicros;                             /**< Shortest duration in microseconds */
+        uint32_t maxMicros;                             /**< Longest duration in microseconds */
+        uint32_t meanMicros;                            /**< Average duration in microseconds */
+        uint32_t p50Micros;                             /**< Median in microseconds */
+        uint32_t p90Micros;                             /**< 90th percentile in microseconds */
+        uint32_t p99Micros;                             /**< 99th percentile in microseconds */
+    } scope_stats_t;
+
+    typedef struct scope_histogram_t {
+        uint16_t buckets[numBuckets];                   /**< Number of samples per bucket */
+        uint32_t count;                                 /**< Number of samples overall */
+        uint32_t minMicros;                             /**< Shortest duration in microseconds */
+        uint32_t maxMicros;                             /**< Longest duration in microseconds */
+        uint64_t sumMicros;                             /**< Sum of all durations in microseconds */
+    } scope_histogram_t;
+
+    typedef struct persistent_data_t {
+        uint32_t magic;                                 /**< Data is valid if this is persistentDataMagic */
+        scope_histogram_t scopes[SCOPE_MAX];            /**< Histograms of all scopes */
+    } persistent_data_t;
+
+    WakeProfiler(void);
+    ~WakeProfiler(void);
+
+    void begin(scope_t scope);
+    void end(scope_t scope);
+    void addSample(scope_t scope, uint32_t micros);
+    bool getStats(scope_t scope, scope_stats_t* dst);
+    void reset(void);
+
+private:
+    const char* logTag = "wake_prof";
+
+    static const uint32_t persistentDataMagic = 0x57505233; // 'WPR3', change on layout changes!
+
+    /** Start times of the currently running scopes (0 = not running) */
+    int64_t startMicros[SCOPE_MAX];
+
+    static int getBucket(uint32_t micros);
+    static uint32_t getBucketUpperMicros(int bucket);
+    static uint32_t getPercentileMicros(const scope_histogram_t* hist, unsigned int percentile);
+};
+
+#endif /* WAKE_PROFILER_H */
@@ -0,0 +1,58 @@
+#ifndef WAKE_TIME_BUDGET_H
+#define WAKE_TIME_BUDGET_H
+
+#include <stdint.h>
+
+#include "esp_log.h"
+
+/**
+ * @brief The WakeTimeBudget class keeps track of the measured durations of the
+ * individual wakeup phases (boot, WiFi connect, ...) and provides time budgets
+ * based on their percentiles.
+ * 
+ * The last samples of all phases are kept in RTC memory, so they survive deep sleep.
+ * Budgets are bounded by the nominal (worst case) values passed in by the caller,
+ * which are also used as long as not enough samples have been collected.
+ * 
+ * Note: The class isn't thread-safe. It is meant to be used by a single task.
+ */
+class WakeTimeBudget
+{
+public:
+    typedef enum {
+        PHASE_BOOT = 0,             /**< Boot until the processing task runs (deep sleep wakeups only) */
+        PHASE_WIFI_CONNECT = 1,     /**< Task start until WiFi is connected */
+        PHASE_SENSOR_READOUT = 2,   /**< Peripheral power up until all sensor data is read */
+        PHASE_MQTT_FLUSH = 3,       /**< Waiting for all MQTT messages to be published */
+        PHASE_MAX = 4
+    } phase_t;
+
+    static const int numSamples = 16;                   /**< Number of samples kept per phase */
+    static const int minSamples = 4;                    /**< Minimum number of samples before measured values are used */
+
+    typedef struct phase_samples_t {
+        uint16_t samples[numSamples];                   /**< Ring buffer of samples in milliseconds */
+        uint8_t next;                                   /**< Index of the next sample to be written */
+        uint8_t count;                                  /**< Number of valid samples */
+    } phase_samples_t;
+
+    typedef struct persistent_data_t {
+        uint32_t magic;                                 /**< Data is valid if this is persistentDataMagic */
+        phase_samples_t phases[PHASE_MAX];              /**< Samples of all phases */
+    } persistent_data_t;
+
+    WakeTimeBudget(void);
+    ~WakeTimeBudget(void);
+
+    void addSample(phase_t phase, uint32_t millis);
+    uint32_t getPercentileMillis(phase_t phase, unsigned int percentile, uint32_t defaultMillis);
+    uint32_t getBudgetMillis(phase_t phase, uint32_t maxMillis);
+
+private:
+    const char* logTag = "wake_budget";
+
+    static const uint32_t persistentDataMagic = 0x57544255; // 'WTBU'
+    static const unsigned int budgetPercentile = 90;    /**< Percentile used for the budgets */
+};
+
+#endif /* WAKE_TIME_BUDGET_H */
@@ -11,6 +11,8 @@ extern EventGroupHandle_t wifiEvents;
 extern const int wifiEventConnected;
 extern const int wifiEventDisconnected;
 
+void wifiStart(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,5 +1,11 @@
 #include "irrigationController.h"
 
+#include <sys/time.h>
+
+#include "esp_timer.h"
+
+#include "bootPlan.h"
+
 extern "C" {
     void esp_restart_noos() __attribute__ ((noreturn));
 }
@@ -7,7 +13,17 @@ extern "C" {
 // TBD: encapsulate
 RTC_DATA_ATTR static IrrigationController::peristent_data_t irrigCtrlPersistentData = {
     .lastIrrigEvent = 0,
-    .reservoirState = IrrigationController::RESERVOIR_OK
+    .reservoirStates = {IrrigationController::RESERVOIR_OK}
+};
+
+/** Stop events of the irrigations running while deep sleeping with held outputs */
+RTC_DATA_ATTR static IrrigationController::persistent_stop_events_t irrigCtrlStopEvents = {
+    .magic = 0
+};
+
+/** Last state confirmed to be published via MQTT */
+RTC_DATA_ATTR static IrrigationController::published_state_t irrigCtrlPublishedState = {
+    .valid = false
 };
 
 /**
@@ -18,34 +34,32 @@ IrrigationController::IrrigationController(void)
 {
     size_t len = strlen(mqttTopicPre) + strlen(mqttStateTopicPost) + 12 + 1;
     mqttStateTopic = (char*) calloc(len, sizeof(char));
-
-    // Format string length + 5 digits voltage in mV + 1 digit batt state + 8 digits for battery state string +
-    // 4 digits (fillLevel * 10) + 1 digit for reservoir state,
-    // 8 digits for reservoir state string,
-    // 2 digits per active output + ', ' as seperator
-    // 6 digits per active output string + ', ' as seperator
-    // 19 digits for the next event datetime
-    // 19 digits for the last SNTP sync datetime
-    // 19 digits for the next SNTP sync datetime.
-    // Format string is a bit too long, but don't care too mich about those few bytes
-    mqttStateDataMaxLen = strlen(mqttStateDataFmt) + 5 + 1 + 8 + 4 + 1 + 8 + 
-        (4+8)*(OutputController::intChannels+OutputController::extChannels) + 
-        19 + 19 + 19 + 1;
+    len = strlen(mqttTopicPre) + strlen(mqttTelemetryTopicPost) + 12 + 1;
+    mqttTelemetryTopic = (char*) calloc(len, sizeof(char));
+    len = strlen(mqttTopicPre) + strlen(mqttDiagTopicPost) + 12 + 1;
+    mqttDiagTopic = (char*) calloc(len, sizeof(char));
+
+    mqttStateDataMaxLen = mqttStateDataBaseLen + 4*10 + 2*8 +
+        (10+1 + 8+3)*(OutputController::intChannels+OutputController::extChannels) +
+        3*(19+2) +
+        2*(10+1)*fillSensorNum;
     mqttStateData = (char*) calloc(mqttStateDataMaxLen, sizeof(char));
 
+    mqttTelemetryDataMaxLen = mqttTelemetryDataBaseLen + mqttTelemetrySampleMaxLen * TelemetryBuffer::numSamples;
+    mqttTelemetryData = (char*) calloc(mqttTelemetryDataMaxLen, sizeof(char));
+
+    mqttDiagDataMaxLen = mqttDiagDataBaseLen + mqttDiagScopeMaxLen * WakeProfiler::SCOPE_MAX + mqttDiagEnergyMaxLen;
+    mqttDiagData = (char*) calloc(mqttDiagDataMaxLen, sizeof(char));
+
     // Reserve space for active outputs
     state.activeOutputs.clear();
     state.activeOutputs.reserve(OutputController::intChannels+OutputController::extChannels);
 
-    // prepare empty last state
-    memset(&lastState, 0, sizeof(state_t));
-    lastState.activeOutputs.clear();
-    lastState.activeOutputs.reserve(OutputController::intChannels+OutputController::extChannels);
-
     // Prepare time system event hook to react properly on time changes
     // Note: hook registration will be performed by the main thread, because the
     // IrrigationPlanner instance will be created before the TimeSystem is initialized.
     extEvents = xEventGroupCreate();
+    eventTimer = nullptr;
 
     if (nullptr == extEvents) {
         ESP_LOGE(logTag, "extEvents event group couldn't be created.");
@@ -60,6 +74,10 @@ IrrigationController::~IrrigationController(void)
     // TBD: graceful shutdown of task
     if(mqttStateTopic) free(mqttStateTopic);
     if(mqttStateData) free(mqttStateData);
+    if(mqttTelemetryTopic) free(mqttTelemetryTopic);
+    if(mqttTelemetryData) free(mqttTelemetryData);
+    if(mqttDiagTopic) free(mqttDiagTopic);
+    if(mqttDiagData) free(mqttDiagData);
 }
 
 /**
@@ -73,7 +91,8 @@ void IrrigationController::start(void)
         // initially signalize a hardware config change, so it gets immediatly processed in the task function
         hardwareConfigUpdatedEventHandler();
 
-        taskHandle = xTaskCreateStatic(taskFuncDispatch, "irrig_ctrl_task", taskStackSize, (void*) this, taskPrio, taskStack, &taskBuf);
+        taskHandle = xTaskCreateStaticPinnedToCore(taskFuncDispatch, "irrig_ctrl_task", taskStackSize, (void*) this, taskPrio,
+            taskStack, &taskBuf, controlTaskCore);
         if (nullptr != taskHandle) {
             ESP_LOGI(logTag, "IrrigationController task created. Starting.");
         } else {
@@ -103,7 +122,8 @@ void IrrigationController::taskFuncDispatch(void* params)
 void IrrigationController::taskFunc()
 {
     EventBits_t events;
-    TickType_t wait, loopStartTicks, nowTicks;
+    TickType_t loopStartTicks, nowTicks, phaseStartTicks;
+    bool sensorsPoweredUp;
     time_t now, nextIrrigEvent, sntpNextSync;
     IrrigationPlanner::err_t plannerErr;
     bool irrigOk;
@@ -116,16 +136,25 @@ void IrrigationController::taskFunc()
         ESP_LOGE(logTag, "Emergency reboot timer couldn't be setup. Doing our best without it ...");
     }
 
-    // Wait for WiFi to come up. TBD: make configurable (globally), implement WiFiManager for that
-    wait = portMAX_DELAY;
-    if(wifiConnectedWaitMillis >= 0) {
-        wait = pdMS_TO_TICKS(wifiConnectedWaitMillis);
+    esp_timer_create_args_t timerArgs;
+    timerArgs.callback = eventTimerCb;
+    timerArgs.arg = this;
+    timerArgs.dispatch_method = ESP_TIMER_TASK;
+    timerArgs.name = "irrig_event";
+    if(ESP_OK != esp_timer_create(&timerArgs, &eventTimer)) {
+        ESP_LOGE(logTag, "Event timer couldn't be created. Falling back to polling the events.");
+        eventTimer = nullptr;
     }
-    events = xEventGroupWaitBits(wifiEvents, wifiEventConnected, pdFALSE, pdTRUE, wait);
-    if(0 != (events & wifiEventConnected)) {
-        ESP_LOGD(logTag, "WiFi connected.");
-    } else {
-        ESP_LOGE(logTag, "WiFi didn't come up within timeout!");
+
+    // Boot time is only representative for deep sleep wakeups, cold boots perform a lot more initialization
+    if(ESP_SLEEP_WAKEUP_UNDEFINED != esp_sleep_get_wakeup_cause()) {
+        wakeBudget.addSample(WakeTimeBudget::PHASE_BOOT, portTICK_RATE_MS * xTaskGetTickCount() + bootCompensationMillis);
+        wakeProfiler.addSample(WakeProfiler::SCOPE_BOOT, (uint32_t) esp_timer_get_time());
+    }
+
+    // In telemetry mode the network is brought up on demand, except for cold boots (or keep awake)
+    if((!telemetryEnabled) || (ESP_SLEEP_WAKEUP_UNDEFINED == esp_sleep_get_wakeup_cause()) || pwrMgr.getKeepAwake()) {
+        startNetwork();
     }
 
     // Check if we have a valid time
@@ -150,6 +179,9 @@ void IrrigationController::taskFunc()
         }
     }
 
+    // Outputs held during deep sleep are on again, so bring back what is going to stop them
+    restoreStopEvents();
+
     // Register event hooks
     TimeSystem_RegisterHook(timeSytemEventsHookDispatch, this);
     irrigPlanner.registerIrrigPlanUpdatedHook(irrigConfigUpdatedHookDispatch, this);
@@ -170,8 +202,10 @@ void IrrigationController::taskFunc()
 
             SettingsManager::battery_config_t batConf;
             SettingsManager::reservoir_config_t reservoirConf;
+            SettingsManager::sleep_config_t sleepConf;
             settingsMgr.copyBatteryConfig(&batConf);
             settingsMgr.copyReservoirConfig(&reservoirConf);
+            settingsMgr.copySleepConfig(&sleepConf);
             disableBatteryCheck = batConf.disableBatteryCheck;
             disableReservoirCheck = reservoirConf.disableReservoirCheck;
             fillLevelMaxVal = reservoirConf.fillLevelMaxVal;
@@ -179,11 +213,22 @@ void IrrigationController::taskFunc()
             fillLevelCriticalThresholdPercent10 = reservoirConf.fillLevelCriticalThresholdPercent10;
             fillLevelLowThresholdPercent10 = reservoirConf.fillLevelLowThresholdPercent10;
             fillLevelHysteresisPercent10 = reservoirConf.fillLevelHysteresisPercent10;
+            eventDrivenSleep = sleepConf.eventDrivenSleep;
+            wakeupIntervalMillis = sleepConf.wakeupIntervalSeconds * 1000 - bootCompensationMillis;
+            maxSleepMillis = sleepConf.maxSleepSeconds * 1000 - bootCompensationMillis;
+            telemetryFlushIntervalMillis = sleepConf.telemetryFlushIntervalSeconds * 1000;
         }
 
         // *********************
         // Power up needed peripherals, DCDC, ...
         // *********************
+        phaseStartTicks = xTaskGetTickCount();
+        sensorsPoweredUp = false;
+        wakeProfiler.begin(WakeProfiler::SCOPE_SENSOR_POWER_UP);
+
+        // Note: The sensor acquisition is pipelined, i.e. the battery voltage is sampled in the
+        // background while waiting for the external sensors and the fill level answer.
+
         // Peripheral enable will power up the DCDC as well as the RS232 driver
         if(!pwrMgr.getPeripheralEnable()) {
             ESP_LOGD(logTag, "Bringing up DCDC + RS232 driver.");
@@ -192,19 +237,39 @@ void IrrigationController::taskFunc()
             vTaskDelay(pdMS_TO_TICKS(peripheralEnStartupMillis));
         }
 
+        // Start sampling the battery voltage, unless the ULP has just sampled it during deep sleep
+        PowerManager::ulp_batt_summary_t ulpBatt;
+        bool ulpBattFresh = pwrMgr.getUlpBatterySummary(&ulpBatt);
+        bool battSampling = (!ulpBattFresh) && pwrMgr.startSupplyVoltageSampling();
+
         // Enable external sensor power
         if((!disableReservoirCheck) && (!pwrMgr.getPeripheralExtSupply())) {
             ESP_LOGD(logTag, "Powering external sensors.");
             pwrMgr.setPeripheralExtSupply(true);
             // Wait for external sensors to power up properly
             vTaskDelay(pdMS_TO_TICKS(peripheralExtSupplyMillis));
+            sensorsPoweredUp = true;
         }
 
+        wakeProfiler.end(WakeProfiler::SCOPE_SENSOR_POWER_UP);
+
+        // Request the fill levels of all reservoirs at once, the answers are fetched after the battery voltage is available
+        uint32_t fillLevelsRequested = disableReservoirCheck ? 0U : fillSensors.requestAll();
+
         // *********************
         // Fetch sensor data
         // *********************
         // Battery voltage
-        state.battVoltage = pwrMgr.getSupplyVoltageMilli();
+        wakeProfiler.begin(WakeProfiler::SCOPE_ADC);
+        if(ulpBattFresh) {
+            ESP_LOGD(logTag, "Using ULP battery data (%u samples, min %u mV, avg %u mV).", ulpBatt.numSamples,
+                ulpBatt.minMilli, ulpBatt.avgMilli);
+            state.battVoltage = ulpBatt.lastMilli;
+        } else {
+            state.battVoltage = battSampling ? pwrMgr.waitSupplyVoltageMilli(pdMS_TO_TICKS(battSampleTimeoutMillis)) :
+                pwrMgr.getSupplyVoltageMilli();
+        }
+        wakeProfiler.end(WakeProfiler::SCOPE_ADC);
         if(disableBatteryCheck) {
             state.battState = PowerManager::BATT_DISABLED;
         } else {
@@ -213,58 +278,54 @@ void IrrigationController::taskFunc()
         ESP_LOGD(logTag, "Battery voltage: %02.2f V (%s)", roundf(state.battVoltage * 0.1f) * 0.01f,
             BATT_STATE_TO_STR(state.battState));
 
-        // Get fill level of the reservoir, if not disabled.
+        // Get fill levels of the reservoirs, if not disabled.
         if(!disableReservoirCheck) {
-            int fillLevelMm = fillSensor.getFillLevel();
-            int fillLevel = 0;
-
-            if(fillLevel < fillLevelMinVal) fillLevel = fillLevelMinVal;
-            if(fillLevel > fillLevelMaxVal) fillLevel = fillLevelMaxVal;
-            fillLevel = (fillLevelMm - fillLevelMinVal);
-            fillLevel = fillLevel * 1000 / fillLevelMaxVal;
-
-            if(fillLevel > 1000) fillLevel = 1000;
-            if(fillLevel < 0) fillLevel = 0;
-
-            state.fillLevel = fillLevel;
-            state.reservoirState = irrigCtrlPersistentData.reservoirState; // keep previous state by default
-
-            if ((irrigCtrlPersistentData.reservoirState == RESERVOIR_OK) ||
-                (irrigCtrlPersistentData.reservoirState == RESERVOIR_DISABLED))
-            {
-                // state was okay or disabled before -> update it with the absolute values
-                if(state.fillLevel >= fillLevelLowThresholdPercent10) {
-                    state.reservoirState = RESERVOIR_OK;
-                } else if (state.fillLevel >= fillLevelCriticalThresholdPercent10) {
-                    state.reservoirState = RESERVOIR_LOW;
-                } else {
-                    state.reservoirState = RESERVOIR_CRITICAL;
-                }
-            } else {
-                // apply appropriate hysteresis if we were critical or low before
-                if (irrigCtrlPersistentData.reservoirState == RESERVOIR_CRITICAL) {
-                    if(state.fillLevel >= (fillLevelLowThresholdPercent10 + fillLevelHysteresisPercent10)) {
-                        state.reservoirState = RESERVOIR_OK;
-                    } else if (state.fillLevel >= (fillLevelCriticalThresholdPercent10 + fillLevelHysteresisPercent10)) {
-                       state.reservoirState = RESERVOIR_LOW;
-                    }
-                } else {
-                    if(state.fillLevel >= (fillLevelLowThresholdPercent10 + fillLevelHysteresisPercent10)) {
-                        state.reservoirState = RESERVOIR_OK;
-                    } else if (state.fillLevel < fillLevelCriticalThresholdPercent10) {
-                       state.reservoirState = RESERVOIR_CRITICAL;
-                    }
-                }
+            int fillLevelsMm[fillSensorNum];
+
+            wakeProfiler.begin(WakeProfiler::SCOPE_FILL_SENSOR);
+            fillSensors.waitAll(fillLevelsRequested, pdMS_TO_TICKS(fillLevelTimeoutMillis), fillLevelsMm);
+#ifdef CONFIG_FILL_SENSOR_STREAMING
+            if(0U != fillLevelsRequested) {
+                fillSensors.finishAll(fillLevelsRequested);
+                // Not needed anymore, as soon as stable values exist
+                pwrMgr.setPeripheralExtSupply(false);
+            }
+#endif
+            wakeProfiler.end(WakeProfiler::SCOPE_FILL_SENSOR);
+
+            // The overall state is the one of the emptiest reservoir
+            state.fillLevel = 1000;
+            state.reservoirState = RESERVOIR_OK;
+            for(int i = 0; i < fillSensorNum; i++) {
+                // Sensors which aren't registered or didn't answer are treated like empty reservoirs
+                state.reservoirFillLevels[i] = getFillLevelPercent10(fillLevelsMm[i]);
+                state.reservoirStates[i] = getReservoirState(state.reservoirFillLevels[i], irrigCtrlPersistentData.reservoirStates[i]);
+                ESP_LOGD(logTag, "Reservoir %d fill level: %d (%s)", i, state.reservoirFillLevels[i],
+                    RESERVOIR_STATE_TO_STR(state.reservoirStates[i]));
+
+                if(state.reservoirFillLevels[i] < state.fillLevel) state.fillLevel = state.reservoirFillLevels[i];
+                if(state.reservoirStates[i] > state.reservoirState) state.reservoirState = state.reservoirStates[i];
             }
         } else {
             state.fillLevel = -2;
             state.reservoirState = RESERVOIR_DISABLED;
+            for(int i = 0; i < fillSensorNum; i++) {
+                state.reservoirFillLevels[i] = -2;
+                state.reservoirStates[i] = RESERVOIR_DISABLED;
+            }
         }
         ESP_LOGD(logTag, "Reservoir fill level: %d (%s)", state.fillLevel, 
             RESERVOIR_STATE_TO_STR(state.reservoirState));
 
         // Store updated fill values in persitent data storage
-        irrigCtrlPersistentData.reservoirState = state.reservoirState;
+        for(int i = 0; i < fillSensorNum; i++) {
+            irrigCtrlPersistentData.reservoirStates[i] = state.reservoirStates[i];
+        }
+
+        // Only a full sensor power up + readout is representative for the time needed before an event
+        if(sensorsPoweredUp) {
+            wakeBudget.addSample(WakeTimeBudget::PHASE_SENSOR_READOUT, portTICK_RATE_MS * (xTaskGetTickCount() - phaseStartTicks));
+        }
 
         // Power down external supply already. Not needed anymore.
         if(pwrMgr.getPeripheralExtSupply()) {
@@ -275,19 +336,42 @@ void IrrigationController::taskFunc()
         // TBD: Get weather forecast
         // TBD: Get local weather data
 
-        // Check system preconditions for the irrigation, i.e. battery state and reservoir fill level
+        // Check system preconditions for the irrigation, i.e. battery state. The reservoir fill levels are
+        // checked per zone (see isZoneSupplyOk()).
         irrigOk = true;
         if(state.battState == PowerManager::BATT_CRITICAL) {
             irrigOk = false;
         }
-        if(state.reservoirState == RESERVOIR_CRITICAL) {
-            irrigOk = false;
-        }
 
         // Check if system conditions got critical and outputs are active
         if(outputCtrl.anyOutputsActive() && !irrigOk) {
             ESP_LOGW(logTag, "Active outputs detected, but system conditions critical! Disabling them for safety.");
-            outputCtrl.disableAllOutputs();
+            outputActuator.disableAllOutputs();
+            outputActuator.flush(pdMS_TO_TICKS(outputsFlushWaitMillis));
+        } else if(outputCtrl.anyOutputsActive() && (state.reservoirState == RESERVOIR_CRITICAL)) {
+            // Only the zones supplied by a critical reservoir are affected
+            disableCriticalZoneOutputs();
+        }
+
+        // *********************
+        // Telemetry + network
+        // *********************
+        if(telemetryEnabled) {
+            TelemetryBuffer::sample_t sample;
+            now = time(nullptr);
+            sample.timestamp = now;
+            sample.battVoltage = state.battVoltage;
+            sample.fillLevel = (int16_t) state.fillLevel;
+            sample.reservoirState = (uint8_t) state.reservoirState;
+            sample.battState = (uint8_t) state.battState;
+            fill_sensor_reading_t fillReading;
+            sample.fillLevelRaw = ((!disableReservoirCheck) && fillSensors.getReading(0, &fillReading)) ? fillReading.raw : 0;
+
+            if(!networkStarted && isNetworkNeeded(sample, now, irrigPlanner.getNextEventTime(irrigCtrlPersistentData.lastIrrigEvent, true))) {
+                startNetwork();
+            }
+
+            telemetry.addSample(sample);
         }
 
         // *********************
@@ -295,6 +379,7 @@ void IrrigationController::taskFunc()
         // *********************
         int millisTillNextEvent;
         bool eventsToProcess = true;
+        wakeProfiler.begin(WakeProfiler::SCOPE_PLANNER);
         while(eventsToProcess) {
             now = time(nullptr);
 
@@ -320,7 +405,8 @@ void IrrigationController::taskFunc()
                 }
 
                 // Disable all outputs to abort any irrigations that may have been started.
-                outputCtrl.disableAllOutputs();
+                outputActuator.disableAllOutputs();
+                outputActuator.flush(pdMS_TO_TICKS(outputsFlushWaitMillis));
             }
             if (0 != (events & extEventIrrigConfigUpdated)) {
                 ESP_LOGI(logTag, "Irrigation config update detected.");
@@ -332,7 +418,7 @@ void IrrigationController::taskFunc()
             millisTillNextEvent = (int) round(difftime(nextIrrigEvent, now) * 1000.0);
 
             // lock the configuration before an event starts (incl. some guard time)
-            if ((nextIrrigEvent != 0) && (millisTillNextEvent <= preEventMillis)) {
+            if ((nextIrrigEvent != 0) && (millisTillNextEvent <= getPreEventMillis())) {
                 ESP_LOGD(logTag, "Event is approaching. Locking config.");
                 irrigPlanner.setConfigLock(true);
             }
@@ -344,11 +430,18 @@ void IrrigationController::taskFunc()
             // // Publish state with the updated next event time
             // publishStateUpdate();
 
+            // Wait for an approaching event right here, the sensor data has just been acquired for it.
+            // If the wait got interrupted by a time set or config update, handle that first (see above).
+            if ((nextIrrigEvent != 0) && (millisTillNextEvent > 0) && (millisTillNextEvent <= getPreEventMillis())) {
+                if (!waitForEvent(nextIrrigEvent)) continue;
+            }
+
             // Perform event actions if it is time now
             now = time(nullptr);
             double diffTime = difftime(nextIrrigEvent, now);
             // Event within delta or have we even overshot the target?
             if((nextIrrigEvent != 0) && ((fabs(diffTime) < 1.0) || (diffTime <= -1.0))) {
+                recordEventJitter(nextIrrigEvent);
                 TimeSystem_LogTime();
 
                 if(!irrigOk) {
@@ -368,6 +461,8 @@ void IrrigationController::taskFunc()
                 if(IrrigationPlanner::ERR_OK != plannerErr) {
                     ESP_LOGW(logTag, "Error getting event handles: %d. Trying our best anyway...", plannerErr);
                 }
+                // Switch the outputs of all zones of these events at once
+                outputActuator.beginUpdate();
                 for(int cnt=0; cnt < maxEventHandles; cnt++) {
                     IrrigationEvent::irrigation_event_data_t eventData;
                     if(eventHandles[cnt].idx >= 0) {
@@ -382,6 +477,10 @@ void IrrigationController::taskFunc()
                                 ESP_LOGE(logTag, "Error getting zone config: %d. No actions available!", plannerErr);
                                 zoneCfgIsValid = false;
                             }
+                            // Stop events kept across a deep sleep apply the zone config chosen back then
+                            if(!eventData.isStart && takeRestoredStopZoneCfg(nextIrrigEvent, eventData.zoneIdx, &zoneCfg)) {
+                                zoneCfgIsValid = true;
+                            }
 
                             bool isStartEvent = eventData.isStart;
                             unsigned int durationSecs = isStartEvent ? eventData.durationSecs : 0;
@@ -403,7 +502,7 @@ void IrrigationController::taskFunc()
                             }
 
                             if((zoneCfgIsValid) && (IrrigationPlanner::ERR_OK == plannerErr)) {
-                                setZoneOutputs(irrigOk, &zoneCfg, isStartEvent);
+                                setZoneOutputs(irrigOk, &zoneCfg, isStartEvent, nextIrrigEvent);
                             }
                         }
                     } else {
@@ -411,6 +510,9 @@ void IrrigationController::taskFunc()
                     }
                 }
 
+                // Wait for the actuation of all events, so the output states are up-to-date below
+                outputActuator.commit();
+                outputActuator.flush(pdMS_TO_TICKS(outputsFlushWaitMillis));
                 irrigCtrlPersistentData.lastIrrigEvent = nextIrrigEvent;
             } else {
                 eventsToProcess = false;
@@ -419,8 +521,8 @@ void IrrigationController::taskFunc()
             // Publish state with the updated next event time + active outputs
             state.sntpLastSync = TimeSystem_GetLastSntpSync();
             state.sntpNextSync = TimeSystem_GetNextSntpSync();
-            publishStateUpdate();
         }
+        wakeProfiler.end(WakeProfiler::SCOPE_PLANNER);
 
         // *********************
         // SNTP resync
@@ -468,7 +570,8 @@ void IrrigationController::taskFunc()
                 // Check status of sync to determine the next sync time
                 if(0 != (events & extEventTimeSetSntp)) {
                     ESP_LOGI(logTag, "SNTP time (re)sync was successful.");
-                    sntpNextSyncTm.tm_hour += sntpResyncIntervalHours;
+                    // the interval has been adapted to the measured drift of the RTC by the sync
+                    sntpNextSyncTm.tm_sec += TimeSystem_GetSntpResyncIntervalSecs(sntpResyncIntervalHours * 3600);
                 } else {
                     ESP_LOGW(logTag, "SNTP time (re)sync wasn't successful within timeout.");
                     sntpNextSyncTm.tm_min += sntpResyncIntervalFailMinutes;
@@ -511,11 +614,11 @@ void IrrigationController::taskFunc()
             }
 
             // Disable all outputs to abort any irrigations that may have been started.
-            outputCtrl.disableAllOutputs();
+            outputActuator.disableAllOutputs();
+            outputActuator.flush(pdMS_TO_TICKS(outputsFlushWaitMillis));
 
-            // Update next irrigation event and publish (also the new SNTP info set above)
+            // Update next irrigation event (published below together with the new SNTP info set above)
             state.nextIrrigEvent = nextIrrigEvent;
-            publishStateUpdate();
         }
         // update the next event time if the schedule has been updated
         if (0 != (events & extEventIrrigConfigUpdated)) {
@@ -525,6 +628,14 @@ void IrrigationController::taskFunc()
 
         millisTillNextEvent = (int) round(difftime(nextIrrigEvent, now) * 1000.0);
 
+        // Publish all state changes of this loop at once (and the telemetry recorded so far)
+        if(networkStarted) {
+            wakeProfiler.begin(WakeProfiler::SCOPE_MQTT_PUBLISH);
+            publishTelemetry();
+            publishStateUpdate();
+            publishDiagnostics();
+        }
+
         // Power down the DCDC if no outputs are active.
         if(!outputCtrl.anyOutputsActive()) {
             pwrMgr.setPeripheralEnable(false);
@@ -532,6 +643,12 @@ void IrrigationController::taskFunc()
         }
 
         if(pwrMgr.getKeepAwake()) {
+            // The messages are published in the background while kept awake
+            wakeProfiler.end(WakeProfiler::SCOPE_MQTT_PUBLISH);
+
+            // The console is skipped on unattended wakeups (see planBoot), so bring it up for the user
+            if(pwrMgr.getKeepAwakeIo()) bootBringUp(BOOT_SUBSYS_CONSOLE);
+
             // Calculate loop runtime and compensate the sleep time with it
             nowTicks = xTaskGetTickCount();
             int loopRunTimeMillis = portTICK_RATE_MS * ((nowTicks > loopStartTicks) ? 
@@ -541,7 +658,7 @@ void IrrigationController::taskFunc()
             firstRun = false;
 
             int sleepMillis = wakeupIntervalKeepAwakeMillis - loopRunTimeMillis;
-            if ((nextIrrigEvent != 0) && (sleepMillis > millisTillNextEvent)) sleepMillis = millisTillNextEvent - preEventMillis;
+            if ((nextIrrigEvent != 0) && (sleepMillis > millisTillNextEvent)) sleepMillis = millisTillNextEvent - getPreEventMillis();
             if (sleepMillis < 500) sleepMillis = 500;
 
             ESP_LOGD(logTag, "Task is going to sleep for %d ms.", sleepMillis);
@@ -553,8 +670,16 @@ void IrrigationController::taskFunc()
             vTaskDelay(pdMS_TO_TICKS(sleepMillis));
         } else {
             // Wait to get all updates through
-            if(!mqttMgr.waitAllPublished(mqttAllPublishedWaitMillis)) {
-                ESP_LOGW(logTag, "Waiting for MQTT to publish all messages didn't complete within timeout.");
+            if(networkStarted) {
+                phaseStartTicks = xTaskGetTickCount();
+                if(!mqttMgr.waitAllPublished(mqttAllPublishedWaitMillis)) {
+                    ESP_LOGW(logTag, "Waiting for MQTT to publish all messages didn't complete within timeout.");
+                } else {
+                    confirmTelemetryPublished();
+                    confirmStatePublished();
+                }
+                wakeBudget.addSample(WakeTimeBudget::PHASE_MQTT_FLUSH, portTICK_RATE_MS * (xTaskGetTickCount() - phaseStartTicks));
+                wakeProfiler.end(WakeProfiler::SCOPE_MQTT_PUBLISH);
             }
 
             // TBD: stop webserver, mqtt and other stuff
@@ -577,8 +702,8 @@ void IrrigationController::taskFunc()
                 ESP_LOGD(logTag, "Loop runtime %d ms.", loopRunTimeMillis);
             }
 
-            int millisTillNextEventCompensated = millisTillNextEvent - preEventMillisDeepSleep - mqttAllPublishedWaitMillis;
-            int sleepMillis = wakeupIntervalMillis - loopRunTimeMillis;
+            int millisTillNextEventCompensated = millisTillNextEvent - getPreEventMillisDeepSleep();
+            int sleepMillis = getDeepSleepMillis(loopRunTimeMillis);
             if((nextIrrigEvent != 0) && (sleepMillis > millisTillNextEventCompensated)) sleepMillis = millisTillNextEventCompensated;
             if(sleepMillis < 500) sleepMillis = 500;
 
@@ -594,8 +719,9 @@ void IrrigationController::taskFunc()
                 }
                 vTaskDelay(pdMS_TO_TICKS(sleepMillis));
             }
-            // Check if any outputs are active, deep sleep would kill them!
-            else if(outputCtrl.anyOutputsActive()) {
+            // Check if any outputs are active, deep sleep would kill them unless they are held
+            // (which needs their stop events to be kept as well)!
+            else if(outputCtrl.anyOutputsActive() && !(outputHoldDeepSleepEnabled && persistStopEvents())) {
                 ESP_LOGD(logTag, "Outputs active. Task is going to sleep for %d ms insted of deep sleep.", sleepMillis);
                 if(sleepMillis > taskMaxSleepTimeMillis) {
                     sleepMillis = taskMaxSleepTimeMillis;
@@ -606,9 +732,11 @@ void IrrigationController::taskFunc()
             }
             else {
                 TickType_t killStartTicks = xTaskGetTickCount();
+                bool holdOutputs = outputCtrl.anyOutputsActive();
+                wakeProfiler.begin(WakeProfiler::SCOPE_SLEEP_PREP);
 
                 ESP_LOGD(logTag, "About to deep sleep. Killing MQTT and WiFi.");
-                mqttMgr.stop();
+                if(networkStarted) mqttMgr.stop();
                 // don't stop WiFi explicitly, because this seemed to hang sometimes.
 
                 nowTicks = xTaskGetTickCount();
@@ -620,11 +748,24 @@ void IrrigationController::taskFunc()
                 ESP_LOGD(logTag, "Kill compensation time %d ms; new deep sleep time %d ms.", \
                     loopRunTimeMillis, sleepMillis);
 
-                if(sleepMillis < noDeepSleepRangeMillis) {
+                if(holdOutputs) {
+                    // A reboot would disable the outputs, so rather wakeup a bit late
+                    if(sleepMillis < 500) sleepMillis = 500;
+                    ESP_LOGD(logTag, "Preparing deep sleep for %d ms with outputs held.", sleepMillis);
+                    outputCtrl.setHold(true);
+                    pwrMgr.setPeripheralEnableHold(true);
+                    wakeProfiler.end(WakeProfiler::SCOPE_SLEEP_PREP);
+                    pwrMgr.gotoSleep(sleepMillis);
+                    // Still awake (e.g. keep awake got set), so take back control over the outputs
+                    pwrMgr.setPeripheralEnableHold(false);
+                    outputCtrl.setHold(false);
+                } else if(sleepMillis < noDeepSleepRangeMillis) {
                     ESP_LOGW(logTag, "Compensating deep sleep time got too near to next event. Rebooting.");
+                    wakeProfiler.end(WakeProfiler::SCOPE_SLEEP_PREP);
                     pwrMgr.reboot();
                 } else {
                     ESP_LOGD(logTag, "Preparing deep sleep for %d ms.", sleepMillis);
+                    wakeProfiler.end(WakeProfiler::SCOPE_SLEEP_PREP);
                     pwrMgr.gotoSleep(sleepMillis);
                 }
             }
@@ -637,21 +778,407 @@ void IrrigationController::taskFunc()
     //pwrMgr->reboot();
 }
 
-void IrrigationController::setZoneOutputs(bool irrigOk, irrigation_zone_cfg_t* zoneCfg, bool start)
+/**
+ * @brief Get the time to wakeup before an event (task sleep only).
+ * 
+ * It is based on the measured sensor readout times, bounded by preEventMillis.
+ * 
+ * @return int Time in milliseconds.
+ */
+int IrrigationController::getPreEventMillis()
 {
+    return wakeBudget.getBudgetMillis(WakeTimeBudget::PHASE_SENSOR_READOUT,
+            peripheralEnStartupMillis + peripheralExtSupplyMillis + sensorBatReadoutTimeMillis) +
+        preEventGuardMillis;
+}
+
+/**
+ * @brief Get the time to wakeup before an event in case of deep sleep, incl. the
+ * time needed to publish all MQTT messages.
+ * 
+ * It is based on the measured boot, WiFi connect, sensor readout and MQTT flush times,
+ * each bounded by its nominal value (i.e. the sum is bounded by
+ * preEventMillisDeepSleep + mqttAllPublishedWaitMillis).
+ * 
+ * @return int Time in milliseconds.
+ */
+int IrrigationController::getPreEventMillisDeepSleep()
+{
+    return wakeBudget.getBudgetMillis(WakeTimeBudget::PHASE_BOOT, bootToTaskTimeMillis) +
+        wakeBudget.getBudgetMillis(WakeTimeBudget::PHASE_WIFI_CONNECT, wifiConnectedWaitMillis) +
+        wakeBudget.getBudgetMillis(WakeTimeBudget::PHASE_SENSOR_READOUT,
+            peripheralEnStartupMillis + peripheralExtSupplyMillis + sensorBatReadoutTimeMillis) +
+        wakeBudget.getBudgetMillis(WakeTimeBudget::PHASE_MQTT_FLUSH, mqttAllPublishedWaitMillis) +
+        preEventGuardMillis;
+}
+
+/**
+ * @brief Get the deep sleep time, not taking the next irrigation event into account.
+ * 
+ * In case of event-driven sleep it is the time till the earliest deadline of the next SNTP resync
+ * and the next telemetry flush, bounded by maxSleepMillis. Otherwise it is the fixed wakeupIntervalMillis.
+ * 
+ * @param loopRunTimeMillis Runtime of the current wakeup, which is compensated for.
+ * @return int Time in milliseconds.
+ */
+int IrrigationController::getDeepSleepMillis(int loopRunTimeMillis)
+{
+    if(!eventDrivenSleep) return wakeupIntervalMillis - loopRunTimeMillis;
+
+    // Deadlines closer than this would end up in a reboot, they are handled with the next wakeup
+    const int minSleepMillis = 2 * noDeepSleepRangeMillis;
+    time_t now = time(nullptr);
+    int sleepMillis = maxSleepMillis - loopRunTimeMillis;
+
+    time_t sntpNextSync = TimeSystem_GetNextSntpSync();
+    if(sntpNextSync != 0) {
+        int millisTillSntp = (int) round(difftime(sntpNextSync, now) * 1000.0);
+        if(millisTillSntp < minSleepMillis) millisTillSntp = minSleepMillis;
+        if(millisTillSntp < sleepMillis) sleepMillis = millisTillSntp;
+    }
+
+    if(telemetryEnabled && (telemetry.getCount() > 0)) {
+        int millisTillFlush = getMillisTillTelemetryFlush(now);
+        if(millisTillFlush < minSleepMillis) millisTillFlush = minSleepMillis;
+        if(millisTillFlush < sleepMillis) sleepMillis = millisTillFlush;
+    }
+
+    ESP_LOGD(logTag, "Event-driven deep sleep time %d ms.", sleepMillis);
+    return sleepMillis;
+}
+
+/**
+ * @brief Get the time till the recorded telemetry samples have to be uploaded (event-driven sleep only).
+ * 
+ * @param now Current time.
+ * @return int Time in milliseconds, telemetryFlushIntervalMillis if no samples are recorded.
+ */
+int IrrigationController::getMillisTillTelemetryFlush(time_t now)
+{
+    TelemetryBuffer::sample_t oldest;
+
+    if(!telemetry.getSample(0, &oldest)) return telemetryFlushIntervalMillis;
+
+    return telemetryFlushIntervalMillis - (int) round(difftime(now, oldest.timestamp) * 1000.0);
+}
+
+/**
+ * @brief Wait for an event with an esp_timer armed at its exact time.
+ *
+ * Returns early, if the system time gets set or the irrigation config gets updated meanwhile
+ * (their event bits are left set for the caller).
+ *
+ * @param eventTime Time of the event.
+ * @return bool True if the event time has been reached.
+ */
+bool IrrigationController::waitForEvent(time_t eventTime)
+{
+    struct timeval tv;
+    EventBits_t events;
+    int64_t remainingMicros;
+
+    gettimeofday(&tv, NULL);
+    remainingMicros = ((int64_t) eventTime - tv.tv_sec) * 1000000 - tv.tv_usec;
+
+    // The esp_timer and the system time may drift slightly apart, so re-arm if the timer was early
+    while(remainingMicros > 0) {
+        if(nullptr != eventTimer) {
+            esp_timer_stop(eventTimer); // fails if the timer isn't running, which is fine
+            xEventGroupClearBits(extEvents, extEventIrrigEventDue);
+            esp_timer_start_once(eventTimer, (uint64_t) remainingMicros);
+        }
+
+        ESP_LOGD(logTag, "Waiting %lld us for the event.", remainingMicros);
+        events = xEventGroupWaitBits(extEvents, extEventIrrigEventDue | extEventTimeSet | extEventIrrigConfigUpdated,
+            pdFALSE, pdFALSE, pdMS_TO_TICKS(remainingMicros / 1000 + eventTimerMarginMillis));
+        xEventGroupClearBits(extEvents, extEventIrrigEventDue);
+
+        if(0 != (events & (extEventTimeSet | extEventIrrigConfigUpdated))) {
+            if(nullptr != eventTimer) esp_timer_stop(eventTimer);
+            ESP_LOGD(logTag, "Event wait interrupted by a time set or config update.");
+            return false;
+        }
+
+        gettimeofday(&tv, NULL);
+        remainingMicros = ((int64_t) eventTime - tv.tv_sec) * 1000000 - tv.tv_usec;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Record the delay between the scheduled time of an event and now, i.e. when it is processed.
+ */
+void IrrigationController::recordEventJitter(time_t eventTime)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    int64_t delayMicros = ((int64_t) tv.tv_sec - eventTime) * 1000000 + tv.tv_usec;
+    if(delayMicros < 0) delayMicros = 0;
+    if(delayMicros > UINT32_MAX) delayMicros = UINT32_MAX;
+
+    ESP_LOGD(logTag, "Processing event %lld us after its scheduled time.", delayMicros);
+    wakeProfiler.addSample(WakeProfiler::SCOPE_EVENT_JITTER, (uint32_t) delayMicros);
+}
+
+void IrrigationController::setZoneOutputs(bool irrigOk, irrigation_zone_cfg_t* zoneCfg, bool start, time_t eventTime)
+{
+    bool zoneOk = irrigOk && isZoneSupplyOk(zoneCfg);
+
+    if(irrigOk && !zoneOk && start) {
+        ESP_LOGE(logTag, "Reservoir %d of zone %s critical! Dropping its irrigation.", zoneCfg->reservoirIdx, zoneCfg->name);
+    }
+
     for(int i=0; i < irrigationZoneCfgElements; i++) {
         if(zoneCfg->chEnabled[i]) {
             bool switchOn = start ? zoneCfg->chStateStart[i] : zoneCfg->chStateStop[i];
             OutputController::ch_map_t chNum = zoneCfg->chNum[i];
             // Only enable outputs when preconditions are met; disabling is always okay.
-            if(irrigOk || !switchOn) {
-                outputCtrl.setOutput(chNum, switchOn);
+            if(zoneOk || !switchOn) {
+                outputActuator.setOutput(chNum, switchOn, eventTime);
                 updateStateActiveOutputs(chNum, switchOn);
             }
         }
     }
 }
 
+/**
+ * @brief Keep the stop events of the running irrigations in RTC memory (see restoreStopEvents()),
+ * right before deep sleeping with held outputs.
+ *
+ * The zone config is kept along with each stop event, so the stop states chosen now are applied
+ * even if the config gets updated meanwhile. Stop events already restored keep their zone config.
+ *
+ * @return bool True if all stop events have been kept, i.e. the outputs may be held.
+ */
+bool IrrigationController::persistStopEvents()
+{
+    static IrrigationPlanner::stop_event_t stopEvents[persistentStopEventsMax];
+    static persistent_stop_events_t persisted;
+    unsigned int num;
+    IrrigationPlanner::err_t plannerErr;
+
+    plannerErr = irrigPlanner.getStopEvents(stopEvents, persistentStopEventsMax, &num);
+    if(IrrigationPlanner::ERR_OK != plannerErr) {
+        ESP_LOGW(logTag, "Error getting the stop events: %d. Not holding the outputs.", plannerErr);
+        return false;
+    }
+    if(0 == num) {
+        ESP_LOGW(logTag, "Outputs active without stop events. Not holding the outputs.");
+        return false;
+    }
+
+    persisted.magic = persistentStopEventsMagic;
+    persisted.num = num;
+    for(unsigned int i = 0; i < num; i++) {
+        persisted.entries[i].evt = stopEvents[i];
+
+        int idx = findPersistedStopEvent(stopEvents[i].time, stopEvents[i].zoneIdx);
+        if(idx >= 0) {
+            persisted.entries[i].zoneCfg = irrigCtrlStopEvents.entries[idx].zoneCfg;
+        } else {
+            plannerErr = irrigPlanner.getZoneConfig(stopEvents[i].zoneIdx, &persisted.entries[i].zoneCfg);
+            if(IrrigationPlanner::ERR_OK != plannerErr) {
+                ESP_LOGW(logTag, "Error getting zone config: %d. Not holding the outputs.", plannerErr);
+                return false;
+            }
+        }
+    }
+
+    irrigCtrlStopEvents = persisted;
+    ESP_LOGD(logTag, "Kept %u stop events for the deep sleep.", num);
+
+    return true;
+}
+
+/**
+ * @brief Restore the stop events of the irrigations running while deep sleeping with held outputs
+ * (see persistStopEvents()).
+ *
+ * Needs to be called before the first IrrigationPlanner::getNextEventTime(). If the stop events
+ * can't be restored, all outputs are disabled, because nothing would stop them otherwise.
+ */
+void IrrigationController::restoreStopEvents()
+{
+    IrrigationPlanner::err_t plannerErr;
+    bool ok = true;
+
+    // Outputs are only restored on deep sleep wakeups (see OutputController), so are their stop events
+    if((ESP_SLEEP_WAKEUP_UNDEFINED == esp_sleep_get_wakeup_cause()) || !outputCtrl.anyOutputsActive()) {
+        irrigCtrlStopEvents.magic = 0;
+        return;
+    }
+
+    if((persistentStopEventsMagic != irrigCtrlStopEvents.magic) || (0 == irrigCtrlStopEvents.num) ||
+        (irrigCtrlStopEvents.num > persistentStopEventsMax)) {
+        ESP_LOGE(logTag, "Outputs held without stop events!");
+        ok = false;
+    } else {
+        for(unsigned int i = 0; i < irrigCtrlStopEvents.num; i++) {
+            IrrigationPlanner::stop_event_t* evt = &irrigCtrlStopEvents.entries[i].evt;
+
+            // Stop events passed meanwhile (i.e. woken up late) are processed right away
+            if(evt->time <= irrigCtrlPersistentData.lastIrrigEvent) {
+                evt->time = irrigCtrlPersistentData.lastIrrigEvent + 1;
+            }
+
+            plannerErr = irrigPlanner.restoreStopEvent(evt);
+            if(IrrigationPlanner::ERR_OK != plannerErr) {
+                ESP_LOGE(logTag, "Error restoring the stop event of zone %d: %d.", evt->zoneIdx, plannerErr);
+                ok = false;
+                break;
+            }
+            ESP_LOGI(logTag, "Restored the stop event of zone %d.", evt->zoneIdx);
+        }
+    }
+
+    if(!ok) {
+        ESP_LOGE(logTag, "Stop events couldn't be restored. Disabling all outputs for safety.");
+        irrigCtrlStopEvents.magic = 0;
+        outputActuator.disableAllOutputs();
+        outputActuator.flush(pdMS_TO_TICKS(outputsFlushWaitMillis));
+    }
+}
+
+/**
+ * @brief Find a stop event kept across a deep sleep (see persistStopEvents()).
+ *
+ * @return int Index of the entry or -1 if there is none.
+ */
+int IrrigationController::findPersistedStopEvent(time_t eventTime, int zoneIdx)
+{
+    if(persistentStopEventsMagic != irrigCtrlStopEvents.magic) return -1;
+
+    for(unsigned int i = 0; (i < irrigCtrlStopEvents.num) && (i < persistentStopEventsMax); i++) {
+        const IrrigationPlanner::stop_event_t& evt = irrigCtrlStopEvents.entries[i].evt;
+        if((evt.time == eventTime) && (evt.zoneIdx == zoneIdx)) return (int) i;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Get the zone config of a stop event restored after a deep sleep and drop the entry.
+ *
+ * @param eventTime Time of the stop event.
+ * @param zoneIdx Zone of the stop event.
+ * @param cfg Destination of the zone config chosen for the stop.
+ * @return bool True if the stop event has been restored, otherwise cfg is left untouched.
+ */
+bool IrrigationController::takeRestoredStopZoneCfg(time_t eventTime, int zoneIdx, irrigation_zone_cfg_t* cfg)
+{
+    int idx = findPersistedStopEvent(eventTime, zoneIdx);
+
+    if(idx < 0) return false;
+
+    *cfg = irrigCtrlStopEvents.entries[idx].zoneCfg;
+    irrigCtrlStopEvents.entries[idx] = irrigCtrlStopEvents.entries[irrigCtrlStopEvents.num - 1];
+    irrigCtrlStopEvents.num--;
+
+    return true;
+}
+
+/**
+ * @brief Return wether or not the reservoir supplying a zone allows irrigating.
+ */
+bool IrrigationController::isZoneSupplyOk(const irrigation_zone_cfg_t* zoneCfg)
+{
+    int idx = zoneCfg->reservoirIdx;
+
+    if(disableReservoirCheck || (idx < 0)) return true;
+    // an invalid reservoir can't be checked, so it's treated like a critical one
+    if(idx >= fillSensorNum) return false;
+
+    return state.reservoirStates[idx] != RESERVOIR_CRITICAL;
+}
+
+/**
+ * @brief Disable the outputs of all zones supplied by a critical reservoir.
+ *
+ * Outputs of the other zones keep running.
+ */
+void IrrigationController::disableCriticalZoneOutputs()
+{
+    static irrigation_zone_cfg_t zoneCfg;
+
+    outputActuator.beginUpdate();
+    for(int zone = 0; zone < irrigationPlannerNumZones; zone++) {
+        if(IrrigationPlanner::ERR_OK != irrigPlanner.getZoneConfig(zone, &zoneCfg)) continue;
+        if(isZoneSupplyOk(&zoneCfg)) continue;
+
+        // outputs which are off already aren't switched again (see OutputController::commit())
+        for(int i = 0; i < irrigationZoneCfgElements; i++) {
+            if(zoneCfg.chEnabled[i]) {
+                ESP_LOGW(logTag, "Reservoir %d critical! Disabling output %s of zone %s for safety.", zoneCfg.reservoirIdx,
+                    CH_MAP_TO_STR(zoneCfg.chNum[i]), zoneCfg.name);
+                outputActuator.setOutput(zoneCfg.chNum[i], false, 0);
+                updateStateActiveOutputs(zoneCfg.chNum[i], false);
+            }
+        }
+    }
+    outputActuator.commit();
+    outputActuator.flush(pdMS_TO_TICKS(outputsFlushWaitMillis));
+}
+
+/**
+ * @brief Convert a fill level reading in mm into the fill level in percent multiplied by 10.
+ *
+ * @param fillLevelMm Fill level in mm (-1 = no reading).
+ * @return int32_t Fill level in the range 0..1000.
+ */
+int32_t IrrigationController::getFillLevelPercent10(int fillLevelMm)
+{
+    int32_t fillLevel = (fillLevelMm - fillLevelMinVal);
+    fillLevel = fillLevel * 1000 / fillLevelMaxVal;
+
+    if(fillLevel > 1000) fillLevel = 1000;
+    if(fillLevel < 0) fillLevel = 0;
+
+    return fillLevel;
+}
+
+/**
+ * @brief Determine the state of a reservoir, applying the hysteresis in case it was low or critical before.
+ *
+ * @param fillLevel Fill level in percent multiplied by 10.
+ * @param lastState Previous state of the reservoir.
+ * @return reservoir_state_t New state of the reservoir.
+ */
+IrrigationController::reservoir_state_t IrrigationController::getReservoirState(int32_t fillLevel, reservoir_state_t lastState)
+{
+    reservoir_state_t newState = lastState; // keep previous state by default
+
+    if ((lastState == RESERVOIR_OK) || (lastState == RESERVOIR_DISABLED))
+    {
+        // state was okay or disabled before -> update it with the absolute values
+        if(fillLevel >= fillLevelLowThresholdPercent10) {
+            newState = RESERVOIR_OK;
+        } else if (fillLevel >= fillLevelCriticalThresholdPercent10) {
+            newState = RESERVOIR_LOW;
+        } else {
+            newState = RESERVOIR_CRITICAL;
+        }
+    } else {
+        // apply appropriate hysteresis if we were critical or low before
+        if (lastState == RESERVOIR_CRITICAL) {
+            if(fillLevel >= (fillLevelLowThresholdPercent10 + fillLevelHysteresisPercent10)) {
+                newState = RESERVOIR_OK;
+            } else if (fillLevel >= (fillLevelCriticalThresholdPercent10 + fillLevelHysteresisPercent10)) {
+               newState = RESERVOIR_LOW;
+            }
+        } else {
+            if(fillLevel >= (fillLevelLowThresholdPercent10 + fillLevelHysteresisPercent10)) {
+                newState = RESERVOIR_OK;
+            } else if (fillLevel < fillLevelCriticalThresholdPercent10) {
+               newState = RESERVOIR_CRITICAL;
+            }
+        }
+    }
+
+    return newState;
+}
+
 /**
  * @brief Update active outputs list in internal state structure.
  * 
@@ -685,79 +1212,518 @@ void IrrigationController::updateStateActiveOutputs(uint32_t chNum, bool active)
 }
 
 /**
- * @brief Publish currently stored state via MQTT.
+ * @brief Start the network (if not done yet) and wait for the WiFi connection.
+ * 
+ * @return bool True if WiFi is connected.
  */
-void IrrigationController::publishStateUpdate()
+bool IrrigationController::startNetwork()
+{
+    EventBits_t events;
+    TickType_t wait, phaseStartTicks;
+
+    if(!networkStarted) {
+        wakeProfiler.begin(WakeProfiler::SCOPE_WIFI);
+        wifiStart();
+        networkStarted = true;
+
+        // Wait for WiFi to come up. TBD: make configurable (globally), implement WiFiManager for that
+        wait = portMAX_DELAY;
+        if(wifiConnectedWaitMillis >= 0) {
+            wait = pdMS_TO_TICKS(wifiConnectedWaitMillis);
+        }
+        phaseStartTicks = xTaskGetTickCount();
+        events = xEventGroupWaitBits(wifiEvents, wifiEventConnected, pdFALSE, pdTRUE, wait);
+        wakeBudget.addSample(WakeTimeBudget::PHASE_WIFI_CONNECT, portTICK_RATE_MS * (xTaskGetTickCount() - phaseStartTicks));
+        wakeProfiler.end(WakeProfiler::SCOPE_WIFI);
+        if(0 != (events & wifiEventConnected)) {
+            ESP_LOGD(logTag, "WiFi connected.");
+        } else {
+            ESP_LOGE(logTag, "WiFi didn't come up within timeout!");
+        }
+    }
+
+    return (0 != (xEventGroupGetBits(wifiEvents) & wifiEventConnected));
+}
+
+/**
+ * @brief Check wether or not the network is needed on this wakeup (telemetry mode only).
+ * 
+ * The network is needed if the telemetry upload is due, the battery or reservoir state changed
+ * (e.g. transitions to LOW/CRITICAL), an irrigation event is near, outputs are active (and not
+ * held during deep sleep), an SNTP resync is due or the system is kept awake.
+ * 
+ * Note: Config updates via MQTT will be received on network wakeups only.
+ * 
+ * @param sample Current sensor sample (not added to the telemetry buffer yet).
+ * @param now Current time.
+ * @param nextIrrigEvent Time of the next irrigation event.
+ * @return bool True if the network is needed.
+ */
+bool IrrigationController::isNetworkNeeded(const TelemetryBuffer::sample_t& sample, time_t now, time_t nextIrrigEvent)
+{
+    TelemetryBuffer::sample_t last;
+    time_t sntpNextSync;
+
+    if(pwrMgr.getKeepAwake()) {
+        ESP_LOGD(logTag, "Network needed: keep awake.");
+        return true;
+    }
+    if(outputCtrl.anyOutputsActive() && !outputHoldDeepSleepEnabled) {
+        ESP_LOGD(logTag, "Network needed: outputs active.");
+        return true;
+    }
+    if((nextIrrigEvent != 0) &&
+        (difftime(nextIrrigEvent, now) * 1000.0 <= noDeepSleepRangeMillis + getPreEventMillisDeepSleep()))
+    {
+        ESP_LOGD(logTag, "Network needed: irrigation event near.");
+        return true;
+    }
+    sntpNextSync = TimeSystem_GetNextSntpSync();
+    if((sntpNextSync == 0) || (difftime(sntpNextSync, now) <= 0.0f)) {
+        ESP_LOGD(logTag, "Network needed: SNTP resync due.");
+        return true;
+    }
+    if((eventDrivenSleep ? (getMillisTillTelemetryFlush(now) <= 0) :
+            (telemetry.getCount() + 1 >= telemetryUploadIntervalWakeups)) ||
+        telemetry.isFull())
+    {
+        ESP_LOGD(logTag, "Network needed: telemetry upload due.");
+        return true;
+    }
+    if((!telemetry.getLatest(&last)) || (last.battState != sample.battState) ||
+        (last.reservoirState != sample.reservoirState))
+    {
+        ESP_LOGD(logTag, "Network needed: battery/reservoir state changed.");
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Prepare the MQTT topics, which contain the MAC address, if not done yet.
+ * 
+ * @return bool True if the topics are ready.
+ */
+bool IrrigationController::prepareMqttTopics()
 {
     static uint8_t mac_addr[6];
-    static char timeStr[20];
-    static char sntpLastSyncTimeStr[20];
-    static char sntpNextSyncTimeStr[20];
-    static char activeOutputs[4*(OutputController::intChannels+OutputController::extChannels)+1];
-    static char activeOutputsStr[8*(OutputController::intChannels+OutputController::extChannels)+1];
     size_t preLen;
     size_t postLen;
 
-    // TBD: Compare more lax, i.e. allow little differences in batt voltage, etc.
-    int stateCmp = memcmp(&state, &lastState, sizeof(state_t));
+    if(!mqttPrepared) {
+        if(ESP_OK == esp_wifi_get_mac(ESP_IF_WIFI_STA, mac_addr)) {
+            preLen = strlen(mqttTopicPre);
+            memcpy(mqttStateTopic, mqttTopicPre, preLen);
+            memcpy(mqttTelemetryTopic, mqttTopicPre, preLen);
+            memcpy(mqttDiagTopic, mqttTopicPre, preLen);
+            for(int i=0; i<6; i++) {
+                sprintf(&mqttStateTopic[preLen+i*2], "%02x", mac_addr[i]);
+                sprintf(&mqttTelemetryTopic[preLen+i*2], "%02x", mac_addr[i]);
+                sprintf(&mqttDiagTopic[preLen+i*2], "%02x", mac_addr[i]);
+            }
+            postLen = strlen(mqttStateTopicPost);
+            memcpy(&mqttStateTopic[preLen+12], mqttStateTopicPost, postLen);
+            mqttStateTopic[preLen+12+postLen] = 0;
+            postLen = strlen(mqttTelemetryTopicPost);
+            memcpy(&mqttTelemetryTopic[preLen+12], mqttTelemetryTopicPost, postLen);
+            mqttTelemetryTopic[preLen+12+postLen] = 0;
+            postLen = strlen(mqttDiagTopicPost);
+            memcpy(&mqttDiagTopic[preLen+12], mqttDiagTopicPost, postLen);
+            mqttDiagTopic[preLen+12+postLen] = 0;
+            mqttPrepared = true;
+        } else {
+            ESP_LOGE(logTag, "Getting MAC address failed!");
+        }
+    }
+
+    return mqttPrepared;
+}
+
+/**
+ * @brief Publish all samples of the telemetry buffer as a single batch via MQTT.
+ * 
+ * The batch is encoded as map with the field names of the samples and the samples
+ * as arrays of values in the same order, e.g.
+ * {"fields":["time","batteryVoltage","batteryState","reservoirFillLevel","reservoirState"],"samples":[[...],...]}
+ * 
+ * On wakeups the network is only up if needed (see isNetworkNeeded()), so the batch is published
+ * right away. When kept awake, batches are published every telemetryUploadIntervalWakeups samples.
+ * Samples are removed from the buffer once the publish has been confirmed (see confirmTelemetryPublished()).
+ */
+void IrrigationController::publishTelemetry()
+{
+    static const char* const fieldNames[] = {"time", "batteryVoltage", "batteryState", "reservoirFillLevel", "reservoirState",
+        "reservoirFillLevelRaw"};
+    TelemetryBuffer::sample_t sample;
+    int count;
+
+    // The last publish may have been completed in the meantime
+    if(telemetryPublishPending && mqttMgr.waitAllPublished(0)) {
+        confirmTelemetryPublished();
+    }
+
+    count = telemetry.getCount();
+    if(!telemetryEnabled || (0 == count)) return;
+
+    // The network is up all the time when kept awake, so stick to the upload interval
+    if(pwrMgr.getKeepAwake() && (count < telemetryUploadIntervalWakeups) && !telemetry.isFull()) return;
+
+    if(false == mqttMgr.waitConnected(mqttConnectedWaitMillis)) {
+        ESP_LOGW(logTag, "MQTT manager has no connection after timeout.");
+    } else if(prepareMqttTopics()) {
+        CompactEncoder enc(mqttStateEncoding, mqttTelemetryData, mqttTelemetryDataMaxLen);
+
+        enc.beginMap();
+        enc.addKey("fields");
+        enc.beginArray(sizeof(fieldNames) / sizeof(fieldNames[0]));
+        for(int i = 0; i < sizeof(fieldNames) / sizeof(fieldNames[0]); i++) enc.addString(fieldNames[i]);
+        enc.endArray();
+        enc.addKey("samples");
+        enc.beginArray(count);
+        for(int i = 0; i < count; i++) {
+            telemetry.getSample(i, &sample);
+            enc.beginArray(6);
+            enc.addUint((uint32_t) sample.timestamp);
+            enc.addUint(sample.battVoltage);
+            enc.addUint(sample.battState);
+            enc.addInt(sample.fillLevel);
+            enc.addUint(sample.reservoirState);
+            enc.addUint(sample.fillLevelRaw);
+            enc.endArray();
+        }
+        enc.endArray();
+        enc.endMap();
+
+        if(enc.hasOverflowed()) {
+            ESP_LOGE(logTag, "Telemetry data buffer too small!");
+        } else if(MqttManager::ERR_OK == mqttMgr.publish(mqttTelemetryTopic, mqttTelemetryData, enc.getLength(),
+            MqttManager::QOS_EXACTLY_ONCE, false))
+        {
+            ESP_LOGD(logTag, "Published telemetry batch of %d samples (%u bytes).", count, enc.getLength());
+            telemetryPendingEndSeq = telemetry.getEndSeq();
+            telemetryPublishPending = true;
+        }
+    }
+}
+
+/**
+ * @brief Confirm that all MQTT messages have been published, i.e. also the last telemetry batch.
+ */
+void IrrigationController::confirmTelemetryPublished()
+{
+    if(telemetryPublishPending) {
+        telemetry.removeUpTo(telemetryPendingEndSeq);
+        telemetryPublishPending = false;
+    }
+}
+
+/**
+ * @brief Publish the wake cycle profiling statistics and the energy accounting via MQTT (retained).
+ * 
+ * The statistics are published along with the telemetry batches (or on every loop if
+ * telemetry is disabled), so they don't cause any additional network wakeups. All
+ * durations are in microseconds, e.g.
+ * {"scopes":{"boot":{"n":42,"min":...,"p50":...,"p90":...,"p99":...,"max":...,"mean":...},...}}
+ * 
+ * The energy accounting of the current and the last complete 24 hour window (if available) is
+ * added with times in seconds and charges in uAh ("uAhPerDay" is normalized to 24 hours), e.g.
+ * "energy":{"current":{"secs":...,"uAh":...,"uAhPerDay":...,"states":{"awake":...,...}},"lastDay":{...}}
+ */
+void IrrigationController::publishDiagnostics()
+{
+    WakeProfiler::scope_stats_t stats;
+    EnergyMeter::energy_stats_t energy;
+
+    if(telemetryEnabled && !telemetryPublishPending) return;
+
+    if(false == mqttMgr.waitConnected(mqttConnectedWaitMillis)) {
+        ESP_LOGW(logTag, "MQTT manager has no connection after timeout.");
+    } else if(prepareMqttTopics()) {
+        CompactEncoder enc(mqttStateEncoding, mqttDiagData, mqttDiagDataMaxLen);
+
+        enc.beginMap();
+        enc.addKey("scopes");
+        enc.beginMap();
+        for(int i = 0; i < WakeProfiler::SCOPE_MAX; i++) {
+            WakeProfiler::scope_t scope = (WakeProfiler::scope_t) i;
+            if(!wakeProfiler.getStats(scope, &stats)) continue;
+
+            enc.addKey(WAKE_PROFILER_SCOPE_TO_STR(scope));
+            enc.beginMap();
+            enc.addKey("n");
+            enc.addUint(stats.count);
+            enc.addKey("min");
+            enc.addUint(stats.minMicros);
+            enc.addKey("p50");
+            enc.addUint(stats.p50Micros);
+            enc.addKey("p90");
+            enc.addUint(stats.p90Micros);
+            enc.addKey("p99");
+            enc.addUint(stats.p99Micros);
+            enc.addKey("max");
+            enc.addUint(stats.maxMicros);
+            enc.addKey("mean");
+            enc.addUint(stats.meanMicros);
+            enc.endMap();
+        }
+        enc.endMap();
+        enc.addKey("energy");
+        enc.beginMap();
+        for(int w = 0; w < 2; w++) {
+            bool lastWindow = (1 == w);
+            if(!energyMeter.getStats(lastWindow, &energy)) continue;
+
+            enc.addKey(lastWindow ? "lastDay" : "current");
+            enc.beginMap();
+            enc.addKey("secs");
+            enc.addUint(energy.windowSeconds);
+            enc.addKey("uAh");
+            enc.addUint(energy.chargeMicroAmpHours);
+            enc.addKey("uAhPerDay");
+            enc.addUint(energy.dailyMicroAmpHours);
+            enc.addKey("states");
+            enc.beginMap();
+            for(int i = 0; i < EnergyMeter::STATE_MAX; i++) {
+                enc.addKey(ENERGY_METER_STATE_TO_STR((EnergyMeter::state_t) i));
+                enc.addUint(energy.seconds[i]);
+            }
+            enc.endMap();
+            enc.endMap();
+        }
+        enc.endMap();
+        enc.endMap();
+
+        if(enc.hasOverflowed()) {
+            ESP_LOGE(logTag, "Diagnostics data buffer too small!");
+        } else if(MqttManager::ERR_OK == mqttMgr.publish(mqttDiagTopic, mqttDiagData, enc.getLength(),
+            MqttManager::QOS_EXACTLY_ONCE, true))
+        {
+            ESP_LOGD(logTag, "Published diagnostics (%u bytes).", enc.getLength());
+        }
+    }
+}
 
-    if(0 != stateCmp) {
+/**
+ * @brief Publish currently stored state via MQTT.
+ * 
+ * It is meant to be called once per processing loop, so all state changes of a loop are
+ * coalesced into a single message. Nothing is sent if the state didn't change since the last
+ * confirmed publish (see confirmStatePublished()).
+ * 
+ * In delta mode (see mqttStateDeltaEnabled) only changed fields are published non-retained.
+ * Full states are published retained after cold boots and every mqttStateFullInterval updates.
+ * If a publish hasn't been confirmed, the next update will contain its fields again.
+ */
+void IrrigationController::publishStateUpdate()
+{
+    static published_state_t current;
+    uint32_t fields;
+    bool fullUpdate;
+
+    // The last publish may have been completed in the meantime
+    if(statePublishPending && mqttMgr.waitAllPublished(0)) {
+        confirmStatePublished();
+    }
+
+    getPublishedState(&current);
+    fields = getChangedStateFields(&current, &irrigCtrlPublishedState);
+    fullUpdate = (!mqttStateDeltaEnabled) || (!irrigCtrlPublishedState.valid) ||
+        (irrigCtrlPublishedState.deltasSinceFull >= mqttStateFullInterval);
+
+    if(0 != fields) {
         if(false == mqttMgr.waitConnected(mqttConnectedWaitMillis)) {
             ESP_LOGW(logTag, "MQTT manager has no connection after timeout.");
         } else {
-            if(!mqttPrepared) {
-                if(ESP_OK == esp_wifi_get_mac(ESP_IF_WIFI_STA, mac_addr)) {
-                    preLen = strlen(mqttTopicPre);
-                    postLen = strlen(mqttStateTopicPost);
-                    memcpy(mqttStateTopic, mqttTopicPre, preLen);
-                    for(int i=0; i<6; i++) {
-                        sprintf(&mqttStateTopic[preLen+i*2], "%02x", mac_addr[i]);
+            if(prepareMqttTopics()) {
+                if(fullUpdate) fields = STATE_FIELD_ALL;
+
+                size_t actualLen = encodeState(&current, fields);
+                if(0 == actualLen) {
+                    ESP_LOGE(logTag, "State data buffer too small!");
+                } else if(MqttManager::ERR_OK == mqttMgr.publish(mqttStateTopic, mqttStateData, actualLen,
+                    MqttManager::QOS_EXACTLY_ONCE, fullUpdate))
+                {
+                    ESP_LOGD(logTag, "Published %s state update (%u bytes).", fullUpdate ? "full" : "delta", actualLen);
+
+                    // The confirmed state consists of the last confirmed state + the fields sent now
+                    memcpy(&pendingPublishedState, fullUpdate ? &current : &irrigCtrlPublishedState, sizeof(published_state_t));
+                    if(0 != (fields & STATE_FIELD_BATT_VOLTAGE)) pendingPublishedState.battVoltage = current.battVoltage;
+                    if(0 != (fields & STATE_FIELD_BATT_STATE)) pendingPublishedState.battState = current.battState;
+                    if(0 != (fields & STATE_FIELD_FILL_LEVEL)) {
+                        pendingPublishedState.fillLevel = current.fillLevel;
+                        memcpy(pendingPublishedState.reservoirFillLevels, current.reservoirFillLevels, sizeof(current.reservoirFillLevels));
                     }
-                    memcpy(&mqttStateTopic[preLen+12], mqttStateTopicPost, postLen);
-                    mqttStateTopic[preLen+12+postLen] = 0;
-                    mqttPrepared = true;
-                } else {
-                    ESP_LOGE(logTag, "Getting MAC address failed!");
+                    if(0 != (fields & STATE_FIELD_RESERVOIR_STATE)) {
+                        pendingPublishedState.reservoirState = current.reservoirState;
+                        memcpy(pendingPublishedState.reservoirStates, current.reservoirStates, sizeof(current.reservoirStates));
+                    }
+                    if(0 != (fields & STATE_FIELD_ACTIVE_OUTPUTS)) {
+                        pendingPublishedState.numActiveOutputs = current.numActiveOutputs;
+                        memcpy(pendingPublishedState.activeOutputs, current.activeOutputs, sizeof(current.activeOutputs));
+                    }
+                    if(0 != (fields & STATE_FIELD_NEXT_EVENT)) pendingPublishedState.nextIrrigEvent = current.nextIrrigEvent;
+                    if(0 != (fields & STATE_FIELD_SNTP_LAST_SYNC)) pendingPublishedState.sntpLastSync = current.sntpLastSync;
+                    if(0 != (fields & STATE_FIELD_SNTP_NEXT_SYNC)) pendingPublishedState.sntpNextSync = current.sntpNextSync;
+                    pendingPublishedState.valid = true;
+                    pendingPublishedState.deltasSinceFull = fullUpdate ? 0 : (irrigCtrlPublishedState.deltasSinceFull + 1);
+                    statePublishPending = true;
                 }
             }
+        }
+    }
+}
+
+/**
+ * @brief Confirm that all MQTT messages have been published, i.e. also the last state update.
+ */
+void IrrigationController::confirmStatePublished()
+{
+    if(statePublishPending) {
+        memcpy(&irrigCtrlPublishedState, &pendingPublishedState, sizeof(published_state_t));
+        statePublishPending = false;
+    }
+}
 
-            if(mqttPrepared) {
-                // Prepare next irrigation string
-                struct tm nextIrrigEventTm;
-                localtime_r(&state.nextIrrigEvent, &nextIrrigEventTm);
-                strftime(timeStr, 20, "%Y-%m-%d %H:%M:%S", &nextIrrigEventTm);
+/**
+ * @brief Convert the currently stored state into its published representation.
+ */
+void IrrigationController::getPublishedState(published_state_t* dst)
+{
+    memset(dst, 0, sizeof(published_state_t));
+
+    dst->valid = true;
+    dst->fillLevel = state.fillLevel;
+    dst->reservoirState = state.reservoirState;
+    memcpy(dst->reservoirFillLevels, state.reservoirFillLevels, sizeof(dst->reservoirFillLevels));
+    memcpy(dst->reservoirStates, state.reservoirStates, sizeof(dst->reservoirStates));
+    dst->battVoltage = state.battVoltage;
+    dst->battState = state.battState;
+    for(std::vector<uint32_t>::iterator it = state.activeOutputs.begin();
+        (it != state.activeOutputs.end()) && (dst->numActiveOutputs < publishedStateMaxOutputs); it++)
+    {
+        dst->activeOutputs[dst->numActiveOutputs++] = *it;
+    }
+    dst->nextIrrigEvent = state.nextIrrigEvent;
+    dst->sntpLastSync = state.sntpLastSync;
+    dst->sntpNextSync = state.sntpNextSync;
+}
 
-                // Prepare next+last SNTP sync strings
-                struct tm sntpLastSyncTm;
-                localtime_r(&state.sntpLastSync, &sntpLastSyncTm);
-                strftime(sntpLastSyncTimeStr, 20, "%Y-%m-%d %H:%M:%S", &sntpLastSyncTm);
+/**
+ * @brief Determine the fields which differ between two published states.
+ * 
+ * @return uint32_t Changed fields (see state_field_t). All fields if last isn't valid.
+ */
+uint32_t IrrigationController::getChangedStateFields(const published_state_t* current, const published_state_t* last)
+{
+    uint32_t fields = 0;
+    uint32_t battVoltageDiff;
 
-                struct tm sntpNextSyncTm;
-                localtime_r(&state.sntpNextSync, &sntpNextSyncTm);
-                strftime(sntpNextSyncTimeStr, 20, "%Y-%m-%d %H:%M:%S", &sntpNextSyncTm);
-
-                // Prepare active outputs strings
-                activeOutputs[0] = '\0';
-                activeOutputsStr[0] = '\0';
-                for(std::vector<uint32_t>::iterator it = state.activeOutputs.begin(); it != state.activeOutputs.end(); it++) {
-                    snprintf(activeOutputs, sizeof(activeOutputs) / sizeof(activeOutputs[0]),
-                        "%s%s%d", activeOutputs, (it==state.activeOutputs.begin()) ? "" : ", ", *it);
-                    snprintf(activeOutputsStr, sizeof(activeOutputsStr) / sizeof(activeOutputsStr[0]),
-                        "%s%s\"%s\"", activeOutputsStr, (it==state.activeOutputs.begin()) ? "" : ", ", CH_MAP_TO_STR(*it));
-                }
+    if(!last->valid) return STATE_FIELD_ALL;
 
-                // Build the string to be send
-                size_t actualLen = snprintf(mqttStateData, mqttStateDataMaxLen, mqttStateDataFmt,
-                    state.battVoltage, state.battState, BATT_STATE_TO_STR(state.battState), 
-                    state.fillLevel, state.reservoirState, RESERVOIR_STATE_TO_STR(state.reservoirState),
-                    activeOutputs, activeOutputsStr, timeStr, sntpLastSyncTimeStr, sntpNextSyncTimeStr);
-                mqttMgr.publish(mqttStateTopic, mqttStateData, actualLen, MqttManager::QOS_EXACTLY_ONCE, true);
+    battVoltageDiff = (current->battVoltage > last->battVoltage) ? (current->battVoltage - last->battVoltage) :
+        (last->battVoltage - current->battVoltage);
+    if(battVoltageDiff >= mqttStateBattVoltageHysteresisMilli) fields |= STATE_FIELD_BATT_VOLTAGE;
+    if(current->battState != last->battState) fields |= STATE_FIELD_BATT_STATE;
+    if((current->fillLevel != last->fillLevel) ||
+        (0 != memcmp(current->reservoirFillLevels, last->reservoirFillLevels, sizeof(current->reservoirFillLevels))))
+    {
+        fields |= STATE_FIELD_FILL_LEVEL;
+    }
+    if((current->reservoirState != last->reservoirState) ||
+        (0 != memcmp(current->reservoirStates, last->reservoirStates, sizeof(current->reservoirStates))))
+    {
+        fields |= STATE_FIELD_RESERVOIR_STATE;
+    }
+    if((current->numActiveOutputs != last->numActiveOutputs) ||
+        (0 != memcmp(current->activeOutputs, last->activeOutputs, current->numActiveOutputs * sizeof(uint32_t))))
+    {
+        fields |= STATE_FIELD_ACTIVE_OUTPUTS;
+    }
+    if(current->nextIrrigEvent != last->nextIrrigEvent) fields |= STATE_FIELD_NEXT_EVENT;
+    if(current->sntpLastSync != last->sntpLastSync) fields |= STATE_FIELD_SNTP_LAST_SYNC;
+    if(current->sntpNextSync != last->sntpNextSync) fields |= STATE_FIELD_SNTP_NEXT_SYNC;
 
-                // Copy the sent state over to lastState, but only if we actually sent it and not in the other cases
-                memcpy(&lastState, &state, sizeof(state_t));
-            }
+    return fields;
+}
+
+/**
+ * @brief Encode the specified fields of a published state into mqttStateData.
+ * 
+ * @param src State to be encoded.
+ * @param fields Fields to be encoded (see state_field_t).
+ * @return size_t Length of the encoded data; 0 if the buffer is too small.
+ */
+size_t IrrigationController::encodeState(const published_state_t* src, uint32_t fields)
+{
+    static char timeStr[20];
+    struct tm timeTm;
+    CompactEncoder enc(mqttStateEncoding, mqttStateData, mqttStateDataMaxLen);
+
+    enc.beginMap();
+    if(0 != (fields & STATE_FIELD_BATT_VOLTAGE)) {
+        enc.addKey("batteryVoltage");
+        enc.addUint(src->battVoltage);
+    }
+    if(0 != (fields & STATE_FIELD_BATT_STATE)) {
+        enc.addKey("batteryState");
+        enc.addUint(src->battState);
+        enc.addKey("batteryStateStr");
+        enc.addString(BATT_STATE_TO_STR(src->battState));
+    }
+    if(0 != (fields & STATE_FIELD_FILL_LEVEL)) {
+        enc.addKey("reservoirFillLevel");
+        enc.addInt(src->fillLevel);
+        if(fillSensorNum > 1) {
+            enc.addKey("reservoirFillLevels");
+            enc.beginArray(fillSensorNum);
+            for(int i = 0; i < fillSensorNum; i++) enc.addInt(src->reservoirFillLevels[i]);
+            enc.endArray();
+        }
+    }
+    if(0 != (fields & STATE_FIELD_RESERVOIR_STATE)) {
+        enc.addKey("reservoirState");
+        enc.addUint(src->reservoirState);
+        enc.addKey("reservoirStateStr");
+        enc.addString(RESERVOIR_STATE_TO_STR(src->reservoirState));
+        if(fillSensorNum > 1) {
+            enc.addKey("reservoirStates");
+            enc.beginArray(fillSensorNum);
+            for(int i = 0; i < fillSensorNum; i++) enc.addUint(src->reservoirStates[i]);
+            enc.endArray();
         }
     }
+    if(0 != (fields & STATE_FIELD_ACTIVE_OUTPUTS)) {
+        enc.addKey("activeOutputs");
+        enc.beginArray(src->numActiveOutputs);
+        for(int i = 0; i < src->numActiveOutputs; i++) enc.addUint(src->activeOutputs[i]);
+        enc.endArray();
+        enc.addKey("activeOutputsStr");
+        enc.beginArray(src->numActiveOutputs);
+        for(int i = 0; i < src->numActiveOutputs; i++) enc.addString(CH_MAP_TO_STR(src->activeOutputs[i]));
+        enc.endArray();
+    }
+    if(0 != (fields & STATE_FIELD_NEXT_EVENT)) {
+        localtime_r(&src->nextIrrigEvent, &timeTm);
+        strftime(timeStr, 20, "%Y-%m-%d %H:%M:%S", &timeTm);
+        enc.addKey("nextIrrigationEvent");
+        enc.addString(timeStr);
+    }
+    if(0 != (fields & STATE_FIELD_SNTP_LAST_SYNC)) {
+        localtime_r(&src->sntpLastSync, &timeTm);
+        strftime(timeStr, 20, "%Y-%m-%d %H:%M:%S", &timeTm);
+        enc.addKey("sntpLastSync");
+        enc.addString(timeStr);
+    }
+    if(0 != (fields & STATE_FIELD_SNTP_NEXT_SYNC)) {
+        localtime_r(&src->sntpNextSync, &timeTm);
+        strftime(timeStr, 20, "%Y-%m-%d %H:%M:%S", &timeTm);
+        enc.addKey("sntpNextSync");
+        enc.addString(timeStr);
+    }
+    enc.endMap();
+
+    return enc.hasOverflowed() ? 0 : enc.getLength();
 }
 
 /**
@@ -856,6 +1822,19 @@ void IrrigationController::hardwareConfigUpdatedEventHandler()
     xEventGroupSetBits(extEvents, extEventHardwareConfigUpdated);
 }
 
+/**
+ * @brief Event timer callback, which wakes up the processing task waiting for an
+ * approaching event (see waitForEvent()).
+ * 
+ * @param arg Pointer to the IrrigationController instance
+ */
+void IrrigationController::eventTimerCb(void* arg)
+{
+    IrrigationController* caller = (IrrigationController*) arg;
+
+    xEventGroupSetBits(caller->extEvents, caller->extEventIrrigEventDue);
+}
+
 /**
  * @brief Emergency reboot timer callback, which will simply reset the device
  * to get back up in operational state.
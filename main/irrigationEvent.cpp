@@ -1,5 +1,9 @@
 #include "irrigationEvent.h"
 
+#ifdef IRRIGATION_EVENT_FAST_PATH_VERIFY
+#include "esp_log.h"
+#endif
+
 /**
  * @brief Default constructor, which performs basic initialization.
  */
@@ -8,6 +12,9 @@ IrrigationEvent::IrrigationEvent(void)
     // make this event invalid
     repetitionType = NOT_SET;
     refTime = 0;
+    eventDaySecs = 0;
+    eventLocalSecs = 0;
+    dayMask = 0;
 
     eventData.zoneIdx = -1;
     eventData.durationSecs = 1;
@@ -24,7 +31,7 @@ IrrigationEvent::~IrrigationEvent(void)
 
 IrrigationEvent::err_t IrrigationEvent::setZoneIndex(int idx)
 {
-    if((idx < -1) || (idx >= irrigationZoneCfgElements)) {
+    if((idx < -1) || (idx >= (int) irrigationPlannerNumZones)) {
         return ERR_INVALID_PARAM;
     }
 
@@ -71,6 +78,9 @@ IrrigationEvent::err_t IrrigationEvent::setSingleEvent(int hour, int minute, int
         eventTime.tm_year = year - 1900;
         eventTime.tm_isdst = -1;
 
+        eventDaySecs = hour*60*60 + minute*60 + second;
+        eventLocalSecs = TimeSystem_CivilToLocalSecs(year, month, day, hour, minute, second);
+
         repetitionType = SINGLE;
     }
 
@@ -90,12 +100,130 @@ IrrigationEvent::err_t IrrigationEvent::setDailyRepetition(int hour, int minute,
         eventTime.tm_min = minute;
         eventTime.tm_sec = second;
 
+        eventDaySecs = hour*60*60 + minute*60 + second;
+
         repetitionType = DAILY;
     }
 
     return ret;
 }
 
+/**
+ * @brief Set a weekly repetition on the given weekdays.
+ * 
+ * @param hour Hour of the event.
+ * @param minute Minute of the event.
+ * @param second Second of the event.
+ * @param weekdayMask Weekdays of the event, bit 0 is Sunday, bit 6 is Saturday (like tm_wday).
+ * @return err_t ERR_OK on success, ERR_INVALID_TIME otherwise.
+ */
+IrrigationEvent::err_t IrrigationEvent::setWeeklyRepetition(int hour, int minute, int second, uint32_t weekdayMask)
+{
+    if((0 == weekdayMask) || (0 != (weekdayMask & ~weekdayMaskAll))) return ERR_INVALID_TIME;
+
+    err_t ret = setDailyRepetition(hour, minute, second);
+    if(ERR_OK == ret) {
+        dayMask = weekdayMask;
+        repetitionType = WEEKLY;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Set a monthly repetition on the given days of the month.
+ * 
+ * Note: Days which don't exist in a month (e.g. the 31st in April) are skipped.
+ * 
+ * @param hour Hour of the event.
+ * @param minute Minute of the event.
+ * @param second Second of the event.
+ * @param monthdayMask Days of the event, bit 0 is the 1st, bit 30 is the 31st.
+ * @return err_t ERR_OK on success, ERR_INVALID_TIME otherwise.
+ */
+IrrigationEvent::err_t IrrigationEvent::setMonthlyRepetition(int hour, int minute, int second, uint32_t monthdayMask)
+{
+    if((0 == monthdayMask) || (0 != (monthdayMask & ~monthdayMaskAll))) return ERR_INVALID_TIME;
+
+    err_t ret = setDailyRepetition(hour, minute, second);
+    if(ERR_OK == ret) {
+        dayMask = monthdayMask;
+        repetitionType = MONTHLY;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Export the configuration of this event in its plain representation.
+ * 
+ * @param dest Pointer to the destination storage.
+ */
+void IrrigationEvent::getConfig(irrigation_event_cfg_t* dest) const
+{
+    memset(dest, 0, sizeof(irrigation_event_cfg_t));
+
+    dest->repetitionType = (uint8_t) repetitionType;
+    if(repetitionType != NOT_SET) {
+        dest->hour = eventTime.tm_hour;
+        dest->minute = eventTime.tm_min;
+        dest->second = eventTime.tm_sec;
+    }
+    if(repetitionType == SINGLE) {
+        dest->day = eventTime.tm_mday;
+        dest->month = eventTime.tm_mon + 1;
+        dest->year = eventTime.tm_year + 1900;
+    }
+    if((repetitionType == WEEKLY) || (repetitionType == MONTHLY)) {
+        dest->dayMask = dayMask;
+    }
+    dest->zoneIdx = eventData.zoneIdx;
+    dest->durationSecs = eventData.durationSecs;
+    dest->isStart = eventData.isStart;
+}
+
+/**
+ * @brief Import the configuration of this event from its plain representation.
+ * 
+ * Note: The data is validated the same way the individual setters do.
+ * 
+ * @param src Pointer to the source storage.
+ * @return err_t ERR_OK on success, ERR_INVALID_PARAM or ERR_INVALID_TIME otherwise.
+ */
+IrrigationEvent::err_t IrrigationEvent::setConfig(const irrigation_event_cfg_t* src)
+{
+    err_t ret = ERR_OK;
+
+    switch(src->repetitionType) {
+        case NOT_SET:
+            repetitionType = NOT_SET;
+            break;
+        case SINGLE:
+            ret = setSingleEvent(src->hour, src->minute, src->second, src->day, src->month, src->year);
+            break;
+        case DAILY:
+            ret = setDailyRepetition(src->hour, src->minute, src->second);
+            break;
+        case WEEKLY:
+            ret = setWeeklyRepetition(src->hour, src->minute, src->second, src->dayMask);
+            break;
+        case MONTHLY:
+            ret = setMonthlyRepetition(src->hour, src->minute, src->second, src->dayMask);
+            break;
+        default:
+            ret = ERR_INVALID_PARAM;
+            break;
+    }
+
+    if(ERR_OK == ret) ret = setZoneIndex(src->zoneIdx);
+    if(ERR_OK == ret) {
+        setDuration(src->durationSecs);
+        setStartFlag(src->isStart);
+    }
+
+    return ret;
+}
+
 /**
  * @brief Update the reference time for this event.
  * 
@@ -109,6 +237,14 @@ void IrrigationEvent::updateReferenceTime(time_t ref)
     refTime = ref;
 }
 
+/**
+ * @brief Return wether or not this is a repetitive (i.e. daily, weekly or monthly) event.
+ */
+bool IrrigationEvent::isRepetitive(void) const
+{
+    return (repetitionType == DAILY) || (repetitionType == WEEKLY) || (repetitionType == MONTHLY);
+}
+
 /**
  * @brief Get the reference time for this event.
  * 
@@ -125,9 +261,62 @@ time_t IrrigationEvent::getReferenceTime(void)
  * Note: If an event has exactly the same time as the reference, it will be reported
  * as the next occurance, i.e. it will not be reported for the following day/week/month.
  * 
+ * The calculation is done with plain integer arithmetic on local seconds based on the
+ * DST table of the TimeSystem. The results are identical to the mktime based
+ * calculation, which is used as fallback if the table doesn't cover the times in question.
+ * 
  * @return time_t Time of next occurance.
  */
 time_t IrrigationEvent::getNextOccurance(void) const
+{
+    time_t next = 0;
+    time_t refLocal;
+    time_t refDayStart;
+    bool fastPath = false;
+
+    if(repetitionType == SINGLE) {
+        fastPath = TimeSystem_LocalSecsToUtc(eventLocalSecs, &next);
+    }
+    else if((repetitionType == DAILY) || (repetitionType == WEEKLY) || (repetitionType == MONTHLY)) {
+        if(TimeSystem_UtcToLocalSecs(refTime, &refLocal)) {
+            refDayStart = refLocal - (((refLocal % secsPerDay) + secsPerDay) % secsPerDay);
+
+            // Adjust day in case event has already passed today
+            refLocal = (refDayStart + eventDaySecs < refLocal) ? (refDayStart + eventDaySecs + secsPerDay) :
+                (refDayStart + eventDaySecs);
+
+            if(repetitionType != DAILY) {
+                struct tm dayTm;
+                gmtime_r(&refLocal, &dayTm); // local seconds are UTC based, so this just splits the calendar fields
+                refLocal += getDayOffset(dayTm.tm_year + 1900, dayTm.tm_mon + 1, dayTm.tm_mday, dayTm.tm_wday) * secsPerDay;
+            }
+
+            fastPath = TimeSystem_LocalSecsToUtc(refLocal, &next);
+        }
+    }
+
+    if(!fastPath) {
+        next = getNextOccuranceMktime();
+    }
+#ifdef IRRIGATION_EVENT_FAST_PATH_VERIFY
+    else if(next != getNextOccuranceMktime()) {
+        ESP_LOGE("irrig_evt", "Fast path mismatch (ref: %ld, fast: %ld, mktime: %ld)",
+            (long) refTime, (long) next, (long) getNextOccuranceMktime());
+    }
+#endif
+
+    if(next < refTime) next = 0; // don't return events in the past
+    return next;
+}
+
+/**
+ * @brief Get the next occurance of this event based on the set reference time by using mktime.
+ * 
+ * Note: Events in the past are NOT filtered.
+ * 
+ * @return time_t Time of next occurance.
+ */
+time_t IrrigationEvent::getNextOccuranceMktime(void) const
 {
     time_t next = 0;
 
@@ -138,7 +327,7 @@ time_t IrrigationEvent::getNextOccurance(void) const
     if(repetitionType == SINGLE) {
         next = mktime(&eventTm);
     }
-    else if(repetitionType == DAILY) {
+    else if((repetitionType == DAILY) || (repetitionType == WEEKLY) || (repetitionType == MONTHLY)) {
         // Convert reference time_t for easier handling
         localtime_r(&refTime, &refTm);
 
@@ -162,12 +351,82 @@ time_t IrrigationEvent::getNextOccurance(void) const
         nextTm.tm_isdst = -1;
 
         next = mktime(&nextTm);
+
+        // Move on to the next matching day (mktime above normalized the date and set the weekday)
+        if(repetitionType != DAILY) {
+            nextTm.tm_mday += getDayOffset(nextTm.tm_year + 1900, nextTm.tm_mon + 1, nextTm.tm_mday, nextTm.tm_wday);
+            nextTm.tm_hour = eventTm.tm_hour;
+            nextTm.tm_min = eventTm.tm_min;
+            nextTm.tm_sec = eventTm.tm_sec;
+            nextTm.tm_isdst = -1;
+
+            next = mktime(&nextTm);
+        }
     }
 
-    if(next < refTime) next = 0; // don't return events in the past
     return next;
 }
 
+/**
+ * @brief Get the number of days from the given date to the next day matching the day mask
+ * of weekly/monthly events.
+ * 
+ * The day is found by bit scans of the (rotated/shifted) mask, i.e. without iterating day by day.
+ * 
+ * @param year Year of the date.
+ * @param month Month of the date (1..12).
+ * @param mday Day of the month of the date (1..31).
+ * @param wday Day of the week of the date (0 = Sunday).
+ * @return int Number of days, 0 if the date itself matches.
+ */
+int IrrigationEvent::getDayOffset(int year, int month, int mday, int wday) const
+{
+    int offset = 0;
+
+    if(repetitionType == WEEKLY) {
+        // rotate the mask, so bit 0 represents the weekday of the date
+        uint32_t rotated = ((dayMask >> wday) | (dayMask << (7 - wday))) & weekdayMaskAll;
+        if(0 != rotated) offset = __builtin_ctz(rotated);
+    }
+    else if(repetitionType == MONTHLY) {
+        // the remaining days of the current month, otherwise the first matching day of the following months
+        // Note: Each day of the month exists at least every other month (29th-31st), so this terminates quickly.
+        for(int i = 0; i < 13; i++) {
+            int daysInMonth = getDaysInMonth(year, month);
+            uint32_t remaining = (dayMask & (monthdayMaskAll >> (31 - daysInMonth))) >> (mday - 1);
+
+            if(0 != remaining) {
+                offset += __builtin_ctz(remaining);
+                break;
+            }
+
+            offset += daysInMonth - mday + 1;
+            mday = 1;
+            if(++month > 12) {
+                month = 1;
+                year++;
+            }
+        }
+    }
+
+    return offset;
+}
+
+/**
+ * @brief Get the number of days of a month.
+ * 
+ * @param year Year.
+ * @param month Month (1..12).
+ * @return int Number of days.
+ */
+int IrrigationEvent::getDaysInMonth(int year, int month)
+{
+    static const int daysInMonth[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leapYear = ((year % 4) == 0) && (((year % 100) != 0) || ((year % 400) == 0));
+
+    return ((month == 2) && leapYear) ? 29 : daysInMonth[month - 1];
+}
+
 /**
  * @brief Implementation of the 'equality' operator.
  * All operators are based on the event's time info only. The configuration
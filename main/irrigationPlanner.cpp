@@ -20,18 +20,40 @@ IrrigationPlanner::IrrigationPlanner()
         for(int j=0; j < irrigationZoneCfgElements; j++) {
             zones[i].chEnabled[j] = false;
         }
+        zones[i].reservoirIdx = 0;
     }
     for(int i = 0; i < irrigationPlannerNumEvents; i++) {
         eventsUsed[i] = false;
+        eventsNext[i] = 0;
+        eventsPos[i] = -1;
     }
     for(int i = 0; i < irrigationPlannerNumStopEvents; i++) {
         stopEventsUsed[i] = false;
+        stopEventsNext[i] = 0;
+        stopEventsPos[i] = -1;
+        // lowest index on top of the stack
+        stopEventsFree[i] = irrigationPlannerNumStopEvents - 1 - i;
     }
+    stopEventsFreeCnt = irrigationPlannerNumStopEvents;
+
+    timelineEntries = 0;
+    timelineRefTime = 0;
+    timelineValid = false;
+
+    configLock = false;
+    for(int k = 0; k < 2; k++) {
+        for(int i = 0; i < irrigationPlannerNumNormalEvents; i++) {
+            configBufs[k].eventsUsed[i] = false;
+        }
+    }
+    configEpoch = 0;
+    configReadingEpoch = configEpochNone;
+    configAdoptedEpoch = 0;
 
     configUpdatedHook = nullptr;
     configUpdatedHookParamPtr = nullptr;
 
-    accessMutex = xSemaphoreCreateMutexStatic(&accessMutexBuf);
+    publishMutex = xSemaphoreCreateMutexStatic(&publishMutexBuf);
     hookMutex = xSemaphoreCreateMutexStatic(&hookMutexBuf);
 }
 
@@ -46,6 +68,7 @@ IrrigationPlanner::~IrrigationPlanner()
         for(int j=0; j < irrigationZoneCfgElements; j++) {
             zones[i].chEnabled[j] = false;
         }
+        zones[i].reservoirIdx = 0;
     }
     for(int i = 0; i < irrigationPlannerNumEvents; i++) {
         eventsUsed[i] = false;
@@ -54,13 +77,16 @@ IrrigationPlanner::~IrrigationPlanner()
         stopEventsUsed[i] = false;
     }
 
-    if (accessMutex) vSemaphoreDelete(accessMutex);
+    if (publishMutex) vSemaphoreDelete(publishMutex);
     if (hookMutex) vSemaphoreDelete(hookMutex);
 }
 
 /**
  * @brief Get the time of the next occuring event starting at startTime.
  * 
+ * The result is taken from the cached timeline. Only events that occured before
+ * startTime will be recalculated, i.e. repeated lookups are cheap.
+ * 
  * @param startTime Start time to consider for searching the next occurance
  * @param excludeStartTime If true, only search for events later than startTime, not equal.
  * @return time_t Time of the next occuring event.
@@ -69,88 +95,300 @@ time_t IrrigationPlanner::getNextEventTime(time_t startTime, bool excludeStartTi
 {
     time_t nextEventTime = 0;
 
-    int nextStartEventIdx;
-    int nextStopEventIdx;
-
     if(excludeStartTime) {
-        // convert startTime to time to easily increase the startTime by one sec
-        struct tm startTimeTm;
-        localtime_r(&startTime, &startTimeTm);
-        startTimeTm.tm_sec++;
-        // and convert it back to time_t, inc. wrap-arounds
-        startTime = mktime(&startTimeTm);
+        // time_t is a plain second counter, so no need for a localtime/mktime roundtrip
+        startTime++;
     }
 
-    if (pdFALSE == xSemaphoreTake(accessMutex, lockAcquireTimeout)) {
-        ESP_LOGE(logTag, "Couldn't acquire access lock within timeout!");
-    } else {
-        // getting the index will update all of the reference times as well
-        nextStartEventIdx = getNextEventIdx(startTime, events, eventsUsed, irrigationPlannerNumEvents);
-        nextStopEventIdx = getNextEventIdx(startTime, stopEvents, stopEventsUsed, irrigationPlannerNumStopEvents);
-
-        if(nextStartEventIdx >= 0) {
-            if(nextStopEventIdx >= 0) {
-                if(events[nextStartEventIdx] < stopEvents[nextStopEventIdx]) {
-                    nextEventTime = events[nextStartEventIdx].getNextOccurance();
-                } else {
-                    nextEventTime = stopEvents[nextStopEventIdx].getNextOccurance();
-                }
-            } else {
-                nextEventTime = events[nextStartEventIdx].getNextOccurance();
-            }
-        } else {
-            if(nextStopEventIdx >= 0) {
-                nextEventTime = stopEvents[nextStopEventIdx].getNextOccurance();
-            }
-        }
+    configAdopt();
+    timelineAdvance(startTime);
 
-        xSemaphoreGive(accessMutex);
+    if(timelineEntries > 0) {
+        nextEventTime = timeline[0].time;
     }
 
     return nextEventTime;
 }
 
 /**
- * @brief Get the index of the next upcoming event in the specified list.
+ * @brief Get the event object corresponding to the specified handle.
  * 
- * @param startTime Start time to consider for searching the next occurance
- * @param eventList Event list to search.
- * @param eventUsedList Used event list corresponding to eventList.
- * @return int Inedx the next occuring event within the list.
+ * Note: The handle is expected to be range checked already.
+ * 
+ * @param handle Handle of the event.
+ * @return IrrigationEvent* Pointer to the event.
+ */
+IrrigationEvent* IrrigationPlanner::getEventByHandle(event_handle_t handle)
+{
+    return handle.isStart ? &events[handle.idx] : &stopEvents[handle.idx];
+}
+
+/**
+ * @brief Get the cached next occurance storage corresponding to the specified handle.
+ * 
+ * Note: The handle is expected to be range checked already.
+ * 
+ * @param handle Handle of the event.
+ * @return time_t* Pointer to the cached next occurance.
+ */
+time_t* IrrigationPlanner::getCachedNextByHandle(event_handle_t handle)
+{
+    return handle.isStart ? &eventsNext[handle.idx] : &stopEventsNext[handle.idx];
+}
+
+/**
+ * @brief Get the timeline position storage corresponding to the specified handle.
+ * 
+ * Note: The handle is expected to be range checked already.
+ * 
+ * @param handle Handle of the event.
+ * @return int* Pointer to the timeline position.
+ */
+int* IrrigationPlanner::getTimelinePosByHandle(event_handle_t handle)
+{
+    return handle.isStart ? &eventsPos[handle.idx] : &stopEventsPos[handle.idx];
+}
+
+/**
+ * @brief Get the next occurance of an event starting at startTime and update its reference time accordingly.
+ * 
+ * The occurance of a repetitive event may not exist for a day, e.g. if its time falls into a DST switch.
+ * In that case, the reference time is moved forward in steps of timelineRetryStepSecs, until the
+ * following occurance is found. Otherwise the event would be missing from the timeline
+ * until the next rebuild.
+ * 
+ * Note: Only to be called from the schedule accessors.
+ * 
+ * @param evt Event to be calculated.
+ * @param startTime Start time to consider for calculating the next occurance.
+ * @return time_t Next occurance, 0 if there is none (e.g. single events in the past).
+ */
+time_t IrrigationPlanner::timelineNextOccurance(IrrigationEvent* evt, time_t startTime)
+{
+    time_t next;
+
+    evt->updateReferenceTime(startTime);
+    next = evt->getNextOccurance();
+
+    for(int i = 1; (next == 0) && evt->isRepetitive() && (i <= timelineRetryMaxSteps); i++) {
+        evt->updateReferenceTime(startTime + i * timelineRetryStepSecs);
+        next = evt->getNextOccurance();
+    }
+
+    #ifdef IRRIGATION_PLANNER_NEXT_EVENT_DEBUG
+        if((next == 0) && evt->isRepetitive()) {
+            ESP_LOGD(logTag, "No occurance of repetitive event found.");
+        }
+    #endif
+
+    return next;
+}
+
+/**
+ * @brief Recalculate the whole timeline for all used events and stop events.
+ * 
+ * Note: Only to be called from the schedule accessors.
+ * 
+ * @param startTime Start time to consider for calculating the next occurances.
  */
-int IrrigationPlanner::getNextEventIdx(time_t startTime, IrrigationEvent* eventList, bool* eventUsedList, 
-    unsigned int listElements)
-{
-    int nextIdx = -1;
-    IrrigationEvent* nextEvent = nullptr;
-
-    for(int i=0; i < listElements; i++) {
-        if((nullptr != nextEvent) && eventUsedList[i]) {
-            eventList[i].updateReferenceTime(startTime);
-            if((eventList[i].getNextOccurance() != 0) && (eventList[i] < *nextEvent)) {
-                nextIdx = i;
-                nextEvent = &eventList[i];
-
-                #ifdef IRRIGATION_PLANNER_NEXT_EVENT_DEBUG
-                    printEventDetails(nextEvent);
-                    ESP_LOGD(logTag, "This is our new candidate!");
-                #endif
+void IrrigationPlanner::timelineRebuild(time_t startTime)
+{
+    event_handle_t handle;
+    time_t next;
+
+    timelineEntries = 0;
+
+    for(int i = 0; i < irrigationPlannerNumEvents; i++) {
+        eventsNext[i] = 0;
+        eventsPos[i] = -1;
+        if(eventsUsed[i]) {
+            next = timelineNextOccurance(&events[i], startTime);
+            if(next != 0) {
+                handle.idx = i;
+                handle.isStart = true;
+                timelinePush(next, handle);
+            }
+        }
+    }
+
+    for(int i = 0; i < irrigationPlannerNumStopEvents; i++) {
+        stopEventsNext[i] = 0;
+        stopEventsPos[i] = -1;
+        if(stopEventsUsed[i]) {
+            next = timelineNextOccurance(&stopEvents[i], startTime);
+            if(next != 0) {
+                handle.idx = i;
+                handle.isStart = false;
+                timelinePush(next, handle);
             }
-        } else if(eventUsedList[i]) {
-            eventList[i].updateReferenceTime(startTime);
-            if(eventList[i].getNextOccurance() != 0) {
-                nextIdx = i;
-                nextEvent = &eventList[i];
-
-                #ifdef IRRIGATION_PLANNER_NEXT_EVENT_DEBUG
-                    printEventDetails(nextEvent);
-                    ESP_LOGD(logTag, "This is our new candidate!");
-                #endif
+        }
+    }
+
+    timelineRefTime = startTime;
+    timelineValid = true;
+
+    #ifdef IRRIGATION_PLANNER_NEXT_EVENT_DEBUG
+        ESP_LOGD(logTag, "Timeline rebuilt with %d entries.", timelineEntries);
+    #endif
+}
+
+/**
+ * @brief Move the timeline forward to the specified start time.
+ * 
+ * Only entries occuring before startTime are recalculated. All other entries
+ * will still have the same next occurance. If startTime lies before the time
+ * the timeline has been calculated for (e.g. due to a time set), it will be
+ * rebuilt entirely.
+ * 
+ * Note: Only to be called from the schedule accessors.
+ * 
+ * @param startTime Start time to consider for calculating the next occurances.
+ */
+void IrrigationPlanner::timelineAdvance(time_t startTime)
+{
+    timeline_entry_t entry;
+    IrrigationEvent* evt;
+    time_t next;
+
+    if(!timelineValid || (startTime < timelineRefTime)) {
+        timelineRebuild(startTime);
+    } else {
+        while((timelineEntries > 0) && (timeline[0].time < startTime)) {
+            entry = timeline[0];
+            timelineRemoveAt(0);
+
+            evt = getEventByHandle(entry.handle);
+            next = timelineNextOccurance(evt, startTime);
+            if(next != 0) {
+                timelinePush(next, entry.handle);
             }
+
+            #ifdef IRRIGATION_PLANNER_NEXT_EVENT_DEBUG
+                printEventDetails(evt);
+                ESP_LOGD(logTag, "Recalculated passed timeline entry.");
+            #endif
+        }
+
+        timelineRefTime = startTime;
+    }
+}
+
+/**
+ * @brief Add an event occurance to the timeline.
+ * 
+ * Note: Only to be called from the schedule accessors.
+ * 
+ * @param time Next occurance of the event.
+ * @param handle Handle of the event.
+ */
+void IrrigationPlanner::timelinePush(time_t time, event_handle_t handle)
+{
+    if(timelineEntries >= timelineMaxEntries) {
+        ESP_LOGE(logTag, "Timeline is full. This can't happen!");
+    } else {
+        timeline_entry_t entry = {.time = time, .handle = handle};
+
+        timelineSet(timelineEntries, entry);
+        timelineEntries++;
+        timelineSiftUp(timelineEntries - 1);
+
+        *getCachedNextByHandle(handle) = time;
+    }
+}
+
+/**
+ * @brief Remove an event from the timeline, if it is part of it.
+ * 
+ * Note: Only to be called from the schedule accessors.
+ * 
+ * @param handle Handle of the event to be removed.
+ */
+void IrrigationPlanner::timelineRemove(event_handle_t handle)
+{
+    int pos = *getTimelinePosByHandle(handle);
+
+    if(pos >= 0) {
+        timelineRemoveAt(pos);
+    }
+
+    *getCachedNextByHandle(handle) = 0;
+}
+
+/**
+ * @brief Remove the entry at the specified heap position from the timeline.
+ * 
+ * Note: Only to be called from the schedule accessors.
+ * 
+ * @param pos Heap position of the entry, 0 being the next occuring one.
+ */
+void IrrigationPlanner::timelineRemoveAt(unsigned int pos)
+{
+    event_handle_t handle = timeline[pos].handle;
+
+    *getTimelinePosByHandle(handle) = -1;
+    *getCachedNextByHandle(handle) = 0;
+
+    timelineEntries--;
+    if(pos < timelineEntries) {
+        // fill the gap with the last entry and restore the heap order
+        timelineSet(pos, timeline[timelineEntries]);
+        if((pos > 0) && (timeline[pos].time < timeline[(pos - 1) / 2].time)) {
+            timelineSiftUp(pos);
+        } else {
+            timelineSiftDown(pos);
         }
     }
+}
 
-    return nextIdx;
+/**
+ * @brief Store an entry at the specified heap position and keep track of its position.
+ * 
+ * Note: Only to be called from the schedule accessors.
+ */
+void IrrigationPlanner::timelineSet(unsigned int pos, const timeline_entry_t& entry)
+{
+    timeline[pos] = entry;
+    *getTimelinePosByHandle(entry.handle) = pos;
+}
+
+/**
+ * @brief Move the entry at the specified heap position up until the heap order is restored.
+ * 
+ * Note: Only to be called from the schedule accessors.
+ */
+void IrrigationPlanner::timelineSiftUp(unsigned int pos)
+{
+    timeline_entry_t entry = timeline[pos];
+
+    while(pos > 0) {
+        unsigned int parent = (pos - 1) / 2;
+        if(timeline[parent].time <= entry.time) break;
+        timelineSet(pos, timeline[parent]);
+        pos = parent;
+    }
+
+    timelineSet(pos, entry);
+}
+
+/**
+ * @brief Move the entry at the specified heap position down until the heap order is restored.
+ * 
+ * Note: Only to be called from the schedule accessors.
+ */
+void IrrigationPlanner::timelineSiftDown(unsigned int pos)
+{
+    timeline_entry_t entry = timeline[pos];
+
+    while(true) {
+        unsigned int child = 2 * pos + 1;
+        if(child >= timelineEntries) break;
+        if((child + 1 < timelineEntries) && (timeline[child + 1].time < timeline[child].time)) child++;
+        if(entry.time <= timeline[child].time) break;
+        timelineSet(pos, timeline[child]);
+        pos = child;
+    }
+
+    timelineSet(pos, entry);
 }
 
 /**
@@ -172,13 +410,13 @@ IrrigationPlanner::err_t IrrigationPlanner::getEventHandles(time_t eventTime,
     err_t ret = IrrigationPlanner::ERR_OK;
 
     unsigned int handleCnt = 0;
-    time_t checkEventTime = 0;
 
-    // check start event list
-    for(int i=0; i < irrigationPlannerNumEvents; i++) {
-        if(eventsUsed[i]) {
-            checkEventTime = events[i].getNextOccurance();
-            if(checkEventTime == eventTime) {
+    // Note: The cached next occurances are taken from the timeline. Events not being
+    // part of it (e.g. unused ones) are set to 0, so no need to check the used flags.
+    if(eventTime != 0) {
+        // check start event list
+        for(int i=0; i < irrigationPlannerNumEvents; i++) {
+            if(eventsNext[i] == eventTime) {
                 if(handleCnt < maxElements) {
                     dest[handleCnt].idx = i;
                     dest[handleCnt].isStart = true;
@@ -189,13 +427,10 @@ IrrigationPlanner::err_t IrrigationPlanner::getEventHandles(time_t eventTime,
                 }
             }
         }
-    }
 
-    // check stop event list
-    for(int i=0; i < irrigationPlannerNumStopEvents; i++) {
-        if(stopEventsUsed[i]) {
-            checkEventTime = stopEvents[i].getNextOccurance();
-            if(checkEventTime == eventTime) {
+        // check stop event list
+        for(int i=0; i < irrigationPlannerNumStopEvents; i++) {
+            if(stopEventsNext[i] == eventTime) {
                 if(handleCnt < maxElements) {
                     dest[handleCnt].idx = i;
                     dest[handleCnt].isStart = false;
@@ -301,6 +536,62 @@ IrrigationPlanner::err_t IrrigationPlanner::confirmEvent(IrrigationPlanner::even
     return ret;
 }
 
+/**
+ * @brief Add a stop event and enqueue it in the timeline, so it is immediately available.
+ * 
+ * @param stopTime Time of the stop event.
+ * @param zoneIdx Zone to be stopped.
+ * @param refTime Reference time of the stop event.
+ * @return IrrigationPlanner::err_t
+ * @retval ERR_OK Success.
+ * @retval ERR_NO_STOP_SLOT_AVAIL No stop event slot available.
+ */
+IrrigationPlanner::err_t IrrigationPlanner::addStopEvent(time_t stopTime, int zoneIdx, time_t refTime)
+{
+    struct tm stopTimeTm;
+
+    if(0 == stopEventsFreeCnt) {
+        ESP_LOGE(logTag, "No stop event slot available!");
+        return ERR_NO_STOP_SLOT_AVAIL;
+    }
+
+    unsigned int i = stopEventsFree[--stopEventsFreeCnt];
+
+    // Mark the slot as used
+    stopEventsUsed[i] = true;
+
+    localtime_r(&stopTime, &stopTimeTm);
+    #ifdef IRRIGATION_PLANNER_STOP_EVENT_DEBUG
+        ESP_LOGD(logTag, "after recalc: stopTime: %lu", stopTime);
+        ESP_LOGD(logTag, "after recalc: stopTimeTm: %d.%d.%d %d:%d:%d",
+            stopTimeTm.tm_mday, stopTimeTm.tm_mon, stopTimeTm.tm_year,
+            stopTimeTm.tm_hour, stopTimeTm.tm_min, stopTimeTm.tm_sec);
+    #endif
+
+    // And now set properties of the stop event
+    stopEvents[i].setSingleEvent(stopTimeTm.tm_hour, stopTimeTm.tm_min, stopTimeTm.tm_sec,
+        stopTimeTm.tm_mday, stopTimeTm.tm_mon + 1, stopTimeTm.tm_year + 1900);
+    stopEvents[i].setStartFlag(false);
+    stopEvents[i].setDuration(0);
+    stopEvents[i].setZoneIndex(zoneIdx);
+    stopEvents[i].updateReferenceTime(refTime);
+
+    // Enqueue the stop event in the timeline, so it is immediately available
+    if(timelineValid) {
+        time_t stopNext = stopEvents[i].getNextOccurance();
+        if(stopNext != 0) {
+            event_handle_t stopHandle = {.idx = (int) i, .isStart = false};
+            timelinePush(stopNext, stopHandle);
+        }
+    }
+
+    #ifdef IRRIGATION_PLANNER_STOP_EVENT_DEBUG
+        printEventDetails(&stopEvents[i]);
+    #endif
+
+    return ERR_OK;
+}
+
 /**
  * @brief Confirm a normal event to proceed it in the schedule
  * 
@@ -314,62 +605,34 @@ bool IrrigationPlanner::confirmNormalEvent(unsigned int idx)
     bool ret = false;
     IrrigationEvent::irrigation_event_data_t evtData;
 
-    for(int i=0; i<irrigationPlannerNumStopEvents; i++) {
-        if(!stopEventsUsed[i]) {
-            // Mark the slot as used
-            stopEventsUsed[i] = true;
-
-            // get event data
-            IrrigationEvent::err_t eventErr;
-            eventErr = events[idx].getEventData(&evtData);
-            if(IrrigationEvent::ERR_OK != eventErr) {
-                ESP_LOGE(logTag, "Error getting event data: %d. Cannot add stop event!", eventErr);
-            } else {
-                // Calculate the actual time
-                time_t stopTime = events[idx].getNextOccurance();
-
-                // a) Convert reference time_t to struct tm for recalculation
-                struct tm stopTimeTm;
-                localtime_r(&stopTime, &stopTimeTm);
-                stopTimeTm.tm_sec += evtData.durationSecs;
-                //    set DST status to not available, because it may be different by
-                //    the modifications modifications
-                stopTimeTm.tm_isdst = -1;
-
-                #ifdef IRRIGATION_PLANNER_STOP_EVENT_DEBUG
-                    ESP_LOGD(logTag, "stopTime: %lu", stopTime);
-                    ESP_LOGD(logTag, "stopTimeTm: %d.%d.%d %d:%d:%d",
-                        stopTimeTm.tm_mday, stopTimeTm.tm_mon, stopTimeTm.tm_year,
-                        stopTimeTm.tm_hour, stopTimeTm.tm_min, stopTimeTm.tm_sec);
-                #endif
-
-                // b) Use mktime to fixup the time and convert time_t back to struct tm
-                stopTime = mktime(&stopTimeTm);
-                localtime_r(&stopTime, &stopTimeTm);
-                #ifdef IRRIGATION_PLANNER_STOP_EVENT_DEBUG
-                    ESP_LOGD(logTag, "after recalc: stopTime: %lu", stopTime);
-                    ESP_LOGD(logTag, "after recalc: stopTimeTm: %d.%d.%d %d:%d:%d",
-                        stopTimeTm.tm_mday, stopTimeTm.tm_mon, stopTimeTm.tm_year,
-                        stopTimeTm.tm_hour, stopTimeTm.tm_min, stopTimeTm.tm_sec);
-                #endif
-
-                // And now set properties of the stop event
-                stopEvents[i].setSingleEvent(stopTimeTm.tm_hour, stopTimeTm.tm_min, stopTimeTm.tm_sec,
-                    stopTimeTm.tm_mday, stopTimeTm.tm_mon + 1, stopTimeTm.tm_year + 1900);
-                stopEvents[i].setStartFlag(false);
-                stopEvents[i].setDuration(0);
-                stopEvents[i].setZoneIndex(evtData.zoneIdx);
-                stopEvents[i].updateReferenceTime(events[idx].getReferenceTime());
-
-                #ifdef IRRIGATION_PLANNER_STOP_EVENT_DEBUG
-                    printEventDetails(&stopEvents[i]);
-                #endif
-
-                ret = true;
-            }
-
-            break;
-        }
+    // get event data
+    IrrigationEvent::err_t eventErr;
+    eventErr = events[idx].getEventData(&evtData);
+    if(IrrigationEvent::ERR_OK != eventErr) {
+        ESP_LOGE(logTag, "Error getting event data: %d. Cannot add stop event!", eventErr);
+    } else {
+        // Calculate the actual time
+        time_t stopTime = events[idx].getNextOccurance();
+
+        // a) Convert reference time_t to struct tm for recalculation
+        struct tm stopTimeTm;
+        localtime_r(&stopTime, &stopTimeTm);
+        stopTimeTm.tm_sec += evtData.durationSecs;
+        //    set DST status to not available, because it may be different by
+        //    the modifications modifications
+        stopTimeTm.tm_isdst = -1;
+
+        #ifdef IRRIGATION_PLANNER_STOP_EVENT_DEBUG
+            ESP_LOGD(logTag, "stopTime: %lu", stopTime);
+            ESP_LOGD(logTag, "stopTimeTm: %d.%d.%d %d:%d:%d",
+                stopTimeTm.tm_mday, stopTimeTm.tm_mon, stopTimeTm.tm_year,
+                stopTimeTm.tm_hour, stopTimeTm.tm_min, stopTimeTm.tm_sec);
+        #endif
+
+        // b) Use mktime to fixup the time
+        stopTime = mktime(&stopTimeTm);
+
+        ret = (ERR_OK == addStopEvent(stopTime, evtData.zoneIdx, events[idx].getReferenceTime()));
     }
 
     // Check for single shot event to disable it
@@ -377,6 +640,9 @@ bool IrrigationPlanner::confirmNormalEvent(unsigned int idx)
     // cleaning up is more important to stay operational
     if(idx >= irrigationPlannerNumNormalEvents) {
         eventsUsed[idx] = false;
+
+        event_handle_t handle = {.idx = (int) idx, .isStart = true};
+        timelineRemove(handle);
     }
 
     return ret;
@@ -390,6 +656,62 @@ bool IrrigationPlanner::confirmNormalEvent(unsigned int idx)
 void IrrigationPlanner::confirmStopEvent(unsigned int idx)
 {
     stopEventsUsed[idx] = false;
+    stopEventsFree[stopEventsFreeCnt++] = idx;
+
+    event_handle_t handle = {.idx = (int) idx, .isStart = false};
+    timelineRemove(handle);
+}
+
+/**
+ * @brief Get the pending stop events of the running irrigations, e.g. to keep them across a deep sleep
+ * (see restoreStopEvent()).
+ * 
+ * @param dest Pointer to a memory area, which will be populated with the stop events.
+ * @param maxElements Number of elements the memory area can hold.
+ * @param num Destination of the number of stop events written to dest.
+ * @return IrrigationPlanner::err_t
+ * @retval ERR_OK Success.
+ * @retval ERR_INVALID_PARAM dest or num is invalid.
+ * @retval ERR_PARTIAL_EVENT_HANDLES Not enough space available at dest.
+ */
+IrrigationPlanner::err_t IrrigationPlanner::getStopEvents(stop_event_t* dest, unsigned int maxElements, unsigned int* num)
+{
+    IrrigationEvent::irrigation_event_data_t evtData;
+
+    if((nullptr == dest) || (nullptr == num)) return ERR_INVALID_PARAM;
+
+    *num = 0;
+    for(int i = 0; i < irrigationPlannerNumStopEvents; i++) {
+        // stop events not being part of the timeline won't occur anymore (see getEventHandles())
+        if(!stopEventsUsed[i] || (0 == stopEventsNext[i])) continue;
+        if(*num >= maxElements) return ERR_PARTIAL_EVENT_HANDLES;
+
+        stopEvents[i].getEventData(&evtData);
+        dest[*num].time = stopEventsNext[i];
+        dest[*num].zoneIdx = evtData.zoneIdx;
+        (*num)++;
+    }
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Restore a stop event taken by getStopEvents(), e.g. after a deep sleep.
+ * 
+ * @param evt Stop event to restore. Its time must not have passed before the start time of
+ * the next getNextEventTime() call, otherwise it will be dropped.
+ * @return IrrigationPlanner::err_t
+ * @retval ERR_OK Success.
+ * @retval ERR_INVALID_PARAM evt or its time is invalid.
+ * @retval ERR_INVALID_ZONE_IDX The zone index is out of range.
+ * @retval ERR_NO_STOP_SLOT_AVAIL No stop event slot available.
+ */
+IrrigationPlanner::err_t IrrigationPlanner::restoreStopEvent(const stop_event_t* evt)
+{
+    if((nullptr == evt) || (0 == evt->time)) return ERR_INVALID_PARAM;
+    if((evt->zoneIdx < 0) || (evt->zoneIdx >= irrigationPlannerNumZones)) return ERR_INVALID_ZONE_IDX;
+
+    return addStopEvent(evt->time, evt->zoneIdx, evt->time);
 }
 
 /**
@@ -452,7 +774,7 @@ void IrrigationPlanner::printAllEvents()
 
 IrrigationPlanner::err_t IrrigationPlanner::getZoneConfig(int idx, irrigation_zone_cfg_t* cfg)
 {
-    if((idx < 0) || (idx >= irrigationZoneCfgElements)) {
+    if((idx < 0) || (idx >= irrigationPlannerNumZones)) {
         return ERR_INVALID_ZONE_IDX;
     }
 
@@ -461,38 +783,75 @@ IrrigationPlanner::err_t IrrigationPlanner::getZoneConfig(int idx, irrigation_zo
     return ERR_OK;
 }
 
+/**
+ * @brief Lock or unlock the config. While locked, published config updates aren't adopted,
+ * e.g. to keep the schedule stable while irrigating.
+ * 
+ * @param lockState New lock state.
+ * @return IrrigationPlanner::err_t Always ERR_OK.
+ */
 IrrigationPlanner::err_t IrrigationPlanner::setConfigLock(bool lockState)
 {
-    err_t ret = ERR_OK;
+    configLock = lockState;
 
-    if (pdFALSE == xSemaphoreTake(accessMutex, lockAcquireTimeout)) { // TBD: wait infinite?
-            ESP_LOGE(logTag, "Couldn't acquire access lock within timeout!");
-            ret = ERR_TIMEOUT;
-    } else {
-        configLock = lockState;
+    if (!lockState && (configEpoch.load() != configAdoptedEpoch)) {
+        ESP_LOGI(logTag, "Config lock released. Performing postponed configuration update.");
+        configAdopt();
 
-        if ((lockState == false) && (configUpdatedDuringLock == true)) {
-            ESP_LOGI(logTag, "Config lock released. Performing postponed configuration update.");
-            configUpdatedDuringLock = false;
-            xSemaphoreGive(accessMutex);
-            irrigConfigUpdated();
-        } else {
-            xSemaphoreGive(accessMutex);
-        }
+        // the update hasn't been announced while locked (see irrigConfigUpdated)
+        callPlanUpdatedHook();
     }
 
-    return ret;
+    return ERR_OK;
 }
 
 bool IrrigationPlanner::getConfigLock()
 {
-    if (pdFALSE == xSemaphoreTake(accessMutex, lockAcquireTimeout)) { // TBD: wait infinite?
-        ESP_LOGE(logTag, "Couldn't acquire access lock within timeout!");
-        return true;
-    } else {
-        xSemaphoreGive(accessMutex);
-        return configLock;
+    return configLock;
+}
+
+/**
+ * @brief Adopt the latest published config, unless the config is locked.
+ * 
+ * The schedule is recalculated on next access. Stop events of running irrigations are kept.
+ * This never blocks; a writer wanting to reuse the buffer being copied waits instead
+ * (see irrigConfigUpdated).
+ * 
+ * Note: Only to be called from the schedule accessors.
+ */
+void IrrigationPlanner::configAdopt()
+{
+    uint32_t epoch;
+
+    if (configLock) return;
+
+    // announce the buffer being read and make sure it is still the published one
+    do {
+        epoch = configEpoch.load();
+        configReadingEpoch.store(epoch);
+    } while (epoch != configEpoch.load());
+
+    if (epoch != configAdoptedEpoch) {
+        const plan_config_t& cfg = configBufs[epoch & 1];
+
+        memcpy(zones, cfg.zones, sizeof(zones));
+        for(int i = 0; i < irrigationPlannerNumNormalEvents; i++) {
+            events[i] = cfg.events[i];
+            eventsUsed[i] = cfg.eventsUsed[i];
+        }
+        configAdoptedEpoch = epoch;
+
+        // The schedule has changed, so the timeline must be recalculated on next access
+        timelineValid = false;
+
+        ESP_LOGI(logTag, "Adopted irrigation config (epoch %u).", epoch);
+
+        #ifdef IRRIGATION_PLANNER_PRINT_ALL_EVENTS
+        printAllEvents();
+        #endif
     }
+
+    configReadingEpoch.store(configEpochNone);
 }
 
 void IrrigationPlanner::irrigConfigUpdatedHookDispatch(void* param)
@@ -506,34 +865,61 @@ void IrrigationPlanner::irrigConfigUpdatedHookDispatch(void* param)
     }
 }
 
+/**
+ * @brief Publish the current irrigation config of the SettingsManager as new snapshot.
+ * 
+ * The config is written into the unpublished buffer and published with an atomic epoch update,
+ * so the schedule accessors are never blocked by config updates. They adopt it on next access.
+ */
 void IrrigationPlanner::irrigConfigUpdated()
 {
-    if (pdFALSE == xSemaphoreTake(accessMutex, portMAX_DELAY)) {
-        ESP_LOGE(logTag, "Failed to acquire access lock!");
+    irrigConfigUpdated(settingsMgr);
+}
+
+/**
+ * @brief Publish the current irrigation config of the given SettingsManager as new snapshot
+ * (see irrigConfigUpdated()), e.g. of an instance used by the benchmarks.
+ * 
+ * @param settings SettingsManager to take the config from.
+ */
+void IrrigationPlanner::irrigConfigUpdated(SettingsManager& settings)
+{
+    if (pdFALSE == xSemaphoreTake(publishMutex, portMAX_DELAY)) {
+        ESP_LOGE(logTag, "Failed to acquire publish lock!");
     } else {
-        if (configLock) {
-            configUpdatedDuringLock = true;
-            ESP_LOGI(logTag, "Irrigation config update notification received during locked state. Postponing update.");
-        } else {
-            ESP_LOGI(logTag, "Irrigation config update notification received.");
+        ESP_LOGI(logTag, "Irrigation config update notification received.");
 
-            settingsMgr.copyZonesAndEvents(zones, events, eventsUsed);
+        const uint32_t next = configEpoch.load() + 1;
 
-            #ifdef IRRIGATION_PLANNER_PRINT_ALL_EVENTS
-            printAllEvents();
-            #endif
+        // the buffer still holds the config of epoch next-2, which may be adopted right now
+        while ((next >= 2) && (configReadingEpoch.load() == (next - 2))) {
+            vTaskDelay(1);
+        }
 
-            if(pdFALSE == xSemaphoreTake(hookMutex, lockAcquireTimeout)) {
-                ESP_LOGE(logTag, "Couldn't acquire hook lock within timeout!");
-            } else {
-                if (nullptr != configUpdatedHook) {
-                    configUpdatedHook(configUpdatedHookParamPtr);
-                }
-                xSemaphoreGive(hookMutex);
-            }
+        plan_config_t& cfg = configBufs[next & 1];
+        settings.copyZonesAndEvents(cfg.zones, cfg.events, cfg.eventsUsed);
+        configEpoch.store(next);
+
+        xSemaphoreGive(publishMutex);
+
+        // announced on lock release otherwise (see setConfigLock)
+        if (configLock) {
+            ESP_LOGI(logTag, "Config is locked. Postponing update.");
+        } else {
+            callPlanUpdatedHook();
+        }
+    }
+}
 
-            xSemaphoreGive(accessMutex);
+void IrrigationPlanner::callPlanUpdatedHook()
+{
+    if(pdFALSE == xSemaphoreTake(hookMutex, lockAcquireTimeout)) {
+        ESP_LOGE(logTag, "Couldn't acquire hook lock within timeout!");
+    } else {
+        if (nullptr != configUpdatedHook) {
+            configUpdatedHook(configUpdatedHookParamPtr);
         }
+        xSemaphoreGive(hookMutex);
     }
 }
 
@@ -0,0 +1,128 @@
+#include "jsonArena.h"
+
+#include <cstdlib>
+
+#include "cJSON.h"
+
+/** Allocation granularity, which satisfies the alignment of all cJSON types (incl. double) */
+static const size_t jsonArenaAlign = 8;
+
+/** The pool and the state of the current scope. Used by the (context-free) cJSON hooks. */
+static uint8_t jsonArenaPool[JsonArena::poolSize] __attribute__((aligned(8)));
+static size_t jsonArenaUsed = 0;
+static size_t jsonArenaHighWater = 0;
+static bool jsonArenaOverflow = false;
+static TaskHandle_t jsonArenaOwner = nullptr;
+
+/**
+ * @brief Default constructor, which performs basic initialization and registers the cJSON hooks.
+ */
+JsonArena::JsonArena(void)
+{
+    static cJSON_Hooks hooks;
+
+    arenaMutex = xSemaphoreCreateMutexStatic(&arenaMutexBuf);
+
+    hooks.malloc_fn = arenaMalloc;
+    hooks.free_fn = arenaFree;
+    cJSON_InitHooks(&hooks);
+}
+
+/**
+ * @brief Default destructor, which cleans up allocated data.
+ */
+JsonArena::~JsonArena(void)
+{
+    cJSON_InitHooks(nullptr);
+}
+
+/**
+ * @brief Start a parse scope: cJSON allocations of the calling task are taken from the pool until end().
+ *
+ * Note: Only one scope can be active at a time. Blocks (up to lockAcquireTimeout) if another task holds it.
+ *
+ * @return err_t ERR_OK on success, ERR_TIMEOUT if the arena is in use.
+ */
+JsonArena::err_t JsonArena::begin(void)
+{
+    if(pdFALSE == xSemaphoreTake(arenaMutex, lockAcquireTimeout)) {
+        ESP_LOGE(logTag, "Couldn't acquire arena lock within timeout!");
+        return ERR_TIMEOUT;
+    }
+
+    jsonArenaUsed = 0;
+    jsonArenaOverflow = false;
+    jsonArenaOwner = xTaskGetCurrentTaskHandle();
+
+    return ERR_OK;
+}
+
+/**
+ * @brief End the parse scope, which releases all allocations of it at once.
+ *
+ * Note: cJSON items of the scope must not be used afterwards.
+ */
+void JsonArena::end(void)
+{
+    jsonArenaOwner = nullptr;
+
+    if(jsonArenaUsed > jsonArenaHighWater) {
+        jsonArenaHighWater = jsonArenaUsed;
+        ESP_LOGI(logTag, "New high-water mark: %u of %u bytes.", jsonArenaHighWater, poolSize);
+    }
+    if(jsonArenaOverflow) {
+        ESP_LOGW(logTag, "Pool exhausted (%u bytes).", poolSize);
+    }
+
+    xSemaphoreGive(arenaMutex);
+}
+
+/**
+ * @brief Return wether or not an allocation failed within the current (or last) scope.
+ */
+bool JsonArena::hasOverflowed(void)
+{
+    return jsonArenaOverflow;
+}
+
+/**
+ * @brief Get the number of bytes allocated within the current (or last) scope.
+ */
+size_t JsonArena::getUsed(void)
+{
+    return jsonArenaUsed;
+}
+
+/**
+ * @brief Get the maximum number of bytes allocated within a scope since boot.
+ */
+size_t JsonArena::getHighWaterMark(void)
+{
+    return jsonArenaHighWater;
+}
+
+void* JsonArena::arenaMalloc(size_t size)
+{
+    if((nullptr == jsonArenaOwner) || (xTaskGetCurrentTaskHandle() != jsonArenaOwner)) {
+        return malloc(size);
+    }
+
+    size_t alignedSize = (size + jsonArenaAlign - 1) & ~(jsonArenaAlign - 1);
+    if(alignedSize > (poolSize - jsonArenaUsed)) {
+        jsonArenaOverflow = true;
+        return nullptr;
+    }
+
+    void* ptr = &jsonArenaPool[jsonArenaUsed];
+    jsonArenaUsed += alignedSize;
+
+    return ptr;
+}
+
+void JsonArena::arenaFree(void* ptr)
+{
+    // pool memory is released by end()
+    if(((uint8_t*) ptr >= jsonArenaPool) && ((uint8_t*) ptr < (jsonArenaPool + poolSize))) return;
+
+    free(ptr);
+}
@@ -0,0 +1,423 @@
+#include "jsonStreamParser.h"
+
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * @brief Default constructor, which prepares an idle parser (see begin).
+ */
+JsonStreamParser::JsonStreamParser()
+{
+    begin(nullptr, nullptr);
+}
+
+/**
+ * @brief Default destructor, which cleans up allocated data.
+ */
+JsonStreamParser::~JsonStreamParser()
+{
+}
+
+/**
+ * @brief Reset the parser to start parsing a new document.
+ *
+ * @param hook Hook to be called for every parsed value.
+ * @param param Parameter passed to the hook.
+ */
+void JsonStreamParser::begin(ValueHookFncPtr hook, void* param)
+{
+    this->hook = hook;
+    this->hookParam = param;
+
+    state = STATE_VALUE;
+    err = ERR_OK;
+    stringIsKey = false;
+    unicodeVal = 0;
+    unicodeDigits = 0;
+    depth = 0;
+    tokenLen = 0;
+    tokenTruncated = false;
+    token[0] = '\0';
+}
+
+/**
+ * @brief Parse the next chunk of the document.
+ *
+ * @param data Chunk data (doesn't need to be NULL-terminated).
+ * @param dataLen Length of the chunk.
+ * @return err_t ERR_OK if the document is valid so far, an error otherwise. Once an error
+ * occured all further chunks are rejected with the same error.
+ */
+JsonStreamParser::err_t JsonStreamParser::feed(const char* data, size_t dataLen)
+{
+    if(STATE_ERROR == state) return err;
+    if((nullptr == data) && (dataLen > 0)) return ERR_INVALID_ARG;
+
+    for(size_t i = 0; i < dataLen; i++) {
+        err_t ret = processChar(data[i]);
+        if(ERR_OK != ret) {
+            fail(ret);
+            return ret;
+        }
+    }
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Finish parsing of the document.
+ *
+ * @return err_t ERR_OK if a complete document has been parsed, ERR_INCOMPLETE if the
+ * document has been truncated or the the error which occured while parsing.
+ */
+JsonStreamParser::err_t JsonStreamParser::end(void)
+{
+    if(STATE_ERROR == state) return err;
+
+    // a root literal is only terminated by the end of the document
+    if(STATE_LITERAL == state) {
+        err_t ret = literalDone();
+        if(ERR_OK != ret) {
+            fail(ret);
+            return ret;
+        }
+    }
+
+    if(STATE_DONE != state) fail(ERR_INCOMPLETE);
+
+    return err;
+}
+
+/**
+ * @brief Get the number of containers enclosing the value currently reported to the hook.
+ *
+ * @return int Number of enclosing containers, i.e. 0 for the root value.
+ */
+int JsonStreamParser::getDepth(void) const
+{
+    return depth;
+}
+
+/**
+ * @brief Check the key of the current member of an enclosing object.
+ *
+ * @param level Container level (0 = root container, getDepth()-1 = innermost container).
+ * @param key Key to compare with.
+ * @return bool True if the container at level is an object and its current member has the specified key.
+ */
+bool JsonStreamParser::isKey(int level, const char* key) const
+{
+    if((level < 0) || (level >= depth)) return false;
+    if(levels[level].isArray || levels[level].keyTruncated) return false;
+
+    return (0 == strcmp(levels[level].key, key));
+}
+
+/**
+ * @brief Get the index of the current element of an enclosing array.
+ *
+ * @param level Container level (0 = root container, getDepth()-1 = innermost container).
+ * @return int Index of the current element or -1 if the container at level isn't an array.
+ */
+int JsonStreamParser::getIndex(int level) const
+{
+    if((level < 0) || (level >= depth)) return -1;
+    if(!levels[level].isArray) return -1;
+
+    return levels[level].index;
+}
+
+JsonStreamParser::err_t JsonStreamParser::processChar(char c)
+{
+    const bool isWhitespace = (' ' == c) || ('\t' == c) || ('\n' == c) || ('\r' == c);
+
+    switch(state) {
+        case STATE_VALUE:
+            if(isWhitespace) return ERR_OK;
+            return valueStart(c);
+
+        case STATE_VALUE_OR_END:
+            if(isWhitespace) return ERR_OK;
+            if(']' == c) return containerEnd(true);
+            return valueStart(c);
+
+        case STATE_KEY:
+        case STATE_KEY_OR_END:
+            if(isWhitespace) return ERR_OK;
+            if((STATE_KEY_OR_END == state) && ('}' == c)) return containerEnd(false);
+            if('"' != c) return ERR_SYNTAX;
+            stringIsKey = true;
+            tokenLen = 0;
+            tokenTruncated = false;
+            state = STATE_STRING;
+            return ERR_OK;
+
+        case STATE_COLON:
+            if(isWhitespace) return ERR_OK;
+            if(':' != c) return ERR_SYNTAX;
+            state = STATE_VALUE;
+            return ERR_OK;
+
+        case STATE_COMMA_OR_END:
+            if(isWhitespace) return ERR_OK;
+            if(']' == c) return containerEnd(true);
+            if('}' == c) return containerEnd(false);
+            if(',' != c) return ERR_SYNTAX;
+            if(levels[depth - 1].isArray) {
+                levels[depth - 1].index++;
+                state = STATE_VALUE;
+            } else {
+                state = STATE_KEY;
+            }
+            return ERR_OK;
+
+        case STATE_STRING:
+            if('"' == c) {
+                token[tokenLen] = '\0';
+                if(stringIsKey) {
+                    level_t& level = levels[depth - 1];
+                    level.keyTruncated = tokenTruncated || (tokenLen > maxKeyLen);
+                    strncpy(level.key, token, maxKeyLen);
+                    level.key[maxKeyLen] = '\0';
+                    state = STATE_COLON;
+                    return ERR_OK;
+                }
+                err_t ret = report(VALUE_STRING);
+                if(ERR_OK != ret) return ret;
+                return valueDone();
+            }
+            if('\\' == c) {
+                state = STATE_STRING_ESCAPE;
+                return ERR_OK;
+            }
+            if((unsigned char) c < 0x20) return ERR_SYNTAX;
+            tokenPut(c);
+            return ERR_OK;
+
+        case STATE_STRING_ESCAPE:
+            state = STATE_STRING;
+            switch(c) {
+                case '"':
+                case '\\':
+                case '/':
+                    tokenPut(c);
+                    return ERR_OK;
+                case 'b': tokenPut('\b'); return ERR_OK;
+                case 'f': tokenPut('\f'); return ERR_OK;
+                case 'n': tokenPut('\n'); return ERR_OK;
+                case 'r': tokenPut('\r'); return ERR_OK;
+                case 't': tokenPut('\t'); return ERR_OK;
+                case 'u':
+                    unicodeVal = 0;
+                    unicodeDigits = 0;
+                    state = STATE_STRING_UNICODE;
+                    return ERR_OK;
+                default:
+                    return ERR_SYNTAX;
+            }
+
+        case STATE_STRING_UNICODE:
+            if((c >= '0') && (c <= '9')) unicodeVal = (unicodeVal << 4) | (c - '0');
+            else if((c >= 'a') && (c <= 'f')) unicodeVal = (unicodeVal << 4) | (c - 'a' + 10);
+            else if((c >= 'A') && (c <= 'F')) unicodeVal = (unicodeVal << 4) | (c - 'A' + 10);
+            else return ERR_SYNTAX;
+
+            if(++unicodeDigits == 4) {
+                tokenPutUtf8(unicodeVal);
+                state = STATE_STRING;
+            }
+            return ERR_OK;
+
+        case STATE_LITERAL:
+            if( ((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+                ('+' == c) || ('-' == c) || ('.' == c) )
+            {
+                tokenPut(c);
+                return ERR_OK;
+            } else {
+                // the delimiter belongs to the enclosing container
+                err_t ret = literalDone();
+                if(ERR_OK != ret) return ret;
+                return processChar(c);
+            }
+
+        case STATE_DONE:
+            if(isWhitespace) return ERR_OK;
+            return ERR_SYNTAX;
+
+        case STATE_ERROR:
+        default:
+            return err;
+    }
+}
+
+JsonStreamParser::err_t JsonStreamParser::valueStart(char c)
+{
+    err_t ret;
+
+    switch(c) {
+        case '{':
+        case '[':
+            if(depth >= maxDepth) return ERR_DEPTH;
+            // report before descending, so the position of the container itself is reported
+            ret = report(('{' == c) ? VALUE_OBJECT_START : VALUE_ARRAY_START);
+            if(ERR_OK != ret) return ret;
+
+            levels[depth].isArray = ('[' == c);
+            levels[depth].index = 0;
+            levels[depth].key[0] = '\0';
+            levels[depth].keyTruncated = false;
+            depth++;
+
+            state = ('{' == c) ? STATE_KEY_OR_END : STATE_VALUE_OR_END;
+            return ERR_OK;
+
+        case '"':
+            stringIsKey = false;
+            tokenLen = 0;
+            tokenTruncated = false;
+            state = STATE_STRING;
+            return ERR_OK;
+
+        case '-':
+        case 't':
+        case 'f':
+        case 'n':
+            break;
+
+        default:
+            if((c < '0') || (c > '9')) return ERR_SYNTAX;
+            break;
+    }
+
+    tokenLen = 0;
+    tokenTruncated = false;
+    tokenPut(c);
+    state = STATE_LITERAL;
+    return ERR_OK;
+}
+
+JsonStreamParser::err_t JsonStreamParser::valueDone(void)
+{
+    state = (0 == depth) ? STATE_DONE : STATE_COMMA_OR_END;
+    return ERR_OK;
+}
+
+JsonStreamParser::err_t JsonStreamParser::literalDone(void)
+{
+    err_t ret;
+
+    if(tokenTruncated) return ERR_SYNTAX;
+    token[tokenLen] = '\0';
+
+    if(0 == strcmp(token, "true")) {
+        ret = report(VALUE_BOOL);
+    } else if(0 == strcmp(token, "false")) {
+        ret = report(VALUE_BOOL);
+    } else if(0 == strcmp(token, "null")) {
+        ret = report(VALUE_NULL);
+    } else {
+        // check the JSON number grammar, as strtod also accepts hex, inf, ...
+        const char* p = token;
+        if('-' == *p) p++;
+        if('0' == *p) {
+            p++;
+        } else if((*p >= '1') && (*p <= '9')) {
+            while((*p >= '0') && (*p <= '9')) p++;
+        } else {
+            return ERR_SYNTAX;
+        }
+        if('.' == *p) {
+            p++;
+            if((*p < '0') || (*p > '9')) return ERR_SYNTAX;
+            while((*p >= '0') && (*p <= '9')) p++;
+        }
+        if(('e' == *p) || ('E' == *p)) {
+            p++;
+            if(('+' == *p) || ('-' == *p)) p++;
+            if((*p < '0') || (*p > '9')) return ERR_SYNTAX;
+            while((*p >= '0') && (*p <= '9')) p++;
+        }
+        if('\0' != *p) return ERR_SYNTAX;
+
+        ret = report(VALUE_NUMBER);
+    }
+
+    if(ERR_OK != ret) return ret;
+    return valueDone();
+}
+
+JsonStreamParser::err_t JsonStreamParser::containerEnd(bool isArray)
+{
+    if((0 == depth) || (levels[depth - 1].isArray != isArray)) return ERR_SYNTAX;
+
+    depth--;
+    err_t ret = report(isArray ? VALUE_ARRAY_END : VALUE_OBJECT_END);
+    if(ERR_OK != ret) return ret;
+
+    return valueDone();
+}
+
+JsonStreamParser::err_t JsonStreamParser::report(value_type_t type)
+{
+    value_t value;
+
+    if(nullptr == hook) return ERR_OK;
+
+    value.type = type;
+    value.str = nullptr;
+    value.truncated = false;
+    value.number = 0;
+    value.valueint = 0;
+    value.boolean = false;
+
+    switch(type) {
+        case VALUE_STRING:
+            value.str = token;
+            value.truncated = tokenTruncated;
+            break;
+        case VALUE_NUMBER:
+            value.number = strtod(token, nullptr);
+            // saturate like cJSON does
+            if(value.number >= INT32_MAX) value.valueint = INT32_MAX;
+            else if(value.number <= INT32_MIN) value.valueint = INT32_MIN;
+            else value.valueint = (int) value.number;
+            break;
+        case VALUE_BOOL:
+            value.boolean = ('t' == token[0]);
+            break;
+        default:
+            break;
+    }
+
+    return hook(this, &value, hookParam) ? ERR_OK : ERR_ABORTED;
+}
+
+void JsonStreamParser::tokenPut(char c)
+{
+    if(tokenLen < maxTokenLen) {
+        token[tokenLen++] = c;
+    } else {
+        tokenTruncated = true;
+    }
+}
+
+void JsonStreamParser::tokenPutUtf8(uint32_t codepoint)
+{
+    if(codepoint < 0x80) {
+        tokenPut((char) codepoint);
+    } else if(codepoint < 0x800) {
+        tokenPut((char) (0xc0 | (codepoint >> 6)));
+        tokenPut((char) (0x80 | (codepoint & 0x3f)));
+    } else {
+        tokenPut((char) (0xe0 | (codepoint >> 12)));
+        tokenPut((char) (0x80 | ((codepoint >> 6) & 0x3f)));
+        tokenPut((char) (0x80 | (codepoint & 0x3f)));
+    }
+}
+
+void JsonStreamParser::fail(err_t err)
+{
+    state = STATE_ERROR;
+    this->err = err;
+}
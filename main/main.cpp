@@ -6,6 +6,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 
 #include "esp_system.h"
 #include "esp_wifi.h"
@@ -19,13 +20,12 @@
 #include "mqtt_client.h"
 #include "console.h"
 #include "wifiEvents.h"
+#include "bootPlan.h"
 #include "globalComponents.h"
 #include "irrigationController.h"
 #include "irrigationPlanner.h"
 #include "iap_https.h"
-#include "cJSON.h"
-
-#define MIN(a, b) ((a <= b) ? a : b)
+#include "jsonStreamParser.h"
 
 #ifndef OTA_METADATA_FILE
 #define OTA_METADATA_FILE "unknown.bin"
@@ -40,30 +40,122 @@ EventGroupHandle_t wifiEvents;
 const int wifiEventConnected = (1<<0);
 const int wifiEventDisconnected = (1<<1);
 
+// must be constructed first, as the other components report their power states to it
+EnergyMeter energyMeter;
+JsonArena jsonArena;
 SettingsManager settingsMgr;
 FillSensorPacketizer fillSensorPacketizer;
 FillSensorProtoHandler<FillSensorPacketizer> fillSensor(&fillSensorPacketizer);
+#if CONFIG_FILL_SENSOR_NUM_SENSORS > 1
+FillSensor1Packetizer fillSensor1Packetizer;
+FillSensorProtoHandler<FillSensor1Packetizer> fillSensor1(&fillSensor1Packetizer);
+#endif
+FillSensorRegistry fillSensors;
 PowerManager pwrMgr;
 OutputController outputCtrl;
+OutputActuator outputActuator;
 MqttManager mqttMgr;
 IrrigationController irrigCtrl;
 IrrigationPlanner irrigPlanner;
+WakeProfiler wakeProfiler;
+MqttIngress mqttIngress;
 
 // ********************************************************************
 // WiFi handling
 // ********************************************************************
+/** Maximum age of a DHCP lease in seconds which may be reused without asking the DHCP server.
+ * Note: Must be (much) lower than the lease time configured in the DHCP server. */
+static const time_t wifiFastConnectLeaseMaxAgeSecs = 4*60*60;
+static const uint32_t wifiFastConnectMagic = 0x57494649; // 'WIFI'
+
+/** AP and IP data of the last successful connection, used to skip the scan and DHCP on wakeups. */
+typedef struct wifi_fast_connect_data_t {
+    uint32_t magic;                         /**< Data is valid if this is wifiFastConnectMagic */
+    uint8_t bssid[6];                       /**< BSSID of the last AP */
+    uint8_t channel;                        /**< Channel of the last AP */
+    bool ipValid;                           /**< Wether or not ipInfo and dnsInfo are valid */
+    tcpip_adapter_ip_info_t ipInfo;         /**< Last DHCP lease */
+    tcpip_adapter_dns_info_t dnsInfo;       /**< Main DNS server of the last DHCP lease */
+    time_t leaseObtained;                   /**< Time the last DHCP lease was obtained */
+} wifi_fast_connect_data_t;
+
+RTC_DATA_ATTR static wifi_fast_connect_data_t wifiFastConnectData = {
+    .magic = 0
+};
+static bool wifiFastConnectActive = false;
+static bool wifiStaticIpActive = false;
+static wifi_config_t wifiConfig;
+
+/**
+ * @brief Check wether or not the cached DHCP lease is young enough to be reused.
+ */
+static bool wifiFastConnectLeaseValid(void)
+{
+    time_t now;
+    time(&now);
+
+    time_t leaseAge = now - wifiFastConnectData.leaseObtained;
+    return wifiFastConnectData.ipValid && (leaseAge >= 0) && (leaseAge < wifiFastConnectLeaseMaxAgeSecs);
+}
+
+/**
+ * @brief Drop the fast connect data and switch back to a full scan and DHCP.
+ */
+static void wifiFastConnectFallback(void)
+{
+    ESP_LOGW(LOG_TAG_WIFI, "Fast connect failed or lease expired. Falling back to full scan and DHCP.");
+
+    wifiFastConnectData.magic = 0;
+    wifiFastConnectActive = false;
+
+    wifiConfig.sta.bssid_set = false;
+    wifiConfig.sta.channel = 0;
+    esp_wifi_set_config(ESP_IF_WIFI_STA, &wifiConfig);
+
+    if (wifiStaticIpActive) {
+        wifiStaticIpActive = false;
+        tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA);
+    }
+}
+
 static esp_err_t wifiEventHandler(void *ctx, system_event_t *event)
 {
+    time_t now;
+
     switch(event->event_id) {
         case SYSTEM_EVENT_STA_START:
+            energyMeter.setLevel(EnergyMeter::STATE_WIFI, 1);
             esp_wifi_connect();
             break;
+        case SYSTEM_EVENT_STA_STOP:
+            energyMeter.setLevel(EnergyMeter::STATE_WIFI, 0);
+            break;
+        case SYSTEM_EVENT_STA_CONNECTED:
+            memcpy(wifiFastConnectData.bssid, event->event_info.connected.bssid, sizeof(wifiFastConnectData.bssid));
+            wifiFastConnectData.channel = event->event_info.connected.channel;
+            break;
         case SYSTEM_EVENT_STA_GOT_IP:
+            if (!wifiStaticIpActive) {
+                // remember the lease, so it can be reused on the next wakeups
+                time(&now);
+                wifiFastConnectData.ipInfo = event->event_info.got_ip.ip_info;
+                wifiFastConnectData.ipValid = (ESP_OK == tcpip_adapter_get_dns_info(TCPIP_ADAPTER_IF_STA,
+                    TCPIP_ADAPTER_DNS_MAIN, &wifiFastConnectData.dnsInfo));
+                wifiFastConnectData.leaseObtained = now;
+            }
+            wifiFastConnectData.magic = wifiFastConnectMagic;
+            wifiFastConnectActive = false; // connection succeeded, so no fallback required anymore
+
             xEventGroupSetBits(wifiEvents, wifiEventConnected);
             xEventGroupClearBits(wifiEvents, wifiEventDisconnected);
             mqttMgr.start();
             break;
         case SYSTEM_EVENT_STA_DISCONNECTED:
+            // Note: a reused lease is renewed on reconnects only, e.g. long keep awake periods won't renew it.
+            if (wifiFastConnectActive || (wifiStaticIpActive && !wifiFastConnectLeaseValid())) {
+                wifiFastConnectFallback();
+            }
+
             xEventGroupClearBits(wifiEvents, wifiEventConnected);
             xEventGroupSetBits(wifiEvents, wifiEventDisconnected);
             mqttMgr.stop();
@@ -81,23 +173,74 @@ static esp_err_t wifiEventHandler(void *ctx, system_event_t *event)
     return ESP_OK;
 }
 
+/**
+ * @brief Prepare a fast connect based on the data of the last connection, i.e.
+ * connect to the last AP without scanning and reuse the last DHCP lease if it is still young enough.
+ * 
+ * Note: A failing fast connect will fall back to a full scan and DHCP (see wifiFastConnectFallback).
+ */
+static void initializeWifiFastConnect(void)
+{
+    if (wifiFastConnectData.magic != wifiFastConnectMagic) {
+        ESP_LOGI(LOG_TAG_WIFI, "No fast connect data available.");
+        return;
+    }
+
+    wifiConfig.sta.bssid_set = true;
+    memcpy(wifiConfig.sta.bssid, wifiFastConnectData.bssid, sizeof(wifiConfig.sta.bssid));
+    wifiConfig.sta.channel = wifiFastConnectData.channel;
+    wifiFastConnectActive = true;
+
+    if (wifiFastConnectLeaseValid() && (ESP_OK == tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA)))
+    {
+        if ((ESP_OK == tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, &wifiFastConnectData.ipInfo)) &&
+            (ESP_OK == tcpip_adapter_set_dns_info(TCPIP_ADAPTER_IF_STA, TCPIP_ADAPTER_DNS_MAIN, &wifiFastConnectData.dnsInfo)))
+        {
+            wifiStaticIpActive = true;
+        } else {
+            tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA);
+        }
+    }
+
+    ESP_LOGI(LOG_TAG_WIFI, "Fast connect to channel %u%s.", wifiFastConnectData.channel,
+        wifiStaticIpActive ? " reusing the last DHCP lease" : "");
+}
+
+/**
+ * @brief Start WiFi, if this hasn't been done yet. Events will start/stop the MQTT client.
+ * 
+ * Note: WiFi is started on demand (see IrrigationController), so wakeups which don't need
+ * the network at all won't power up the radio. The network stack is brought up by then, too.
+ */
+void wifiStart(void)
+{
+    static bool wifiStarted = false;
+
+    if (!wifiStarted) {
+        bootBringUp(BOOT_SUBSYS_NETWORK);
+        ESP_LOGI(LOG_TAG_WIFI, "Starting WiFi.");
+        ESP_ERROR_CHECK( esp_wifi_start() );
+        wifiStarted = true;
+    }
+}
+
 static void initializeWifi(void)
 {
     ESP_LOGI(LOG_TAG_WIFI, "Initializing WiFi.");
 
     tcpip_adapter_init();
 
-    wifiEvents = xEventGroupCreate();
     ESP_ERROR_CHECK( esp_event_loop_init(wifiEventHandler, NULL) );
 
     static wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK( esp_wifi_init(&cfg) );
     ESP_ERROR_CHECK( esp_wifi_set_storage(WIFI_STORAGE_RAM) );
 
-    static wifi_config_t wifiConfig;
     memcpy(wifiConfig.sta.ssid, STA_SSID, sizeof(STA_SSID) / sizeof(uint8_t));
     memcpy(wifiConfig.sta.password, STA_PASS, sizeof(STA_PASS) / sizeof(uint8_t));
 
+    initializeWifiFastConnect();
+
     ESP_LOGI(LOG_TAG_WIFI, "Setting WiFi configuration for SSID %s.", wifiConfig.sta.ssid);
     ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_STA) );
     ESP_ERROR_CHECK( esp_wifi_set_config(ESP_IF_WIFI_STA, &wifiConfig) );
@@ -156,8 +299,12 @@ extern const uint8_t ota_host_public_key_pem_end[] asm("_binary_ota_host_public_
 #define MQTT_OTA_UPGRADE_TOPIC_POST_REQ         "/req"
 #define MQTT_OTA_UPGRADE_TOPIC_POST_REQ_LEN     4
 void mqttOtaCallback(const char* topic, int topicLen, const char* data, int dataLen);
+void otaRequestHandler(const char* data, int dataLen, void* param);
 void iapHttpsEventCallback(iap_https_event_t* event);
 
+/** OTA request topic, built once at subscribe time (also used for the request ack) */
+static char otaTopic[MQTT_OTA_UPGRADE_TOPIC_PRE_LEN + MQTT_OTA_UPGRADE_TOPIC_POST_REQ_LEN + 12 + 1];
+
 static void initializeOta()
 {
     static iap_https_config_t ota_config;
@@ -180,7 +327,6 @@ static void initializeOta()
     iap_https_init(&ota_config);
 
     // subscribe to OTA topic
-    static char otaTopic[MQTT_OTA_UPGRADE_TOPIC_PRE_LEN + MQTT_OTA_UPGRADE_TOPIC_POST_REQ_LEN + 12 + 1];
     static uint8_t mac_addr[6];
     int i;
     esp_err_t ret;
@@ -194,7 +340,8 @@ static void initializeOta()
         }
         memcpy(&otaTopic[MQTT_OTA_UPGRADE_TOPIC_PRE_LEN + 12], MQTT_OTA_UPGRADE_TOPIC_POST_REQ, MQTT_OTA_UPGRADE_TOPIC_POST_REQ_LEN);
         otaTopic[MQTT_OTA_UPGRADE_TOPIC_PRE_LEN + MQTT_OTA_UPGRADE_TOPIC_POST_REQ_LEN + 12] = 0;
-        
+
+        mqttIngress.registerHandler(MqttIngress::MSG_OTA_REQUEST, otaRequestHandler, nullptr);
         if(MqttManager::ERR_OK != mqttMgr.subscribe(otaTopic, MqttManager::QOS_EXACTLY_ONCE, mqttOtaCallback)) {
             ESP_LOGW(LOG_TAG_OTA, "Failed to subscribe to OTA topic!");
         }
@@ -205,42 +352,53 @@ static void initializeOta()
 
 void mqttOtaCallback(const char* topic, int topicLen, const char* data, int dataLen)
 {
-    if(0 == iap_https_update_in_progress()) {
-        cJSON* root = cJSON_Parse(data);
-        if(nullptr == root) {
-            ESP_LOGW(LOG_TAG_OTA, "Error parsing JSON OTA request.");
-        } else {
-            bool check = false;
-            cJSON* checkItem = cJSON_GetObjectItem(root, "check");
-            if(nullptr != checkItem) {
-                check = (cJSON_IsTrue(checkItem)) ? true : false;
-                if(check) {
-                    // Check if there's a new firmware image available.
-                    ESP_LOGI(LOG_TAG_OTA, "Requesting OTA firmware upgrade.");
-                    iap_https_check_now();
-
-                    char* reqAckTopic = (char*) calloc((topicLen + 1), sizeof(char));
-                    const char* reqAckData = "";
-
-                    if(nullptr == reqAckTopic) {
-                        ESP_LOGE(LOG_TAG_OTA, "Couldn't allocate memory for request ack topic!");
-                    } else {
-                        strncpy(reqAckTopic, topic, topicLen);
-                        if(MqttManager::ERR_OK != mqttMgr.publish(reqAckTopic, reqAckData, strlen(reqAckData), MqttManager::QOS_EXACTLY_ONCE, true)) {
-                            ESP_LOGE(LOG_TAG_OTA, "Error publishing request ack.");
-                        }
-                    }
-                } else {
-                    ESP_LOGD(LOG_TAG_OTA, "Check request set to false.");
-                }
-            } else {
-                // could have been our "ack", so just debug log it.
-                ESP_LOGD(LOG_TAG_OTA, "No valid check request found.");
-            }
-            cJSON_Delete(root);
+    // our (empty) request ack is delivered as well
+    if(dataLen > 0) mqttIngress.post(MqttIngress::MSG_OTA_REQUEST, data, dataLen);
+}
+
+/**
+ * @brief JSON value hook of the OTA request parser: looks for {"check":true}.
+ */
+static bool otaRequestValueHook(JsonStreamParser* parser, const JsonStreamParser::value_t* value, void* param)
+{
+    int* check = (int*) param;
+
+    if((1 == parser->getDepth()) && parser->isKey(0, "check")) {
+        *check = ((JsonStreamParser::VALUE_BOOL == value->type) && value->boolean) ? 1 : 0;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Process an OTA request (called by the MQTT ingress task).
+ */
+void otaRequestHandler(const char* data, int dataLen, void* param)
+{
+    static JsonStreamParser parser;
+    int check = -1; // not found
+
+    if(0 != iap_https_update_in_progress()) {
+        ESP_LOGI(LOG_TAG_OTA, "OTA firmware upgrade already in progress. Dropping request.");
+        return;
+    }
+
+    parser.begin(otaRequestValueHook, &check);
+    if((JsonStreamParser::ERR_OK != parser.feed(data, dataLen)) || (JsonStreamParser::ERR_OK != parser.end())) {
+        ESP_LOGW(LOG_TAG_OTA, "Error parsing JSON OTA request.");
+    } else if(1 == check) {
+        // Check if there's a new firmware image available.
+        ESP_LOGI(LOG_TAG_OTA, "Requesting OTA firmware upgrade.");
+        iap_https_check_now();
+
+        const char* reqAckData = "";
+        if(MqttManager::ERR_OK != mqttMgr.publish(otaTopic, reqAckData, strlen(reqAckData), MqttManager::QOS_EXACTLY_ONCE, true)) {
+            ESP_LOGE(LOG_TAG_OTA, "Error publishing request ack.");
         }
+    } else if(0 == check) {
+        ESP_LOGD(LOG_TAG_OTA, "Check request set to false.");
     } else {
-        ESP_LOGI(LOG_TAG_OTA, "OTA firmware upgrade already in progress. Dropping request.");
+        ESP_LOGD(LOG_TAG_OTA, "No valid check request found.");
     }
 }
 
@@ -280,6 +438,9 @@ esp_err_t initializeSpiffs(void)
 {
     esp_err_t ret = ESP_OK;
 
+    // mounting is done on demand, e.g. in case the settings manager needs to write a config file
+    if (esp_spiffs_mounted(partlabelConfigStore)) return ESP_OK;
+
     esp_vfs_spiffs_conf_t conf = {
       .base_path = filepathConfigStore,
       .partition_label = partlabelConfigStore,
@@ -323,25 +484,47 @@ esp_err_t initializeSpiffs(void)
 #define MQTT_CONFIG_HARDWARE_TOPIC_POST_SET_LEN  20
 void mqttIrrigConfigSetCallback(const char* topic, int topicLen, const char* data, int dataLen);
 void mqttHardwareConfigSetCallback(const char* topic, int topicLen, const char* data, int dataLen);
+void irrigConfigSetHandler(const char* data, int dataLen, void* param);
+void hardwareConfigSetHandler(const char* data, int dataLen, void* param);
+
+/** Config topics, built once at subscribe time (also used for clearing the retained messages) */
+static char irrigConfigTopic[MQTT_CONFIG_TOPIC_PRE_LEN + MQTT_CONFIG_IRRIG_TOPIC_POST_SET_LEN + 12 + 1];
+static char hardwareConfigTopic[MQTT_CONFIG_TOPIC_PRE_LEN + MQTT_CONFIG_HARDWARE_TOPIC_POST_SET_LEN + 12 + 1];
 
 esp_err_t initializeSettingsMgr(void)
 {
-    esp_err_t ret = ESP_OK;
-
     settingsMgr.init();
 
-    // try to read config files from SPIFFS
-    settingsMgr.readIrrigationConfigFile();
-    settingsMgr.readHardwareConfigFile();
+    // Config files only need to be read in if no snapshot was available (i.e. cold boot or config change)
+    if(!settingsMgr.isRestoredFromSnapshot()) {
+        // try to read the persistent configs (SPIFFS is only mounted if legacy config files need to be migrated)
+        settingsMgr.readIrrigationConfigFile();
+        settingsMgr.readHardwareConfigFile();
+
+        settingsMgr.storeSnapshot();
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Subscribe to the config topics (part of the network bring-up, see bootBringUp()).
+ */
+esp_err_t subscribeConfigTopics(void)
+{
+    esp_err_t ret = ESP_OK;
 
     // subscribe to the config topics
-    static char irrigTopic[MQTT_CONFIG_TOPIC_PRE_LEN + MQTT_CONFIG_IRRIG_TOPIC_POST_SET_LEN + 12 + 1];
-    static char hardwareTopic[MQTT_CONFIG_TOPIC_PRE_LEN + MQTT_CONFIG_HARDWARE_TOPIC_POST_SET_LEN + 12 + 1];
     static uint8_t mac_addr[6];
+    char* irrigTopic = irrigConfigTopic;
+    char* hardwareTopic = hardwareConfigTopic;
 
     ret = esp_wifi_get_mac(ESP_IF_WIFI_STA, mac_addr);
 
     if(ESP_OK == ret) {
+        mqttIngress.registerHandler(MqttIngress::MSG_IRRIG_CONFIG, irrigConfigSetHandler, nullptr);
+        mqttIngress.registerHandler(MqttIngress::MSG_HARDWARE_CONFIG, hardwareConfigSetHandler, nullptr);
+
         // subscribe to the irrigation config topic
         memcpy(irrigTopic, MQTT_CONFIG_TOPIC_PRE, MQTT_CONFIG_TOPIC_PRE_LEN);
         for(int i=0; i<6; i++) {
@@ -377,30 +560,53 @@ esp_err_t initializeSettingsMgr(void)
     return ret;
 }
 
+/**
+ * @brief Clear a retained config message which can't ever be queued, so it isn't delivered on every connect.
+ */
+static void mqttConfigDropped(MqttIngress::err_t err, const char* topic, int dataLen)
+{
+    if(MqttIngress::ERR_TOO_LARGE == err) {
+        ESP_LOGE(LOG_TAG_MQTT_CFG_SETUP, "Config on %s (%d bytes) exceeds the MQTT ingress slots. Discarding it.", topic, dataLen);
+        mqttMgr.publish(topic, nullptr, 0, MqttManager::QOS_EXACTLY_ONCE, true);
+    } else if(MqttIngress::ERR_OK != err) {
+        // still retained, so it's received again on the next connect
+        ESP_LOGE(LOG_TAG_MQTT_CFG_SETUP, "Config on %s (%d bytes) couldn't be queued (%d).", topic, dataLen, err);
+    }
+}
+
 void mqttIrrigConfigSetCallback(const char* topic, int topicLen, const char* data, int dataLen)
 {
-    static char topicBuf[MQTT_CONFIG_TOPIC_PRE_LEN+MQTT_CONFIG_IRRIG_TOPIC_POST_SET_LEN+12+1];
-    strncpy(topicBuf, topic, MIN(sizeof(topicBuf)-1, topicLen));
-    topicBuf[MIN(sizeof(topicBuf), topicLen)] = 0;
+    // clearing the retained message (see irrigConfigSetHandler) delivers an empty one, which is ignored
+    if(dataLen > 0) mqttConfigDropped(mqttIngress.post(MqttIngress::MSG_IRRIG_CONFIG, data, dataLen), irrigConfigTopic, dataLen);
+}
 
+void mqttHardwareConfigSetCallback(const char* topic, int topicLen, const char* data, int dataLen)
+{
+    if(dataLen > 0) mqttConfigDropped(mqttIngress.post(MqttIngress::MSG_HARDWARE_CONFIG, data, dataLen), hardwareConfigTopic, dataLen);
+}
+
+/**
+ * @brief Apply an irrigation config update (called by the MQTT ingress task).
+ */
+void irrigConfigSetHandler(const char* data, int dataLen, void* param)
+{
     if (SettingsManager::ERR_OK == settingsMgr.updateIrrigationConfig(data, dataLen, false)) {
         // TBD: publish state somewhere
     }
     // clear the topic, so we won't parse it again
-    mqttMgr.publish(topicBuf, nullptr, 0, MqttManager::QOS_EXACTLY_ONCE, true);
+    mqttMgr.publish(irrigConfigTopic, nullptr, 0, MqttManager::QOS_EXACTLY_ONCE, true);
 }
 
-void mqttHardwareConfigSetCallback(const char* topic, int topicLen, const char* data, int dataLen)
+/**
+ * @brief Apply a hardware config update (called by the MQTT ingress task).
+ */
+void hardwareConfigSetHandler(const char* data, int dataLen, void* param)
 {
-    static char topicBuf[MQTT_CONFIG_TOPIC_PRE_LEN+MQTT_CONFIG_HARDWARE_TOPIC_POST_SET_LEN+12+1];
-    strncpy(topicBuf, topic, MIN(sizeof(topicBuf)-1, topicLen));
-    topicBuf[MIN(sizeof(topicBuf), topicLen)] = 0;
-
     if (SettingsManager::ERR_OK == settingsMgr.updateHardwareConfig(data, dataLen, false)) {
         // TBD: publish state somewhere
     }
     // clear the topic, so we won't parse it again
-    mqttMgr.publish(topicBuf, nullptr, 0, MqttManager::QOS_EXACTLY_ONCE, true);
+    mqttMgr.publish(hardwareConfigTopic, nullptr, 0, MqttManager::QOS_EXACTLY_ONCE, true);
 }
 
 // ********************************************************************
@@ -423,6 +629,71 @@ void ConsoleExitHook(void)
     #endif
 }
 
+// ********************************************************************
+// boot plan
+// ********************************************************************
+static SemaphoreHandle_t bootMutex;
+static StaticSemaphore_t bootMutexBuf;
+static uint32_t bootSubsystemsStarted = 0;
+
+/**
+ * @brief Determine the subsystems needed right away on this boot, based on the RTC-retained state.
+ *
+ * Cold boots and wakeups kept awake bring up everything, as do timer wakeups with an SNTP resync due.
+ * All other deadlines (next event, telemetry upload, state changes) are checked by the
+ * IrrigationController after the sensor readout, which brings up the network on demand (see wifiStart()).
+ * OTA requests are received via MQTT, i.e. they need the network in the first place.
+ */
+static uint32_t planBoot(void)
+{
+    if(ESP_SLEEP_WAKEUP_UNDEFINED == esp_sleep_get_wakeup_cause()) return BOOT_SUBSYS_ALL;
+    if(pwrMgr.getKeepAwakeIo()) return BOOT_SUBSYS_ALL;
+
+    time_t sntpNextSync = TimeSystem_GetNextSntpSync();
+    if((sntpNextSync == 0) || (difftime(sntpNextSync, time(nullptr)) <= 0.0)) return BOOT_SUBSYS_NETWORK;
+
+    return 0;
+}
+
+/**
+ * @brief Bring up subsystems skipped by the boot plan (if not done yet).
+ *
+ * @param subsystems Bitmask of boot_subsys_t.
+ */
+void bootBringUp(uint32_t subsystems)
+{
+    xSemaphoreTake(bootMutex, portMAX_DELAY);
+
+    uint32_t missing = subsystems & ~bootSubsystemsStarted;
+
+    if(0 != (missing & BOOT_SUBSYS_NETWORK)) {
+        // Initialize WiFi, but don't start yet (see wifiStart).
+        initializeWifi();
+
+        // Prepare global mqtt clientName (needed due to lack of named initializers in C99)
+        // and init the manager.
+        ESP_ERROR_CHECK( initializeMqttMgr() );
+        ESP_ERROR_CHECK( subscribeConfigTopics() );
+
+        initializeOta();
+    }
+
+    if(0 != (missing & BOOT_SUBSYS_CONSOLE)) {
+        ConsoleInit(true, ConsoleStartHook, ConsoleExitHook);
+    }
+
+    bootSubsystemsStarted |= missing;
+    xSemaphoreGive(bootMutex);
+}
+
+/**
+ * @brief Get the subsystems brought up so far (bitmask of boot_subsys_t).
+ */
+uint32_t bootGetStarted(void)
+{
+    return bootSubsystemsStarted;
+}
+
 extern "C" void app_main()
 {
     ESP_LOGI("main", "%s starting ...", VERSION_STRING);
@@ -432,38 +703,44 @@ extern "C" void app_main()
     esp_log_level_set("phy_init", ESP_LOG_INFO);
     #endif
 
-    ESP_ERROR_CHECK( nvs_flash_init() );
+    bootMutex = xSemaphoreCreateMutexStatic(&bootMutexBuf);
+    wifiEvents = xEventGroupCreate();
 
-    // Initialize WiFi, but don't start yet.
-    initializeWifi();
+    ESP_ERROR_CHECK( nvs_flash_init() );
 
-    // Initialize the SPIFFS, which may contain a config file
-    ESP_ERROR_CHECK( initializeSpiffs() );
+    // Received config and OTA messages are processed by the ingress task
+    mqttIngress.start();
 
-    // Initialize settings storage including setup of hooks, initial load from file, etc.
+    // Initialize settings storage including setup of hooks, initial load from snapshot or file
+    // (incl. SPIFFS mount), etc.
     ESP_ERROR_CHECK( initializeSettingsMgr() );
 
-    // Prepare global mqtt clientName (needed due to lack of named initializers in C99)
-    // and init the manager.
-    ESP_ERROR_CHECK( initializeMqttMgr() );
-
-    initializeOta();
-
-    // Start WiFi. Events will start/stop MQTT client
-    ESP_ERROR_CHECK( esp_wifi_start() );
-
     TimeSystem_Init();
 
-    ConsoleInit(true, ConsoleStartHook, ConsoleExitHook);
+    // Bring up only what this wakeup needs, the rest is brought up on demand (see bootBringUp).
+    // Note: WiFi will be started by the IrrigationController, once the network is needed (see wifiStart).
+    uint32_t bootPlan = planBoot();
+    ESP_LOGI("main", "Boot plan: network %s, console %s.", (0 != (bootPlan & BOOT_SUBSYS_NETWORK)) ? "now" : "on demand",
+        (0 != (bootPlan & BOOT_SUBSYS_CONSOLE)) ? "now" : "on demand");
+    bootBringUp(bootPlan);
 
     // Register config hooks for classes that have no init or task startup functions and therefore can't do it
     // on their own
     settingsMgr.registerHardwareConfigUpdatedHook(pwrMgr.hardwareConfigUpdatedHookDispatch, &pwrMgr);
+    settingsMgr.registerHardwareConfigUpdatedHook(energyMeter.hardwareConfigUpdatedHookDispatch, &energyMeter);
     settingsMgr.registerIrrigConfigUpdatedHook(irrigPlanner.irrigConfigUpdatedHookDispatch, &irrigPlanner);
 
     // ... and initiate an initial settings update for them
     pwrMgr.hardwareConfigUpdated();
+    energyMeter.hardwareConfigUpdated();
     irrigPlanner.irrigConfigUpdated();
 
+    // sensor index = reservoir index
+    fillSensors.registerSensor(&fillSensor);
+#if CONFIG_FILL_SENSOR_NUM_SENSORS > 1
+    fillSensors.registerSensor(&fillSensor1);
+#endif
+
+    outputActuator.start();
     irrigCtrl.start();
 }
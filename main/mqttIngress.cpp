@@ -0,0 +1,161 @@
+#include "mqttIngress.h"
+
+#include <cstring>
+
+#include "globalComponents.h"
+
+/**
+ * @brief Default constructor, which performs basic initialization.
+ *
+ * Note: The ingress task is created by start().
+ */
+MqttIngress::MqttIngress(void)
+{
+    taskHandle = nullptr;
+
+    freeSlots = xQueueCreateStatic(numSlots, sizeof(int), freeSlotsStorage, &freeSlotsBuf);
+    freeLargeSlots = xQueueCreateStatic(numLargeSlots, sizeof(int), freeLargeSlotsStorage, &freeLargeSlotsBuf);
+    pendingSlots = xQueueCreateStatic(numSlots + numLargeSlots, sizeof(int), pendingSlotsStorage, &pendingSlotsBuf);
+    for(int i = 0; i < numSlots; i++) {
+        slots[i].data = slotData[i];
+        slots[i].freeQueue = freeSlots;
+        xQueueSend(freeSlots, &i, 0);
+    }
+    for(int i = numSlots; i < (numSlots + numLargeSlots); i++) {
+        slots[i].data = largeSlotData[i - numSlots];
+        slots[i].freeQueue = freeLargeSlots;
+        xQueueSend(freeLargeSlots, &i, 0);
+    }
+
+    handlerMutex = xSemaphoreCreateMutexStatic(&handlerMutexBuf);
+    memset(handlers, 0, sizeof(handlers));
+    memset(handlerParams, 0, sizeof(handlerParams));
+}
+
+/**
+ * @brief Default destructor, which cleans up allocated data.
+ */
+MqttIngress::~MqttIngress(void)
+{
+    if(taskHandle) vTaskDelete(taskHandle);
+}
+
+/**
+ * @brief Create the ingress task.
+ *
+ * @return err_t ERR_OK on success.
+ */
+MqttIngress::err_t MqttIngress::start(void)
+{
+    if(nullptr != taskHandle) return ERR_OK;
+
+    taskHandle = xTaskCreateStaticPinnedToCore(taskFuncDispatch, "mqtt_ingress", taskStackSize, (void*) this, taskPrio,
+        taskStack, &taskBuf, controlTaskCore);
+    if(nullptr == taskHandle) {
+        ESP_LOGE(logTag, "Failed to create MQTT ingress task.");
+        return ERR_NO_RESOURCES;
+    }
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Register the handler of a message type. An already registered handler is replaced.
+ *
+ * @param type Message type.
+ * @param handler Handler function.
+ * @param param Parameter passed to the handler.
+ * @return err_t ERR_OK on success.
+ */
+MqttIngress::err_t MqttIngress::registerHandler(msg_type_t type, MessageHandlerFncPtr handler, void* param)
+{
+    if((type < 0) || (type >= MSG_MAX) || (nullptr == handler)) return ERR_INVALID_ARG;
+
+    xSemaphoreTake(handlerMutex, portMAX_DELAY);
+    handlers[type] = handler;
+    handlerParams[type] = param;
+    xSemaphoreGive(handlerMutex);
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Queue a received message for processing by the ingress task.
+ *
+ * Meant to be called by the MQTT subscription callbacks. Doesn't block.
+ * Irrigation configs exceeding slotDataSize go to a large slot.
+ *
+ * @param type Message type.
+ * @param data Message data (doesn't need to be NULL-terminated).
+ * @param dataLen Length of the message data.
+ * @return err_t ERR_OK on success, ERR_NO_SLOT if all slots are in use, ERR_TOO_LARGE if the message
+ * exceeds slotDataSize (largeSlotDataSize for irrigation configs).
+ */
+MqttIngress::err_t MqttIngress::post(msg_type_t type, const char* data, int dataLen)
+{
+    int idx;
+
+    if((type < 0) || (type >= MSG_MAX) || (dataLen < 0) || ((nullptr == data) && (dataLen > 0))) return ERR_INVALID_ARG;
+
+    bool large = (dataLen > (int) slotDataSize);
+    if((large && (MSG_IRRIG_CONFIG != type)) || (dataLen > (int) largeSlotDataSize)) {
+        ESP_LOGE(logTag, "Dropping %s message (%d bytes): too large.", MQTT_INGRESS_MSG_TO_STR(type), dataLen);
+        return ERR_TOO_LARGE;
+    }
+
+    if(pdTRUE != xQueueReceive(large ? freeLargeSlots : freeSlots, &idx, 0)) {
+        ESP_LOGE(logTag, "Dropping %s message (%d bytes): no free slot.", MQTT_INGRESS_MSG_TO_STR(type), dataLen);
+        return ERR_NO_SLOT;
+    }
+
+    slots[idx].type = type;
+    slots[idx].dataLen = dataLen;
+    if(dataLen > 0) memcpy(slots[idx].data, data, dataLen);
+    slots[idx].data[dataLen] = 0;
+
+    // released by the ingress task once the message has been processed
+    pwrMgr.setKeepAwakeForce(true);
+    xQueueSend(pendingSlots, &idx, 0); // can't fail, as there are never more slot indices than entries
+
+    return ERR_OK;
+}
+
+void MqttIngress::taskFuncDispatch(void* params)
+{
+    MqttIngress* ingress = (MqttIngress*) params;
+
+    if(nullptr == ingress) {
+        ESP_LOGE("unkown", "No valid MqttIngress available to dispatch the task function to!");
+        vTaskDelete(NULL);
+    } else {
+        ingress->taskFunc();
+    }
+}
+
+void MqttIngress::taskFunc(void)
+{
+    int idx;
+
+    while(1) {
+        if(pdTRUE != xQueueReceive(pendingSlots, &idx, portMAX_DELAY)) continue;
+
+        slot_t* slot = &slots[idx];
+        MessageHandlerFncPtr handler;
+        void* param;
+
+        xSemaphoreTake(handlerMutex, portMAX_DELAY);
+        handler = handlers[slot->type];
+        param = handlerParams[slot->type];
+        xSemaphoreGive(handlerMutex);
+
+        if(nullptr == handler) {
+            ESP_LOGW(logTag, "No handler for %s message registered. Dropping it.", MQTT_INGRESS_MSG_TO_STR(slot->type));
+        } else {
+            ESP_LOGD(logTag, "Processing %s message (%d bytes).", MQTT_INGRESS_MSG_TO_STR(slot->type), slot->dataLen);
+            handler(slot->data, slot->dataLen, param);
+        }
+
+        xQueueSend(slot->freeQueue, &idx, 0);
+        pwrMgr.setKeepAwakeForce(false);
+    }
+}
@@ -0,0 +1,229 @@
+#include "outputActuator.h"
+
+#include <sys/time.h>
+
+#include "globalComponents.h"
+
+static_assert(OutputController::NUM_CHANNELS <= 64, "Channel masks of the requests are limited to 64 channels.");
+
+/**
+ * @brief Default constructor, which performs basic initialization.
+ *
+ * Note: The actuation task is created by start(). Until then, requests are queued only.
+ */
+OutputActuator::OutputActuator(void)
+{
+    taskHandle = nullptr;
+    batchActive = false;
+    requestQueue = xQueueCreateStatic(queueLen, sizeof(request_t), requestQueueStorage, &requestQueueBuf);
+}
+
+/**
+ * @brief Default destructor, which cleans up allocated data.
+ */
+OutputActuator::~OutputActuator(void)
+{
+    if(taskHandle) vTaskDelete(taskHandle);
+}
+
+/**
+ * @brief Create the actuation task (pinned to the control core).
+ *
+ * @return err_t ERR_OK on success.
+ */
+OutputActuator::err_t OutputActuator::start(void)
+{
+    if(nullptr != taskHandle) return ERR_OK;
+
+    taskHandle = xTaskCreateStaticPinnedToCore(taskFuncDispatch, "out_act_task", taskStackSize, (void*) this, taskPrio,
+        taskStack, &taskBuf, controlTaskCore);
+    if(nullptr == taskHandle) {
+        ESP_LOGE(logTag, "Failed to create output actuation task.");
+        return ERR_NO_RESOURCES;
+    }
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Start a batch: setOutput() calls are collected until commit().
+ *
+ * Note: Meant to be used by a single task (the IrrigationController).
+ */
+void OutputActuator::beginUpdate(void)
+{
+    batch.type = REQ_UPDATE;
+    batch.onMask = 0;
+    batch.offMask = 0;
+    batch.eventTime = 0;
+    batch.requester = nullptr;
+    batchActive = true;
+}
+
+/**
+ * @brief Request to switch an output.
+ *
+ * Within a batch (see beginUpdate()) the change is queued by commit(), otherwise right away.
+ *
+ * @param outputNum The output channel to be switched.
+ * @param switchOn Wether or not to switch the output on.
+ * @param eventTime Time of the event triggering the switching, used to measure the latency (0 = none).
+ * @return err_t ERR_OK on success, ERR_QUEUE_FULL if the request couldn't be queued.
+ */
+OutputActuator::err_t OutputActuator::setOutput(OutputController::ch_map_t outputNum, bool switchOn, time_t eventTime)
+{
+    if(outputNum >= OutputController::NUM_CHANNELS) return ERR_INVALID_PARAM;
+
+    bool implicitBatch = !batchActive;
+    if(implicitBatch) beginUpdate();
+
+    uint64_t mask = 1ULL << outputNum;
+    if(switchOn) {
+        batch.onMask |= mask;
+        batch.offMask &= ~mask;
+    } else {
+        batch.offMask |= mask;
+        batch.onMask &= ~mask;
+    }
+    if(0 != eventTime) batch.eventTime = eventTime;
+
+    return implicitBatch ? commit() : ERR_OK;
+}
+
+/**
+ * @brief Queue the batch (see beginUpdate()) and end it.
+ *
+ * @return err_t ERR_OK on success, ERR_QUEUE_FULL if the request couldn't be queued.
+ */
+OutputActuator::err_t OutputActuator::commit(void)
+{
+    if(!batchActive) return ERR_OK;
+    batchActive = false;
+
+    if((0 == batch.onMask) && (0 == batch.offMask)) return ERR_OK;
+
+    return post(batch);
+}
+
+/**
+ * @brief Request to disable all outputs at once.
+ *
+ * @return err_t ERR_OK on success, ERR_QUEUE_FULL if the request couldn't be queued.
+ */
+OutputActuator::err_t OutputActuator::disableAllOutputs(void)
+{
+    request_t req;
+
+    req.type = REQ_DISABLE_ALL;
+    req.onMask = 0;
+    req.offMask = 0;
+    req.eventTime = 0;
+    req.requester = nullptr;
+
+    return post(req);
+}
+
+/**
+ * @brief Wait until all requests queued so far have been performed, e.g. before checking the
+ * output states or going to sleep.
+ *
+ * Note: Uses the task notification of the calling task.
+ *
+ * @param wait Maximum time to wait in OS ticks.
+ * @return err_t ERR_OK on success, ERR_TIMEOUT if the requests haven't been performed in time.
+ */
+OutputActuator::err_t OutputActuator::flush(TickType_t wait)
+{
+    request_t req;
+    err_t ret;
+
+    req.type = REQ_FLUSH;
+    req.onMask = 0;
+    req.offMask = 0;
+    req.eventTime = 0;
+    req.requester = xTaskGetCurrentTaskHandle();
+
+    ulTaskNotifyTake(pdTRUE, 0); // drop a stale notification
+    ret = post(req);
+    if((ERR_OK == ret) && (0 == ulTaskNotifyTake(pdTRUE, wait))) {
+        ESP_LOGE(logTag, "Output requests not performed within timeout!");
+        ret = ERR_TIMEOUT;
+    }
+
+    return ret;
+}
+
+OutputActuator::err_t OutputActuator::post(const request_t& req)
+{
+    if(pdTRUE != xQueueSend(requestQueue, &req, 0)) {
+        ESP_LOGE(logTag, "Request queue full! Dropping request %d.", req.type);
+        return ERR_QUEUE_FULL;
+    }
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Record the latency of a switching relative to its event time.
+ *
+ * Switchings ahead of the event time are recorded with zero latency.
+ */
+void OutputActuator::recordLatency(bool switchOn, time_t eventTime)
+{
+    struct timeval tv;
+
+    if(0 == eventTime) return;
+
+    gettimeofday(&tv, NULL);
+    int64_t latency = ((int64_t) tv.tv_sec - eventTime) * 1000000 + tv.tv_usec;
+    if(latency < 0) latency = 0;
+    if(latency > UINT32_MAX) latency = UINT32_MAX;
+
+    wakeProfiler.addSample(switchOn ? WakeProfiler::SCOPE_RELAY_ON_LATENCY : WakeProfiler::SCOPE_RELAY_OFF_LATENCY,
+        (uint32_t) latency);
+}
+
+void OutputActuator::taskFuncDispatch(void* params)
+{
+    OutputActuator* actuator = (OutputActuator*) params;
+
+    if(nullptr == actuator) {
+        ESP_LOGE("unkown", "No valid OutputActuator available to dispatch the task function to!");
+        vTaskDelete(NULL);
+    } else {
+        actuator->taskFunc();
+    }
+}
+
+void OutputActuator::taskFunc(void)
+{
+    request_t req;
+
+    while(1) {
+        if(pdTRUE != xQueueReceive(requestQueue, &req, portMAX_DELAY)) continue;
+
+        switch(req.type) {
+            case REQ_UPDATE:
+                outputCtrl.beginUpdate();
+                for(int ch = 0; ch < OutputController::NUM_CHANNELS; ch++) {
+                    uint64_t mask = 1ULL << ch;
+                    if(0 != ((req.onMask | req.offMask) & mask)) {
+                        outputCtrl.setOutput((OutputController::ch_map_t) ch, 0 != (req.onMask & mask));
+                    }
+                }
+                outputCtrl.commit();
+
+                if(0 != req.onMask) recordLatency(true, req.eventTime);
+                if(0 != req.offMask) recordLatency(false, req.eventTime);
+                break;
+            case REQ_DISABLE_ALL:
+                outputCtrl.disableAllOutputs();
+                break;
+            case REQ_FLUSH:
+                if(nullptr != req.requester) xTaskNotifyGive(req.requester);
+                break;
+            default:
+                break;
+        }
+    }
+}
@@ -1,15 +1,62 @@
 #include "outputController.h"
 
+#include "soc/gpio_struct.h"
+#include "rom/ets_sys.h"
+
+#include "globalComponents.h"
+
+// The internal outputs are written at once by the GPIO_OUT_W1TS/W1TC registers, which cover GPIO 0..31 only
+static_assert((irrigationMainGpioNum < 32) && (irrigationAux0GpioNum < 32) && (irrigationAux1GpioNum < 32),
+    "Internal output GPIOs must be in the range 0..31.");
+
+RTC_DATA_ATTR static OutputController::persistent_data_t outputCtrlPersistentData = {
+    .held = false,
+    .activeIntChannelMap = 0,
+    .activeExtChannelMap = 0
+};
+
 /**
  * @brief Default constructor, which performs basic initialization.
+ *
+ * Outputs held during deep sleep (see setHold()) keep their state on wakeups. On any other
+ * boot (e.g. emergency reboots) all outputs get disabled.
  */
 OutputController::OutputController(void)
 {
-    // setup mapped GPIOs to inactive state
+    bool restore = outputCtrlPersistentData.held && (ESP_SLEEP_WAKEUP_UNDEFINED != esp_sleep_get_wakeup_cause());
+
+    activeIntChannelMap = restore ? outputCtrlPersistentData.activeIntChannelMap : 0U;
+    activeExtChannelMap = restore ? outputCtrlPersistentData.activeExtChannelMap : 0U;
+    updateActive = false;
+    pendingIntChannelMap = activeIntChannelMap;
+    pendingExtChannelMap = activeExtChannelMap;
+
+    // setup mapped GPIOs to their (restored) state, before releasing the hold
     for(int i = 0; i < (sizeof(intChannelMap) / sizeof(intChannelMap[0])); i++) {
-        gpio_set_level(intChannelMap[i], 0);
+        gpio_set_level(intChannelMap[i], (0U != (activeIntChannelMap & (1U << i))) ? 1U : 0U);
         gpio_set_direction(intChannelMap[i], GPIO_MODE_OUTPUT);
+        rtc_gpio_hold_dis(intChannelMap[i]);
+    }
+
+    // the shift register keeps its state on its own, so only the lines get setup
+    gpio_set_level(outputExtDataGpioNum, 0);
+    gpio_set_level(outputExtClockGpioNum, 0);
+    gpio_set_level(outputExtLatchGpioNum, 0);
+    gpio_set_level(outputExtEnableGpioNum, (0U != activeExtChannelMap) ? 0U : 1U);
+    for(int i = 0; i < (sizeof(extGpios) / sizeof(extGpios[0])); i++) {
+        gpio_set_direction(extGpios[i], GPIO_MODE_OUTPUT);
     }
+    for(int i = 0; i < (sizeof(extHoldGpios) / sizeof(extHoldGpios[0])); i++) {
+        rtc_gpio_hold_dis(extHoldGpios[i]);
+    }
+
+    if(restore && ((0U != activeIntChannelMap) || (0U != activeExtChannelMap))) {
+        ESP_LOGI(logTag, "Outputs restored after deep sleep (map 0x%08x, ext 0x%08x).", activeIntChannelMap,
+            activeExtChannelMap);
+    }
+    energyMeter.setLevel(EnergyMeter::STATE_OUTPUTS,
+        __builtin_popcount(activeIntChannelMap) + __builtin_popcount(activeExtChannelMap));
+    outputCtrlPersistentData.held = false;
 }
 
 /**
@@ -21,6 +68,7 @@ OutputController::~OutputController(void)
     for(int i = 0; i < (sizeof(intChannelMap) / sizeof(intChannelMap[0])); i++) {
         gpio_set_level(intChannelMap[i], 0);
     }
+    gpio_set_level(outputExtEnableGpioNum, 1);
 }
 
 /**
@@ -28,12 +76,26 @@ OutputController::~OutputController(void)
  */
 bool OutputController::anyOutputsActive(void)
 {
-    return (activeIntChannelMap != 0U);
+    return (activeIntChannelMap != 0U) || (activeExtChannelMap != 0U);
+}
+
+/**
+ * @brief Start a transaction: setOutput() calls are collected until commit().
+ *
+ * The transaction starts from the current output states.
+ */
+void OutputController::beginUpdate(void)
+{
+    pendingIntChannelMap = activeIntChannelMap;
+    pendingExtChannelMap = activeExtChannelMap;
+    updateActive = true;
 }
 
 /**
  * @brief Set an output channel to the desired value.
- * 
+ *
+ * Within a transaction (see beginUpdate()) the change is applied by commit(), otherwise right away.
+ *
  * @param outputNum The output channel to be switched
  * @param switchOn Wether or not to switch the output on
  * @return OutputController::err_t
@@ -42,38 +104,137 @@ bool OutputController::anyOutputsActive(void)
  */
 OutputController::err_t OutputController::setOutput(ch_map_t outputNum, bool switchOn)
 {
-    err_t ret = ERR_OK;
-
-    if(outputNum >= NUM_CHANNELS) return ERR_INVALID_PARAM;
+    uint32_t* map;
+    uint32_t mapMask;
 
     if((outputNum >= intChannelMin) && (outputNum <= intChannelMax)) {
-        ESP_LOGD(logTag, "Switching output %d (%s; GPIO %d) %s", outputNum, CH_MAP_TO_STR(outputNum),
-                    intChannelMap[outputNum], switchOn ? "ON" : "OFF");
-        gpio_set_level(intChannelMap[outputNum-intChannelMin], switchOn ? 1U : 0U);
+        map = &pendingIntChannelMap;
+        mapMask = 1U << (outputNum - intChannelMin);
+    } else if((outputNum >= extChannelMin) && (outputNum <= extChannelMax)) {
+        map = &pendingExtChannelMap;
+        mapMask = 1U << (outputNum - extChannelMin);
+    } else {
+        return ERR_INVALID_PARAM;
+    }
+
+    if(!updateActive) {
+        pendingIntChannelMap = activeIntChannelMap;
+        pendingExtChannelMap = activeExtChannelMap;
+    }
+
+    if(switchOn) {
+        *map |= mapMask;
+    } else {
+        *map &= ~mapMask;
+    }
+
+    if(!updateActive) commit();
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Apply the output states of the transaction (see beginUpdate()) and end it.
+ */
+void OutputController::commit(void)
+{
+    updateActive = false;
+
+    if((pendingIntChannelMap == activeIntChannelMap) && (pendingExtChannelMap == activeExtChannelMap)) return;
 
-        uint32_t mapMask = 1U << (outputNum-intChannelMin);
-        if(switchOn) {
-            activeIntChannelMap |= mapMask;
+    ESP_LOGD(logTag, "Switching outputs: map 0x%08x -> 0x%08x, ext 0x%08x -> 0x%08x", activeIntChannelMap,
+        pendingIntChannelMap, activeExtChannelMap, pendingExtChannelMap);
+
+    if(pendingIntChannelMap != activeIntChannelMap) writeIntOutputs(pendingIntChannelMap);
+    if(pendingExtChannelMap != activeExtChannelMap) writeExtOutputs(pendingExtChannelMap);
+
+    activeIntChannelMap = pendingIntChannelMap;
+    activeExtChannelMap = pendingExtChannelMap;
+    energyMeter.setLevel(EnergyMeter::STATE_OUTPUTS,
+        __builtin_popcount(activeIntChannelMap) + __builtin_popcount(activeExtChannelMap));
+}
+
+/**
+ * @brief Write all internal outputs at once.
+ */
+void OutputController::writeIntOutputs(uint32_t channelMap)
+{
+    uint32_t setMask = 0;
+    uint32_t clearMask = 0;
+
+    for(int i = 0; i < (sizeof(intChannelMap) / sizeof(intChannelMap[0])); i++) {
+        if(0U != (channelMap & (1U << i))) {
+            setMask |= (1U << intChannelMap[i]);
         } else {
-            activeIntChannelMap &= ~mapMask;
+            clearMask |= (1U << intChannelMap[i]);
         }
-    } else if((outputNum >= extChannelMin) && (outputNum <= extChannelMax)) {
-        ESP_LOGW(logTag, "External outputs not yet supported.");
-        ret = ERR_INVALID_PARAM;
-    } else {
-        ret = ERR_INVALID_PARAM;
     }
 
-    return ret;
+    GPIO.out_w1ts = setMask;
+    GPIO.out_w1tc = clearMask;
+}
+
+/**
+ * @brief Shift all external outputs into the register and latch them at once.
+ *
+ * The register outputs are disabled while no external channel is active.
+ */
+void OutputController::writeExtOutputs(uint32_t channelMap)
+{
+    // MSB first, i.e. CH_EXT0 ends up at QA
+    for(int i = extChannels - 1; i >= 0; i--) {
+        gpio_set_level(outputExtDataGpioNum, (0U != (channelMap & (1U << i))) ? 1U : 0U);
+        gpio_set_level(outputExtClockGpioNum, 1);
+        ets_delay_us(1);
+        gpio_set_level(outputExtClockGpioNum, 0);
+    }
+    gpio_set_level(outputExtLatchGpioNum, 1);
+    ets_delay_us(1);
+    gpio_set_level(outputExtLatchGpioNum, 0);
+
+    gpio_set_level(outputExtEnableGpioNum, (0U != channelMap) ? 0U : 1U);
+}
+
+/**
+ * @brief Hold the output states, so they are kept during deep sleep. Meant to be called right before deep sleep.
+ *
+ * The states are restored on wakeups by the constructor. Don't change outputs while they are held!
+ *
+ * @param en Wether to enable or release the hold.
+ */
+void OutputController::setHold(bool en)
+{
+    outputCtrlPersistentData.activeIntChannelMap = activeIntChannelMap;
+    outputCtrlPersistentData.activeExtChannelMap = activeExtChannelMap;
+    outputCtrlPersistentData.held = en;
+
+    for(int i = 0; i < (sizeof(intChannelMap) / sizeof(intChannelMap[0])); i++) {
+        if(en) {
+            rtc_gpio_hold_en(intChannelMap[i]);
+        } else {
+            rtc_gpio_hold_dis(intChannelMap[i]);
+        }
+    }
+    for(int i = 0; i < (sizeof(extHoldGpios) / sizeof(extHoldGpios[0])); i++) {
+        if(en) {
+            rtc_gpio_hold_en(extHoldGpios[i]);
+        } else {
+            rtc_gpio_hold_dis(extHoldGpios[i]);
+        }
+    }
+
+    // the pad holds need the RTC peripherals being powered
+    if(en) esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
 }
 
 /**
  * @brief Disable all outputs at once.
- * 
+ *
  */
 void OutputController::disableAllOutputs(void)
 {
-    for(int outputNum = intChannelMin; outputNum <= intChannelMax; outputNum++) {
-        setOutput((ch_map_t) outputNum, false);
-    }
+    beginUpdate();
+    pendingIntChannelMap = 0U;
+    pendingExtChannelMap = 0U;
+    commit();
 }
@@ -4,6 +4,9 @@
 
 #include "globalComponents.h"
 
+/** Wether or not the peripheral enable was held when going to deep sleep (i.e. outputs were active) */
+RTC_DATA_ATTR static bool peripheralEnHeld = false;
+
 PowerManager::PowerManager()
 {
     // setup ADC for battery voltage conversion
@@ -32,13 +35,17 @@ PowerManager::PowerManager()
     battVoltageMult = 10.1F;
 
     // setup peripheral power and enable GPIOs, state and mutexes
-    gpio_set_level(peripheralEnGpioNum, 0);
+    // the peripheral enable is kept on wakeups if it was held during deep sleep (see setPeripheralEnableHold)
+    peripheralEnState = peripheralEnHeld && (ESP_SLEEP_WAKEUP_UNDEFINED != esp_sleep_get_wakeup_cause());
+    peripheralEnHeld = false;
+    gpio_set_level(peripheralEnGpioNum, peripheralEnState ? 1 : 0);
     gpio_set_level(peripheralExtSupplyGpioNum, 0);
     gpio_set_direction(peripheralEnGpioNum, GPIO_MODE_OUTPUT);
     gpio_set_direction(peripheralExtSupplyGpioNum, GPIO_MODE_OUTPUT);
+    rtc_gpio_hold_dis(peripheralEnGpioNum);
 
-    peripheralEnState = false;
     peripheralExtSupplyState = false;
+    energyMeter.setLevel(EnergyMeter::STATE_PERIPHERAL, peripheralEnState ? 1 : 0);
 
     peripheralEnMutex = xSemaphoreCreateMutexStatic(&peripheralEnMutexBuf);
     peripheralExtSupplyMutex = xSemaphoreCreateMutexStatic(&peripheralExtSupplyMutexBuf);
@@ -53,6 +60,19 @@ PowerManager::PowerManager()
     keepAwakeAtBootState = gpio_get_level(keepAwakeGpioNum);
 
     configMutex = xSemaphoreCreateMutexStatic(&configMutexBuf);
+
+    // battery sampling timer will be created on first use, because esp_timer may not be available yet
+    battSampleTimer = nullptr;
+    battSampleDoneSem = xSemaphoreCreateBinaryStatic(&battSampleDoneSemBuf);
+    battSampleActive = false;
+
+    // fetch the data of the ULP battery monitor (if it was running during deep sleep) and stop it
+    lastSupplyVoltageMilli = 0;
+    ulpBattDataValid = UlpBattMonitor_GetData(&ulpBattData);
+    UlpBattMonitor_Stop();
+    if(ulpBattDataValid) {
+        lastSupplyVoltageMilli = battRawToMilli(ulpBattData.lastRaw);
+    }
 }
 
 PowerManager::~PowerManager()
@@ -60,25 +80,83 @@ PowerManager::~PowerManager()
     if (configMutex) vSemaphoreDelete(configMutex);
 }
 
+/**
+ * @brief Measure the supply voltage (blocking).
+ * 
+ * @return uint32_t Supply voltage in mV.
+ */
 uint32_t PowerManager::getSupplyVoltageMilli(void)
 {
-    int adcRaw;
-    uint32_t millis = 0;
-    float result = NAN;
-    int sampleCnt;
+    if(!startSupplyVoltageSampling()) return 0;
 
-    for(sampleCnt = 7; sampleCnt >= 0; sampleCnt--) {
-        adcRaw = adc1_get_raw(battVoltageChannel);
-        if(adcRaw > -1) {
-            millis += esp_adc_cal_raw_to_voltage(adcRaw, &battVoltageAdcCharacteristics);
-        } else {
-            break;
+    return waitSupplyVoltageMilli(portMAX_DELAY);
+}
+
+/**
+ * @brief Start measuring the supply voltage in the background.
+ * 
+ * The samples are taken by an esp_timer, so the caller can do other things meanwhile
+ * (e.g. waiting for the external sensor supply). The result must be fetched by
+ * waitSupplyVoltageMilli().
+ * 
+ * @return bool True if the sampling has been started.
+ */
+bool PowerManager::startSupplyVoltageSampling(void)
+{
+    if(nullptr == battSampleTimer) {
+        esp_timer_create_args_t timerArgs;
+        timerArgs.callback = battSampleTimerCb;
+        timerArgs.arg = this;
+        timerArgs.dispatch_method = ESP_TIMER_TASK;
+        timerArgs.name = "batt_sample";
+
+        if(ESP_OK != esp_timer_create(&timerArgs, &battSampleTimer)) {
+            ESP_LOGE(logTag, "Battery sampling timer couldn't be created.");
+            battSampleTimer = nullptr;
+            return false;
         }
-        if(sampleCnt > 0) vTaskDelay(pdMS_TO_TICKS(10));
     }
 
-    if(adcRaw > -1) {
-        millis = millis>>3;
+    if(battSampleActive) {
+        ESP_LOGW(logTag, "Battery sampling already running.");
+        return false;
+    }
+
+    xSemaphoreTake(battSampleDoneSem, 0); // drop a stale result
+    battSampleCnt = 0;
+    battSampleSumMilli = 0;
+    battSampleErr = false;
+    battSampleActive = true;
+
+    // take the first sample right away, the remaining ones are taken by the timer
+    battSample();
+    if(battSampleActive && (ESP_OK != esp_timer_start_periodic(battSampleTimer, battSampleIntervalMillis * 1000))) {
+        ESP_LOGE(logTag, "Battery sampling timer couldn't be started.");
+        battSampleActive = false;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Wait for the result of a supply voltage measurement started by startSupplyVoltageSampling().
+ * 
+ * @param wait Maximum time to wait in OS ticks.
+ * @return uint32_t Supply voltage in mV. Zero in case of errors or timeout.
+ */
+uint32_t PowerManager::waitSupplyVoltageMilli(TickType_t wait)
+{
+    float result = NAN;
+    uint32_t millis;
+
+    if(pdTRUE != xSemaphoreTake(battSampleDoneSem, wait)) {
+        ESP_LOGE(logTag, "Battery sampling didn't complete within timeout.");
+        return 0;
+    }
+
+    if(!battSampleErr) {
+        millis = battSampleSumMilli / battNumSamples;
         ESP_LOGD(logTag, "batt voltage filtered, calibrated from ADC: %04d mV", millis);
         result = millis * battVoltageMult;
     } else {
@@ -86,7 +164,141 @@ uint32_t PowerManager::getSupplyVoltageMilli(void)
     }
 
     // return the rounded value (assumes positive floats)
-    return ((uint32_t)((result)+0.5));
+    lastSupplyVoltageMilli = ((uint32_t)((result)+0.5));
+    return lastSupplyVoltageMilli;
+}
+
+/**
+ * @brief Get the summary of the battery voltage samples taken by the ULP during the last deep sleep.
+ * 
+ * The data is considered fresh (i.e. can replace an own measurement) for one ULP sampling period after the wakeup.
+ * 
+ * @param dst Destination storage.
+ * @return bool True if fresh data is available.
+ */
+bool PowerManager::getUlpBatterySummary(ulp_batt_summary_t* dst)
+{
+    if(!ulpBattDataValid) return false;
+    if((portTICK_PERIOD_MS * xTaskGetTickCount()) >= ulpBattSamplePeriodMillis) return false;
+
+    dst->lastMilli = battRawToMilli(ulpBattData.lastRaw);
+    dst->minMilli = battRawToMilli(ulpBattData.minRaw);
+    dst->avgMilli = battRawToMilli(ulpBattData.sumRaw / ulpBattData.numSamples);
+    dst->numSamples = ulpBattData.numSamples;
+
+    return true;
+}
+
+/**
+ * @brief Convert a raw ADC reading of the battery voltage channel to the battery voltage.
+ * 
+ * @param raw Raw ADC reading.
+ * @return uint32_t Battery voltage in mV.
+ */
+uint32_t PowerManager::battRawToMilli(uint32_t raw)
+{
+    return ((uint32_t)((esp_adc_cal_raw_to_voltage(raw, &battVoltageAdcCharacteristics) * battVoltageMult)+0.5));
+}
+
+/**
+ * @brief Convert a battery voltage to the (lowest) raw ADC reading of the battery voltage channel
+ * representing it.
+ * 
+ * @param millis Battery voltage in mV.
+ * @return uint16_t Raw ADC reading.
+ */
+uint16_t PowerManager::battMilliToRaw(uint32_t millis)
+{
+    uint32_t low = 0;
+    uint32_t high = 4095;
+
+    // the calibration is monotonic, so perform a binary search
+    while(low < high) {
+        uint32_t mid = (low + high) / 2;
+        if(battRawToMilli(mid) < millis) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return (uint16_t) low;
+}
+
+/**
+ * @brief Start the ULP battery monitor before going to deep sleep.
+ * 
+ * The ULP wakes up the main CPU if the battery voltage leaves the range of the current battery state,
+ * i.e. one of the thresholds of the battery config is crossed by more than ulpBattWakeHysteresisMilli.
+ */
+void PowerManager::startUlpBattMonitor(void)
+{
+    uint16_t wakeBelowRaw = 0;
+    uint16_t wakeAboveRaw = 0xffff;
+    int critical, low, ok;
+    bool disabled;
+
+    if (pdFALSE == xSemaphoreTake(configMutex, lockAcquireTimeout)) {
+        ESP_LOGE(logTag, "Couldn't acquire config lock within timeout!");
+        return;
+    }
+    disabled = battMonitorDisabled;
+    critical = battCriticalThresholdMilli;
+    low = battLowThresholdMilli;
+    ok = battOkThresholdMilli;
+    xSemaphoreGive(configMutex);
+
+    if(disabled || (0 == lastSupplyVoltageMilli)) return;
+
+    // below the thresholds by the hysteresis margin, above them by the same margin
+    int hyst = ulpBattWakeHysteresisMilli;
+    if((int) lastSupplyVoltageMilli >= ok) {
+        wakeBelowRaw = battMilliToRaw((ok > hyst) ? (ok - hyst) : 0);
+    } else if((int) lastSupplyVoltageMilli >= low) {
+        wakeBelowRaw = battMilliToRaw((low > hyst) ? (low - hyst) : 0);
+        wakeAboveRaw = battMilliToRaw(ok + hyst);
+    } else if((int) lastSupplyVoltageMilli >= critical) {
+        wakeBelowRaw = battMilliToRaw((critical > hyst) ? (critical - hyst) : 0);
+        wakeAboveRaw = battMilliToRaw(low + hyst);
+    } else {
+        wakeAboveRaw = battMilliToRaw(critical + hyst);
+    }
+
+    UlpBattMonitor_Start(battVoltageChannel, ulpBattSamplePeriodMillis, wakeBelowRaw, wakeAboveRaw);
+}
+
+/**
+ * @brief Dispatcher of the battery sampling timer.
+ */
+void PowerManager::battSampleTimerCb(void* arg)
+{
+    PowerManager* manager = (PowerManager*) arg;
+
+    manager->battSample();
+}
+
+/**
+ * @brief Take a single battery voltage sample and signal completion after the last one.
+ */
+void PowerManager::battSample(void)
+{
+    int adcRaw;
+
+    if(!battSampleActive) return;
+
+    adcRaw = adc1_get_raw(battVoltageChannel);
+    if(adcRaw > -1) {
+        battSampleSumMilli += esp_adc_cal_raw_to_voltage(adcRaw, &battVoltageAdcCharacteristics);
+        battSampleCnt++;
+    } else {
+        battSampleErr = true;
+    }
+
+    if(battSampleErr || (battSampleCnt >= battNumSamples)) {
+        esp_timer_stop(battSampleTimer); // fails if the timer hasn't been started yet, which is fine
+        battSampleActive = false;
+        xSemaphoreGive(battSampleDoneSem);
+    }
 }
 
 /**
@@ -120,6 +332,7 @@ void PowerManager::setPeripheralEnable(bool en)
     if(pdTRUE == xSemaphoreTake(peripheralEnMutex, portMAX_DELAY)) {
         gpio_set_level(peripheralEnGpioNum, (en == true) ? 1 : 0);
         peripheralEnState = en;
+        energyMeter.setLevel(EnergyMeter::STATE_PERIPHERAL, en ? 1 : 0);
 
         if(pdFALSE == xSemaphoreGive(peripheralEnMutex)) {
             ESP_LOGE(logTag, "Error occurred releasing the peripheralEnMutex.");
@@ -134,6 +347,24 @@ bool PowerManager::getPeripheralEnable(void)
     return peripheralEnState;
 }
 
+/**
+ * @brief Hold the state of the peripheral enable, so it is kept during deep sleep (e.g. for active outputs).
+ * Meant to be called right before deep sleep.
+ * 
+ * @param en Wether to enable or release the hold.
+ */
+void PowerManager::setPeripheralEnableHold(bool en)
+{
+    peripheralEnHeld = en && peripheralEnState;
+
+    if(en) {
+        rtc_gpio_hold_en(peripheralEnGpioNum);
+        esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+    } else {
+        rtc_gpio_hold_dis(peripheralEnGpioNum);
+    }
+}
+
 void PowerManager::setPeripheralExtSupply(bool en)
 {
     if((peripheralEnState == false) && (en == true)) {
@@ -143,6 +374,7 @@ void PowerManager::setPeripheralExtSupply(bool en)
     if(pdTRUE == xSemaphoreTake(peripheralExtSupplyMutex, portMAX_DELAY)) {
         gpio_set_level(peripheralExtSupplyGpioNum, (en == true) ? 1 : 0);
         peripheralExtSupplyState = en;
+        energyMeter.setLevel(EnergyMeter::STATE_EXT_SUPPLY, en ? 1 : 0);
 
         if(pdFALSE == xSemaphoreGive(peripheralExtSupplyMutex)) {
             ESP_LOGE(logTag, "Error occurred releasing the peripheralExtSupplyMutex.");
@@ -173,6 +405,8 @@ void PowerManager::setKeepAwakeForce(bool en)
             ESP_LOGE(logTag, "Couldn't decrease keepAwakeForced semaphore. Most likely we'll be stuck in keep awake now!");
         }
     }
+
+    energyMeter.setLevel(EnergyMeter::STATE_KEEP_AWAKE, getKeepAwakeForce() ? 1 : 0);
 }
 
 bool PowerManager::getKeepAwakeForce(void)
@@ -205,6 +439,9 @@ bool PowerManager::gotoSleep(uint32_t ms)
         // setup ext0 wakeup for keepAwake input
         esp_sleep_enable_ext0_wakeup(keepAwakeGpioNum, 0);
 
+        // let the ULP monitor the battery voltage
+        if(ulpBattMonitorEnabled) startUlpBattMonitor();
+
         err = esp_sleep_enable_timer_wakeup(sleepUs);
         if(ESP_OK != err) ESP_LOGE(logTag, "Error setting up deep sleep timer.");
 
@@ -223,6 +460,7 @@ bool PowerManager::gotoSleep(uint32_t ms)
 
         // actually go to sleep
         if(ESP_OK == err) {
+            energyMeter.enterDeepSleep(ms);
             esp_deep_sleep_start();
             ret = true; // previous function doesn't return, but this function must return something
         }
@@ -257,6 +495,7 @@ void PowerManager::hardwareConfigUpdated()
     } else {
         SettingsManager::battery_config_t batConf;
         settingsMgr.copyBatteryConfig(&batConf);
+        battMonitorDisabled = batConf.disableBatteryCheck;
         battCriticalThresholdMilli = batConf.battCriticalThresholdMilli;
         battLowThresholdMilli = batConf.battLowThresholdMilli;
         battOkThresholdMilli = batConf.battOkThresholdMilli;
@@ -0,0 +1,318 @@
+#ifndef SERIAL_FRAMER_H
+#define SERIAL_FRAMER_H
+
+#include <stdint.h>
+#include <cstring>
+
+#include "esp_log.h"
+
+/**
+ * @brief The SerialFramer class implements the framing used by the SerialPacketizer, i.e. it encodes
+ * payloads into frames and runs the receive FSM over received bytes.
+ *
+ * Frame format: preamble (0xfe 0xaa), payload length, inverted payload length, payload, postamble (0x55 0x01).
+ *
+ * It doesn't depend on a UART, so it can be fed with arbitrary byte streams as well (see feed()).
+ * Empty packets are dropped.
+ */
+template <unsigned int maxPayloadLen=16>
+class SerialFramer
+{
+public:
+    typedef struct {
+        int len;
+        uint8_t data[maxPayloadLen];
+    } BUFFER_T;
+
+    /** Hook called by feed() for each received packet */
+    typedef void(*PacketHookFncPtr)(const BUFFER_T* packet, void* param);
+
+private:
+    const char* logTag;
+
+    typedef enum {
+        RX_FSM_STATE_IDLE = 0,
+        RX_FSM_STATE_HEADER = 1,
+        RX_FSM_STATE_DATA = 2,
+        RX_FSM_STATE_FOOTER = 3
+    } RX_FSM_STATE_E;
+
+    const char preamble[2] = {0xfe, 0xaa};
+    static const int preambleLen = sizeof(preamble) / sizeof(preamble[0]);
+
+    const char postamble[2] = {0x55, 0x01};
+    static const int postambleLen = sizeof(postamble) / sizeof(postamble[0]);
+
+    // rx related state+buffers
+    BUFFER_T rxBuffer;
+    RX_FSM_STATE_E rxFsmState;
+    int rxFsmCnt;
+    uint8_t rxFsmLen;
+    bool rxFsmEn;
+
+public:
+    /** Maximum length of an encoded frame */
+    static const unsigned int maxFrameLen = maxPayloadLen + preambleLen + postambleLen + 2;
+
+    SerialFramer(void)
+    {
+        logTag = "ser_framer";
+        rxFsmLen = 0;
+        reset();
+    }
+
+    /**
+     * @brief Set the log tag of the framing messages.
+     *
+     * @param tag Log tag, which must exist for the lifetime of the framer.
+     */
+    void setLogTag(const char* tag) { logTag = tag; }
+
+    /**
+     * @brief Get the last postamble byte, e.g. for detecting the end of frames by UART pattern detection.
+     */
+    char getPostambleEnd(void) { return postamble[postambleLen-1]; }
+
+    /**
+     * @brief Drop the packet being received and reset the receive FSM.
+     */
+    void reset(void)
+    {
+        rxFsmState = RX_FSM_STATE_IDLE;
+        rxFsmCnt = 0;
+        rxFsmEn = false;
+        rxBuffer.len = -1;
+        memset(rxBuffer.data, 0x00, maxPayloadLen);
+    }
+
+    /**
+     * @brief Encode a payload into a frame.
+     *
+     * @param len Payload length.
+     * @param data Payload.
+     * @param dst Destination of the frame, which must hold maxFrameLen bytes.
+     * @return int Length of the frame or -1 if the payload is invalid.
+     */
+    int encode(unsigned int len, const uint8_t* data, uint8_t* dst)
+    {
+        if((len > maxPayloadLen) || (NULL == data) || (NULL == dst)) return -1;
+
+        memcpy(dst, preamble, preambleLen);
+        dst[preambleLen] = len & 0xff;
+        dst[preambleLen+1] = (len ^ 0xff) & 0xff;
+        memcpy(&dst[preambleLen+2], data, len);
+        memcpy(&dst[preambleLen+2+len], postamble, postambleLen);
+
+        return len+preambleLen+postambleLen+2;
+    }
+
+    /**
+     * @brief Run the receive FSM for a single byte.
+     *
+     * A complete packet must be released (see releasePacket()) before the next one can be received.
+     *
+     * @param curChar Received byte.
+     * @return int Length of the received packet (see getPacket()) if it is complete, 0 if not
+     * or -1 in case of an error.
+     */
+    int handleByte(uint8_t curChar)
+    {
+        int ret = 0;
+
+        //ESP_LOGD(logTag, "UART byte received: 0x%02x ('%c').", curChar, curChar);
+        switch(rxFsmState) {
+            case RX_FSM_STATE_IDLE:
+                if(curChar == preamble[0]) {
+                    rxFsmState = RX_FSM_STATE_HEADER;
+                    rxFsmCnt = 1;
+                }
+                break;
+
+            case RX_FSM_STATE_HEADER:
+                if(rxFsmCnt < preambleLen) {
+                    // preamble
+                    if(curChar == preamble[rxFsmCnt]) {
+                        rxFsmCnt++;
+                    } else {
+                        rxFsmCnt = 0;
+                        rxFsmState = RX_FSM_STATE_IDLE;
+                        ESP_LOGW(logTag, "Invalid preamble byte received.");
+                        // TBD: return distinctive error code
+                        ret = -1;
+                    }
+                } else if(rxFsmCnt == preambleLen) {
+                    // length
+                    rxFsmLen = curChar;
+                    rxFsmCnt++;
+                } else {
+                    // length inverted
+                    if (curChar != (rxFsmLen ^ 0xff)) {
+                        rxFsmCnt = 0;
+                        rxFsmState = RX_FSM_STATE_IDLE;
+                        ESP_LOGW(logTag, "Invalid length/inverted-length combo received.");
+                        // TBD: return distinctive error code
+                        ret = -1;
+                    } else {
+                        rxFsmCnt = rxFsmLen;
+                        if((rxFsmLen <= maxPayloadLen) && (rxBuffer.len == -1)) {
+                            rxFsmEn = true;
+                            rxBuffer.len = rxFsmCnt;
+                            memset(rxBuffer.data, 0x00, maxPayloadLen);
+                        } else {
+                            rxFsmEn = false;
+                            if(rxFsmLen > maxPayloadLen) {
+                                ESP_LOGW(logTag, "Receiving packet length (%d) is too big. Packet will be dropped.", rxFsmLen);
+                                // TBD: return distinctive error code
+                                ret = -1;
+                            } else {
+                                ESP_LOGE(logTag, "Receive buffer is not free. This can't happen!");
+                                // TBD: return distinctive error code
+                                ret = -1;
+                            }
+                        }
+
+                        if(rxFsmCnt > 0) {
+                            rxFsmState = RX_FSM_STATE_DATA;
+                        } else {
+                            rxFsmState = RX_FSM_STATE_FOOTER;
+                        }
+                    }
+                }
+                break;
+
+            case RX_FSM_STATE_DATA:
+                if(rxFsmEn) {
+                    int pos = rxBuffer.len - rxFsmCnt;
+                    rxBuffer.data[pos] = curChar;
+                }
+
+                rxFsmCnt--;
+                if(rxFsmCnt == 0) {
+                    rxFsmState = RX_FSM_STATE_FOOTER;
+                }
+                break;
+
+            case RX_FSM_STATE_FOOTER:
+                if(curChar == postamble[rxFsmCnt]) {
+                    rxFsmCnt++;
+                    if(rxFsmCnt == postambleLen) {
+                        rxFsmState = RX_FSM_STATE_IDLE;
+                        rxFsmCnt = 0;
+                        if(rxFsmEn) {
+                            ret = rxBuffer.len;
+                            // empty packets are dropped right away, so they don't block the receive buffer
+                            if(ret == 0) {
+                                rxBuffer.len = -1;
+                            }
+                        }
+                    }
+                } else {
+                    rxFsmCnt = 0;
+                    rxFsmState = RX_FSM_STATE_IDLE;
+                    if(rxFsmEn) {
+                        rxBuffer.len = -1;
+                    }
+                    ESP_LOGW(logTag, "Invalid postamble byte received.");
+                    // TBD: return distinctive error code
+                    ret = -1;
+                }
+                break;
+
+            default:
+                rxFsmState = RX_FSM_STATE_IDLE;
+                rxFsmCnt = 0;
+                ESP_LOGE(logTag, "RX_FSM in invalid state!");
+                // TBD: return distinctive error code
+                ret = -1;
+                break;
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Get the received packet, which is valid once handleByte() has reported it to be complete.
+     */
+    const BUFFER_T* getPacket(void) { return &rxBuffer; }
+
+    /**
+     * @brief Free the receive buffer for the next packet.
+     */
+    void releasePacket(void)
+    {
+        memset(rxBuffer.data, 0x00, maxPayloadLen);
+        rxBuffer.len = -1;
+    }
+
+    /**
+     * @brief Get the number of payload bytes still expected for the packet being received, which may be
+     * written to getPayloadDest() directly instead of running them through handleByte().
+     *
+     * @return int Number of payload bytes or 0 if no payload is being received.
+     */
+    int getPayloadPending(void)
+    {
+        return ((rxFsmState == RX_FSM_STATE_DATA) && rxFsmEn) ? rxFsmCnt : 0;
+    }
+
+    /**
+     * @brief Get the destination of the next payload byte (see getPayloadPending()).
+     */
+    uint8_t* getPayloadDest(void) { return &rxBuffer.data[rxBuffer.len - rxFsmCnt]; }
+
+    /**
+     * @brief Advance the receive FSM by the payload bytes written to getPayloadDest().
+     *
+     * @param len Number of bytes written, at most getPayloadPending().
+     */
+    void payloadWritten(int len)
+    {
+        rxFsmCnt -= len;
+        if(rxFsmCnt == 0) {
+            rxFsmState = RX_FSM_STATE_FOOTER;
+        }
+    }
+
+    /**
+     * @brief Get the number of bytes until the next state change of the receive FSM, i.e. the number
+     * of bytes which can be processed before the payload may be written directly.
+     */
+    int getBytesTillStateChange(void)
+    {
+        switch(rxFsmState) {
+            case RX_FSM_STATE_HEADER: return preambleLen + 2 - rxFsmCnt;
+            case RX_FSM_STATE_DATA: return rxFsmCnt;
+            case RX_FSM_STATE_FOOTER: return postambleLen - rxFsmCnt;
+            default: return preambleLen + 2;
+        }
+    }
+
+    /**
+     * @brief Run the receive FSM over a byte stream, e.g. to test or benchmark the framing without a UART.
+     *
+     * @param data Received bytes.
+     * @param len Number of received bytes.
+     * @param hook Called for each received packet (may be nullptr).
+     * @param param Parameter passed to the hook.
+     * @return int Number of framing errors.
+     */
+    int feed(const uint8_t* data, unsigned int len, PacketHookFncPtr hook, void* param)
+    {
+        int errors = 0;
+        int stat;
+
+        for(unsigned int i = 0; i < len; i++) {
+            stat = handleByte(data[i]);
+            if(stat > 0) {
+                if(nullptr != hook) hook(&rxBuffer, param);
+                releasePacket();
+            } else if(stat < 0) {
+                errors++;
+            }
+        }
+
+        return errors;
+    }
+};
+
+#endif /* SERIAL_FRAMER_H */
@@ -13,40 +13,46 @@
 #include "esp_log.h"
 
 #include "user_config.h"
+#include "serialFramer.h"
 
 
-template <uart_port_t portNum, uint32_t baud, int rxPin, int txPin, unsigned int maxPayloadLen=16, unsigned int numRxBuffers=2>
+/** Receive modes of the SerialPacketizer */
+typedef enum {
+    SERIAL_PACKETIZER_RX_DATA_EVENTS = 0,   /**< Process received data on every UART_DATA event */
+    SERIAL_PACKETIZER_RX_PATTERN_DET = 1    /**< Process received data on detection of the postamble, i.e. once per frame */
+} serial_packetizer_rx_mode_t;
+
+template <uart_port_t portNum, uint32_t baud, int rxPin, int txPin, unsigned int maxPayloadLen=16, unsigned int numRxBuffers=2,
+    serial_packetizer_rx_mode_t rxMode=SERIAL_PACKETIZER_RX_DATA_EVENTS>
 class SerialPacketizer
 {
 public:
-    typedef struct {
-        int len;
-        uint8_t data[maxPayloadLen];
-    } BUFFER_T;
+    typedef typename SerialFramer<maxPayloadLen>::BUFFER_T BUFFER_T;
 
 private:
     char logTag[14]; // "ser_pkt_uartX"
 
-    typedef enum {
-        RX_FSM_STATE_IDLE = 0,
-        RX_FSM_STATE_HEADER = 1,
-        RX_FSM_STATE_DATA = 2,
-        RX_FSM_STATE_FOOTER = 3
-    } RX_FSM_STATE_E;
-
-    const char preamble[2] = {0xfe, 0xaa};
-    static const int preambleLen = sizeof(preamble) / sizeof(preamble[0]);
-
-    const char postamble[2] = {0x55, 0x01};
-    static const int postambleLen = sizeof(postamble) / sizeof(postamble[0]);
+    /** Framing of the transmitted and received packets, incl. the receive FSM state */
+    SerialFramer<maxPayloadLen> framer;
 
     const unsigned int rxDriverQueueSize = 32;
     QueueHandle_t rxDriverQueue;
 
     static const BaseType_t queueWaitTime = pdMS_TO_TICKS(50);
 
+    // pattern detection related config (see SERIAL_PACKETIZER_RX_PATTERN_DET)
+    // Note: The hardware only detects repetitions of a single character, so the last postamble byte is used.
+    static const int rxPatternQueueSize = 2*numRxBuffers + 2;
+    static const int rxPatternChrTout = 1;
+    static const int rxPatternPostIdle = 0;
+    static const int rxPatternPreIdle = 0;
+
     // rx related state+buffers
-    BUFFER_T rxBuffer;
+    // scratch buffer holding the bytes read from the driver, which haven't been processed by the FSM yet
+    static const unsigned int rxScratchLen = UART_FIFO_LEN;
+    uint8_t rxScratch[rxScratchLen];
+    unsigned int rxScratchPos;
+    unsigned int rxScratchFill;
     QueueHandle_t rxPacketQueue;
     uint8_t rxPacketQueueStorageBuf[numRxBuffers*sizeof(BUFFER_T)];
     StaticQueue_t rxPacketQueueBuf;
@@ -56,6 +62,7 @@ private:
     QueueHandle_t txPacketQueue;
     uint8_t txPacketQueueStorageBuf[numTxBuffers*sizeof(BUFFER_T)];
     StaticQueue_t txPacketQueueBuf;
+    uint8_t txBuffer[SerialFramer<maxPayloadLen>::maxFrameLen];
 
     // processing task state+buffers
     //static const unsigned int taskStackSize = configMINIMAL_STACK_SIZE;
@@ -64,6 +71,8 @@ private:
     StackType_t taskStack[taskStackSize];
     StaticTask_t taskBuf;
     TaskHandle_t taskHandle;
+    uart_event_t taskUartEvent;
+    BUFFER_T taskTxBuffer;
 
     // queue set used for processing
     // defined as member, because it must be set up before anything is queued
@@ -71,41 +80,46 @@ private:
 
     static void taskFunc(void* params)
     {
-        SerialPacketizer<portNum, baud, rxPin, txPin, maxPayloadLen, numRxBuffers>* caller = 
-            (SerialPacketizer<portNum, baud, rxPin, txPin, maxPayloadLen, numRxBuffers>*) params;
+        SerialPacketizer<portNum, baud, rxPin, txPin, maxPayloadLen, numRxBuffers, rxMode>* caller = 
+            (SerialPacketizer<portNum, baud, rxPin, txPin, maxPayloadLen, numRxBuffers, rxMode>*) params;
 
         QueueSetMemberHandle_t activeQueue;
         int stat;
 
-        static uart_event_t uart_event;
-        static BUFFER_T tmpBuffer;
+        uart_event_t& uart_event = caller->taskUartEvent;
+        BUFFER_T& tmpBuffer = caller->taskTxBuffer;
 
         ESP_LOGD(caller->logTag, "Handling task started. Caller: 0x%08x", (uint32_t) params);
 
         while(1) {
             // TBD: add stop request signal
-            activeQueue = xQueueSelectFromSet(caller->procQueueSet, pdMS_TO_TICKS(200));
+            activeQueue = xQueueSelectFromSet(caller->procQueueSet, 
+                (rxMode == SERIAL_PACKETIZER_RX_PATTERN_DET) ? portMAX_DELAY : pdMS_TO_TICKS(200));
             if(activeQueue == caller->rxDriverQueue) {
                 xQueueReceive(activeQueue, &uart_event, portMAX_DELAY); // no blocking, because select ensures it is available
-                if(uart_event.type == UART_DATA) {
+                if((rxMode == SERIAL_PACKETIZER_RX_PATTERN_DET) && (uart_event.type == UART_DATA)) {
+                    // Data will be processed once the postamble is detected
+                } else if((rxMode == SERIAL_PACKETIZER_RX_PATTERN_DET) &&
+                    ((uart_event.type == UART_FIFO_OVF) || (uart_event.type == UART_BUFFER_FULL)))
+                {
+                    // Pattern positions are lost, so drop everything and resync with the next frame
+                    ESP_LOGW(caller->logTag, "UART overflow (event type %d). Dropping received data.", (uint32_t) uart_event.type);
+                    caller->resetRx();
+                } else if((uart_event.type == UART_DATA) || (uart_event.type == UART_PATTERN_DET)) {
                     bool continueProcessing = true;
                     while(continueProcessing) {
-                        stat = caller->handleRxData();
+                        stat = (rxMode == SERIAL_PACKETIZER_RX_PATTERN_DET) ? caller->handleRxPattern() : caller->handleRxData();
                         if(stat < 0) {
                             ESP_LOGW(caller->logTag, "handleRxData returned error code %d", stat);
                             continueProcessing = false;
                         } else if(stat > 0) {
-                            if(errQUEUE_FULL == xQueueSendToBack(caller->rxPacketQueue, &(caller->rxBuffer), queueWaitTime)) {
+                            if(errQUEUE_FULL == xQueueSendToBack(caller->rxPacketQueue, caller->framer.getPacket(), queueWaitTime)) {
                                 ESP_LOGW(caller->logTag, "Received packet couldn't be queued within timeout. Dropping it.");
                             }
-                            memset(caller->rxBuffer.data, 0x00, maxPayloadLen);
-                            caller->rxBuffer.len = -1;
+                            caller->framer.releasePacket();
                         } else {
-                            // Status zero means there is nothing more to process currently. 
-                            // In consequence this means empty packets will be dropped, which is okay.
-                            if(caller->rxBuffer.len == 0) {
-                                caller->rxBuffer.len = -1;
-                            }
+                            // Status zero means there is nothing more to process currently.
+                            // Empty packets are dropped by the framer, which is okay.
                             continueProcessing = false;
                         }
                     }
@@ -131,159 +145,148 @@ private:
         vTaskDelete(NULL);
     }
 
+    /**
+     * @brief Process the received data, i.e. read all available bytes from the driver
+     * into the scratch buffer and run the framing FSM over them.
+     * 
+     * Processing stops after a complete packet. The remaining bytes are kept in the
+     * scratch buffer and will be processed with the next call.
+     * 
+     * @return int Length of the received packet (see SerialFramer::getPacket()), 0 if there is nothing more
+     * to process or -1 in case of an error.
+     */
     int handleRxData(void)
     {
         int ret = 0;
+        int stat;
 
         size_t charsAvail;
         int readStat;
-        uint8_t curChar;
-
-        static RX_FSM_STATE_E state = RX_FSM_STATE_IDLE;
-        static int cnt = 0;
-        static uint8_t len = 0;
-        static bool rxEn = false;
-
-        ESP_ERROR_CHECK(uart_get_buffered_data_len(portNum, &charsAvail));
-        while(charsAvail) {
-            readStat = uart_read_bytes(portNum, &curChar, 1, 1);
-            if(1 != readStat) {
-                ESP_LOGW(logTag, "Reading UART byte failed with status %d.", readStat);
-                ret = -1;
-            } else {
-                //ESP_LOGD(logTag, "UART byte received: 0x%02x ('%c').", curChar, curChar);
-                charsAvail--;
-
-                switch(state) {
-                    case RX_FSM_STATE_IDLE:
-                        if(curChar == preamble[0]) {
-                            state = RX_FSM_STATE_HEADER;
-                            cnt = 1;
-                        }
-                        break;
-
-                    case RX_FSM_STATE_HEADER:
-                        if(cnt < preambleLen) {
-                            // preamble
-                            if(curChar == preamble[cnt]) {
-                                cnt++;
-                            } else {
-                                cnt = 0;
-                                state = RX_FSM_STATE_IDLE;
-                                ESP_LOGW(logTag, "Invalid preamble byte received.");
-                                // TBD: return distinctive error code
-                                ret = -1;
-                            }
-                        } else if(cnt == preambleLen) {
-                            // length
-                            len = curChar;
-                            cnt++;
-                        } else {
-                            // length inverted
-                            if (curChar != (len ^ 0xff)) {
-                                cnt = 0;
-                                state = RX_FSM_STATE_IDLE;
-                                ESP_LOGW(logTag, "Invalid length/inverted-length combo received.");
-                                // TBD: return distinctive error code
-                                ret = -1;
-                            } else {
-                                cnt = len;
-                                if((len <= maxPayloadLen) && (rxBuffer.len == -1)) {
-                                    rxEn = true;
-                                    rxBuffer.len = cnt;
-                                    memset(rxBuffer.data, 0x00, maxPayloadLen);
-                                } else {
-                                    rxEn = false;
-                                    if(len > maxPayloadLen) {
-                                        ESP_LOGW(logTag, "Receiving packet length (%d) is too big. Packet will be dropped.", len);
-                                        // TBD: return distinctive error code
-                                        ret = -1;
-                                    } else {
-                                        ESP_LOGE(logTag, "Receive buffer is not free. This can't happen!");
-                                        // TBD: return distinctive error code
-                                        ret = -1;
-                                    }
-                                }
-
-                                if(cnt > 0) {
-                                    state = RX_FSM_STATE_DATA;
-                                } else {
-                                    state = RX_FSM_STATE_FOOTER;
-                                }
-                            }
-                        }
-                        break;
 
-                    case RX_FSM_STATE_DATA:
-                        if(rxEn) {
-                            int pos = rxBuffer.len - cnt;
-                            rxBuffer.data[pos] = curChar;
-                        }
+        while(1) {
+            if(rxScratchPos >= rxScratchFill) {
+                // scratch buffer is empty, so refill it with all bytes available
+                ESP_ERROR_CHECK(uart_get_buffered_data_len(portNum, &charsAvail));
+                if(0 == charsAvail) break;
+                if(charsAvail > rxScratchLen) charsAvail = rxScratchLen;
+
+                rxScratchPos = 0;
+                rxScratchFill = 0;
+                readStat = uart_read_bytes(portNum, rxScratch, charsAvail, 0);
+                if(readStat <= 0) {
+                    ESP_LOGW(logTag, "Reading %d UART bytes failed with status %d.", charsAvail, readStat);
+                    ret = -1;
+                    break;
+                }
+                rxScratchFill = readStat;
+            }
 
-                        cnt--;
-                        if(cnt == 0) {
-                            state = RX_FSM_STATE_FOOTER;
-                        }
-                        break;
-
-                    case RX_FSM_STATE_FOOTER:
-                        if(curChar == postamble[cnt]) {
-                            cnt++;
-                            if(cnt == postambleLen) {
-                                state = RX_FSM_STATE_IDLE;
-                                cnt = 0;
-                                if(rxEn) {
-                                    ret = rxBuffer.len;
-                                    // Override charsAvail to break out of the loop; next packet will be processed
-                                    // later.
-                                    charsAvail = 0;
-                                    break;
-                                }
-                            }
-                        } else {
-                            cnt = 0;
-                            state = RX_FSM_STATE_IDLE;
-                            if(rxEn) {
-                                rxBuffer.len = -1;
-                            }
-                            ESP_LOGW(logTag, "Invalid postamble byte received.");
-                            // TBD: return distinctive error code
-                            ret = -1;
-                        }
-                        break;
-
-                    default:
-                        state = RX_FSM_STATE_IDLE;
-                        cnt = 0;
-                        ESP_LOGE(logTag, "RX_FSM in invalid state!");
-                        // TBD: return distinctive error code
-                        ret = -1;
-                        break;
+            while(rxScratchPos < rxScratchFill) {
+                stat = framer.handleByte(rxScratch[rxScratchPos++]);
+                if(stat > 0) {
+                    // next packet will be processed later
+                    return stat;
+                } else if(stat < 0) {
+                    ret = stat;
+                }
+            }
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Process the received data up to the next detected postamble (pattern detection mode only).
+     * 
+     * Header and postamble bytes are run through the framing FSM. Payload bytes are read from the driver
+     * directly into the receive buffer of the framer, which gets queued as is.
+     * 
+     * Note: The pattern (last postamble byte) may also be part of the header or payload. In this case
+     * processing just stops there and continues with the next detected pattern.
+     * 
+     * @return int Length of the received packet (see SerialFramer::getPacket()), 0 if there is nothing more
+     * to process or -1 in case of an error.
+     */
+    int handleRxPattern(void)
+    {
+        int ret = 0;
+        int stat;
+        int pos;
+        int remaining;
+        int payloadPending;
+        int chunkLen;
+        int readStat;
+
+        pos = uart_pattern_pop_pos(portNum);
+        if(pos < 0) return 0;
+
+        remaining = pos + 1;
+        while(remaining > 0) {
+            payloadPending = framer.getPayloadPending();
+            if(payloadPending > 0) {
+                chunkLen = (remaining < payloadPending) ? remaining : payloadPending;
+                readStat = uart_read_bytes(portNum, framer.getPayloadDest(), chunkLen, 0);
+                if(chunkLen != readStat) {
+                    ESP_LOGW(logTag, "Reading %d UART bytes failed with status %d.", chunkLen, readStat);
+                    resetRx();
+                    return -1;
+                }
+
+                framer.payloadWritten(chunkLen);
+            } else {
+                // read at most the bytes until the next state change, so the payload can be read directly
+                chunkLen = framer.getBytesTillStateChange();
+                if(chunkLen > remaining) chunkLen = remaining;
+                if(chunkLen > (int) rxScratchLen) chunkLen = rxScratchLen;
+                if(chunkLen < 1) chunkLen = 1;
+
+                readStat = uart_read_bytes(portNum, rxScratch, chunkLen, 0);
+                if(chunkLen != readStat) {
+                    ESP_LOGW(logTag, "Reading %d UART bytes failed with status %d.", chunkLen, readStat);
+                    resetRx();
+                    return -1;
+                }
+
+                for(int i = 0; i < chunkLen; i++) {
+                    stat = framer.handleByte(rxScratch[i]);
+                    if(stat != 0) ret = stat;
                 }
             }
+
+            remaining -= chunkLen;
         }
 
         return ret;
     }
 
+    /**
+     * @brief Drop all received data and reset the framing FSM.
+     */
+    void resetRx(void)
+    {
+        uart_flush_input(portNum);
+        if(rxMode == SERIAL_PACKETIZER_RX_PATTERN_DET) {
+            uart_pattern_queue_reset(portNum, rxPatternQueueSize);
+        }
+
+        framer.reset();
+        rxScratchPos = 0;
+        rxScratchFill = 0;
+    }
+
     int handleTxData(unsigned int len, uint8_t* data)
     {
         const int retryCntMax = 1;
         unsigned int bytesWritten = 0;
         int stat;
         int retries = retryCntMax + 1;
-        static uint8_t txBuffer[maxPayloadLen+preambleLen+postambleLen+2];
-
-        if((len > maxPayloadLen) || (NULL == data)) return -1;
+        int frameLen;
 
-        memcpy(txBuffer, preamble, preambleLen);
-        txBuffer[preambleLen] = len & 0xff;
-        txBuffer[preambleLen+1] = (len ^ 0xff) & 0xff;
-        memcpy(&txBuffer[preambleLen+2], data, len);
-        memcpy(&txBuffer[preambleLen+2+len], postamble, postambleLen);
+        frameLen = framer.encode(len, data, txBuffer);
+        if(frameLen < 0) return -1;
 
-        while((retries > 0) && (bytesWritten < (len+preambleLen+postambleLen+2))) {
-            stat = uart_write_bytes(portNum, (char*) &txBuffer[bytesWritten], len+preambleLen+postambleLen+2-bytesWritten);
+        while((retries > 0) && (bytesWritten < (unsigned int) frameLen)) {
+            stat = uart_write_bytes(portNum, (char*) &txBuffer[bytesWritten], frameLen-bytesWritten);
             if(stat < 0) {
                 ESP_ERROR_CHECK(stat);
                 retries--;
@@ -295,7 +298,7 @@ private:
             }
         }
 
-        if(bytesWritten < (len+preambleLen+postambleLen+2)) {
+        if(bytesWritten < (unsigned int) frameLen) {
             return -1;
         } else {
             return 0;
@@ -306,12 +309,13 @@ public:
     SerialPacketizer(void)
     {
         snprintf(logTag, sizeof(logTag) / sizeof(logTag[0]), "ser_pkt_uart%d", portNum);
+        framer.setLogTag(logTag);
 
         const int uartRxBufferSize = (maxPayloadLen*4 < UART_FIFO_LEN*2) ? UART_FIFO_LEN*2 : maxPayloadLen*4;
         const int uartTxBufferSize = (maxPayloadLen*4 < UART_FIFO_LEN*2) ? UART_FIFO_LEN*2 : maxPayloadLen*4;
 
-        rxBuffer.len = -1;
-        memset(rxBuffer.data, 0x00, maxPayloadLen);
+        rxScratchPos = 0;
+        rxScratchFill = 0;
 
         uart_config_t cfg;
         cfg.baud_rate = baud;
@@ -325,6 +329,14 @@ public:
         ESP_ERROR_CHECK(uart_set_pin(portNum, txPin, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
         ESP_ERROR_CHECK(uart_driver_install(portNum, uartRxBufferSize, uartTxBufferSize, rxDriverQueueSize, &rxDriverQueue, 0));
 
+        if(rxMode == SERIAL_PACKETIZER_RX_PATTERN_DET) {
+            ESP_ERROR_CHECK(uart_enable_pattern_det_intr(portNum, framer.getPostambleEnd(), 1, 
+                rxPatternChrTout, rxPatternPostIdle, rxPatternPreIdle));
+            ESP_ERROR_CHECK(uart_pattern_queue_reset(portNum, rxPatternQueueSize));
+            // Frames are shorter than the FIFO, so no rx timeout events are needed to get the data
+            ESP_ERROR_CHECK(uart_disable_intr_mask(portNum, UART_RXFIFO_TOUT_INT_ENA_M));
+        }
+
         rxPacketQueue = xQueueCreateStatic(numRxBuffers, sizeof(BUFFER_T), rxPacketQueueStorageBuf, &rxPacketQueueBuf);
         txPacketQueue = xQueueCreateStatic(numTxBuffers, sizeof(BUFFER_T), txPacketQueueStorageBuf, &txPacketQueueBuf);
 
@@ -337,7 +349,8 @@ public:
         }
 
         //taskHandle = xTaskCreateStatic(this->taskFunc, "serial_packetizer_task", taskStackSize, NULL, taskPrio, taskStack, taskBuf);
-        taskHandle = xTaskCreateStatic(taskFunc, "serial_packetizer_task", taskStackSize, (void*) this, taskPrio, taskStack, &taskBuf);
+        taskHandle = xTaskCreateStaticPinnedToCore(taskFunc, "serial_packetizer_task", taskStackSize, (void*) this, taskPrio,
+            taskStack, &taskBuf, controlTaskCore);
     }
 
     int getPayloadMax(void) { return maxPayloadLen; }
@@ -347,7 +360,7 @@ public:
     int transmitData(unsigned int len, uint8_t* data, TickType_t wait)
     {
         BaseType_t stat;
-        static BUFFER_T tmpBuffer;
+        BUFFER_T tmpBuffer;
 
         if((len > maxPayloadLen) || (NULL == data)) return -1;
 
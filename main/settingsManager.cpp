@@ -1,10 +1,20 @@
 #include "settingsManager.h"
 
 #include <stdio.h>
+#include <stddef.h> // used for offsetof
+
+#include "esp_sleep.h"
+#include "nvs.h"
+#include "rom/crc.h"
 
 #include "globalComponents.h"
 #include "irrigationController.h"
 extern IrrigationController irrigCtrl;
+extern esp_err_t initializeSpiffs(void);
+
+RTC_DATA_ATTR static SettingsManager::config_snapshot_t settingsSnapshot = {
+    .magic = 0
+};
 
 extern const uint8_t irrigationConfig_default_json_start[] asm("_binary_irrigationConfig_default_json_start");
 extern const uint8_t irrigationConfig_default_json_end[] asm("_binary_irrigationConfig_default_json_end");
@@ -19,10 +29,17 @@ SettingsManager::SettingsManager()
     // Clear event and zone shadow storages
     clearZoneData(shadowDataIrrigationConfig);
     clearEventData(shadowDataIrrigationConfig);
+    copySleepConfigInt(&shadowDataSleepConfig, sleepConfigDefaults);
+    copyEnergyConfigInt(&shadowDataEnergyConfig, energyConfigDefaults);
+
+    restoredFromSnapshot = false;
+    volatileChanges = false;
 
     configMutex = xSemaphoreCreateMutexStatic(&configMutexBuf);
     fileIoMutex = xSemaphoreCreateMutexStatic(&fileIoMutexBuf);
     hookMutex = xSemaphoreCreateMutexStatic(&hookMutexBuf);
+    streamMutex = xSemaphoreCreateMutexStatic(&streamMutexBuf);
+    irrigStream.active = false;
 
     for (int i=0; i<numHookTableEntries; i++) {
         irrigConfigUpdatedHooks[i] = nullptr;
@@ -40,14 +57,248 @@ SettingsManager::~SettingsManager()
     if (configMutex) vSemaphoreDelete(configMutex);
     if (fileIoMutex) vSemaphoreDelete(fileIoMutex);
     if (hookMutex) vSemaphoreDelete(hookMutex);
+    if (streamMutex) vSemaphoreDelete(streamMutex);
 }
 
+/**
+ * @brief Load the initial configuration.
+ * 
+ * On deep sleep wakeups the configuration is restored from the binary snapshot in RTC
+ * memory (or NVS as fallback), which is much faster than mounting the SPIFFS and parsing
+ * the JSON files. Otherwise the default configuration is loaded and the caller is expected
+ * to read the config files and to call storeSnapshot() afterwards (see isRestoredFromSnapshot()).
+ */
 void SettingsManager::init()
 {
-    // setup default data so defaults are available as soon as possible
-    ESP_LOGD(logTag, "Loading default configuration.");
-    updateIrrigationConfig((const char*) irrigationConfig_default_json_start, irrigationConfig_default_json_end - irrigationConfig_default_json_start + 1, true);
-    updateHardwareConfig((const char*) hardwareConfig_default_json_start, hardwareConfig_default_json_end - hardwareConfig_default_json_start + 1, true);
+    static config_snapshot_t nvsSnapshot;
+
+    restoredFromSnapshot = false;
+
+    // RAM used by the planner and the irrigation config storages (shadow + parsing), depending on the planner capacities
+    constexpr size_t irrigationRamFootprint = sizeof(IrrigationPlanner) + 2 * sizeof(irrigation_config_t);
+    static_assert(irrigationRamFootprint <= irrigationPlannerRamBudget,
+        "Irrigation planner capacities exceed the RAM budget (see CONFIG_IRRIGATION_PLANNER_RAM_BUDGET)!");
+    // RTC slow memory is shared with other persistent data and the ULP, so keep the snapshot within a reasonable size
+    static_assert(sizeof(config_snapshot_t) <= 4096,
+        "Config snapshot doesn't fit into RTC memory. Reduce the irrigation planner capacities!");
+
+    ESP_LOGI(logTag, "Planner capacities: %u zones, %u events, %u stop events; RAM: %u bytes (budget %u), snapshot: %u bytes.",
+        irrigationPlannerNumZones, irrigationPlannerNumEvents, irrigationPlannerNumStopEvents,
+        irrigationRamFootprint, irrigationPlannerRamBudget, sizeof(config_snapshot_t));
+
+    if(ESP_SLEEP_WAKEUP_UNDEFINED != esp_sleep_get_wakeup_cause()) {
+        if(snapshotValid(&settingsSnapshot) && (ERR_OK == snapshotApply(&settingsSnapshot))) {
+            ESP_LOGI(logTag, "Configuration restored from RTC snapshot.");
+            restoredFromSnapshot = true;
+        } else if((ERR_OK == snapshotReadNvs(&nvsSnapshot)) && (ERR_OK == snapshotApply(&nvsSnapshot))) {
+            ESP_LOGI(logTag, "Configuration restored from NVS snapshot.");
+            memcpy(&settingsSnapshot, &nvsSnapshot, sizeof(config_snapshot_t));
+            restoredFromSnapshot = true;
+        }
+    }
+
+    if(!restoredFromSnapshot) {
+        settingsSnapshot.magic = 0;
+
+        // setup default data so defaults are available as soon as possible
+        ESP_LOGD(logTag, "Loading default configuration.");
+        updateIrrigationConfig((const char*) irrigationConfig_default_json_start, irrigationConfig_default_json_end - irrigationConfig_default_json_start + 1, true);
+        updateHardwareConfig((const char*) hardwareConfig_default_json_start, hardwareConfig_default_json_end - hardwareConfig_default_json_start + 1, true);
+    }
+}
+
+/**
+ * @brief Check wether or not the configuration was restored from a snapshot during init().
+ * 
+ * @return bool If false, the config files need to be read in.
+ */
+bool SettingsManager::isRestoredFromSnapshot()
+{
+    return restoredFromSnapshot;
+}
+
+/**
+ * @brief Store the current configuration as binary snapshot in RTC memory and NVS.
+ * 
+ * Note: The NVS copy is only written if it differs from the current one to reduce flash wear.
+ * 
+ * @return err_t ERR_OK on success, ERR_TIMEOUT or ERR_FILE_IO otherwise.
+ */
+SettingsManager::err_t SettingsManager::storeSnapshot()
+{
+    err_t ret = ERR_OK;
+    static config_snapshot_t snapshot;
+    static config_snapshot_t nvsSnapshot;
+
+    if (pdFALSE == xSemaphoreTake(configMutex, lockAcquireTimeout)) {
+        ESP_LOGE(logTag, "Couldn't acquire config lock within timeout!");
+        return ERR_TIMEOUT;
+    }
+    snapshotCreate(&snapshot);
+    xSemaphoreGive(configMutex);
+
+    if (pdFALSE == xSemaphoreTake(fileIoMutex, lockAcquireTimeout)) {
+        ESP_LOGE(logTag, "Couldn't acquire file IO lock within timeout!");
+        ret = ERR_TIMEOUT;
+    } else {
+        memcpy(&settingsSnapshot, &snapshot, sizeof(config_snapshot_t));
+
+        if((ERR_OK != snapshotReadNvs(&nvsSnapshot)) || (0 != memcmp(&snapshot, &nvsSnapshot, sizeof(config_snapshot_t)))) {
+            ESP_LOGI(logTag, "Updating NVS snapshot.");
+            ret = snapshotWriteNvs(&snapshot);
+        }
+
+        xSemaphoreGive(fileIoMutex);
+    }
+
+    return ret;
+}
+
+uint32_t SettingsManager::snapshotCrc(const config_snapshot_t* snapshot)
+{
+    return crc32_le(0, (const uint8_t*) snapshot, offsetof(config_snapshot_t, crc));
+}
+
+bool SettingsManager::snapshotValid(const config_snapshot_t* snapshot)
+{
+    return (snapshot->magic == snapshotMagic) && (snapshot->version == snapshotVersion) &&
+        (snapshot->size == sizeof(config_snapshot_t)) && (snapshot->crc == snapshotCrc(snapshot));
+}
+
+/**
+ * @brief Create a snapshot of the current configuration.
+ * 
+ * Note: Must be called with the config lock held.
+ */
+void SettingsManager::snapshotCreate(config_snapshot_t* snapshot)
+{
+    // clear everything, so padding bytes are deterministic for the CRC
+    memset(snapshot, 0, sizeof(config_snapshot_t));
+
+    snapshot->magic = snapshotMagic;
+    snapshot->version = snapshotVersion;
+    snapshot->size = sizeof(config_snapshot_t);
+
+    memcpy(snapshot->zones, shadowDataIrrigationConfig.zones, sizeof(snapshot->zones));
+    for(int i = 0; i < irrigationPlannerNumNormalEvents; i++) {
+        shadowDataIrrigationConfig.events[i].getConfig(&snapshot->events[i]);
+        snapshot->eventsUsed[i] = shadowDataIrrigationConfig.eventsUsed[i];
+    }
+    copyBatteryConfigInt(&snapshot->battery, shadowDataBatteryConfig);
+    copyReservoirConfigInt(&snapshot->reservoir, shadowDataReservoirConfig);
+    copySleepConfigInt(&snapshot->sleep, shadowDataSleepConfig);
+    copyEnergyConfigInt(&snapshot->energy, shadowDataEnergyConfig);
+
+    snapshot->crc = snapshotCrc(snapshot);
+}
+
+/**
+ * @brief Apply a (validated) snapshot to the current configuration.
+ * 
+ * Note: No hooks are called, like it is done for the initial config load from file.
+ */
+SettingsManager::err_t SettingsManager::snapshotApply(const config_snapshot_t* snapshot)
+{
+    err_t ret = ERR_OK;
+    static irrigation_config_t settingsTemp;
+
+    for(int i = 0; i < irrigationPlannerNumNormalEvents; i++) {
+        if(IrrigationEvent::ERR_OK != settingsTemp.events[i].setConfig(&snapshot->events[i])) {
+            ESP_LOGE(logTag, "Snapshot contains invalid event %d", i);
+            return ERR_SETTINGS_INVALID;
+        }
+        settingsTemp.eventsUsed[i] = snapshot->eventsUsed[i];
+    }
+
+    if (pdFALSE == xSemaphoreTake(configMutex, lockAcquireTimeout)) {
+        ESP_LOGE(logTag, "Couldn't acquire config lock within timeout!");
+        ret = ERR_TIMEOUT;
+    } else {
+        memcpy(shadowDataIrrigationConfig.zones, snapshot->zones, sizeof(shadowDataIrrigationConfig.zones));
+        for(int i = 0; i < irrigationPlannerNumNormalEvents; i++) {
+            shadowDataIrrigationConfig.events[i] = settingsTemp.events[i];
+            shadowDataIrrigationConfig.eventsUsed[i] = settingsTemp.eventsUsed[i];
+        }
+        copyBatteryConfigInt(&shadowDataBatteryConfig, snapshot->battery);
+        copyReservoirConfigInt(&shadowDataReservoirConfig, snapshot->reservoir);
+        copySleepConfigInt(&shadowDataSleepConfig, snapshot->sleep);
+        copyEnergyConfigInt(&shadowDataEnergyConfig, snapshot->energy);
+
+        xSemaphoreGive(configMutex);
+    }
+
+    return ret;
+}
+
+SettingsManager::err_t SettingsManager::snapshotReadNvs(config_snapshot_t* snapshot)
+{
+    err_t ret = ERR_OK;
+    nvs_handle handle;
+    size_t len = sizeof(config_snapshot_t);
+
+    if(ESP_OK != nvs_open(snapshotNvsNamespace, NVS_READONLY, &handle)) {
+        return ERR_FILE_IO;
+    }
+
+    if((ESP_OK != nvs_get_blob(handle, snapshotNvsKey, snapshot, &len)) || (len != sizeof(config_snapshot_t))) {
+        ret = ERR_FILE_IO;
+    } else if(!snapshotValid(snapshot)) {
+        ESP_LOGW(logTag, "NVS snapshot invalid.");
+        ret = ERR_SETTINGS_INVALID;
+    }
+
+    nvs_close(handle);
+    return ret;
+}
+
+SettingsManager::err_t SettingsManager::snapshotWriteNvs(const config_snapshot_t* snapshot)
+{
+    err_t ret = ERR_OK;
+    nvs_handle handle;
+
+    if(ESP_OK != nvs_open(snapshotNvsNamespace, NVS_READWRITE, &handle)) {
+        ESP_LOGE(logTag, "Failed to open NVS namespace for snapshot.");
+        return ERR_FILE_IO;
+    }
+
+    if(nullptr == snapshot) {
+        nvs_erase_key(handle, snapshotNvsKey);
+    } else if(ESP_OK != nvs_set_blob(handle, snapshotNvsKey, snapshot, sizeof(config_snapshot_t))) {
+        ESP_LOGE(logTag, "Failed to write NVS snapshot.");
+        ret = ERR_FILE_IO;
+    }
+
+    if(ESP_OK != nvs_commit(handle)) ret = ERR_FILE_IO;
+
+    nvs_close(handle);
+    return ret;
+}
+
+/**
+ * @brief Keep the snapshots consistent with the persistent config after a config update.
+ * 
+ * Snapshots must always represent what the persistent config contains, because the previous
+ * behavior of loosing non-persistent changes on deep sleep wakeups must be preserved.
+ * 
+ * @param persistent Wether or not the update was written to the persistent config.
+ * @param applied Wether or not the update was applied to the current configuration.
+ */
+void SettingsManager::snapshotConfigChanged(bool persistent, bool applied)
+{
+    if(persistent && applied && !volatileChanges) {
+        storeSnapshot();
+    } else {
+        // RTC snapshot doesn't represent the persistent config anymore, NVS only does if these are unchanged
+        settingsSnapshot.magic = 0;
+        if(persistent) {
+            ESP_LOGI(logTag, "Persistent and current config differ. Dropping NVS snapshot.");
+            if (pdTRUE == xSemaphoreTake(fileIoMutex, lockAcquireTimeout)) {
+                snapshotWriteNvs(nullptr);
+                xSemaphoreGive(fileIoMutex);
+            }
+        }
+        volatileChanges = true;
+    }
 }
 
 void SettingsManager::clearZoneData(irrigation_config_t& settings)
@@ -57,6 +308,7 @@ void SettingsManager::clearZoneData(irrigation_config_t& settings)
         for(int j = 0; j < irrigationZoneCfgElements; j++) {
             settings.zones[i].chEnabled[j] = false;
         }
+        settings.zones[i].reservoirIdx = 0;
     }
 }
 
@@ -67,246 +319,453 @@ void SettingsManager::clearEventData(irrigation_config_t& settings)
     }
 }
 
-SettingsManager::err_t SettingsManager::jsonParseZone(cJSON* zoneJson, irrigation_zone_cfg_t& zoneCfg)
+/** Keys of the numeric event fields (see event_field_t) */
+static const char* const eventFieldNames[] = {
+    "zoneNum", "durationSecs", "hour", "minute", "second", "day", "month", "year"
+};
+
+/** Keys of the zone channel arrays (see zone_ch_array_t) */
+static const char* const zoneChArrayNames[] = {
+    "chEnabled", "chNum", "chStateStart", "chStateStop"
+};
+
+static const uint32_t zonePresentName = 1UL << 31;
+static const uint32_t zonePresentAll = zonePresentName | ((1UL << 4) - 1);
+
+/**
+ * @brief Static hook dispatching values of streamed irrigation configs to the SettingsManager.
+ */
+bool SettingsManager::irrigStreamValueHook(JsonStreamParser* parser, const JsonStreamParser::value_t* value, void* param)
+{
+    return static_cast<SettingsManager*>(param)->irrigStreamValue(parser, value);
+}
+
+/**
+ * @brief Record a settings error of the streamed irrigation config, which aborts parsing.
+ *
+ * @return bool Always false, so it can be returned by the value hooks directly.
+ */
+bool SettingsManager::irrigStreamFail(const char* msg, int idx)
 {
-    err_t ret = ERR_OK;
+    ESP_LOGE(logTag, "%s (%d)", msg, idx);
+    irrigStream.ret = ERR_SETTINGS_INVALID;
+    return false;
+}
 
-    cJSON* namePtr = cJSON_GetObjectItem(zoneJson, "name");
-    cJSON* chEnPtr = cJSON_GetObjectItem(zoneJson, "chEnabled");
-    cJSON* chNumPtr = cJSON_GetObjectItem(zoneJson, "chNum");
-    cJSON* chStateStartPtr = cJSON_GetObjectItem(zoneJson, "chStateStart");
-    cJSON* chStateStopPtr = cJSON_GetObjectItem(zoneJson, "chStateStop");
-    cJSON* elem;
-    int numZones;
-
-    if( (nullptr != namePtr) && (nullptr != chEnPtr) && (nullptr != chNumPtr) &&
-        (nullptr != chStateStartPtr) && (nullptr != chStateStopPtr) )
-    {
-        if( cJSON_IsString(namePtr) && cJSON_IsArray(chEnPtr) && cJSON_IsArray(chNumPtr) &&
-            cJSON_IsArray(chStateStartPtr) && cJSON_IsArray(chStateStopPtr) &&
-            ((numZones = cJSON_GetArraySize(chEnPtr)) <= irrigationZoneCfgElements) &&
-            (numZones == cJSON_GetArraySize(chNumPtr)) && (numZones == cJSON_GetArraySize(chStateStartPtr)) &&
-            (numZones == cJSON_GetArraySize(chStateStopPtr)) )
-        {
-            strncpy(zoneCfg.name, cJSON_GetStringValue(namePtr), irrigationZoneCfgNameLen);
-            zoneCfg.name[irrigationZoneCfgNameLen] = '\0';
+/**
+ * @brief Handle a value of a streamed irrigation config.
+ *
+ * Zones and events are written straight into the parsing storage, event fields are collected
+ * until the end of the event object, as their order isn't defined.
+ *
+ * @return bool False if parsing shall be aborted due to invalid settings.
+ */
+bool SettingsManager::irrigStreamValue(JsonStreamParser* parser, const JsonStreamParser::value_t* value)
+{
+    const int depth = parser->getDepth();
 
-            int i = 0;
-            cJSON_ArrayForEach(elem, chEnPtr) {
-                if(!cJSON_IsBool(elem)) {
-                    ret = ERR_PARSING_ERR;
-                    break;
-                }
-                zoneCfg.chEnabled[i] = cJSON_IsTrue(elem);
-                i++;
+    if(0 == depth) {
+        // root
+        if((JsonStreamParser::VALUE_OBJECT_START != value->type) && (JsonStreamParser::VALUE_OBJECT_END != value->type)) {
+            return irrigStreamFail("Irrigation config isn't a JSON object!", value->type);
+        }
+    } else if(1 == depth) {
+        // root members
+        if(parser->isKey(0, "zones")) {
+            if(JsonStreamParser::VALUE_ARRAY_END != value->type) {
+                irrigStream.zonesFound = (JsonStreamParser::VALUE_ARRAY_START == value->type);
             }
+        } else if(parser->isKey(0, "events")) {
+            if(JsonStreamParser::VALUE_ARRAY_END != value->type) {
+                irrigStream.eventsFound = (JsonStreamParser::VALUE_ARRAY_START == value->type);
+            }
+        } else if(parser->isKey(0, "storePersistent")) {
+            irrigStream.storePersistent = (JsonStreamParser::VALUE_BOOL == value->type) && value->boolean;
+        }
+    } else if(parser->isKey(0, "zones") && (parser->getIndex(1) >= 0)) {
+        const int zoneIdx = parser->getIndex(1);
 
-            i = 0;
-            cJSON_ArrayForEach(elem, chNumPtr) {
-                if(!cJSON_IsNumber(elem)) {
-                    ret = ERR_PARSING_ERR;
-                    break;
+        if(zoneIdx >= irrigationPlannerNumZones) {
+            return irrigStreamFail("Too many zones!", zoneIdx);
+        }
+
+        return irrigStreamZoneValue(parser, value, zoneIdx);
+    } else if(parser->isKey(0, "events") && (parser->getIndex(1) >= 0)) {
+        if(parser->getIndex(1) >= irrigationPlannerNumNormalEvents) {
+            return irrigStreamFail("Too many events!", parser->getIndex(1));
+        }
+
+        return irrigStreamEventValue(parser, value);
+    }
+
+    return true;
+}
+
+bool SettingsManager::irrigStreamZoneValue(JsonStreamParser* parser, const JsonStreamParser::value_t* value, int zoneIdx)
+{
+    const int depth = parser->getDepth();
+    irrigation_zone_cfg_t& zoneCfg = irrigStream.settings.zones[zoneIdx];
+
+    if(2 == depth) {
+        // zone object
+        if(JsonStreamParser::VALUE_OBJECT_START == value->type) {
+            irrigStream.zonePresent = 0;
+            for(int i = 0; i < ZONE_CH_ARRAY_NUM; i++) {
+                irrigStream.zoneArrayLen[i] = 0;
+            }
+            // optional, the first reservoir by default
+            zoneCfg.reservoirIdx = 0;
+        } else if(JsonStreamParser::VALUE_OBJECT_END == value->type) {
+            if(zonePresentAll != irrigStream.zonePresent) {
+                return irrigStreamFail("Zone config incomplete!", zoneIdx);
+            }
+            for(int i = 1; i < ZONE_CH_ARRAY_NUM; i++) {
+                if(irrigStream.zoneArrayLen[i] != irrigStream.zoneArrayLen[0]) {
+                    return irrigStreamFail("Zone channel arrays differ in length!", zoneIdx);
                 }
-                zoneCfg.chNum[i] = (OutputController::ch_map_t) elem->valueint;
-                i++;
             }
-
-            i = 0;
-            cJSON_ArrayForEach(elem, chStateStartPtr) {
-                if(!cJSON_IsBool(elem)) {
-                    ret = ERR_PARSING_ERR;
+            ESP_LOGD(logTag, "Parsed zone %d", zoneIdx);
+        } else {
+            return irrigStreamFail("Zone config isn't an object!", zoneIdx);
+        }
+    } else if(3 == depth) {
+        // zone members
+        if(parser->isKey(2, "name")) {
+            if(JsonStreamParser::VALUE_STRING != value->type) {
+                return irrigStreamFail("Zone name isn't a string!", zoneIdx);
+            }
+            strncpy(zoneCfg.name, value->str, irrigationZoneCfgNameLen);
+            zoneCfg.name[irrigationZoneCfgNameLen] = '\0';
+            irrigStream.zonePresent |= zonePresentName;
+        } else if(parser->isKey(2, "reservoir")) {
+            if((JsonStreamParser::VALUE_NUMBER != value->type) || (value->valueint < -1) ||
+                (value->valueint >= fillSensorNum))
+            {
+                return irrigStreamFail("Zone reservoir invalid!", zoneIdx);
+            }
+            zoneCfg.reservoirIdx = (int8_t) value->valueint;
+        } else {
+            for(int i = 0; i < ZONE_CH_ARRAY_NUM; i++) {
+                if(parser->isKey(2, zoneChArrayNames[i])) {
+                    if(JsonStreamParser::VALUE_ARRAY_START == value->type) {
+                        irrigStream.zonePresent |= (1UL << i);
+                    } else if(JsonStreamParser::VALUE_ARRAY_END != value->type) {
+                        return irrigStreamFail("Zone channel config isn't an array!", zoneIdx);
+                    }
                     break;
                 }
-                zoneCfg.chStateStart[i] = cJSON_IsTrue(elem);
-                i++;
             }
+        }
+    } else if(4 == depth) {
+        // channel array elements
+        for(int i = 0; i < ZONE_CH_ARRAY_NUM; i++) {
+            if(parser->isKey(2, zoneChArrayNames[i])) {
+                const int chIdx = parser->getIndex(3);
+                const bool isNum = (ZONE_CH_NUM == i);
+
+                if((chIdx < 0) || (chIdx >= irrigationZoneCfgElements)) {
+                    return irrigStreamFail("Too many zone channels!", zoneIdx);
+                }
+                if(value->type != (isNum ? JsonStreamParser::VALUE_NUMBER : JsonStreamParser::VALUE_BOOL)) {
+                    return irrigStreamFail("Zone channel config has wrong type!", zoneIdx);
+                }
 
-            i = 0;
-            cJSON_ArrayForEach(elem, chStateStopPtr) {
-                if(!cJSON_IsBool(elem)) {
-                    ret = ERR_PARSING_ERR;
-                    break;
+                switch(i) {
+                    case ZONE_CH_ENABLED:
+                        zoneCfg.chEnabled[chIdx] = value->boolean;
+                        break;
+                    case ZONE_CH_NUM:
+                        zoneCfg.chNum[chIdx] = (OutputController::ch_map_t) value->valueint;
+                        break;
+                    case ZONE_CH_STATE_START:
+                        zoneCfg.chStateStart[chIdx] = value->boolean;
+                        break;
+                    case ZONE_CH_STATE_STOP:
+                    default:
+                        zoneCfg.chStateStop[chIdx] = value->boolean;
+                        break;
                 }
-                zoneCfg.chStateStop[i] = cJSON_IsTrue(elem);
-                i++;
+                irrigStream.zoneArrayLen[i] = chIdx + 1;
+                break;
             }
-        } else {
-            ret = ERR_PARSING_ERR;
         }
-    } else {
-        ret = ERR_PARSING_ERR;
     }
 
-    return ret;
+    return true;
 }
 
-SettingsManager::err_t SettingsManager::jsonParseEvent(cJSON* evtJson, IrrigationEvent& evt, bool& used)
+bool SettingsManager::irrigStreamEventValue(JsonStreamParser* parser, const JsonStreamParser::value_t* value)
 {
-    err_t ret = ERR_OK;
-
-    cJSON* zoneNumPtr = cJSON_GetObjectItem(evtJson, "zoneNum");
-    cJSON* durationSecsPtr = cJSON_GetObjectItem(evtJson, "durationSecs");
-    cJSON* isSinglePtr = cJSON_GetObjectItem(evtJson, "isSingle");
-    cJSON* isDailyPtr = cJSON_GetObjectItem(evtJson, "isDaily");
-    cJSON* hourPtr = cJSON_GetObjectItem(evtJson, "hour");
-    cJSON* minutePtr = cJSON_GetObjectItem(evtJson, "minute");
-    cJSON* secondPtr = cJSON_GetObjectItem(evtJson, "second");
-    cJSON* dayPtr = cJSON_GetObjectItem(evtJson, "day");
-    cJSON* monthPtr = cJSON_GetObjectItem(evtJson, "month");
-    cJSON* yearPtr = cJSON_GetObjectItem(evtJson, "year");
-
-    if( (nullptr != zoneNumPtr) && (nullptr != durationSecsPtr) && (nullptr != hourPtr) &&
-        (nullptr != minutePtr) && (nullptr != secondPtr) &&
-        cJSON_IsNumber(zoneNumPtr) && cJSON_IsNumber(durationSecsPtr) && cJSON_IsNumber(hourPtr) &&
-        cJSON_IsNumber(minutePtr) && cJSON_IsNumber(secondPtr) )
-    {
-        if( (nullptr != isSinglePtr) && cJSON_IsBool(isSinglePtr) && cJSON_IsTrue(isSinglePtr) &&
-            (nullptr != dayPtr) && (nullptr != monthPtr) && (nullptr != yearPtr) &&
-            cJSON_IsNumber(dayPtr) && cJSON_IsNumber(monthPtr) && cJSON_IsNumber(yearPtr))
-        {
-            if(IrrigationEvent::ERR_OK != evt.setSingleEvent(
-                hourPtr->valueint, minutePtr->valueint, secondPtr->valueint,
-                dayPtr->valueint, monthPtr->valueint, yearPtr->valueint))
-            {
-                ret = ERR_PARSING_ERR;
+    const int depth = parser->getDepth();
+    const int evtIdx = parser->getIndex(1);
+    stream_event_t& evt = irrigStream.event;
+
+    if(2 == depth) {
+        // event object; other types are ignored (i.e. the event isn't used)
+        if(JsonStreamParser::VALUE_OBJECT_START == value->type) {
+            memset(&evt, 0, sizeof(evt));
+        } else if(JsonStreamParser::VALUE_OBJECT_END == value->type) {
+            if(ERR_OK != irrigStreamApplyEvent(evt, irrigStream.settings.events[evtIdx], irrigStream.settings.eventsUsed[evtIdx])) {
+                return irrigStreamFail("Event config invalid!", evtIdx);
             }
-            if(IrrigationEvent::ERR_OK != evt.setZoneIndex(zoneNumPtr->valueint)) {
-                ret = ERR_PARSING_ERR;
-            }
-            evt.setDuration(durationSecsPtr->valueint);
-            evt.setStartFlag(true);
-            used = true;
-        } else if((nullptr != isDailyPtr) && cJSON_IsBool(isDailyPtr) && cJSON_IsTrue(isDailyPtr)) {
-            if(IrrigationEvent::ERR_OK != evt.setDailyRepetition(
-                hourPtr->valueint, minutePtr->valueint, secondPtr->valueint))
-            {
-                ret = ERR_PARSING_ERR;
-            }
-            if(IrrigationEvent::ERR_OK != evt.setZoneIndex(zoneNumPtr->valueint)) {
-                ret = ERR_PARSING_ERR;
+            ESP_LOGD(logTag, "Parsed event %d", evtIdx);
+        }
+    } else if(3 == depth) {
+        // event members
+        const bool isTrue = (JsonStreamParser::VALUE_BOOL == value->type) && value->boolean;
+
+        if(parser->isKey(2, "isSingle")) {
+            evt.isSingle = isTrue;
+        } else if(parser->isKey(2, "isDaily")) {
+            evt.isDaily = isTrue;
+        } else if(parser->isKey(2, "isWeekly")) {
+            evt.isWeekly = isTrue;
+        } else if(parser->isKey(2, "isMonthly")) {
+            evt.isMonthly = isTrue;
+        } else if(parser->isKey(2, "weekdays") || parser->isKey(2, "monthdays")) {
+            uint32_t& mask = parser->isKey(2, "weekdays") ? evt.weekdayMask : evt.monthdayMask;
+            if(JsonStreamParser::VALUE_ARRAY_START == value->type) {
+                mask = 0;
+                evt.dayListErr = false;
+            } else if((JsonStreamParser::VALUE_ARRAY_END == value->type) && evt.dayListErr) {
+                mask = 0;
             }
-            evt.setDuration(durationSecsPtr->valueint);
-            evt.setStartFlag(true);
-            used = true;
         } else {
-            ret = ERR_PARSING_ERR;
+            for(int i = 0; i < EVT_FIELD_NUM; i++) {
+                if(parser->isKey(2, eventFieldNames[i])) {
+                    if(JsonStreamParser::VALUE_NUMBER == value->type) {
+                        evt.values[i] = value->valueint;
+                        evt.present |= (1UL << i);
+                    } else {
+                        evt.present &= ~(1UL << i);
+                    }
+                    break;
+                }
+            }
+        }
+    } else if(4 == depth) {
+        // day list elements
+        if(parser->isKey(2, "weekdays")) {
+            evt.dayListErr |= !irrigStreamDayValue(value, 0, 6, evt.weekdayMask);
+        } else if(parser->isKey(2, "monthdays")) {
+            evt.dayListErr |= !irrigStreamDayValue(value, 1, 31, evt.monthdayMask);
         }
     }
-    return ret;
+
+    return true;
+}
+
+/**
+ * @brief Add an element of a list of days (e.g. "weekdays": [1, 3, 5]) to a bitmask.
+ *
+ * @param value Day number.
+ * @param minVal Minimum day number, which is represented by bit 0.
+ * @param maxVal Maximum day number.
+ * @param mask Bitmask to be updated.
+ * @return bool False if the element isn't a valid day.
+ */
+bool SettingsManager::irrigStreamDayValue(const JsonStreamParser::value_t* value, int minVal, int maxVal, uint32_t& mask)
+{
+    if((JsonStreamParser::VALUE_NUMBER != value->type) || (value->valueint < minVal) || (value->valueint > maxVal)) {
+        return false;
+    }
+    mask |= 1U << (value->valueint - minVal);
+
+    return true;
+}
+
+/**
+ * @brief Setup an irrigation event from the fields collected while streaming.
+ *
+ * Note: Events lacking any of the mandatory fields are silently left unused.
+ *
+ * @return err_t ERR_OK on success, ERR_PARSING_ERR if the event is invalid.
+ */
+SettingsManager::err_t SettingsManager::irrigStreamApplyEvent(const stream_event_t& fields, IrrigationEvent& evt, bool& used)
+{
+    const uint32_t mandatory = (1UL << EVT_FIELD_ZONE_NUM) | (1UL << EVT_FIELD_DURATION_SECS) |
+        (1UL << EVT_FIELD_HOUR) | (1UL << EVT_FIELD_MINUTE) | (1UL << EVT_FIELD_SECOND);
+    const uint32_t date = (1UL << EVT_FIELD_DAY) | (1UL << EVT_FIELD_MONTH) | (1UL << EVT_FIELD_YEAR);
+    const int* v = fields.values;
+    IrrigationEvent::err_t evtErr;
+
+    if(mandatory != (fields.present & mandatory)) return ERR_OK;
+
+    if(fields.isSingle && (date == (fields.present & date))) {
+        evtErr = evt.setSingleEvent(v[EVT_FIELD_HOUR], v[EVT_FIELD_MINUTE], v[EVT_FIELD_SECOND],
+            v[EVT_FIELD_DAY], v[EVT_FIELD_MONTH], v[EVT_FIELD_YEAR]);
+    } else if(fields.isDaily) {
+        evtErr = evt.setDailyRepetition(v[EVT_FIELD_HOUR], v[EVT_FIELD_MINUTE], v[EVT_FIELD_SECOND]);
+    } else if(fields.isWeekly) {
+        evtErr = (0 == fields.weekdayMask) ? IrrigationEvent::ERR_INVALID_PARAM :
+            evt.setWeeklyRepetition(v[EVT_FIELD_HOUR], v[EVT_FIELD_MINUTE], v[EVT_FIELD_SECOND], fields.weekdayMask);
+    } else if(fields.isMonthly) {
+        evtErr = (0 == fields.monthdayMask) ? IrrigationEvent::ERR_INVALID_PARAM :
+            evt.setMonthlyRepetition(v[EVT_FIELD_HOUR], v[EVT_FIELD_MINUTE], v[EVT_FIELD_SECOND], fields.monthdayMask);
+    } else {
+        return ERR_PARSING_ERR;
+    }
+
+    if(IrrigationEvent::ERR_OK != evt.setZoneIndex(v[EVT_FIELD_ZONE_NUM])) {
+        evtErr = IrrigationEvent::ERR_INVALID_PARAM;
+    }
+    evt.setDuration(v[EVT_FIELD_DURATION_SECS]);
+    evt.setStartFlag(true);
+    used = true;
+
+    return (IrrigationEvent::ERR_OK == evtErr) ? ERR_OK : ERR_PARSING_ERR;
 }
 
+/**
+ * @brief Update the irrigation config from a complete JSON document.
+ *
+ * @param jsonData JSON data (doesn't need to be NULL-terminated).
+ * @param jsonDataLen Length of the JSON data.
+ * @param noNotify If true, the registered hooks aren't called.
+ * @return err_t ERR_OK on success.
+ */
 SettingsManager::err_t SettingsManager::updateIrrigationConfig(const char* const jsonData, int jsonDataLen, bool noNotify)
 {
-    err_t ret = ERR_OK;
-    static char jsonStr[8192]; // data is not a NULL-terminated string, therefore we need to pre-process it
+    err_t ret;
 
     if (nullptr == jsonData) return ERR_INVALID_ARG;
     if (jsonDataLen < 2) return ERR_INVALID_ARG; // check for minimum data length ("{}")
-    if (jsonDataLen > (sizeof(jsonStr) - 1)) return ERR_INVALID_ARG; // chekc for maximum buffer space
 
-    if (pdFALSE == xSemaphoreTake(configMutex, lockAcquireTimeout)) {
-        ESP_LOGE(logTag, "Couldn't acquire config lock within timeout!");
-        ret = ERR_TIMEOUT;
-    } else {
-        ESP_LOGI(logTag, "Parsing irrigation config update.");
+    ret = beginIrrigationConfigStream();
+    if(ERR_OK == ret) {
+        feedIrrigationConfigStream(jsonData, jsonDataLen);
+        ret = endIrrigationConfigStream(noNotify);
+    }
 
-        static irrigation_config_t settingsTemp;
+    return ret;
+}
 
-        pwrMgr.setKeepAwakeForce(true);
+/**
+ * @brief Start a streamed irrigation config update, i.e. the JSON document is parsed
+ * chunk by chunk (see feedIrrigationConfigStream) with bounded memory usage.
+ *
+ * Note: Only one stream can be active at a time. The calling task must finish it with
+ * endIrrigationConfigStream, even if feeding failed.
+ *
+ * @return err_t ERR_OK on success, ERR_TIMEOUT if another stream is active.
+ */
+SettingsManager::err_t SettingsManager::beginIrrigationConfigStream()
+{
+    if (pdFALSE == xSemaphoreTake(streamMutex, lockAcquireTimeout)) {
+        ESP_LOGE(logTag, "Couldn't acquire stream lock within timeout!");
+        return ERR_TIMEOUT;
+    }
 
-        clearZoneData(settingsTemp);
-        clearEventData(settingsTemp);
+    ESP_LOGI(logTag, "Parsing irrigation config update.");
 
-        memcpy(jsonStr, jsonData, sizeof(char) * jsonDataLen);
-        jsonStr[jsonDataLen] = 0;
+    pwrMgr.setKeepAwakeForce(true);
 
-        cJSON* root = cJSON_ParseWithOpts(jsonStr, nullptr, true);
-        cJSON* zones;
-        cJSON* events;
-        if(nullptr != root) {
-            zones = cJSON_GetObjectItem(root, "zones");
-            events = cJSON_GetObjectItem(root, "events");
+    clearZoneData(irrigStream.settings);
+    clearEventData(irrigStream.settings);
 
-            int numZones;
-            int numEvents;
+    irrigStream.active = true;
+    irrigStream.fromFile = false;
+    irrigStream.ret = ERR_OK;
+    irrigStream.zonesFound = false;
+    irrigStream.eventsFound = false;
+    irrigStream.storePersistent = false;
+    irrigStream.parser.begin(irrigStreamValueHook, this);
 
-            bool parsingErr = false;
-            if( (nullptr != zones) && (nullptr != events) &&
-                cJSON_IsArray(zones) && ((numZones = cJSON_GetArraySize(zones)) <= irrigationPlannerNumZones) &&
-                cJSON_IsArray(events) && ((numEvents = cJSON_GetArraySize(events)) <= irrigationPlannerNumNormalEvents) )
-            {
-                int i = 0;
-                cJSON* elem;
-                cJSON_ArrayForEach(elem, zones) {
-                    ESP_LOGD(logTag, "Parsing zone %d", i);
-                    if(ERR_OK != jsonParseZone(elem, settingsTemp.zones[i])) {
-                        parsingErr = true;
-                        break;
-                    }
-                    i++;
-                }
+    return ERR_OK;
+}
 
-                i = 0;
-                cJSON_ArrayForEach(elem, events) {
-                    ESP_LOGD(logTag, "Parsing event %d", i);
-                    if(ERR_OK != jsonParseEvent(elem, settingsTemp.events[i], settingsTemp.eventsUsed[i])) {
-                        parsingErr = true;
-                        break;
-                    }
-                    i++;
-                }
-            } else {
-                ESP_LOGE(logTag, "Zone or event config not found in JSON or have wrong type / length!");
-                ret = ERR_SETTINGS_INVALID;
-            }
+/**
+ * @brief Parse the next chunk of a streamed irrigation config update.
+ *
+ * @param jsonData Chunk data (doesn't need to be NULL-terminated, parsing stops at a NULL character).
+ * @param jsonDataLen Length of the chunk.
+ * @return err_t ERR_OK if the config is valid so far, an error otherwise.
+ */
+SettingsManager::err_t SettingsManager::feedIrrigationConfigStream(const char* const jsonData, int jsonDataLen)
+{
+    if (!irrigStream.active) return ERR_INVALID_ARG;
+    if ((nullptr == jsonData) || (jsonDataLen < 0)) return ERR_INVALID_ARG;
 
-            if(parsingErr) {
-                ESP_LOGE(logTag, "Parsing zone or event config from JSON failed!");
-                ret = ERR_SETTINGS_INVALID;
-            }
-        } else {
-            ESP_LOGE(logTag, "Parsing JSON tree failed!");
-            ret = ERR_INVALID_JSON;
-        }
+    if (ERR_OK != irrigStream.ret) return irrigStream.ret;
 
-        if(ret == ERR_OK) {
-            ESP_LOGI(logTag, "Zone and event data successfully parsed.");
-            memcpy(shadowDataIrrigationConfig.zones, settingsTemp.zones, sizeof(irrigation_zone_cfg_t) * irrigationZoneCfgElements);
-            for(int i = 0; i < irrigationPlannerNumNormalEvents; i++) {
-                shadowDataIrrigationConfig.events[i] = settingsTemp.events[i];
-                shadowDataIrrigationConfig.eventsUsed[i] = settingsTemp.eventsUsed[i];
-            }
-        }
+    if (JsonStreamParser::ERR_OK != irrigStream.parser.feed(jsonData, strnlen(jsonData, jsonDataLen))) {
+        // settings errors abort the parser, all others are JSON errors
+        return (ERR_OK != irrigStream.ret) ? irrigStream.ret : ERR_INVALID_JSON;
+    }
 
-        cJSON* storePersistentPtr = cJSON_GetObjectItem(root, "storePersistent");
-        if( (nullptr != storePersistentPtr) && cJSON_IsBool(storePersistentPtr) && cJSON_IsTrue(storePersistentPtr) ) {
-            ESP_LOGI(logTag, "Persistent storage of irrigation config requested.");
+    return ERR_OK;
+}
 
-            cJSON_DetachItemViaPointer(root, storePersistentPtr);
+/**
+ * @brief Finish a streamed irrigation config update and apply the config if it is valid.
+ *
+ * @param noNotify If true, the registered hooks aren't called.
+ * @return err_t ERR_OK on success.
+ */
+SettingsManager::err_t SettingsManager::endIrrigationConfigStream(bool noNotify)
+{
+    err_t ret;
+    bool persistent = false;
 
-            char* jsonStrModified = cJSON_Print(root);
-            int jsonStrModifiedLen = strlen(jsonStrModified);
+    if (!irrigStream.active) return ERR_INVALID_ARG;
 
-            if (ERR_OK != writeConfigFile(filenameIrrigationConfig, jsonStrModified, jsonStrModifiedLen)) {
-                ret = ERR_FILE_IO;
+    ret = irrigStream.ret;
+    if ((ERR_OK == ret) && (JsonStreamParser::ERR_OK != irrigStream.parser.end())) {
+        ESP_LOGE(logTag, "Parsing JSON failed!");
+        ret = ERR_INVALID_JSON;
+    }
+
+    if ((ERR_OK == ret) && (!irrigStream.zonesFound || !irrigStream.eventsFound)) {
+        ESP_LOGE(logTag, "Zone or event config not found in JSON or have wrong type!");
+        ret = ERR_SETTINGS_INVALID;
+    }
+
+    if (ERR_OK == ret) {
+        if (pdFALSE == xSemaphoreTake(configMutex, lockAcquireTimeout)) {
+            ESP_LOGE(logTag, "Couldn't acquire config lock within timeout!");
+            ret = ERR_TIMEOUT;
+        } else {
+            ESP_LOGI(logTag, "Zone and event data successfully parsed.");
+            memcpy(shadowDataIrrigationConfig.zones, irrigStream.settings.zones, sizeof(shadowDataIrrigationConfig.zones));
+            for(int i = 0; i < irrigationPlannerNumNormalEvents; i++) {
+                shadowDataIrrigationConfig.events[i] = irrigStream.settings.events[i];
+                shadowDataIrrigationConfig.eventsUsed[i] = irrigStream.settings.eventsUsed[i];
             }
+            xSemaphoreGive(configMutex);
         }
+    }
 
-        xSemaphoreGive(configMutex);
+    // configs read from the (legacy) config file are migrated by readIrrigationConfigFile
+    if ((ERR_OK == ret) && irrigStream.storePersistent && !irrigStream.fromFile) {
+        ESP_LOGI(logTag, "Persistent storage of irrigation config requested.");
 
-        if((ret == ERR_OK) && !noNotify) {
-            callIrrigConfigUpdatedHooks();
+        if (ERR_OK != persistIrrigationConfig(irrigStream.settings)) {
+            ret = ERR_FILE_IO;
+        } else {
+            persistent = true;
         }
+    }
 
-        pwrMgr.setKeepAwakeForce(false);
+    irrigStream.active = false;
+    xSemaphoreGive(streamMutex);
+
+    if(persistent || ((ret == ERR_OK) && !noNotify)) {
+        snapshotConfigChanged(persistent, (ret == ERR_OK));
     }
 
+    if((ret == ERR_OK) && !noNotify) {
+        callIrrigConfigUpdatedHooks();
+    }
+
+    pwrMgr.setKeepAwakeForce(false);
+
     return ret;
 }
 
 SettingsManager::err_t SettingsManager::updateHardwareConfig(const char* const jsonData, int jsonDataLen, bool noNotify)
 {
     err_t ret = ERR_OK;
+    bool persistent = false;
     static char jsonStr[2048]; // data is not a NULL-terminated string, therefore we need to pre-process it
 
     if (nullptr == jsonData) return ERR_INVALID_ARG;
@@ -321,13 +780,17 @@ SettingsManager::err_t SettingsManager::updateHardwareConfig(const char* const j
 
         static battery_config_t batteryTemp;
         static reservoir_config_t reservoirTemp;
+        static sleep_config_t sleepTemp;
+        static energy_config_t energyTemp;
 
         pwrMgr.setKeepAwakeForce(true);
 
         memcpy(jsonStr, jsonData, sizeof(char) * jsonDataLen);
         jsonStr[jsonDataLen] = 0;
 
-        cJSON* root = cJSON_ParseWithOpts(jsonStr, nullptr, true);
+        // the DOM is allocated from the JSON arena, which is released at once after parsing
+        bool arenaActive = (JsonArena::ERR_OK == jsonArena.begin());
+        cJSON* root = arenaActive ? cJSON_ParseWithOpts(jsonStr, nullptr, true) : nullptr;
         if(nullptr != root) {
             cJSON* disableBatteryCheckItem = cJSON_GetObjectItem(root, "disableBatteryCheck");
             cJSON* battCriticalThresholdMilliItem = cJSON_GetObjectItem(root, "battCriticalThresholdMilli");
@@ -366,6 +829,70 @@ SettingsManager::err_t SettingsManager::updateHardwareConfig(const char* const j
                 ESP_LOGE(logTag, "Some mandatory hardware settings not found.");
                 ret = ERR_SETTINGS_INVALID;
             }
+
+            // sleep settings are optional
+            cJSON* eventDrivenSleepItem = cJSON_GetObjectItem(root, "eventDrivenSleep");
+            cJSON* wakeupIntervalSecondsItem = cJSON_GetObjectItem(root, "wakeupIntervalSeconds");
+            cJSON* maxSleepSecondsItem = cJSON_GetObjectItem(root, "maxSleepSeconds");
+            cJSON* telemetryFlushIntervalSecondsItem = cJSON_GetObjectItem(root, "telemetryFlushIntervalSeconds");
+
+            copySleepConfigInt(&sleepTemp, sleepConfigDefaults);
+            if(nullptr != eventDrivenSleepItem) {
+                if(cJSON_IsBool(eventDrivenSleepItem)) sleepTemp.eventDrivenSleep = cJSON_IsTrue(eventDrivenSleepItem);
+                else ret = ERR_SETTINGS_INVALID;
+            }
+            if(nullptr != wakeupIntervalSecondsItem) {
+                if(cJSON_IsNumber(wakeupIntervalSecondsItem) && (wakeupIntervalSecondsItem->valueint > 0)) {
+                    sleepTemp.wakeupIntervalSeconds = wakeupIntervalSecondsItem->valueint;
+                } else {
+                    ret = ERR_SETTINGS_INVALID;
+                }
+            }
+            if(nullptr != maxSleepSecondsItem) {
+                if(cJSON_IsNumber(maxSleepSecondsItem) && (maxSleepSecondsItem->valueint > 0)) {
+                    sleepTemp.maxSleepSeconds = maxSleepSecondsItem->valueint;
+                } else {
+                    ret = ERR_SETTINGS_INVALID;
+                }
+            }
+            if(nullptr != telemetryFlushIntervalSecondsItem) {
+                if(cJSON_IsNumber(telemetryFlushIntervalSecondsItem) && (telemetryFlushIntervalSecondsItem->valueint > 0)) {
+                    sleepTemp.telemetryFlushIntervalSeconds = telemetryFlushIntervalSecondsItem->valueint;
+                } else {
+                    ret = ERR_SETTINGS_INVALID;
+                }
+            }
+
+            // energy accounting settings are optional as well
+            const struct {
+                const char* key;
+                int* dst;
+            } energyItems[] = {
+                { "energyDeepSleepMicroAmps", &energyTemp.deepSleepMicroAmps },
+                { "energyAwakeMicroAmps", &energyTemp.awakeMicroAmps },
+                { "energyWifiMicroAmps", &energyTemp.wifiMicroAmps },
+                { "energyPeripheralMicroAmps", &energyTemp.peripheralMicroAmps },
+                { "energyExtSupplyMicroAmps", &energyTemp.extSupplyMicroAmps },
+                { "energyOutputMicroAmps", &energyTemp.outputMicroAmps }
+            };
+
+            copyEnergyConfigInt(&energyTemp, energyConfigDefaults);
+            for(int i = 0; i < (sizeof(energyItems) / sizeof(energyItems[0])); i++) {
+                cJSON* item = cJSON_GetObjectItem(root, energyItems[i].key);
+                if(nullptr != item) {
+                    if(cJSON_IsNumber(item) && (item->valueint >= 0)) *energyItems[i].dst = item->valueint;
+                    else ret = ERR_SETTINGS_INVALID;
+                }
+            }
+
+            if(ERR_SETTINGS_INVALID == ret) {
+                ESP_LOGE(logTag, "Some hardware settings are invalid.");
+            }
+        } else if(!arenaActive) {
+            ret = ERR_TIMEOUT;
+        } else if(jsonArena.hasOverflowed()) {
+            ESP_LOGE(logTag, "Hardware config exceeds the JSON arena!");
+            ret = ERR_NO_RESOURCES;
         } else {
             ESP_LOGE(logTag, "Parsing JSON tree failed!");
             ret = ERR_INVALID_JSON;
@@ -375,24 +902,30 @@ SettingsManager::err_t SettingsManager::updateHardwareConfig(const char* const j
             ESP_LOGI(logTag, "Hardware config successfully parsed.");
             copyBatteryConfigInt(&shadowDataBatteryConfig, batteryTemp);
             copyReservoirConfigInt(&shadowDataReservoirConfig, reservoirTemp);
+            copySleepConfigInt(&shadowDataSleepConfig, sleepTemp);
+            copyEnergyConfigInt(&shadowDataEnergyConfig, energyTemp);
         }
 
         cJSON* storePersistentPtr = cJSON_GetObjectItem(root, "storePersistent");
-        if( (nullptr != storePersistentPtr) && cJSON_IsBool(storePersistentPtr) && cJSON_IsTrue(storePersistentPtr) ) {
+        if( (ret == ERR_OK) && (nullptr != storePersistentPtr) && cJSON_IsBool(storePersistentPtr) && cJSON_IsTrue(storePersistentPtr) ) {
             ESP_LOGI(logTag, "Persistent storage of hardware config requested.");
 
-            cJSON_DetachItemViaPointer(root, storePersistentPtr);
-
-            char* jsonStrModified = cJSON_Print(root);
-            int jsonStrModifiedLen = strlen(jsonStrModified);
-
-            if (ERR_OK != writeConfigFile(filenameHardwareConfig, jsonStrModified, jsonStrModifiedLen)) {
+            if (ERR_OK != persistHardwareConfig(batteryTemp, reservoirTemp, sleepTemp, energyTemp)) {
                 ret = ERR_FILE_IO;
+            } else {
+                persistent = true;
             }
         }
 
+        cJSON_Delete(root);
+        if(arenaActive) jsonArena.end();
+
         xSemaphoreGive(configMutex);
 
+        if(persistent || ((ret == ERR_OK) && !noNotify)) {
+            snapshotConfigChanged(persistent, (ret == ERR_OK));
+        }
+
         if((ret == ERR_OK) && !noNotify) {
             callHardwareConfigUpdatedHooks();
         }
@@ -403,14 +936,73 @@ SettingsManager::err_t SettingsManager::updateHardwareConfig(const char* const j
     return ret;
 }
 
+/**
+ * @brief Load the persistent irrigation config.
+ * 
+ * The binary record in NVS is used if available. Otherwise the (legacy) JSON config file
+ * is read and migrated into a record, so it is only parsed once.
+ * 
+ * @return err_t ERR_OK on success.
+ */
 SettingsManager::err_t SettingsManager::readIrrigationConfigFile()
 {
-    return readConfigFile(CONFIG_FILE_IRRIGATION);
+    static irrigation_record_t record;
+    err_t ret;
+
+    if (ERR_OK == recordRead(irrigRecordNvsKey, &record.header, sizeof(irrigation_record_t))) {
+        ESP_LOGI(logTag, "Updating irrigation config from persistent record.");
+        return applyIrrigationRecord(&record);
+    }
+
+    ret = readConfigFile(CONFIG_FILE_IRRIGATION);
+    if (ERR_OK == ret) {
+        ESP_LOGI(logTag, "Migrating irrigation config file to persistent record.");
+        persistIrrigationConfig(shadowDataIrrigationConfig);
+    }
+
+    return ret;
 }
 
+/**
+ * @brief Load the persistent hardware config.
+ * 
+ * The binary record in NVS is used if available. Otherwise the (legacy) JSON config file
+ * is read and migrated into a record, so it is only parsed once.
+ * 
+ * @return err_t ERR_OK on success.
+ */
 SettingsManager::err_t SettingsManager::readHardwareConfigFile()
 {
-    return readConfigFile(CONFIG_FILE_HARDWARE);
+    static hardware_record_t record;
+    static energy_record_t energyRecord;
+    err_t ret;
+
+    if (ERR_OK == recordRead(hardwareRecordNvsKey, &record.header, sizeof(hardware_record_t))) {
+        ESP_LOGI(logTag, "Updating hardware config from persistent record.");
+
+        // records written before the energy accounting was introduced don't have an energy record
+        bool energyValid = (ERR_OK == recordRead(energyRecordNvsKey, &energyRecord.header, sizeof(energy_record_t)));
+
+        if (pdFALSE == xSemaphoreTake(configMutex, lockAcquireTimeout)) {
+            ESP_LOGE(logTag, "Couldn't acquire config lock within timeout!");
+            return ERR_TIMEOUT;
+        }
+        copyBatteryConfigInt(&shadowDataBatteryConfig, record.battery);
+        copyReservoirConfigInt(&shadowDataReservoirConfig, record.reservoir);
+        copySleepConfigInt(&shadowDataSleepConfig, record.sleep);
+        copyEnergyConfigInt(&shadowDataEnergyConfig, energyValid ? energyRecord.energy : energyConfigDefaults);
+        xSemaphoreGive(configMutex);
+
+        return ERR_OK;
+    }
+
+    ret = readConfigFile(CONFIG_FILE_HARDWARE);
+    if (ERR_OK == ret) {
+        ESP_LOGI(logTag, "Migrating hardware config file to persistent record.");
+        persistHardwareConfig(shadowDataBatteryConfig, shadowDataReservoirConfig, shadowDataSleepConfig, shadowDataEnergyConfig);
+    }
+
+    return ret;
 }
 
 SettingsManager::err_t SettingsManager::readConfigFile(config_file_type_t type)
@@ -433,6 +1025,8 @@ SettingsManager::err_t SettingsManager::readConfigFile(config_file_type_t type)
 
     if (ret != ERR_OK) {
         ESP_LOGE(logTag, "Invalid config file type specified.");
+    } else if (ESP_OK != initializeSpiffs()) {
+        ret = ERR_FILE_IO;
     } else {
         struct stat st;
         if (stat(filename, &st) == 0) {
@@ -444,6 +1038,11 @@ SettingsManager::err_t SettingsManager::readConfigFile(config_file_type_t type)
                 if (f == NULL) {
                     ESP_LOGW(logTag, "Failed to open irrigation config file for reading.");
                     ret = ERR_FILE_IO;
+                } else if (CONFIG_FILE_IRRIGATION == type) {
+                    // the irrigation config is streamed, so its size isn't limited by a read buffer
+                    ESP_LOGI(logTag, "Updating irrigation config from file.");
+                    ret = streamIrrigationConfigFile(f);
+                    fclose(f);
                 } else {
                     size_t bytesRead;
 
@@ -454,19 +1053,8 @@ SettingsManager::err_t SettingsManager::readConfigFile(config_file_type_t type)
                         ESP_LOGW(logTag, "Config file too big for read buffer. Not reading it in.");
                         ret = ERR_FILE_IO;
                     } else if(bytesRead > 0) {
-                        switch(type) {
-                            case CONFIG_FILE_IRRIGATION:
-                                ESP_LOGI(logTag, "Updating irrigation config from file.");
-                                ret = updateIrrigationConfig(settingsBuffer, bytesRead, true);
-                                break;
-                            case CONFIG_FILE_HARDWARE:
-                                ESP_LOGI(logTag, "Updating hardware config from file.");
-                                ret = updateHardwareConfig(settingsBuffer, bytesRead, true);
-                                break;
-                            default:
-                                ret = ERR_INVALID_ARG;
-                                break;
-                        }
+                        ESP_LOGI(logTag, "Updating hardware config from file.");
+                        ret = updateHardwareConfig(settingsBuffer, bytesRead, true);
                     }
                 }
                 xSemaphoreGive(fileIoMutex);
@@ -480,34 +1068,230 @@ SettingsManager::err_t SettingsManager::readConfigFile(config_file_type_t type)
     return ret;
 }
 
-SettingsManager::err_t SettingsManager::writeConfigFile(const char* const filename, const char* const jsonData, int jsonDataLen)
+/**
+ * @brief Stream the irrigation config file through the parser in small chunks.
+ *
+ * Note: The file I/O lock must be held by the caller.
+ *
+ * @param f Config file opened for reading.
+ * @return err_t ERR_OK on success.
+ */
+SettingsManager::err_t SettingsManager::streamIrrigationConfigFile(FILE* f)
+{
+    static char chunkBuffer[256];
+    size_t bytesRead;
+    err_t ret;
+
+    ret = beginIrrigationConfigStream();
+    if (ERR_OK != ret) return ret;
+
+    irrigStream.fromFile = true;
+
+    while ((bytesRead = fread(chunkBuffer, sizeof(char), sizeof(chunkBuffer), f)) > 0) {
+        if (ERR_OK != feedIrrigationConfigStream(chunkBuffer, bytesRead)) break;
+    }
+
+    if (ferror(f) && (ERR_OK == irrigStream.ret)) {
+        ESP_LOGW(logTag, "Error reading irrigation config file.");
+        irrigStream.ret = ERR_FILE_IO;
+    }
+
+    return endIrrigationConfigStream(true);
+}
+
+uint32_t SettingsManager::recordCrc(const record_header_t* record, size_t size)
+{
+    return crc32_le(0, (const uint8_t*) record, size - sizeof(uint32_t));
+}
+
+/**
+ * @brief Setup the header and the trailing CRC of a persistent config record.
+ */
+void SettingsManager::recordSeal(record_header_t* record, size_t size)
+{
+    record->magic = recordMagic;
+    record->version = recordVersion;
+    record->size = size;
+
+    uint32_t crc = recordCrc(record, size);
+    memcpy((uint8_t*) record + size - sizeof(uint32_t), &crc, sizeof(uint32_t));
+}
+
+bool SettingsManager::recordValid(const record_header_t* record, size_t size)
+{
+    uint32_t crc;
+
+    memcpy(&crc, (const uint8_t*) record + size - sizeof(uint32_t), sizeof(uint32_t));
+
+    return (record->magic == recordMagic) && (record->version == recordVersion) &&
+        (record->size == size) && (crc == recordCrc(record, size));
+}
+
+/**
+ * @brief Read and validate a persistent config record from NVS.
+ * 
+ * @return err_t ERR_OK on success, ERR_FILE_IO if not available, ERR_SETTINGS_INVALID if corrupted or outdated.
+ */
+SettingsManager::err_t SettingsManager::recordRead(const char* key, record_header_t* record, size_t size)
 {
     err_t ret = ERR_OK;
+    nvs_handle handle;
+    size_t len = size;
 
     if (pdFALSE == xSemaphoreTake(fileIoMutex, lockAcquireTimeout)) {
-        ESP_LOGE(logTag, "Couldn't acquire config lock within timeout!");
-        ret = ERR_TIMEOUT;
+        ESP_LOGE(logTag, "Couldn't acquire file IO lock within timeout!");
+        return ERR_TIMEOUT;
+    }
+
+    if(ESP_OK != nvs_open(snapshotNvsNamespace, NVS_READONLY, &handle)) {
+        ret = ERR_FILE_IO;
     } else {
-        FILE* f = fopen(filename, "w");
-        if (f == NULL) {
-            ESP_LOGW(logTag, "Failed to open config file for writing.");
+        if((ESP_OK != nvs_get_blob(handle, key, record, &len)) || (len != size)) {
             ret = ERR_FILE_IO;
-        } else {
-            size_t bytesWritten;
+        } else if(!recordValid(record, size)) {
+            ESP_LOGW(logTag, "Persistent config record %s invalid.", key);
+            ret = ERR_SETTINGS_INVALID;
+        }
+        nvs_close(handle);
+    }
 
-            bytesWritten = fwrite(jsonData, sizeof(char), jsonDataLen, f);
-            fclose(f);
+    xSemaphoreGive(fileIoMutex);
+
+    return ret;
+}
+
+/**
+ * @brief Write a persistent config record to NVS, unless it is unchanged.
+ * 
+ * The CRC of the stored record is kept in a separate NVS entry, so unchanged configs
+ * (e.g. re-pushed by a home automation system) are detected without reading the record
+ * and don't cause any flash writes. NVS replaces the blob atomically, i.e. either the
+ * old or the new record survives a power loss.
+ * 
+ * @param key NVS key of the record.
+ * @param hashKey NVS key of the record's CRC.
+ * @param record Sealed record (see recordSeal).
+ * @param size Size of the record.
+ * @return err_t ERR_OK on success.
+ */
+SettingsManager::err_t SettingsManager::recordWrite(const char* key, const char* hashKey, const record_header_t* record, size_t size)
+{
+    err_t ret = ERR_OK;
+    nvs_handle handle;
+    uint32_t crc;
+    uint32_t storedCrc;
+
+    memcpy(&crc, (const uint8_t*) record + size - sizeof(uint32_t), sizeof(uint32_t));
+
+    if (pdFALSE == xSemaphoreTake(fileIoMutex, lockAcquireTimeout)) {
+        ESP_LOGE(logTag, "Couldn't acquire file IO lock within timeout!");
+        return ERR_TIMEOUT;
+    }
 
-            if(bytesWritten != jsonDataLen) {
-                ESP_LOGW(logTag, "Error writing config file. Deleting it.");
-                unlink(filename);
+    if(ESP_OK != nvs_open(snapshotNvsNamespace, NVS_READWRITE, &handle)) {
+        ESP_LOGE(logTag, "Failed to open NVS namespace for config records.");
+        ret = ERR_FILE_IO;
+    } else {
+        if((ESP_OK == nvs_get_u32(handle, hashKey, &storedCrc)) && (storedCrc == crc)) {
+            ESP_LOGI(logTag, "Persistent config record %s unchanged. Skipping write.", key);
+        } else {
+            // the hash is only a hint, so it is written after the record
+            if((ESP_OK != nvs_set_blob(handle, key, record, size)) ||
+                (ESP_OK != nvs_set_u32(handle, hashKey, crc)) ||
+                (ESP_OK != nvs_commit(handle)))
+            {
+                ESP_LOGE(logTag, "Failed to write persistent config record %s.", key);
                 ret = ERR_FILE_IO;
             } else {
-                ESP_LOGI(logTag, "Config file written successfully.");
+                ESP_LOGI(logTag, "Persistent config record %s written.", key);
             }
+        }
+        nvs_close(handle);
+    }
+
+    xSemaphoreGive(fileIoMutex);
+
+    return ret;
+}
+
+SettingsManager::err_t SettingsManager::persistIrrigationConfig(const irrigation_config_t& settings)
+{
+    static irrigation_record_t record;
+
+    static_assert(offsetof(irrigation_record_t, crc) == sizeof(irrigation_record_t) - sizeof(uint32_t),
+        "CRC must be the last field of the record!");
+
+    // clear everything, so padding bytes are deterministic for the CRC
+    memset(&record, 0, sizeof(irrigation_record_t));
+
+    memcpy(record.zones, settings.zones, sizeof(record.zones));
+    for(int i = 0; i < irrigationPlannerNumNormalEvents; i++) {
+        settings.events[i].getConfig(&record.events[i]);
+        record.eventsUsed[i] = settings.eventsUsed[i];
+    }
+    recordSeal(&record.header, sizeof(irrigation_record_t));
+
+    return recordWrite(irrigRecordNvsKey, irrigRecordHashNvsKey, &record.header, sizeof(irrigation_record_t));
+}
+
+SettingsManager::err_t SettingsManager::persistHardwareConfig(
+    const battery_config_t& battery, const reservoir_config_t& reservoir, const sleep_config_t& sleep,
+    const energy_config_t& energy)
+{
+    static hardware_record_t record;
+    static energy_record_t energyRecord;
+
+    static_assert(offsetof(hardware_record_t, crc) == sizeof(hardware_record_t) - sizeof(uint32_t),
+        "CRC must be the last field of the record!");
+    static_assert(offsetof(energy_record_t, crc) == sizeof(energy_record_t) - sizeof(uint32_t),
+        "CRC must be the last field of the record!");
+
+    memset(&energyRecord, 0, sizeof(energy_record_t));
+    copyEnergyConfigInt(&energyRecord.energy, energy);
+    recordSeal(&energyRecord.header, sizeof(energy_record_t));
+
+    if (ERR_OK != recordWrite(energyRecordNvsKey, energyRecordHashNvsKey, &energyRecord.header, sizeof(energy_record_t))) {
+        return ERR_FILE_IO;
+    }
+
+    // clear everything, so padding bytes are deterministic for the CRC
+    memset(&record, 0, sizeof(hardware_record_t));
+
+    copyBatteryConfigInt(&record.battery, battery);
+    copyReservoirConfigInt(&record.reservoir, reservoir);
+    copySleepConfigInt(&record.sleep, sleep);
+    recordSeal(&record.header, sizeof(hardware_record_t));
 
+    return recordWrite(hardwareRecordNvsKey, hardwareRecordHashNvsKey, &record.header, sizeof(hardware_record_t));
+}
+
+/**
+ * @brief Apply a (validated) irrigation config record to the current configuration.
+ * 
+ * Note: No hooks are called, like it is done for the initial config load from file.
+ */
+SettingsManager::err_t SettingsManager::applyIrrigationRecord(const irrigation_record_t* record)
+{
+    err_t ret = ERR_OK;
+    static IrrigationEvent eventsTemp[irrigationPlannerNumNormalEvents];
+
+    for(int i = 0; i < irrigationPlannerNumNormalEvents; i++) {
+        if(IrrigationEvent::ERR_OK != eventsTemp[i].setConfig(&record->events[i])) {
+            ESP_LOGE(logTag, "Persistent record contains invalid event %d", i);
+            return ERR_SETTINGS_INVALID;
         }
-        xSemaphoreGive(fileIoMutex);
+    }
+
+    if (pdFALSE == xSemaphoreTake(configMutex, lockAcquireTimeout)) {
+        ESP_LOGE(logTag, "Couldn't acquire config lock within timeout!");
+        ret = ERR_TIMEOUT;
+    } else {
+        memcpy(shadowDataIrrigationConfig.zones, record->zones, sizeof(shadowDataIrrigationConfig.zones));
+        for(int i = 0; i < irrigationPlannerNumNormalEvents; i++) {
+            shadowDataIrrigationConfig.events[i] = eventsTemp[i];
+            shadowDataIrrigationConfig.eventsUsed[i] = record->eventsUsed[i];
+        }
+        xSemaphoreGive(configMutex);
     }
 
     return ret;
@@ -526,7 +1310,7 @@ SettingsManager::err_t SettingsManager::copyZonesAndEvents(
         ESP_LOGE(logTag, "Couldn't acquire config lock within timeout!");
         ret = ERR_TIMEOUT;
     } else {
-        memcpy(zones, shadowDataIrrigationConfig.zones, sizeof(irrigation_zone_cfg_t) * irrigationZoneCfgElements);
+        memcpy(zones, shadowDataIrrigationConfig.zones, sizeof(shadowDataIrrigationConfig.zones));
         // TBD: handling of single shot event; currently not implemented in IrrigationPlanner
         for(int i = 0; i < irrigationPlannerNumNormalEvents; i++) {
             events[i] = shadowDataIrrigationConfig.events[i];
@@ -539,7 +1323,7 @@ SettingsManager::err_t SettingsManager::copyZonesAndEvents(
     return ret;
 }
 
-void SettingsManager::copyBatteryConfigInt(battery_config_t* dst, battery_config_t& src)
+void SettingsManager::copyBatteryConfigInt(battery_config_t* dst, const battery_config_t& src)
 {
     dst->disableBatteryCheck = src.disableBatteryCheck;
     dst->battCriticalThresholdMilli = src.battCriticalThresholdMilli;
@@ -547,7 +1331,7 @@ void SettingsManager::copyBatteryConfigInt(battery_config_t* dst, battery_config
     dst->battOkThresholdMilli = src.battOkThresholdMilli;
 }
 
-void SettingsManager::copyReservoirConfigInt(reservoir_config_t* dst, reservoir_config_t& src)
+void SettingsManager::copyReservoirConfigInt(reservoir_config_t* dst, const reservoir_config_t& src)
 {
     dst->disableReservoirCheck = src.disableReservoirCheck;
     dst->fillLevelMaxVal = src.fillLevelMaxVal;
@@ -557,6 +1341,24 @@ void SettingsManager::copyReservoirConfigInt(reservoir_config_t* dst, reservoir_
     dst->fillLevelHysteresisPercent10 = src.fillLevelHysteresisPercent10;
 }
 
+void SettingsManager::copySleepConfigInt(sleep_config_t* dst, const sleep_config_t& src)
+{
+    dst->eventDrivenSleep = src.eventDrivenSleep;
+    dst->wakeupIntervalSeconds = src.wakeupIntervalSeconds;
+    dst->maxSleepSeconds = src.maxSleepSeconds;
+    dst->telemetryFlushIntervalSeconds = src.telemetryFlushIntervalSeconds;
+}
+
+void SettingsManager::copyEnergyConfigInt(energy_config_t* dst, const energy_config_t& src)
+{
+    dst->deepSleepMicroAmps = src.deepSleepMicroAmps;
+    dst->awakeMicroAmps = src.awakeMicroAmps;
+    dst->wifiMicroAmps = src.wifiMicroAmps;
+    dst->peripheralMicroAmps = src.peripheralMicroAmps;
+    dst->extSupplyMicroAmps = src.extSupplyMicroAmps;
+    dst->outputMicroAmps = src.outputMicroAmps;
+}
+
 SettingsManager::err_t SettingsManager::copyBatteryConfig(battery_config_t* dst)
 {
     err_t ret = ERR_OK;
@@ -591,6 +1393,40 @@ SettingsManager::err_t SettingsManager::copyReservoirConfig(reservoir_config_t*
     return ret;
 }
 
+SettingsManager::err_t SettingsManager::copySleepConfig(sleep_config_t* dst)
+{
+    err_t ret = ERR_OK;
+
+    if(nullptr == dst) return ERR_INVALID_ARG;
+
+    if(pdFALSE == xSemaphoreTake(configMutex, lockAcquireTimeout)) {
+        ESP_LOGE(logTag, "Couldn't acquire config lock within timeout!");
+        ret = ERR_TIMEOUT;
+    } else {
+        copySleepConfigInt(dst, shadowDataSleepConfig);
+        xSemaphoreGive(configMutex);
+    }
+
+    return ret;
+}
+
+SettingsManager::err_t SettingsManager::copyEnergyConfig(energy_config_t* dst)
+{
+    err_t ret = ERR_OK;
+
+    if(nullptr == dst) return ERR_INVALID_ARG;
+
+    if(pdFALSE == xSemaphoreTake(configMutex, lockAcquireTimeout)) {
+        ESP_LOGE(logTag, "Couldn't acquire config lock within timeout!");
+        ret = ERR_TIMEOUT;
+    } else {
+        copyEnergyConfigInt(dst, shadowDataEnergyConfig);
+        xSemaphoreGive(configMutex);
+    }
+
+    return ret;
+}
+
 SettingsManager::err_t SettingsManager::registerIrrigConfigUpdatedHook(ConfigUpdatedHookFncPtr hook, void* param)
 {
     err_t ret = ERR_OK;
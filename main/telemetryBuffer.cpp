@@ -0,0 +1,124 @@
+#include "telemetryBuffer.h"
+
+#include <cstring>
+
+#include "esp_attr.h"
+
+RTC_DATA_ATTR static TelemetryBuffer::persistent_data_t telemetryBufferPersistentData = {
+    .magic = 0
+};
+
+/**
+ * @brief Default constructor, which performs basic initialization.
+ *
+ * Note: Persistent data will be cleared on cold boots only.
+ */
+TelemetryBuffer::TelemetryBuffer(void)
+{
+    if(telemetryBufferPersistentData.magic != persistentDataMagic) {
+        memset(&telemetryBufferPersistentData, 0, sizeof(persistent_data_t));
+        telemetryBufferPersistentData.magic = persistentDataMagic;
+    }
+}
+
+/**
+ * @brief Default destructor, which cleans up allocated data.
+ */
+TelemetryBuffer::~TelemetryBuffer(void)
+{
+}
+
+/**
+ * @brief Add a sample. Overwrites the oldest one if the buffer is full.
+ *
+ * @param sample Sample to be added.
+ */
+void TelemetryBuffer::addSample(const sample_t& sample)
+{
+    persistent_data_t* data = &telemetryBufferPersistentData;
+
+    if(data->count >= numSamples) {
+        ESP_LOGW(logTag, "Buffer full. Dropping oldest sample.");
+    }
+
+    memcpy(&data->samples[data->next], &sample, sizeof(sample_t));
+    data->next = (data->next + 1) % numSamples;
+    data->nextSeq++;
+    if(data->count < numSamples) data->count++;
+}
+
+/**
+ * @brief Get the most recently added sample.
+ *
+ * @param dst Destination storage.
+ * @return bool True if a sample was available.
+ */
+bool TelemetryBuffer::getLatest(sample_t* dst)
+{
+    return getSample(telemetryBufferPersistentData.count - 1, dst);
+}
+
+/**
+ * @brief Get a sample by its index.
+ *
+ * @param idx Index of the sample, 0 being the oldest one.
+ * @param dst Destination storage.
+ * @return bool True if the index is valid.
+ */
+bool TelemetryBuffer::getSample(int idx, sample_t* dst)
+{
+    const persistent_data_t* data = &telemetryBufferPersistentData;
+
+    if((idx < 0) || (idx >= data->count)) return false;
+
+    int pos = (data->next + numSamples - data->count + idx) % numSamples;
+    memcpy(dst, &data->samples[pos], sizeof(sample_t));
+
+    return true;
+}
+
+/**
+ * @brief Get the number of samples stored.
+ */
+int TelemetryBuffer::getCount(void)
+{
+    return telemetryBufferPersistentData.count;
+}
+
+/**
+ * @brief Check wether or not the next sample will overwrite the oldest one.
+ */
+bool TelemetryBuffer::isFull(void)
+{
+    return (telemetryBufferPersistentData.count >= numSamples);
+}
+
+/**
+ * @brief Get the sequence number following the most recently added sample.
+ *
+ * Used together with removeUpTo() to remove the samples which were stored at the time
+ * of this call.
+ */
+uint32_t TelemetryBuffer::getEndSeq(void)
+{
+    return telemetryBufferPersistentData.nextSeq;
+}
+
+/**
+ * @brief Remove all samples with a sequence number lower than the specified one.
+ *
+ * @param endSeq End sequence number as returned by getEndSeq().
+ */
+void TelemetryBuffer::removeUpTo(uint32_t endSeq)
+{
+    persistent_data_t* data = &telemetryBufferPersistentData;
+    uint32_t oldestSeq = data->nextSeq - data->count;
+    uint32_t numRemove = endSeq - oldestSeq;
+
+    // the samples are already gone (e.g. overwritten) or the sequence number is invalid
+    if(numRemove > data->count) {
+        numRemove = ((int32_t) numRemove < 0) ? 0 : data->count;
+    }
+
+    data->count -= numRemove;
+}
@@ -1,6 +1,8 @@
 #include "timeSystem.h"
 
 #include <cstdio>
+#include <cstring>
+#include <cmath>
 #include <ctime>
 #include <sys/time.h>
 #include <vector>
@@ -9,8 +11,10 @@
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
 
+#include "sdkconfig.h"
 #include "esp_log.h"
 #include "esp_sntp.h"
+#include "esp_timer.h"
 
 #include "wifiEvents.h"
 
@@ -34,12 +38,72 @@ static void TimeSystem_CallHooks(time_system_event_t event);
 SemaphoreHandle_t TimeSystem_HookMutex;
 StaticSemaphore_t TimeSystem_HookMutexBuf;
 
+/** DST information of a single (local) year. All offsets are seconds east of UTC. */
+typedef struct time_system_dst_year_t {
+    int year;                   /**< Year this entry is valid for; -1 if invalid. */
+    time_t localStart;          /**< Local seconds of Jan 1st 00:00:00 of the year. */
+    time_t localEnd;            /**< Local seconds of Jan 1st 00:00:00 of the following year. */
+    time_t utcStart;            /**< UTC time corresponding to localStart. */
+    time_t utcEnd;              /**< UTC time corresponding to localEnd. */
+    bool hasDst;                /**< Wether or not DST is observed in this year. */
+    bool north;                 /**< Northern hemisphere rule, i.e. DST starts before it ends within the year. */
+    time_t dstStartUtc;         /**< UTC time DST starts. */
+    time_t stdStartUtc;         /**< UTC time DST ends. */
+    int32_t stdOffset;          /**< UTC offset during standard time. */
+    int32_t dstOffset;          /**< UTC offset during DST. */
+    bool gapIsDst;              /**< Wether mktime treats local times skipped at DST start as DST. */
+    bool overlapIsDst;          /**< Wether mktime treats local times repeated at DST end as DST. */
+} time_system_dst_year_t;
+
+static const int TimeSystem_DstTableYears = 2;
+static const time_t TimeSystem_SecsPerDay = 24*60*60;
+static const time_t TimeSystem_DstScanStep = 7*TimeSystem_SecsPerDay;
+RTC_DATA_ATTR static time_system_dst_year_t TimeSystem_DstTable[TimeSystem_DstTableYears] = {
+    {.year = -1}, {.year = -1}
+};
+static portMUX_TYPE TimeSystem_DstTableMux = portMUX_INITIALIZER_UNLOCKED;
+
+/** Drift of the system time (i.e. the RTC slow clock during deep sleep), measured by successive SNTP syncs */
+typedef struct time_system_drift_t {
+    uint32_t magic;             /**< Data is valid if this is TimeSystem_DriftMagic */
+    bool refValid;              /**< Wether or not the last SNTP sync is a valid reference for measuring the drift */
+    bool driftValid;            /**< Wether or not driftPpm has been measured */
+    float driftPpm;             /**< Drift in us per second, which is added to the time (positive = clock too slow) */
+    float residualPpm;          /**< Drift left uncorrected at the last sync, i.e. the uncertainty of driftPpm */
+    time_t lastCorrection;      /**< System time the drift has been corrected up to */
+    int32_t resyncIntervalSecs; /**< SNTP resync interval adapted to the drift (see TimeSystem_AdaptSntpResyncInterval) */
+} time_system_drift_t;
+
+static const uint32_t TimeSystem_DriftMagic = 0x44524654; // 'DRFT', change on layout changes!
+static const float TimeSystem_DriftMaxPpm = 1000.0f;                    /**< Plausibility limit of the drift */
+static const float TimeSystem_DriftMinUncertaintyPpm = 1.0f;            /**< Lower bound of the uncertainty used for predictions */
+static const int64_t TimeSystem_DriftMaxOffsetMicros = 60LL * 1000000;  /**< Larger offsets are time jumps, not drift */
+static const double TimeSystem_DriftMinIntervalSecs = 15*60;            /**< Minimum time between syncs to measure the drift */
+static const int64_t TimeSystem_DriftNotifyMicros = 1000000;            /**< Corrections from this size on are notified as time set */
+RTC_DATA_ATTR static time_system_drift_t TimeSystem_Drift = {
+    .magic = 0
+};
+
+/** System time and esp_timer time right before an SNTP request, to determine the offset of the sync */
+static bool TimeSystem_SntpRefTaken = false;
+static int64_t TimeSystem_SntpRefMicros = 0;
+static int64_t TimeSystem_SntpRefMono = 0;
+
+static void TimeSystem_UpdateDrift(const struct timeval* tv, time_t prevSync);
+static void TimeSystem_AdaptSntpResyncInterval(double elapsedSecs);
+static int64_t TimeSystem_CorrectDrift(void);
+static int32_t TimeSystem_DaysFromCivil(int year, int month, int day);
+static bool TimeSystem_BuildDstYear(int year, time_system_dst_year_t* entry);
+static bool TimeSystem_ProbeMktimeIsDst(time_t local, const time_system_dst_year_t* entry);
+
 // ********************************************************************
 // SNTP time sync callback
 // ********************************************************************
 void TimeSystem_SntpTimeSyncCb(struct timeval *tv)
 {
+    TimeSystem_UpdateDrift(tv, sntpLastSync);
     time(&sntpLastSync);
+    TimeSystem_UpdateDstTable();
 
     ESP_LOGI(LOG_TAG_TIME, "Time set via SNTP. Setting timeEvents.");
     xEventGroupSetBits(timeEvents, TimeSystem_timeEventTimeSet | TimeSystem_timeEventTimeSetSntp);
@@ -64,7 +128,15 @@ extern "C" void TimeSystem_Init(void)
     // register a hook into the SNTP code
     sntp_set_time_sync_notification_cb(TimeSystem_SntpTimeSyncCb);
 
+    if(TimeSystem_DriftMagic != TimeSystem_Drift.magic) {
+        memset(&TimeSystem_Drift, 0, sizeof(TimeSystem_Drift));
+        TimeSystem_Drift.magic = TimeSystem_DriftMagic;
+    }
+
     ESP_LOGI(LOG_TAG_TIME, "Checking if time is already set.");
+    // the time is kept across deep sleeps, so compensate the drift accumulated meanwhile
+    // Note: No separate notification needed, the time set events below cover the corrected time.
+    TimeSystem_CorrectDrift();
     time(&now);
 
     // set correct timezone
@@ -72,6 +144,9 @@ extern "C" void TimeSystem_Init(void)
     tzset();
     localtime_r(&now, &timeinfo);
 
+    // DST table is kept in RTC memory, so this is only a check on deep sleep wakeups
+    TimeSystem_UpdateDstTable();
+
     // Is time set? If not, tm_year will be (1970 - 1900).
     if(!(timeinfo.tm_year < (2017 - 1900))) {
         ESP_LOGI(LOG_TAG_TIME, "-> Time already set. Setting timeEvents.");
@@ -128,6 +203,11 @@ extern "C" int TimeSystem_SetTime(int16_t day, int16_t month, int16_t year, int1
     result = settimeofday(&tv, NULL);
 
     if(0 == result) {
+        // the offset of the next SNTP sync won't be representative for the drift anymore
+        TimeSystem_Drift.refValid = false;
+        TimeSystem_Drift.lastCorrection = t;
+        TimeSystem_UpdateDstTable();
+
         ESP_LOGI(LOG_TAG_TIME, "Time set. Setting timeEvents.");
         xEventGroupClearBits(timeEvents, TimeSystem_timeEventTimeSetSntp);
         xEventGroupSetBits(timeEvents, TimeSystem_timeEventTimeSet);
@@ -241,12 +321,287 @@ void TimeSystem_SetNextSntpSync(time_t next)
     sntpNextSync = next;
 }
 
+// ********************************************************************
+// DST table / local time arithmetic
+// ********************************************************************
+/**
+ * @brief Convert a civil date into days since 1970-01-01.
+ * 
+ * Note: Based on Howard Hinnant's days_from_civil algorithm.
+ */
+static int32_t TimeSystem_DaysFromCivil(int year, int month, int day)
+{
+    year -= (month <= 2) ? 1 : 0;
+    const int era = ((year >= 0) ? year : (year - 399)) / 400;
+    const int yoe = year - era * 400;
+    const int doy = (153 * (month + ((month > 2) ? -3 : 9)) + 2) / 5 + day - 1;
+    const int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+/**
+ * @brief Get the UTC offset and DST state the C library reports for the specified time.
+ */
+static int32_t TimeSystem_ProbeOffset(time_t utc, int* isDst)
+{
+    struct tm tm;
+    localtime_r(&utc, &tm);
+    *isDst = (tm.tm_isdst > 0) ? 1 : 0;
+    return (int32_t) (TimeSystem_CivilToLocalSecs(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+        tm.tm_hour, tm.tm_min, tm.tm_sec) - utc);
+}
+
+/**
+ * @brief Check wether mktime with tm_isdst = -1 applies the DST offset to the specified local seconds.
+ */
+static bool TimeSystem_ProbeMktimeIsDst(time_t local, const time_system_dst_year_t* entry)
+{
+    struct tm tm;
+    gmtime_r(&local, &tm); // local seconds are UTC based, so this just splits the calendar fields
+    tm.tm_isdst = -1;
+    return (mktime(&tm) == (local - entry->dstOffset));
+}
+
+/**
+ * @brief Find the DST transitions of the specified year by probing localtime_r.
+ * 
+ * The year is scanned in weekly steps and each change is located to the second
+ * by bisection, i.e. ~100 localtime_r calls per year. Only years with no
+ * transitions or a single DST start + end are supported.
+ * 
+ * @return bool Wether or not the year could be represented.
+ */
+static bool TimeSystem_BuildDstYear(int year, time_system_dst_year_t* entry)
+{
+    int isDst, prevDst, loDst;
+    int32_t off, prevOff;
+    time_t t, prev, lo, hi, mid;
+    int dstStarts = 0;
+    int stdStarts = 0;
+
+    entry->year = -1;
+    entry->localStart = (time_t) TimeSystem_DaysFromCivil(year, 1, 1) * TimeSystem_SecsPerDay;
+    entry->localEnd = (time_t) TimeSystem_DaysFromCivil(year + 1, 1, 1) * TimeSystem_SecsPerDay;
+    entry->hasDst = false;
+    entry->north = true;
+
+    off = TimeSystem_ProbeOffset(entry->localStart, &isDst);
+    entry->utcStart = entry->localStart - off;
+    if((TimeSystem_ProbeOffset(entry->utcStart, &isDst) != off)) return false;
+    off = TimeSystem_ProbeOffset(entry->localEnd, &isDst);
+    entry->utcEnd = entry->localEnd - off;
+    if((TimeSystem_ProbeOffset(entry->utcEnd, &isDst) != off)) return false;
+
+    prev = entry->utcStart;
+    prevOff = TimeSystem_ProbeOffset(prev, &prevDst);
+    if(prevDst) {
+        entry->dstOffset = prevOff;
+    } else {
+        entry->stdOffset = prevOff;
+    }
+
+    while(prev < (entry->utcEnd - 1)) {
+        t = prev + TimeSystem_DstScanStep;
+        if(t > (entry->utcEnd - 1)) t = entry->utcEnd - 1;
+
+        off = TimeSystem_ProbeOffset(t, &isDst);
+        if(isDst != prevDst) {
+            // bisect for the first second of the new state
+            lo = prev;
+            hi = t;
+            while((hi - lo) > 1) {
+                mid = lo + (hi - lo) / 2;
+                TimeSystem_ProbeOffset(mid, &loDst);
+                if(loDst == prevDst) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+
+            if(isDst) {
+                entry->dstStartUtc = hi;
+                entry->dstOffset = off;
+                dstStarts++;
+            } else {
+                entry->stdStartUtc = hi;
+                entry->stdOffset = off;
+                stdStarts++;
+            }
+        } else if(off != prevOff) {
+            // offset changes without DST flag changes are not supported
+            return false;
+        }
+
+        prev = t;
+        prevOff = off;
+        prevDst = isDst;
+    }
+
+    if((dstStarts == 0) && (stdStarts == 0)) {
+        if(prevDst) return false;
+    } else if((dstStarts == 1) && (stdStarts == 1) && (entry->dstOffset > entry->stdOffset)) {
+        entry->hasDst = true;
+        entry->north = (entry->dstStartUtc < entry->stdStartUtc);
+        // the C library decides how ambiguous local times are resolved, so ask it
+        entry->gapIsDst = TimeSystem_ProbeMktimeIsDst(entry->dstStartUtc + entry->stdOffset, entry);
+        entry->overlapIsDst = TimeSystem_ProbeMktimeIsDst(entry->stdStartUtc + entry->stdOffset, entry);
+    } else {
+        return false;
+    }
+
+    entry->year = year;
+    return true;
+}
+
+/**
+ * @brief Update the DST transition table in case the current year isn't covered anymore.
+ * 
+ * The table covers the current and the following year and is kept in RTC memory,
+ * so it needs to be rebuilt only once per year or after a time set.
+ */
+void TimeSystem_UpdateDstTable(void)
+{
+    time_system_dst_year_t table[TimeSystem_DstTableYears];
+    time_t now;
+    struct tm nowTm;
+    bool upToDate;
+
+    time(&now);
+    localtime_r(&now, &nowTm);
+
+    portENTER_CRITICAL(&TimeSystem_DstTableMux);
+    upToDate = (TimeSystem_DstTable[0].year == nowTm.tm_year + 1900);
+    portEXIT_CRITICAL(&TimeSystem_DstTableMux);
+
+    if(!upToDate) {
+        for(int i = 0; i < TimeSystem_DstTableYears; i++) {
+            if(!TimeSystem_BuildDstYear(nowTm.tm_year + 1900 + i, &table[i])) {
+                ESP_LOGW(LOG_TAG_TIME, "DST rules of year %d not supported. Using mktime.", nowTm.tm_year + 1900 + i);
+            }
+        }
+
+        portENTER_CRITICAL(&TimeSystem_DstTableMux);
+        memcpy(TimeSystem_DstTable, table, sizeof(TimeSystem_DstTable));
+        portEXIT_CRITICAL(&TimeSystem_DstTableMux);
+
+        ESP_LOGD(LOG_TAG_TIME, "DST table updated for year %d.", nowTm.tm_year + 1900);
+    }
+}
+
+/**
+ * @brief Convert a local date and time into local seconds, i.e. seconds since
+ * 1970-01-01 00:00:00 on the local wall clock.
+ * 
+ * Note: No range checks are performed. Overflowing fields are normalized like mktime does.
+ */
+time_t TimeSystem_CivilToLocalSecs(int year, int month, int day, int hour, int minute, int second)
+{
+    return (time_t) TimeSystem_DaysFromCivil(year, month, day) * TimeSystem_SecsPerDay +
+        hour*60*60 + minute*60 + second;
+}
+
+/**
+ * @brief Convert a UTC time into local seconds using the DST table.
+ * 
+ * The result is the same as localtime_r provides, but without the calendar conversion.
+ * 
+ * @param utc Time to be converted.
+ * @param local Pointer to the result storage.
+ * @return bool False if the time isn't covered by the DST table. The caller must use
+ * the C library in this case.
+ */
+bool TimeSystem_UtcToLocalSecs(time_t utc, time_t* local)
+{
+    bool ret = false;
+    bool isDst;
+
+    portENTER_CRITICAL(&TimeSystem_DstTableMux);
+    for(int i = 0; i < TimeSystem_DstTableYears; i++) {
+        const time_system_dst_year_t* entry = &TimeSystem_DstTable[i];
+        if((entry->year >= 0) && (utc >= entry->utcStart) && (utc < entry->utcEnd)) {
+            isDst = entry->hasDst && (entry->north ?
+                ((utc >= entry->dstStartUtc) && (utc < entry->stdStartUtc)) :
+                ((utc >= entry->dstStartUtc) || (utc < entry->stdStartUtc)));
+            *local = utc + (isDst ? entry->dstOffset : entry->stdOffset);
+            ret = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&TimeSystem_DstTableMux);
+
+    return ret;
+}
+
+/**
+ * @brief Convert local seconds into a UTC time using the DST table.
+ * 
+ * The result is the same as mktime with tm_isdst = -1 provides, including the
+ * handling of the skipped (DST start) and repeated (DST end) local times.
+ * Newlib treats both as standard time.
+ * 
+ * @param local Local seconds to be converted.
+ * @param utc Pointer to the result storage.
+ * @return bool False if the time isn't covered by the DST table. The caller must use
+ * the C library in this case.
+ */
+bool TimeSystem_LocalSecsToUtc(time_t local, time_t* utc)
+{
+    bool ret = false;
+    bool isDst;
+    time_t dstStartLocal, stdStartLocal;
+
+    portENTER_CRITICAL(&TimeSystem_DstTableMux);
+    for(int i = 0; i < TimeSystem_DstTableYears; i++) {
+        const time_system_dst_year_t* entry = &TimeSystem_DstTable[i];
+        if((entry->year >= 0) && (local >= entry->localStart) && (local < entry->localEnd)) {
+            // DST start in DST local time, DST end in standard local time
+            dstStartLocal = entry->dstStartUtc + entry->dstOffset;
+            stdStartLocal = entry->stdStartUtc + entry->stdOffset;
+            if(!entry->hasDst) {
+                isDst = false;
+            } else if((local >= (entry->dstStartUtc + entry->stdOffset)) && (local < dstStartLocal)) {
+                isDst = entry->gapIsDst;
+            } else if((local >= stdStartLocal) && (local < (entry->stdStartUtc + entry->dstOffset))) {
+                isDst = entry->overlapIsDst;
+            } else {
+                isDst = entry->north ?
+                    ((local >= dstStartLocal) && (local < stdStartLocal)) :
+                    ((local >= dstStartLocal) || (local < stdStartLocal));
+            }
+            *utc = local - (isDst ? entry->dstOffset : entry->stdOffset);
+            ret = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&TimeSystem_DstTableMux);
+
+    return ret;
+}
+
 // ********************************************************************
 // SNTP handling
 // ********************************************************************
 void TimeSystem_SntpStart(void)
 {
     if(0 != (xEventGroupGetBits(wifiEvents) & wifiEventConnected)) {
+        struct timeval tv;
+
+        // take the reference for the offset of the sync, based on the drift corrected time
+        int64_t correctionMicros = TimeSystem_CorrectDrift();
+        if((correctionMicros >= TimeSystem_DriftNotifyMicros) || (correctionMicros <= -TimeSystem_DriftNotifyMicros)) {
+            // the correction may have moved the time across event boundaries, so let the users recalculate
+            // their schedules like after a sync (which may not succeed)
+            TimeSystem_UpdateDstTable();
+            ESP_LOGI(LOG_TAG_TIME, "Time corrected by %lld us. Setting timeEvents.", correctionMicros);
+            xEventGroupSetBits(timeEvents, TimeSystem_timeEventTimeSet);
+            TimeSystem_CallHooks(TimeSystem_timeEventTimeSet);
+        }
+        gettimeofday(&tv, NULL);
+        TimeSystem_SntpRefMono = esp_timer_get_time();
+        TimeSystem_SntpRefMicros = (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+        TimeSystem_SntpRefTaken = true;
+
         sntp_setoperatingmode(SNTP_OPMODE_POLL);
         sntp_setservername(0, (char*) "de.pool.ntp.org");
         sntp_init();
@@ -266,3 +621,139 @@ void TimeSystem_SntpRequest(void)
     TimeSystem_SntpStop();
     TimeSystem_SntpStart();
 }
+
+// ********************************************************************
+// RTC drift compensation
+// ********************************************************************
+/**
+ * @brief Update the drift estimation with the offset of an SNTP sync.
+ *
+ * The offset is measured against the time right before the sync, which is extrapolated from the
+ * reference taken by TimeSystem_SntpStart() with the (crystal based) esp_timer. As the time is
+ * drift corrected already, the offset is the residual drift since the previous sync.
+ *
+ * @param tv Time received by the sync.
+ * @param prevSync Time of the previous sync (0 = none).
+ */
+static void TimeSystem_UpdateDrift(const struct timeval* tv, time_t prevSync)
+{
+    bool refValid = TimeSystem_Drift.refValid && (0 != prevSync) && TimeSystem_SntpRefTaken;
+
+    if(TimeSystem_SntpRefTaken) {
+        int64_t predictedMicros = TimeSystem_SntpRefMicros + (esp_timer_get_time() - TimeSystem_SntpRefMono);
+        int64_t offsetMicros = (int64_t) tv->tv_sec * 1000000 + tv->tv_usec - predictedMicros;
+        double elapsedSecs = difftime(tv->tv_sec, prevSync);
+
+        if(!refValid) {
+            ESP_LOGI(LOG_TAG_TIME, "SNTP offset %lld us. No drift reference yet.", offsetMicros);
+        } else if((offsetMicros > TimeSystem_DriftMaxOffsetMicros) || (offsetMicros < -TimeSystem_DriftMaxOffsetMicros)) {
+            ESP_LOGW(LOG_TAG_TIME, "SNTP offset %lld us is a time jump. Restarting the drift measurement.", offsetMicros);
+        } else if(elapsedSecs < TimeSystem_DriftMinIntervalSecs) {
+            ESP_LOGD(LOG_TAG_TIME, "SNTP offset %lld us. Too close to the previous sync for a drift update.", offsetMicros);
+        } else {
+            float residualPpm = (float) (offsetMicros / elapsedSecs);
+            float driftPpm = TimeSystem_Drift.driftPpm + residualPpm;
+            if(driftPpm > TimeSystem_DriftMaxPpm) driftPpm = TimeSystem_DriftMaxPpm;
+            if(driftPpm < -TimeSystem_DriftMaxPpm) driftPpm = -TimeSystem_DriftMaxPpm;
+
+            TimeSystem_Drift.driftPpm = driftPpm;
+            TimeSystem_Drift.residualPpm = fabsf(residualPpm);
+            TimeSystem_Drift.driftValid = true;
+            ESP_LOGI(LOG_TAG_TIME, "SNTP offset %lld us after %.0f s. Drift %.2f ppm (residual %.2f ppm).", offsetMicros,
+                elapsedSecs, driftPpm, residualPpm);
+
+            TimeSystem_AdaptSntpResyncInterval(elapsedSecs);
+        }
+    }
+
+    TimeSystem_SntpRefTaken = false;
+    TimeSystem_Drift.refValid = true;
+    TimeSystem_Drift.lastCorrection = tv->tv_sec;
+}
+
+/**
+ * @brief Add the estimated drift accumulated since the last correction (or sync) to the system time.
+ *
+ * Note: Doesn't notify the time set, that's up to the caller (see TimeSystem_DriftNotifyMicros).
+ *
+ * @return int64_t Applied correction in us.
+ */
+static int64_t TimeSystem_CorrectDrift(void)
+{
+    struct timeval tv;
+
+    if(!TimeSystem_Drift.driftValid || (0 == TimeSystem_Drift.lastCorrection)) return 0;
+
+    gettimeofday(&tv, NULL);
+    double elapsedSecs = difftime(tv.tv_sec, TimeSystem_Drift.lastCorrection);
+    if(elapsedSecs <= 0.0) return 0;
+
+    int64_t correctionMicros = (int64_t) (TimeSystem_Drift.driftPpm * elapsedSecs);
+    if(0 == correctionMicros) return 0; // keep accumulating
+
+    int64_t correctedMicros = (int64_t) tv.tv_sec * 1000000 + tv.tv_usec + correctionMicros;
+    tv.tv_sec = (time_t) (correctedMicros / 1000000);
+    tv.tv_usec = (suseconds_t) (correctedMicros % 1000000);
+    if(0 != settimeofday(&tv, NULL)) return 0;
+
+    TimeSystem_Drift.lastCorrection = tv.tv_sec;
+    ESP_LOGD(LOG_TAG_TIME, "Corrected drift of %lld us over %.0f s.", correctionMicros, elapsedSecs);
+
+    return correctionMicros;
+}
+
+/**
+ * @brief Adapt the SNTP resync interval to the updated drift estimation.
+ *
+ * The interval is chosen such that the predicted time error (uncertainty of the drift times
+ * the interval) stays below CONFIG_TIME_SYSTEM_MAX_PREDICTED_ERROR_MS. It grows by at most a factor
+ * of two compared to the interval just measured and is bounded by CONFIG_TIME_SYSTEM_MAX_SNTP_INTERVAL_HOURS.
+ *
+ * @param elapsedSecs Time between the previous and the current sync.
+ */
+static void TimeSystem_AdaptSntpResyncInterval(double elapsedSecs)
+{
+    float uncertaintyPpm = TimeSystem_Drift.residualPpm;
+    if(uncertaintyPpm < TimeSystem_DriftMinUncertaintyPpm) uncertaintyPpm = TimeSystem_DriftMinUncertaintyPpm;
+
+    double secs = CONFIG_TIME_SYSTEM_MAX_PREDICTED_ERROR_MS * 1000.0 / uncertaintyPpm;
+    double maxSecs = CONFIG_TIME_SYSTEM_MAX_SNTP_INTERVAL_HOURS * 3600.0;
+    if(2.0 * elapsedSecs < maxSecs) maxSecs = 2.0 * elapsedSecs;
+    if(secs > maxSecs) secs = maxSecs;
+
+    TimeSystem_Drift.resyncIntervalSecs = (int32_t) secs;
+    ESP_LOGI(LOG_TAG_TIME, "SNTP resync interval adapted to %d s.", TimeSystem_Drift.resyncIntervalSecs);
+}
+
+/**
+ * @brief Get the interval till the next SNTP resync.
+ *
+ * The interval is adapted to the measured drift on each SNTP sync (see TimeSystem_AdaptSntpResyncInterval()),
+ * but never shorter than baseSecs.
+ *
+ * @param baseSecs Interval in seconds used as long as the drift hasn't been measured.
+ * @return int32_t Interval in seconds.
+ */
+int32_t TimeSystem_GetSntpResyncIntervalSecs(int32_t baseSecs)
+{
+    if(TimeSystem_Drift.driftValid && (TimeSystem_Drift.resyncIntervalSecs > baseSecs)) {
+        return TimeSystem_Drift.resyncIntervalSecs;
+    }
+
+    return baseSecs;
+}
+
+/**
+ * @brief Get the estimated drift of the system time.
+ *
+ * @param driftPpm Destination of the drift in us per second.
+ * @param residualPpm Destination of its uncertainty in us per second (may be NULL).
+ * @return bool True if the drift has been measured.
+ */
+bool TimeSystem_GetDrift(float* driftPpm, float* residualPpm)
+{
+    if(NULL != driftPpm) *driftPpm = TimeSystem_Drift.driftPpm;
+    if(NULL != residualPpm) *residualPpm = TimeSystem_Drift.residualPpm;
+
+    return TimeSystem_Drift.driftValid;
+}
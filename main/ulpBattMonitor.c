@@ -0,0 +1,151 @@
+#include "ulpBattMonitor.h"
+
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "sdkconfig.h"
+
+#if defined(CONFIG_ULP_COPROC_ENABLED)
+#include "esp32/ulp.h"
+#include "soc/soc.h"
+#include "soc/rtc_cntl_reg.h"
+#endif
+
+// ********************************************************************
+// private objects, vars and prototypes
+// ********************************************************************
+static const char* LOG_TAG_ULP_BATT = "ulp_batt";
+
+/** Word offsets of the data shared with the ULP program (lower 16 bits of each word are used) */
+enum {
+    ULP_DATA_LAST = 0,
+    ULP_DATA_MIN = 1,
+    ULP_DATA_SUM_LO = 2,
+    ULP_DATA_SUM_HI = 3,
+    ULP_DATA_COUNT = 4,
+    ULP_DATA_WORDS = 8
+};
+
+/** Word offset of the ULP program in RTC slow memory, i.e. right after the data */
+static const uint32_t ulpProgramAddr = ULP_DATA_WORDS;
+
+/** Wether or not the ULP has been started before going to deep sleep */
+RTC_DATA_ATTR static bool ulpBattMonitorRunning = false;
+
+// ********************************************************************
+// public functions
+// ********************************************************************
+/**
+ * @brief Start sampling the battery voltage with the ULP. Meant to be called right before deep sleep.
+ *
+ * The ULP samples the ADC channel periodically and keeps the last sample, min and sum in RTC memory.
+ * It wakes up the main CPU if a sample is below wakeBelowRaw or at/above wakeAboveRaw.
+ *
+ * @param channel ADC1 channel to be sampled. ADC1 must already be configured (width, attenuation).
+ * @param periodMillis Sampling period in milliseconds.
+ * @param wakeBelowRaw Raw ADC threshold to wakeup below. 0 disables it.
+ * @param wakeAboveRaw Raw ADC threshold to wakeup at or above. 0xffff disables it.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_SUPPORTED if the ULP isn't enabled in the sdkconfig.
+ */
+esp_err_t UlpBattMonitor_Start(adc1_channel_t channel, uint32_t periodMillis, uint16_t wakeBelowRaw, uint16_t wakeAboveRaw)
+{
+#if defined(CONFIG_ULP_COPROC_ENABLED)
+    esp_err_t err;
+    size_t programSize;
+
+    const ulp_insn_t program[] = {
+        I_MOVI(R3, 0),                          // R3 <- data base address
+        I_ADC(R0, 0, channel),                  // R0 <- sample
+        I_ST(R0, R3, ULP_DATA_LAST),
+        // min
+        I_LD(R1, R3, ULP_DATA_MIN),
+        I_SUBR(R2, R1, R0),                     // min - sample overflows if sample > min
+        M_BXF(1),
+        I_ST(R0, R3, ULP_DATA_MIN),
+        M_LABEL(1),
+        // sum (32 bit)
+        I_LD(R1, R3, ULP_DATA_SUM_LO),
+        I_ADDR(R1, R1, R0),
+        I_ST(R1, R3, ULP_DATA_SUM_LO),          // doesn't affect the ALU flags
+        M_BXF(2),
+        M_BX(3),
+        M_LABEL(2),
+        I_LD(R1, R3, ULP_DATA_SUM_HI),
+        I_ADDI(R1, R1, 1),
+        I_ST(R1, R3, ULP_DATA_SUM_HI),
+        M_LABEL(3),
+        // count
+        I_LD(R1, R3, ULP_DATA_COUNT),
+        I_ADDI(R1, R1, 1),
+        I_ST(R1, R3, ULP_DATA_COUNT),
+        // thresholds
+        M_BL(4, wakeBelowRaw),
+        M_BGE(4, wakeAboveRaw),
+        I_HALT(),
+        M_LABEL(4),
+        I_WAKE(),
+        I_HALT()
+    };
+
+    RTC_SLOW_MEM[ULP_DATA_LAST] = 0;
+    RTC_SLOW_MEM[ULP_DATA_MIN] = 0xffff;
+    RTC_SLOW_MEM[ULP_DATA_SUM_LO] = 0;
+    RTC_SLOW_MEM[ULP_DATA_SUM_HI] = 0;
+    RTC_SLOW_MEM[ULP_DATA_COUNT] = 0;
+
+    programSize = sizeof(program) / sizeof(ulp_insn_t);
+    err = ulp_process_macros_and_load(ulpProgramAddr, program, &programSize);
+    if(ESP_OK == err) err = ulp_set_wakeup_period(0, periodMillis * 1000);
+    if(ESP_OK == err) err = esp_sleep_enable_ulp_wakeup();
+    if(ESP_OK == err) {
+        adc1_ulp_enable();
+        err = ulp_run(ulpProgramAddr);
+    }
+
+    if(ESP_OK == err) {
+        ulpBattMonitorRunning = true;
+        ESP_LOGD(LOG_TAG_ULP_BATT, "ULP started (window %u..%u).", wakeBelowRaw, wakeAboveRaw);
+    } else {
+        ESP_LOGE(LOG_TAG_ULP_BATT, "Starting the ULP failed (%s).", esp_err_to_name(err));
+    }
+
+    return err;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * @brief Stop the ULP sampling. Meant to be called after wakeups, so the ULP won't interfere
+ * with the ADC readings of the main CPU.
+ *
+ * Note: The collected data won't be available anymore afterwards, so get it before (see UlpBattMonitor_GetData).
+ */
+void UlpBattMonitor_Stop(void)
+{
+#if defined(CONFIG_ULP_COPROC_ENABLED)
+    CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_ULP_CP_SLP_TIMER_EN);
+    ulpBattMonitorRunning = false;
+#endif
+}
+
+/**
+ * @brief Get the data collected by the ULP during the last deep sleep.
+ *
+ * @param dst Destination storage.
+ * @return bool True if the ULP was running and took at least one sample.
+ */
+bool UlpBattMonitor_GetData(ulp_batt_monitor_data_t* dst)
+{
+#if defined(CONFIG_ULP_COPROC_ENABLED)
+    if(!ulpBattMonitorRunning) return false;
+
+    dst->lastRaw = RTC_SLOW_MEM[ULP_DATA_LAST] & 0xffff;
+    dst->minRaw = RTC_SLOW_MEM[ULP_DATA_MIN] & 0xffff;
+    dst->sumRaw = ((RTC_SLOW_MEM[ULP_DATA_SUM_HI] & 0xffff) << 16) | (RTC_SLOW_MEM[ULP_DATA_SUM_LO] & 0xffff);
+    dst->numSamples = RTC_SLOW_MEM[ULP_DATA_COUNT] & 0xffff;
+
+    return (dst->numSamples > 0);
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,183 @@
+#include "wakeProfiler.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_attr.h"
+#include "esp_timer.h"
+
+RTC_DATA_ATTR static WakeProfiler::persistent_data_t wakeProfilerPersistentData = {
+    .magic = 0
+};
+
+/** Protects the persistent data, which is read by other tasks (console, ...) */
+static portMUX_TYPE wakeProfilerMux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Default constructor, which performs basic initialization.
+ *
+ * Note: Persistent data will be cleared on cold boots only.
+ */
+WakeProfiler::WakeProfiler(void)
+{
+    memset(startMicros, 0, sizeof(startMicros));
+
+    if(wakeProfilerPersistentData.magic != persistentDataMagic) {
+        memset(&wakeProfilerPersistentData, 0, sizeof(persistent_data_t));
+        wakeProfilerPersistentData.magic = persistentDataMagic;
+    }
+}
+
+/**
+ * @brief Default destructor, which cleans up allocated data.
+ */
+WakeProfiler::~WakeProfiler(void)
+{
+}
+
+/**
+ * @brief Start measuring a scope.
+ *
+ * Note: Starting an already running scope restarts it.
+ *
+ * @param scope Scope to be measured.
+ */
+void WakeProfiler::begin(scope_t scope)
+{
+    if((scope < 0) || (scope >= SCOPE_MAX)) return;
+
+    startMicros[scope] = esp_timer_get_time();
+}
+
+/**
+ * @brief Stop measuring a scope and add its duration to the histogram.
+ *
+ * Note: Nothing is added if the scope hasn't been started.
+ *
+ * @param scope Scope to be stopped.
+ */
+void WakeProfiler::end(scope_t scope)
+{
+    if((scope < 0) || (scope >= SCOPE_MAX)) return;
+    if(0 == startMicros[scope]) return;
+
+    int64_t duration = esp_timer_get_time() - startMicros[scope];
+    startMicros[scope] = 0;
+
+    addSample(scope, (uint32_t) std::min(std::max(duration, (int64_t) 0), (int64_t) UINT32_MAX));
+}
+
+/**
+ * @brief Add a measured duration of the specified scope, e.g. if it has been measured
+ * by other means (like the boot time).
+ *
+ * @param scope Scope the sample belongs to.
+ * @param micros Measured duration in microseconds.
+ */
+void WakeProfiler::addSample(scope_t scope, uint32_t micros)
+{
+    if((scope < 0) || (scope >= SCOPE_MAX)) return;
+
+    scope_histogram_t* hist = &wakeProfilerPersistentData.scopes[scope];
+    int bucket = getBucket(micros);
+
+    portENTER_CRITICAL(&wakeProfilerMux);
+    // age the histogram instead of saturating a bucket, which keeps the distribution intact
+    if(hist->buckets[bucket] == UINT16_MAX) {
+        for(int i = 0; i < numBuckets; i++) hist->buckets[i] /= 2;
+    }
+    hist->buckets[bucket]++;
+
+    if((0 == hist->count) || (micros < hist->minMicros)) hist->minMicros = micros;
+    if((0 == hist->count) || (micros > hist->maxMicros)) hist->maxMicros = micros;
+    hist->sumMicros += micros;
+    if(hist->count < UINT32_MAX) hist->count++;
+    portEXIT_CRITICAL(&wakeProfilerMux);
+
+    ESP_LOGD(logTag, "%s took %u us.", WAKE_PROFILER_SCOPE_TO_STR(scope), micros);
+}
+
+/**
+ * @brief Get the statistics of a scope.
+ *
+ * @param scope Scope to get the statistics for.
+ * @param dst Statistics destination.
+ * @return bool False if no samples are available (or the parameters are invalid).
+ */
+bool WakeProfiler::getStats(scope_t scope, scope_stats_t* dst)
+{
+    scope_histogram_t hist;
+
+    if((scope < 0) || (scope >= SCOPE_MAX) || (nullptr == dst)) return false;
+
+    // take a consistent copy, so the (slow) percentile calculation doesn't block the measuring task
+    portENTER_CRITICAL(&wakeProfilerMux);
+    memcpy(&hist, &wakeProfilerPersistentData.scopes[scope], sizeof(scope_histogram_t));
+    portEXIT_CRITICAL(&wakeProfilerMux);
+
+    memset(dst, 0, sizeof(scope_stats_t));
+    if(0 == hist.count) return false;
+
+    dst->count = hist.count;
+    dst->minMicros = hist.minMicros;
+    dst->maxMicros = hist.maxMicros;
+    dst->meanMicros = (uint32_t) (hist.sumMicros / hist.count);
+    dst->p50Micros = getPercentileMicros(&hist, 50);
+    dst->p90Micros = getPercentileMicros(&hist, 90);
+    dst->p99Micros = getPercentileMicros(&hist, 99);
+
+    return true;
+}
+
+/**
+ * @brief Clear the histograms of all scopes.
+ */
+void WakeProfiler::reset(void)
+{
+    portENTER_CRITICAL(&wakeProfilerMux);
+    memset(wakeProfilerPersistentData.scopes, 0, sizeof(wakeProfilerPersistentData.scopes));
+    portEXIT_CRITICAL(&wakeProfilerMux);
+}
+
+int WakeProfiler::getBucket(uint32_t micros)
+{
+    if(micros < (1UL << firstBucketShift)) return 0;
+
+    int bucket = (31 - __builtin_clz(micros)) - firstBucketShift + 1;
+
+    return std::min(bucket, numBuckets - 1);
+}
+
+uint32_t WakeProfiler::getBucketUpperMicros(int bucket)
+{
+    if(bucket >= numBuckets - 1) return UINT32_MAX;
+
+    return (1UL << (bucket + firstBucketShift));
+}
+
+/**
+ * @brief Get the specified percentile of a histogram (nearest-rank method).
+ *
+ * @return uint32_t Upper bound of the bucket containing the percentile, limited to the
+ * recorded min/max.
+ */
+uint32_t WakeProfiler::getPercentileMicros(const scope_histogram_t* hist, unsigned int percentile)
+{
+    uint32_t total = 0;
+    uint32_t sum = 0;
+
+    for(int i = 0; i < numBuckets; i++) total += hist->buckets[i];
+    if(0 == total) return 0;
+
+    uint32_t rank = (percentile * total + 99) / 100; // ceil, 1-based
+    if(rank < 1) rank = 1;
+
+    for(int i = 0; i < numBuckets; i++) {
+        sum += hist->buckets[i];
+        if(sum >= rank) {
+            return std::max(std::min(getBucketUpperMicros(i), hist->maxMicros), hist->minMicros);
+        }
+    }
+
+    return hist->maxMicros;
+}
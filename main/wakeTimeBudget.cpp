@@ -0,0 +1,91 @@
+#include "wakeTimeBudget.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_attr.h"
+
+RTC_DATA_ATTR static WakeTimeBudget::persistent_data_t wakeTimeBudgetPersistentData = {
+    .magic = 0
+};
+
+/**
+ * @brief Default constructor, which performs basic initialization.
+ * 
+ * Note: Persistent data will be cleared on cold boots only.
+ */
+WakeTimeBudget::WakeTimeBudget(void)
+{
+    if(wakeTimeBudgetPersistentData.magic != persistentDataMagic) {
+        memset(&wakeTimeBudgetPersistentData, 0, sizeof(persistent_data_t));
+        wakeTimeBudgetPersistentData.magic = persistentDataMagic;
+    }
+}
+
+/**
+ * @brief Default destructor, which cleans up allocated data.
+ */
+WakeTimeBudget::~WakeTimeBudget(void)
+{
+}
+
+/**
+ * @brief Add a measured duration of the specified phase.
+ * 
+ * @param phase Phase the sample belongs to.
+ * @param millis Measured duration in milliseconds. Will be saturated to 65535 ms.
+ */
+void WakeTimeBudget::addSample(phase_t phase, uint32_t millis)
+{
+    if((phase < 0) || (phase >= PHASE_MAX)) return;
+
+    phase_samples_t* samples = &wakeTimeBudgetPersistentData.phases[phase];
+
+    samples->samples[samples->next] = (uint16_t) std::min(millis, (uint32_t) UINT16_MAX);
+    samples->next = (samples->next + 1) % numSamples;
+    if(samples->count < numSamples) samples->count++;
+
+    ESP_LOGD(logTag, "Phase %d took %u ms.", phase, millis);
+}
+
+/**
+ * @brief Get the specified percentile of the recorded samples of a phase.
+ * 
+ * @param phase Phase to get the percentile for.
+ * @param percentile Percentile (0..100) to get. The nearest-rank method is used.
+ * @param defaultMillis Value to be returned if less than minSamples are available.
+ * @return uint32_t Percentile in milliseconds.
+ */
+uint32_t WakeTimeBudget::getPercentileMillis(phase_t phase, unsigned int percentile, uint32_t defaultMillis)
+{
+    uint16_t sorted[numSamples];
+
+    if((phase < 0) || (phase >= PHASE_MAX)) return defaultMillis;
+
+    const phase_samples_t* samples = &wakeTimeBudgetPersistentData.phases[phase];
+    if(samples->count < minSamples) return defaultMillis;
+
+    if(percentile > 100) percentile = 100;
+
+    memcpy(sorted, samples->samples, samples->count * sizeof(uint16_t));
+    std::sort(sorted, sorted + samples->count);
+
+    int rank = (percentile * samples->count + 99) / 100; // ceil, 1-based
+    if(rank < 1) rank = 1;
+
+    return sorted[rank - 1];
+}
+
+/**
+ * @brief Get the time budget of the specified phase, i.e. its measured percentile
+ * bounded by the nominal maximum.
+ * 
+ * @param phase Phase to get the budget for.
+ * @param maxMillis Nominal (worst case) duration of the phase. Used as upper bound
+ * and as long as not enough samples are available.
+ * @return uint32_t Budget in milliseconds.
+ */
+uint32_t WakeTimeBudget::getBudgetMillis(phase_t phase, uint32_t maxMillis)
+{
+    return std::min(getPercentileMillis(phase, budgetPercentile, maxMillis), maxMillis);
+}